@@ -13,6 +13,6 @@ def add_info(report):
 		report['ThirdParty'] = 'True'
 		report['CrashDB'] = 'url_dispatcher'
 
-	dbpath = os.path.join(xdg_cache_home, 'url-dispatcher', 'urls-1.db')
+	dbpath = os.path.join(xdg_cache_home, 'url-dispatcher', 'urls-3.db')
 	if os.path.exists(dbpath):
 		attach_command_output(report, ['url-dispatcher-dump'], 'URLDispatcherDB')
@@ -93,7 +93,7 @@ url_dispatch_send_restricted (const gchar * url, const gchar * package, URLDispa
 	                       "DispatchURL",
 	                       g_variant_new("(ss)", url, package ? package : ""),
 	                       NULL,
-	                       G_DBUS_CALL_FLAGS_NO_AUTO_START,
+	                       G_DBUS_CALL_FLAGS_NONE,
 	                       -1, /* timeout */
 	                       NULL, /* cancelable */
 	                       cb != NULL ? url_dispatched : NULL,
@@ -108,6 +108,114 @@ url_dispatch_send_restricted (const gchar * url, const gchar * package, URLDispa
 	return;
 }
 
+typedef struct _dispatch_many_data_t dispatch_many_data_t;
+struct _dispatch_many_data_t {
+	URLDispatchCallback cb;
+	gpointer user_data;
+	gchar ** urls;
+};
+
+static void
+urls_dispatched (GObject * obj, GAsyncResult * res, gpointer user_data)
+{
+	GError * error = NULL;
+	dispatch_many_data_t * dispatch_data = (dispatch_many_data_t *)user_data;
+	gchar ** errors = NULL;
+
+	GVariant * retval = g_dbus_connection_call_finish(
+		G_DBUS_CONNECTION(obj),
+		res,
+		&error);
+
+	if (error != NULL) {
+		g_warning("Unable to dispatch urls starting with '%s':%s", dispatch_data->urls[0], error->message);
+		g_error_free(error);
+	} else {
+		g_variant_get(retval, "(^as)", &errors);
+		g_variant_unref(retval);
+	}
+
+	guint errorslen = errors != NULL ? g_strv_length(errors) : 0;
+	guint i;
+	for (i = 0; dispatch_data->urls[i] != NULL; i++) {
+		/* An empty string is no error for that URL */
+		gboolean success = i < errorslen && errors[i][0] == '\0';
+
+		if (i < errorslen && !success) {
+			g_warning("Unable to dispatch url '%s':%s", dispatch_data->urls[i], errors[i]);
+		}
+
+		dispatch_data->cb(dispatch_data->urls[i], success, dispatch_data->user_data);
+	}
+
+	g_strfreev(errors);
+	g_strfreev(dispatch_data->urls);
+	g_free(dispatch_data);
+
+	return;
+}
+
+void
+url_dispatch_send_many (const gchar ** urls, const gchar * package, URLDispatchCallback cb, gpointer user_data)
+{
+	g_return_if_fail(urls != NULL);
+
+	/* Nothing to send, and no URL to call @cb for */
+	if (urls[0] == NULL) {
+		return;
+	}
+
+	GError * error = NULL;
+	GDBusConnection * bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+
+	if (error != NULL) {
+		g_warning("Unable to get session bus: %s", error->message);
+		g_error_free(error);
+		return;
+	}
+
+	dispatch_many_data_t * dispatch_data = NULL;
+
+	if (cb != NULL) {
+		dispatch_data = g_new0(dispatch_many_data_t, 1);
+
+		dispatch_data->cb = cb;
+		dispatch_data->user_data = user_data;
+		dispatch_data->urls = g_strdupv((gchar **)urls);
+	}
+
+	GVariantBuilder builder;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(ss)"));
+
+	int i;
+	for (i = 0; urls[i] != NULL; i++) {
+		g_variant_builder_add(&builder, "(ss)", urls[i], package ? package : "");
+	}
+
+	GVariant * vurls = g_variant_builder_end(&builder);
+
+	g_dbus_connection_call(bus,
+	                       "com.canonical.URLDispatcher",
+	                       "/com/canonical/URLDispatcher",
+	                       "com.canonical.URLDispatcher",
+	                       "DispatchURLs",
+	                       g_variant_new_tuple(&vurls, 1),
+	                       G_VARIANT_TYPE("(as)"),
+	                       G_DBUS_CALL_FLAGS_NONE,
+	                       -1, /* timeout */
+	                       NULL, /* cancelable */
+	                       cb != NULL ? urls_dispatched : NULL,
+	                       dispatch_data);
+
+	if (cb == NULL) {
+		g_dbus_connection_flush_sync(bus, NULL, NULL);
+	}
+
+	g_object_unref(bus);
+
+	return;
+}
+
 gchar **
 url_dispatch_url_appid (const gchar ** urls)
 {
@@ -131,7 +239,7 @@ url_dispatch_url_appid (const gchar ** urls)
 	                                     "TestURL",
 	                                     vparam,
 	                                     G_VARIANT_TYPE("(as)"),
-	                                     G_DBUS_CALL_FLAGS_NO_AUTO_START,
+	                                     G_DBUS_CALL_FLAGS_NONE,
 	                                     -1, /* timeout */
 	                                     NULL, /* cancelable */
 	                                     &error);
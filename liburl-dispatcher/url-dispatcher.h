@@ -58,6 +58,24 @@ void       url_dispatch_send_restricted (const gchar *         url,
                                          URLDispatchCallback   cb,
                                          gpointer              user_data);
 
+/**
+ * url_dispatch_send_many:
+ * @urls: NULL terminated list of URLs to send to the dispatcher
+ * @package: (allow-none): Package allowed to have the URLs
+ * @cb: Function to call with the result of each URL
+ * @user_data: data pointer for @cb
+ *
+ * Like url_dispatch_send_restricted() but sends all of @urls in a
+ * single message. URLs that go to the same application have it
+ * started once with all of them. @cb is called once for each URL,
+ * in the order of @urls. An empty @urls sends nothing and never
+ * calls @cb.
+ */
+void       url_dispatch_send_many       (const gchar **        urls,
+                                         const gchar *         package,
+                                         URLDispatchCallback   cb,
+                                         gpointer              user_data);
+
 /**
  * url_dispatch_url_appid:
  * @urls: URLs to check the AppIDs for
@@ -1,6 +1,12 @@
 pragma journal_mode = WAL;
 begin transaction;
-create table if not exists configfiles (name text unique, timestamp bigint);
+create table if not exists configfiles (name text unique, mtime bigint, size bigint, inode bigint, hash bigint);
 create table if not exists urls (sourcefile integer, protocol text, domainsuffix text);
 create unique index if not exists urls_index on urls (sourcefile, protocol, domainsuffix);
+create table if not exists generation (value integer);
+insert into generation select cast((julianday('now') - 2440587.5) * 86400000000 as integer) where not exists (select * from generation);
+create trigger if not exists configfiles_insert_generation after insert on configfiles begin update generation set value = value + 1; end;
+create trigger if not exists configfiles_delete_generation after delete on configfiles begin update generation set value = value + 1; end;
+create trigger if not exists urls_insert_generation after insert on urls begin update generation set value = value + 1; end;
+create trigger if not exists urls_delete_generation after delete on urls begin update generation set value = value + 1; end;
 commit transaction;
@@ -0,0 +1,225 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Latency histograms for DispatchURL, by stage and outcome. Recording
+   is a couple of clock reads per stage and an increment per stage when
+   the call is done, so it stays on all the time. The buckets split each
+   power of two of nanoseconds in four, so a percentile is within 25%.
+   Histograms are main thread only, timings aren't shared. */
+
+#include <string.h>
+#include <time.h>
+#include "dispatch-stats.h"
+
+#define SUB_BITS 2
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define MAX_BITS 48 /* About three days in nanoseconds */
+#define BUCKETS (SUB_BUCKETS + (MAX_BITS - SUB_BITS) * SUB_BUCKETS)
+
+typedef struct {
+	guint64 count;
+	guint64 buckets[BUCKETS];
+} Histogram;
+
+struct _DispatchStats {
+	Histogram histograms[DISPATCH_OUTCOME_COUNT][DISPATCH_STAGE_COUNT];
+};
+
+static const gchar * stage_names[DISPATCH_STAGE_COUNT] = {
+	"queue",
+	"parse",
+	"lookup",
+	"restrict",
+	"overlay",
+	"handoff",
+	"reply",
+	"total"
+};
+
+static const gchar * outcome_names[DISPATCH_OUTCOME_COUNT] = {
+	"launched",
+	"overlay",
+	"bad-url",
+	"restricted"
+};
+
+static gint64
+now_ns (void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (gint64)now.tv_sec * G_GINT64_CONSTANT(1000000000) + now.tv_nsec;
+}
+
+static guint
+bucket_index (guint64 value)
+{
+	if (value < SUB_BUCKETS) {
+		return value;
+	}
+
+	guint bits = g_bit_storage(value) - 1;
+	if (bits >= MAX_BITS) {
+		return BUCKETS - 1;
+	}
+
+	guint sub = (value >> (bits - SUB_BITS)) & (SUB_BUCKETS - 1);
+	return SUB_BUCKETS + (bits - SUB_BITS) * SUB_BUCKETS + sub;
+}
+
+/* Smallest value that goes in the bucket after @index */
+static guint64
+bucket_limit (guint index)
+{
+	index++;
+
+	if (index < SUB_BUCKETS) {
+		return index;
+	}
+
+	guint bits = (index - SUB_BUCKETS) / SUB_BUCKETS + SUB_BITS;
+	guint64 sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+	return (G_GUINT64_CONSTANT(1) << bits) + (sub << (bits - SUB_BITS));
+}
+
+static guint64
+histogram_percentile (const Histogram * histogram, guint percent)
+{
+	if (histogram->count == 0) {
+		return 0;
+	}
+
+	/* Rank of the value we're after, rounded up */
+	guint64 rank = (histogram->count * percent + 99) / 100;
+	guint64 seen = 0;
+	guint i;
+
+	for (i = 0; i < BUCKETS - 1; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= rank) {
+			break;
+		}
+	}
+
+	return bucket_limit(i);
+}
+
+void
+dispatch_timing_start (DispatchTiming * timing)
+{
+	g_return_if_fail(timing != NULL);
+
+	memset(timing, 0, sizeof(DispatchTiming));
+	timing->start = now_ns();
+	timing->mark = timing->start;
+}
+
+/* Everything since the last mark goes to @stage, adding to what was
+   already there */
+void
+dispatch_timing_mark (DispatchTiming * timing, DispatchStage stage)
+{
+	g_return_if_fail(timing != NULL);
+	g_return_if_fail(stage < DISPATCH_STAGE_TOTAL);
+
+	gint64 now = now_ns();
+
+	timing->stages[stage] += now - timing->mark;
+	timing->reached |= 1 << stage;
+	timing->mark = now;
+}
+
+DispatchStats *
+dispatch_stats_new (void)
+{
+	return g_new0(DispatchStats, 1);
+}
+
+void
+dispatch_stats_free (DispatchStats * stats)
+{
+	g_return_if_fail(stats != NULL);
+
+	g_free(stats);
+}
+
+static void
+histogram_add (Histogram * histogram, gint64 value)
+{
+	histogram->count++;
+	histogram->buckets[bucket_index(MAX(value, 0))]++;
+}
+
+/* Adds a finished call, only the stages it got to are counted */
+void
+dispatch_stats_record (DispatchStats * stats, DispatchOutcome outcome, const DispatchTiming * timing)
+{
+	g_return_if_fail(stats != NULL);
+	g_return_if_fail(outcome < DISPATCH_OUTCOME_COUNT);
+	g_return_if_fail(timing != NULL);
+
+	Histogram * histograms = stats->histograms[outcome];
+	guint stage;
+
+	for (stage = 0; stage < DISPATCH_STAGE_TOTAL; stage++) {
+		if (timing->reached & (1 << stage)) {
+			histogram_add(&histograms[stage], timing->stages[stage]);
+		}
+	}
+
+	histogram_add(&histograms[DISPATCH_STAGE_TOTAL], timing->mark - timing->start);
+}
+
+/* Returns how many calls went through @stage with @outcome, and the
+   percentiles of how long it took them in nanoseconds */
+guint64
+dispatch_stats_get (DispatchStats * stats, DispatchOutcome outcome, DispatchStage stage, guint64 * p50, guint64 * p90, guint64 * p99)
+{
+	g_return_val_if_fail(stats != NULL, 0);
+	g_return_val_if_fail(outcome < DISPATCH_OUTCOME_COUNT, 0);
+	g_return_val_if_fail(stage < DISPATCH_STAGE_COUNT, 0);
+
+	const Histogram * histogram = &stats->histograms[outcome][stage];
+
+	if (p50 != NULL) {
+		*p50 = histogram_percentile(histogram, 50);
+	}
+	if (p90 != NULL) {
+		*p90 = histogram_percentile(histogram, 90);
+	}
+	if (p99 != NULL) {
+		*p99 = histogram_percentile(histogram, 99);
+	}
+
+	return histogram->count;
+}
+
+const gchar *
+dispatch_stage_name (DispatchStage stage)
+{
+	g_return_val_if_fail(stage < DISPATCH_STAGE_COUNT, NULL);
+
+	return stage_names[stage];
+}
+
+const gchar *
+dispatch_outcome_name (DispatchOutcome outcome)
+{
+	g_return_val_if_fail(outcome < DISPATCH_OUTCOME_COUNT, NULL);
+
+	return outcome_names[outcome];
+}
@@ -0,0 +1,76 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DISPATCH_STATS_H
+#define DISPATCH_STATS_H 1
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DispatchStats DispatchStats;
+
+/* Where a DispatchURL call spends its time */
+typedef enum {
+	DISPATCH_STAGE_QUEUE, /* Waiting for a worker and the main loop */
+	DISPATCH_STAGE_PARSE,
+	DISPATCH_STAGE_LOOKUP,
+	DISPATCH_STAGE_RESTRICT,
+	DISPATCH_STAGE_OVERLAY,
+	DISPATCH_STAGE_HANDOFF, /* To the launch queue or overlay tracker */
+	DISPATCH_STAGE_REPLY,
+	DISPATCH_STAGE_TOTAL,
+	DISPATCH_STAGE_COUNT
+} DispatchStage;
+
+typedef enum {
+	DISPATCH_OUTCOME_LAUNCHED,
+	DISPATCH_OUTCOME_OVERLAY,
+	DISPATCH_OUTCOME_BAD_URL,
+	DISPATCH_OUTCOME_RESTRICTED,
+	DISPATCH_OUTCOME_COUNT
+} DispatchOutcome;
+
+/* The timings of one call, it can move between threads with it */
+typedef struct {
+	gint64 start; /* Nanoseconds */
+	gint64 mark; /* End of the last stage */
+	gint64 stages[DISPATCH_STAGE_COUNT];
+	guint reached; /* Bit per stage */
+} DispatchTiming;
+
+void          dispatch_timing_start                 (DispatchTiming * timing);
+void          dispatch_timing_mark                  (DispatchTiming * timing,
+                                                     DispatchStage  stage);
+
+DispatchStats * dispatch_stats_new                  (void);
+void          dispatch_stats_free                   (DispatchStats * stats);
+void          dispatch_stats_record                 (DispatchStats * stats,
+                                                     DispatchOutcome outcome,
+                                                     const DispatchTiming * timing);
+guint64       dispatch_stats_get                    (DispatchStats * stats,
+                                                     DispatchOutcome outcome,
+                                                     DispatchStage  stage,
+                                                     guint64 *      p50,
+                                                     guint64 *      p90,
+                                                     guint64 *      p99);
+const gchar * dispatch_stage_name                   (DispatchStage  stage);
+const gchar * dispatch_outcome_name                 (DispatchOutcome outcome);
+
+G_END_DECLS
+
+#endif /* DISPATCH_STATS_H */
@@ -17,23 +17,93 @@
  *
  */
 
+#include <string.h>
+#include <sys/stat.h>
 #include <gio/gio.h>
 #include <json-glib/json-glib.h>
 #include <ubuntu-app-launch.h>
 #include "dispatcher.h"
+#include "dispatch-stats.h"
 #include "service-iface.h"
+#include "launch-queue.h"
+#include "overlay-registry.h"
+#include "pid-cache.h"
+#include "probes.h"
+#include "problem-limiter.h"
 #include "recoverable-problem.h"
 #include "url-db.h"
+#include "url-cache.h"
+#include "url-index.h"
+#include "url-parse.h"
+#include "url-trie.h"
+
+#define DEFAULT_CACHE_SIZE 64
+#define MAX_WORKERS 16
+#define TEST_CHUNK_SIZE 256 /* URLs per job for TestURLs */
+#define DEFAULT_REPORT_INTERVAL 60 /* s */
+#define MAX_REPORT_INTERVAL 86400 /* s */
+#define DEFAULT_URL_LIMIT (2 * 1024 * 1024) /* bytes */
+#define MAX_URL_LIMIT (128 * 1024 * 1024) /* bytes, the largest D-Bus message */
+#define MESSAGE_URL_LENGTH 256 /* bytes of a URL that go into messages */
+#define INDEX_RECHECK_INTERVAL (1 * G_USEC_PER_SEC) /* us between database checks of a mapped index */
+
+/* A database connection we can build the routing trie from, and what
+   the trie was last built from: the index file if it was mapped from
+   one, otherwise the data version the database had */
+typedef struct {
+	UrlDb * db;
+	gint64 version;
+	gboolean built;
+	gboolean mapped;
+	struct stat index;
+	gint64 checked; /* When the database was last checked, if mapped */
+} RouteSource;
 
 /* Globals */
 static OverlayTracker * tracker = NULL;
 static GCancellable * cancellable = NULL;
-static ServiceIfaceComCanonicalURLDispatcher * skel = NULL;
-static GRegex * applicationre = NULL;
-static GRegex * appidre = NULL;
-static GRegex * genericre = NULL;
-static GRegex * intentre = NULL;
-static sqlite3 * urldb = NULL;
+static guint objectid = 0; /* Our object on egress */
+static RouteSource mainsource = { NULL, 0, FALSE };
+static GMutex mainsourcelock; /* Threads that aren't workers share it */
+static UrlTrie * urltrie = NULL;
+static UrlCache * urlcache = NULL;
+static GMutex routelock; /* Protects urltrie and urlcache */
+static GMutex rebuildlock; /* Held while reading the database into a trie */
+static OverlayRegistry * overlays = NULL;
+static GDBusConnection * egress = NULL;
+static GQueue dashqueue = G_QUEUE_INIT; /* URL lists waiting for the bus */
+static PidCache * pidcache = NULL;
+static ProblemLimiter * problemlimiter = NULL;
+static DispatchStats * dispatchstats = NULL;
+static LaunchQueue * launchqueue = NULL;
+static GMainContext * maincontext = NULL;
+static GThreadPool * workers = NULL; /* NULL resolves on the main thread */
+static GAsyncQueue * workersources = NULL; /* A RouteSource per worker */
+static GAsyncQueue * finished = NULL; /* Jobs back from the workers */
+static GPrivate threadsource; /* RouteSource of the current worker */
+static guint64 jobsequence = 0;
+static GThread * setupthread = NULL; /* Opens the database at startup */
+static GSource * setupsource = NULL; /* Finishes setup on the main thread */
+static gboolean setupdone = FALSE; /* Main thread, setup_finished() ran */
+static GQueue setupqueue = G_QUEUE_INIT; /* Jobs that came before then */
+static GMutex setuplock;
+static GCond setupcond;
+static gboolean setupopened = FALSE; /* Protected by setuplock */
+static GThread * mainthread = NULL;
+static gboolean setupfailed = FALSE;
+static gint64 starttime = 0;
+static gboolean served = FALSE;
+static guint ownerid = 0;
+static guint inflight = 0; /* Requests and overlays not done yet */
+static gint64 lastactive = 0; /* When one last started or finished */
+static guint urllimit = DEFAULT_URL_LIMIT; /* Longer URLs aren't looked at */
+static gchar * indexfilename = NULL;
+
+/* Tracepoints, see probes.h */
+PROBE_SEMAPHORE(app_started);
+PROBE_SEMAPHORE(send_to_app);
+PROBE_SEMAPHORE(startup);
+PROBE_SEMAPHORE(url_to_appid);
 
 /* Errors */
 enum {
@@ -41,47 +111,102 @@ enum {
 	ERROR_RESTRICTED_URL
 };
 
+#define ERROR_BAD_URL_NAME "com.canonical.URLDispatcher.BadURL"
+#define ERROR_RESTRICTED_URL_NAME "com.canonical.URLDispatcher.RestrictedURL"
+
 G_DEFINE_QUARK(url_dispatcher, url_dispatcher_error)
 
+/* URLs can be megabytes long, so messages only get the start of them.
+   Use as MESSAGE_URL_FORMAT in the format and MESSAGE_URL(url) in the
+   arguments. */
+#define MESSAGE_URL_FORMAT "%.*s%s"
+#define MESSAGE_URL(url) message_url_length(url), message_url_text(url), message_url_tail(url)
+
+static const gchar *
+message_url_text (const gchar * url)
+{
+	return url != NULL ? url : "(null)";
+}
+
+/* Stops short of a character that is cut in half, error messages
+   have to stay UTF-8 to go out on the bus */
+static int
+message_url_length (const gchar * url)
+{
+	const gchar * text = message_url_text(url);
+	gsize len = strnlen(text, MESSAGE_URL_LENGTH);
+
+	while (len > 0 && ((guchar)text[len] & 0xC0) == 0x80) {
+		len--;
+	}
+
+	return (int)len;
+}
+
+static const gchar *
+message_url_tail (const gchar * url)
+{
+	return strnlen(message_url_text(url), MESSAGE_URL_LENGTH + 1) > MESSAGE_URL_LENGTH ? "..." : "";
+}
+
+/* Checked before anything else is done with a URL, only ever reads
+   up to the limit */
+static gboolean
+url_too_long (const gchar * url)
+{
+	return strnlen(url, (gsize)urllimit + 1) > urllimit;
+}
+
 /* Register our errors */
 static void
 register_dbus_errors ()
 {
-	g_dbus_error_register_error(url_dispatcher_error_quark(), ERROR_BAD_URL, "com.canonical.URLDispatcher.BadURL");
-	g_dbus_error_register_error(url_dispatcher_error_quark(), ERROR_RESTRICTED_URL, "com.canonical.URLDispatcher.RestrictedURL");
+	g_dbus_error_register_error(url_dispatcher_error_quark(), ERROR_BAD_URL, ERROR_BAD_URL_NAME);
+	g_dbus_error_register_error(url_dispatcher_error_quark(), ERROR_RESTRICTED_URL, ERROR_RESTRICTED_URL_NAME);
 	return;
 }
 
+typedef struct {
+	gchar * url;
+	guint suppressed;
+} BadUrlReport;
+
 /* We should have the PID now so we can make sure to file the
    problem on the right package. */
 static void
-recoverable_problem_file (GObject * obj, GAsyncResult * res, gpointer user_data)
+recoverable_problem_file (const gchar * sender, guint32 pid, const GError * error, gpointer user_data)
 {
-	gchar * badurl = (gchar *)user_data;
-	GVariant * pid_tuple = NULL;
-	GError * error = NULL;
+	BadUrlReport * report = (BadUrlReport *)user_data;
 
-	pid_tuple = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, &error);
 	if (error != NULL) {
-		g_warning("Unable to get PID for calling program with URL '%s': %s", badurl, error->message);
-		g_free(badurl);
-		g_error_free(error);
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_warning("Unable to get PID for calling program with URL '%s': %s", report->url, error->message);
+		}
+		g_free(report->url);
+		g_free(report);
 		return;
 	}
 
-	guint32 pid = 0;
-	g_variant_get(pid_tuple, "(u)", &pid);
-	g_variant_unref(pid_tuple);
+	gchar * suppressed = g_strdup_printf("%u", report->suppressed);
 
-	const gchar * additional[3] = {
+	const gchar * additional[5] = {
 		"BadURL",
-		badurl,
+		report->url,
+		"Suppressed",
+		suppressed,
 		NULL
 	};
 
+	/* Only say how many were held back if there were some */
+	if (report->suppressed == 0) {
+		additional[2] = NULL;
+	}
+
 	report_recoverable_problem("url-dispatcher-bad-url", pid, FALSE, additional);
 
-	g_free(badurl);
+	g_free(suppressed);
+	g_free(report->url);
+	g_free(report);
 
 	return;
 }
@@ -96,38 +221,50 @@ restricted_appid (GDBusMethodInvocation * invocation, const gchar * url, const g
 	g_dbus_method_invocation_return_error(invocation,
 		url_dispatcher_error_quark(),
 		ERROR_RESTRICTED_URL,
-		"URL '%s' does not have a handler in package '%s'",
-		url, package);
+		"URL '" MESSAGE_URL_FORMAT "' does not have a handler in package '%s'",
+		MESSAGE_URL(url), package);
 
 	return TRUE;
 }
 
+/* Report a recoverable error on the process that sent us a bad URL,
+   unless it has had one recently */
+static void
+report_bad_url (GDBusMethodInvocation * invocation, const gchar * url)
+{
+	const gchar * sender = g_dbus_method_invocation_get_sender(invocation);
+	guint suppressed = 0;
+
+	/* Not while shutting down */
+	if (pidcache == NULL || problemlimiter == NULL) {
+		return;
+	}
+
+	/* Before the PID lookup, that's a bus round trip too */
+	if (!problem_limiter_check(problemlimiter, sender, "url-dispatcher-bad-url", g_get_monotonic_time(), &suppressed)) {
+		g_debug("Not reporting bad URL '" MESSAGE_URL_FORMAT "' from '%s' again yet", MESSAGE_URL(url), sender);
+		return;
+	}
+
+	BadUrlReport * report = g_new0(BadUrlReport, 1);
+	report->url = g_strdup_printf(MESSAGE_URL_FORMAT, MESSAGE_URL(url));
+	report->suppressed = suppressed;
+
+	pid_cache_lookup(pidcache, sender, recoverable_problem_file, report);
+}
+
 /* Say that we have a bad URL and report a recoverable error on the process that
    sent it to us. */
 static gboolean
 bad_url (GDBusMethodInvocation * invocation, const gchar * url)
 {
-	const gchar * sender = g_dbus_method_invocation_get_sender(invocation);
-	GDBusConnection * conn = g_dbus_method_invocation_get_connection(invocation); /* transfer: none */
-
-	g_dbus_connection_call(conn,
-		"org.freedesktop.DBus",
-		"/",
-		"org.freedesktop.DBus",
-		"GetConnectionUnixProcessID",
-		g_variant_new("(s)", sender),
-		G_VARIANT_TYPE("(u)"),
-		G_DBUS_CALL_FLAGS_NONE,
-		-1, /* timeout */
-		NULL, /* cancellable */
-		recoverable_problem_file,
-		g_strdup(url));
+	report_bad_url(invocation, url);
 
 	g_dbus_method_invocation_return_error(invocation,
 		url_dispatcher_error_quark(),
 		ERROR_BAD_URL,
-		"URL '%s' is not handleable by the URL Dispatcher",
-		url);
+		"URL '" MESSAGE_URL_FORMAT "' is not handleable by the URL Dispatcher",
+		MESSAGE_URL(url));
 
 	return TRUE;
 }
@@ -147,13 +284,10 @@ send_open_cb (GObject * object, GAsyncResult * res, gpointer user_data)
 	}
 }
 
-/* Sends the URL to the dash, which isn't an app, but just on the bus generally. */
-gboolean
-send_to_dash (const gchar * url)
+/* Focus the dash and give it the URLs */
+static void
+dash_send (GDBusConnection * bus, const gchar * const * urls)
 {
-	GDBusConnection * bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
-	g_return_val_if_fail(bus != NULL, FALSE);
-
 	/* Kinda sucks that we need to do this, should probably find it's way into
 	   the libUAL API if it's needed outside */
 	g_dbus_connection_emit_signal(bus,
@@ -166,9 +300,7 @@ send_to_dash (const gchar * url)
 
 	GVariantBuilder opendata;
 	g_variant_builder_init(&opendata, G_VARIANT_TYPE_TUPLE);
-	g_variant_builder_open(&opendata, G_VARIANT_TYPE_ARRAY);
-	g_variant_builder_add_value(&opendata, g_variant_new_string(url));
-	g_variant_builder_close(&opendata);
+	g_variant_builder_add_value(&opendata, g_variant_new_strv(urls, -1));
 	g_variant_builder_add_value(&opendata, g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0));
 
 	/* Using the FD.o Application interface */
@@ -183,98 +315,201 @@ send_to_dash (const gchar * url)
 		-1,
 		NULL,
 		send_open_cb, NULL);
+}
+
+/* Sends the URLs to the dash, which isn't an app, but just on the bus generally.
+   If we're still connecting to the bus they go out once we're connected. */
+static gboolean
+send_to_dash (const gchar * const * urls)
+{
+	if (G_UNLIKELY(egress == NULL)) {
+		g_debug("Bus not ready, queuing URLs for dash: " MESSAGE_URL_FORMAT, MESSAGE_URL(urls[0]));
+		g_queue_push_tail(&dashqueue, g_strdupv((gchar **)urls));
+		return TRUE;
+	}
 
-	g_object_unref(bus);
+	dash_send(egress, urls);
 	return TRUE;
 }
 
-/* Handles taking an application and an URL and sending them to Upstart */
-gboolean
-dispatcher_send_to_app (const gchar * app_id, const gchar * url)
+/* Runs on the launch queue's thread */
+static gboolean
+launch_app (const gchar * app_id, const gchar * const * urls, gpointer user_data)
+{
+	gint64 start = PROBE_START(app_started);
+	gboolean started = ubuntu_app_launch_start_application(app_id, urls);
+
+	PROBE4(app_started, app_id, g_strv_length((gchar **)urls), started, PROBE_SINCE(start));
+
+	if (!started) {
+		g_warning("Unable to start application '%s' with URL '" MESSAGE_URL_FORMAT "'", app_id, MESSAGE_URL(urls[0]));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Sends all of @urls to one app, the start happens later on the
+   launch queue */
+static gboolean
+send_to_app_urls (const gchar * app_id, const gchar * const * urls)
 {
-	g_debug("Emitting 'application-start' for APP_ID='%s' and URLS='%s'", app_id, url);
+	g_return_val_if_fail(launchqueue != NULL, FALSE);
+
+	g_debug("Emitting 'application-start' for APP_ID='%s' and %u URLS starting with '" MESSAGE_URL_FORMAT "'", app_id, g_strv_length((gchar **)urls), MESSAGE_URL(urls[0]));
+	PROBE3(send_to_app, app_id, urls[0], g_strv_length((gchar **)urls));
 
 	if (g_strcmp0(app_id, "unity8-dash") == 0) {
-		return send_to_dash(url);
+		return send_to_dash(urls);
 	}
 
+	launch_queue_push(launchqueue, app_id, urls);
+
+	return TRUE;
+}
+
+/* Handles taking an application and an URL and sending them to Upstart */
+gboolean
+dispatcher_send_to_app (const gchar * app_id, const gchar * url)
+{
 	const gchar * urls[2] = {
 		url,
 		NULL
 	};
 
-	if (!ubuntu_app_launch_start_application(app_id, urls)) {
-		g_warning("Unable to start application '%s' with URL '%s'", app_id, url);
-	}
+	return send_to_app_urls(app_id, urls);
+}
 
-	return TRUE;
+/* Block until everything queued has been started, mostly for testing */
+void
+dispatcher_flush_launches ()
+{
+	g_return_if_fail(launchqueue != NULL);
+
+	launch_queue_flush(launchqueue);
 }
 
-/* Handles setting up the overlay with the URL */
-gboolean
-dispatcher_send_to_overlay (const gchar * app_id, const gchar * url, GDBusConnection * conn, const gchar * sender)
+/* How deep the launch queue gets and how long starts take */
+void
+dispatcher_get_launch_stats (LaunchQueueStats * stats)
 {
-	GError * error = NULL;
+	g_return_if_fail(launchqueue != NULL);
 
-	/* TODO: Detect if a scope is what we need to overlay on */
-	GVariant * callret = g_dbus_connection_call_sync(conn,
-		"org.freedesktop.DBus",
-		"/",
-		"org.freedesktop.DBus",
-		"GetConnectionUnixProcessID",
-		g_variant_new("(s)", sender),
-		G_VARIANT_TYPE("(u)"),
-		G_DBUS_CALL_FLAGS_NONE,
-		-1, /* timeout */
-		NULL, /* cancellable */
-		&error);
+	launch_queue_get_stats(launchqueue, stats);
+}
+
+/* Counts the work that's going on, only on the main thread */
+static void
+inflight_add (gint delta)
+{
+	inflight += delta;
+	lastactive = g_get_monotonic_time();
+}
+
+/* When the last bit of work finished, zero if there is some going on
+   right now. Launches count until they've been started. */
+gint64
+dispatcher_idle_since ()
+{
+	if (inflight > 0 || !g_queue_is_empty(&dashqueue)) {
+		return 0;
+	}
+
+	if (launchqueue != NULL) {
+		LaunchQueueStats stats;
+		launch_queue_get_stats(launchqueue, &stats);
+
+		if (stats.depth > 0) {
+			return 0;
+		}
+	}
+
+	return lastactive;
+}
+
+typedef struct {
+	gchar * appid;
+	gchar * url;
+	DispatcherSentFunc func;
+	gpointer user_data;
+} OverlayData;
+
+/* Got the PID of the sender, now we can put the overlay on it */
+static void
+overlay_pid_cb (const gchar * sender, guint32 pid, const GError * error, gpointer user_data)
+{
+	OverlayData * data = (OverlayData *)user_data;
+	gboolean sent = FALSE;
 
 	if (error != NULL) {
-		g_warning("Unable to get PID for '%s' when processing URL '%s': %s", sender, url, error->message);
-		g_error_free(error);
-		return FALSE;
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_warning("Unable to get PID for '%s' when processing URL '" MESSAGE_URL_FORMAT "': %s", sender, MESSAGE_URL(data->url), error->message);
+		}
+	} else {
+		sent = overlay_tracker_add(tracker, data->appid, pid, data->url);
 	}
 
-	unsigned int pid = 0;
-	g_variant_get_child(callret, 0, "u", &pid);
-	g_variant_unref(callret);
+	data->func(sent, data->user_data);
+
+	g_free(data->appid);
+	g_free(data->url);
+	g_free(data);
+
+	inflight_add(-1);
+}
+
+/* Handles setting up the overlay with the URL on the app that @sender
+   is from, @func is called with the result once it's done */
+void
+dispatcher_send_to_overlay (const gchar * app_id, const gchar * url, const gchar * sender, DispatcherSentFunc func, gpointer user_data)
+{
+	g_return_if_fail(app_id != NULL);
+	g_return_if_fail(url != NULL);
+	g_return_if_fail(sender != NULL);
+	g_return_if_fail(func != NULL);
+
+	inflight_add(1);
 
-	return overlay_tracker_add(tracker, app_id, pid, url);
+	OverlayData * data = g_new0(OverlayData, 1);
+	data->appid = g_strdup(app_id);
+	data->url = g_strdup(url);
+	data->func = func;
+	data->user_data = user_data;
+
+	/* TODO: Detect if a scope is what we need to overlay on */
+	pid_cache_lookup(pidcache, sender, overlay_pid_cb, data);
 }
 
 /* Check to see if this is an overlay AppID */
 gboolean
 dispatcher_is_overlay (const gchar * appid)
 {
-	const gchar * systemdir = NULL;
-	gboolean found = FALSE;
-	gchar * desktopname = g_strdup_printf("%s.desktop", appid);
+	g_return_val_if_fail(overlays != NULL, FALSE);
 
-	/* First time, check the environment */
-	if (G_UNLIKELY(systemdir == NULL)) {
-		systemdir = g_getenv("URL_DISPATCHER_OVERLAY_DIR");
-		if (systemdir == NULL) {
-			systemdir = OVERLAY_SYSTEM_DIRECTORY;
-		}
-	}
+	return overlay_registry_contains(overlays, appid);
+}
 
-	/* Check system dir */
-	if (!found) {
-		gchar * sysdir = g_build_filename(systemdir, desktopname, NULL);
-		found = g_file_test(sysdir, G_FILE_TEST_EXISTS);
-		g_free(sysdir);
+/* Start watching the system and user (clicks) overlay directories */
+static OverlayRegistry *
+overlays_new (void)
+{
+	const gchar * systemdir = g_getenv("URL_DISPATCHER_OVERLAY_DIR");
+	if (systemdir == NULL) {
+		systemdir = OVERLAY_SYSTEM_DIRECTORY;
 	}
 
-	/* Check user dir (clicks) */
-	if (!found) {
-		gchar * usrdir = g_build_filename(g_get_user_cache_dir(), "url-dispatcher", "url-overlays", desktopname, NULL);
-		found = g_file_test(usrdir, G_FILE_TEST_EXISTS);
-		g_free(usrdir);
-	}
+	gchar * usrdir = g_build_filename(g_get_user_cache_dir(), "url-dispatcher", "url-overlays", NULL);
+
+	const gchar * dirs[3] = {
+		systemdir,
+		usrdir,
+		NULL
+	};
 
-	g_free(desktopname);
+	OverlayRegistry * registry = overlay_registry_new(dirs);
+	g_free(usrdir);
 
-	return found;
+	return registry;
 }
 
 /* Whether we should restrict this appid based on the package name */
@@ -301,287 +536,1454 @@ dispatcher_appid_restrict (const gchar * appid, const gchar * package)
 	return !match;
 }
 
-/* Get a URL off of the bus */
-static gboolean
-dispatch_url_cb (GObject * skel, GDBusMethodInvocation * invocation, const gchar * url, const gchar * package, gpointer user_data)
+/* The last stage of a DispatchURL, puts the call in the statistics */
+static void
+dispatch_replied (DispatchTiming * timing, DispatchOutcome outcome)
 {
-	/* Nice debugging message depending on whether the @package variable
-	   is valid from DBus */
-	if (package == NULL || package[0] == '\0') {
-		g_debug("Dispatching URL: %s", url);
-	} else {
-		g_debug("Dispatching Restricted URL: %s", url);
-		g_debug("Package restriction: %s", package);
-	}
-
-	/* Check to ensure the URL is valid coming from DBus */
-	if (url == NULL || url[0] == '\0') {
-		return bad_url(invocation, url);
-	}
-
-	/* Actually do it */
-	gchar * appid = NULL;
-	const gchar * outurl = NULL;
+	dispatch_timing_mark(timing, DISPATCH_STAGE_REPLY);
 
-	/* Discover the AppID */
-	if (!dispatcher_url_to_appid(url, &appid, &outurl)) {
-		return bad_url(invocation, url);
+	/* Not while shutting down */
+	if (dispatchstats != NULL) {
+		dispatch_stats_record(dispatchstats, outcome, timing);
 	}
+}
 
-	/* Check for the 'unconfined' app id which is causing problems */
-	if (g_strcmp0(appid, "unconfined") == 0) {
-		g_free(appid);
-		return bad_url(invocation, url);
-	}
+typedef struct {
+	GDBusMethodInvocation * invocation;
+	DispatchTiming timing;
+} OverlayReply;
 
-	/* Check to see if we're allowed to use it */
-	if (dispatcher_appid_restrict(appid, package)) {
-		g_free(appid);
-		return restricted_appid(invocation, url, package);
-	}
+/* Finish the DispatchURL call for an overlay */
+static void
+overlay_sent_cb (gboolean sent, gpointer user_data)
+{
+	OverlayReply * reply = (OverlayReply *)user_data;
+	GDBusMethodInvocation * invocation = reply->invocation;
 
-	/* We're cleared to continue */
-	gboolean sent = FALSE;
-	if (!dispatcher_is_overlay(appid)) {
-		sent = dispatcher_send_to_app(appid, outurl);
-	} else {
-		sent = dispatcher_send_to_overlay(
-			appid,
-			outurl,
-			g_dbus_method_invocation_get_connection(invocation),
-			g_dbus_method_invocation_get_sender(invocation));
-	}
-	g_free(appid);
+	dispatch_timing_mark(&reply->timing, DISPATCH_STAGE_HANDOFF);
 
 	if (sent) {
 		g_dbus_method_invocation_return_value(invocation, NULL);
+		dispatch_replied(&reply->timing, DISPATCH_OUTCOME_OVERLAY);
 	} else {
+		const gchar * url = NULL;
+		g_variant_get_child(g_dbus_method_invocation_get_parameters(invocation), 0, "&s", &url);
 		bad_url(invocation, url);
+		dispatch_replied(&reply->timing, DISPATCH_OUTCOME_BAD_URL);
 	}
 
-	return sent;
+	g_object_unref(invocation);
+	g_free(reply);
 }
 
-/* Test a URL to find it's AppID */
-static gboolean
-test_url_cb (GObject * skel, GDBusMethodInvocation * invocation, const gchar * const * urls, gpointer user_data)
+static gboolean url_to_appid (const gchar * url, UrlTrie ** trie, gchar ** out_appid, const gchar ** out_url, DispatchTiming * timing);
+
+/* A TestURLs call, it gets split into chunks that can be resolved
+   in parallel and replies when the last one is done */
+typedef struct {
+	GDBusMethodInvocation * invocation;
+	guint count;
+	gchar ** appids; /* Filled in by the chunks */
+	guint pending;
+} TestBatch;
+
+/* A DispatchURL, DispatchURLs, TestURL or TestURLs chunk. The AppIDs
+   are found on a worker, if there are workers, and everything else
+   happens on the main thread. */
+typedef enum {
+	JOB_DISPATCH_URL,
+	JOB_DISPATCH_URLS,
+	JOB_TEST_URL,
+	JOB_TEST_URLS
+} UrlJobType;
+
+typedef struct {
+	UrlJobType type;
+	GDBusMethodInvocation * invocation;
+	guint64 sequence;
+	guint count;
+	const gchar ** urls; /* Borrowed from the message of the invocation */
+	const gchar ** packages; /* Only for dispatches, borrowed too */
+	gchar ** appids; /* NULL where there isn't a handler */
+	const gchar * badurl; /* TestURL, points into urls */
+	TestBatch * batch; /* TestURLs */
+	guint offset; /* Of urls[0] in the batch */
+	DispatchTiming timing; /* DispatchURL */
+} UrlJob;
+
+static UrlJob *
+job_new (UrlJobType type, GDBusMethodInvocation * invocation, guint count)
 {
-	if (urls == NULL || urls[0] == NULL || urls[0][0] == '\0') {
-		/* Right off the bat, let's deal with these */
-		return bad_url(invocation, NULL);
+	inflight_add(1);
+
+	UrlJob * job = g_new0(UrlJob, 1);
+	job->type = type;
+	job->invocation = g_object_ref(invocation);
+	job->count = count;
+	job->urls = g_new0(const gchar *, count + 1);
+	if (type == JOB_DISPATCH_URL || type == JOB_DISPATCH_URLS) {
+		job->packages = g_new0(const gchar *, count + 1);
 	}
+	job->appids = g_new0(gchar *, count + 1);
+	return job;
+}
 
-	GVariantBuilder builder;
-	g_variant_builder_init(&builder, G_VARIANT_TYPE_ARRAY);
+static void
+job_free (UrlJob * job)
+{
+	guint i;
 
-	int i;
-	for (i = 0; urls[i] != NULL; i++) {
-		const gchar * url = urls[i];
+	/* Not a strv, there can be holes */
+	for (i = 0; i < job->count; i++) {
+		g_free(job->appids[i]);
+	}
+	g_free(job->appids);
 
-		g_debug("Testing URL: %s", url);
+	g_object_unref(job->invocation);
+	g_free(job->urls);
+	g_free(job->packages);
+	g_free(job);
 
-		if (url == NULL || url[0] == '\0') {
-			g_variant_builder_clear(&builder);
-			return bad_url(invocation, url);
-		}
+	inflight_add(-1);
+}
 
-		gchar * appid = NULL;
-		const gchar * outurl = NULL;
+/* The part that is safe to run on any thread. All of the URLs are
+   looked up in the same routing trie. */
+static void
+job_resolve (UrlJob * job)
+{
+	UrlTrie * trie = NULL;
+	DispatchTiming * timing = job->type == JOB_DISPATCH_URL ? &job->timing : NULL;
+	guint i;
 
-		if (dispatcher_url_to_appid(url, &appid, &outurl)) {
-			GVariant * vappid = g_variant_new_take_string(appid);
-			g_variant_builder_add_value(&builder, vappid);
-		} else {
-			g_variant_builder_clear(&builder);
-			return bad_url(invocation, url);
-		}
+	if (timing != NULL) {
+		dispatch_timing_mark(timing, DISPATCH_STAGE_QUEUE);
 	}
 
-	GVariant * varray = g_variant_builder_end(&builder);
-	GVariant * tuple = g_variant_new_tuple(&varray, 1);
-	g_dbus_method_invocation_return_value(invocation, tuple);
+	for (i = 0; i < job->count; i++) {
+		const gchar * url = job->urls[i];
 
-	return TRUE;
-}
+		if (job->type == JOB_TEST_URL || job->type == JOB_TEST_URLS) {
+			g_debug("Testing URL: " MESSAGE_URL_FORMAT, MESSAGE_URL(url));
+		}
 
-/* Determine the domain for an intent using the package variable */
-static gchar *
-intent_domain (const gchar * url)
-{
-	gchar * domain = NULL;
-	GMatchInfo * intentmatch = NULL;
+		if (url[0] == '\0' || !url_to_appid(url, &trie, &job->appids[i], NULL, timing)) {
+			g_clear_pointer(&job->appids[i], g_free);
 
-	if (g_regex_match(intentre, url, 0, &intentmatch)) {
-		domain = g_match_info_fetch(intentmatch, 1);
+			if (job->type == JOB_TEST_URL) {
+				job->badurl = url;
+				break;
+			}
+		}
+	}
 
-		g_match_info_free(intentmatch);
+	if (trie != NULL) {
+		url_trie_unref(trie);
 	}
 
-	return domain;
+	if (timing != NULL) {
+		dispatch_timing_mark(timing, DISPATCH_STAGE_LOOKUP);
+	}
 }
 
-/* The core of the URL handling */
-gboolean
-dispatcher_url_to_appid (const gchar * url, gchar ** out_appid, const gchar ** out_url)
+/* Launch what the DispatchURL resolved to and reply */
+static void
+dispatch_url_finish (UrlJob * job)
 {
-	g_return_val_if_fail(url != NULL, FALSE);
-	g_return_val_if_fail(out_appid != NULL, FALSE);
-
-	/* Special case the app id */
-	GMatchInfo * appidmatch = NULL;
-	if (g_regex_match(appidre, url, 0, &appidmatch)) {
-		gchar * package = g_match_info_fetch(appidmatch, 1);
-		gchar * app = g_match_info_fetch(appidmatch, 2);
-		gchar * version = g_match_info_fetch(appidmatch, 3);
-		gboolean retval = FALSE;
-
-		*out_appid = ubuntu_app_launch_triplet_to_app_id(package, app, version);
-		if (*out_appid != NULL) {
-			retval = TRUE;
-		}
+	GDBusMethodInvocation * invocation = job->invocation;
+	DispatchTiming * timing = &job->timing;
+	const gchar * url = job->urls[0];
+	const gchar * package = job->packages[0];
+	const gchar * appid = job->appids[0];
 
-		g_free(package);
-		g_free(app);
-		g_free(version);
-		g_match_info_free(appidmatch);
+	/* Coming back to the main loop from a worker */
+	dispatch_timing_mark(timing, DISPATCH_STAGE_QUEUE);
 
-		return retval;
+	if (appid == NULL) {
+		bad_url(invocation, url);
+		dispatch_replied(timing, DISPATCH_OUTCOME_BAD_URL);
+		return;
 	}
 
-	/* Special case the application URL */
-	GMatchInfo * appmatch = NULL;
-	if (g_regex_match(applicationre, url, 0, &appmatch)) {
-		*out_appid = g_match_info_fetch(appmatch, 1);
+	/* Check for the 'unconfined' app id which is causing problems */
+	if (g_strcmp0(appid, "unconfined") == 0) {
+		bad_url(invocation, url);
+		dispatch_replied(timing, DISPATCH_OUTCOME_BAD_URL);
+		return;
+	}
 
-		g_match_info_free(appmatch);
+	/* Check to see if we're allowed to use it */
+	gboolean restricted = dispatcher_appid_restrict(appid, package);
+	dispatch_timing_mark(timing, DISPATCH_STAGE_RESTRICT);
 
-		return TRUE;
+	if (restricted) {
+		restricted_appid(invocation, url, package);
+		dispatch_replied(timing, DISPATCH_OUTCOME_RESTRICTED);
+		return;
 	}
-	g_match_info_free(appmatch);
 
-	/* Check the URL db */
-	GMatchInfo * genericmatch = NULL;
-	if (g_regex_match(genericre, url, 0, &genericmatch)) {
-		gboolean found = FALSE;
-		gchar * protocol = g_match_info_fetch(genericmatch, 1);
-		gchar * domain = NULL;
+	/* We're cleared to continue */
+	gboolean overlay = dispatcher_is_overlay(appid);
+	dispatch_timing_mark(timing, DISPATCH_STAGE_OVERLAY);
+
+	if (overlay) {
+		OverlayReply * reply = g_new0(OverlayReply, 1);
+		reply->invocation = g_object_ref(invocation);
+		reply->timing = *timing;
 
-		/* We special case the intent domain (further comment there) */
-		if (g_strcmp0(protocol, "intent") == 0) {
-			domain = intent_domain(url);
-		} else {
-			domain = g_match_info_fetch(genericmatch, 2);
-		}
+		/* Replies once the overlay is set up */
+		dispatcher_send_to_overlay(
+			appid,
+			url,
+			g_dbus_method_invocation_get_sender(invocation),
+			overlay_sent_cb,
+			reply);
+		return;
+	}
 
-		*out_appid = url_db_find_url(urldb, protocol, domain);
-		g_debug("Protocol '%s' for domain '%s' resulting in app id '%s'", protocol, domain, *out_appid);
+	gboolean sent = dispatcher_send_to_app(appid, url);
+	dispatch_timing_mark(timing, DISPATCH_STAGE_HANDOFF);
 
-		if (*out_appid != NULL) {
-			found = TRUE;
-			if (out_url != NULL) {
-				*out_url = url;
-			}
-		}
+	if (sent) {
+		g_dbus_method_invocation_return_value(invocation, NULL);
+		dispatch_replied(timing, DISPATCH_OUTCOME_LAUNCHED);
+	} else {
+		bad_url(invocation, url);
+		dispatch_replied(timing, DISPATCH_OUTCOME_BAD_URL);
+	}
+}
 
-		g_free(protocol);
-		g_free(domain);
+/* The reply to a DispatchURLs call, it goes out when the last of the
+   overlays has been set up */
+typedef struct {
+	GDBusMethodInvocation * invocation;
+	const gchar ** errors; /* "" for the URLs that were sent */
+	guint pending;
+} BatchReply;
 
-		g_match_info_free(genericmatch);
+typedef struct {
+	BatchReply * reply;
+	guint index;
+	const gchar * url; /* Borrowed from the invocation of the reply */
+} BatchOverlay;
 
-		return found;
+static void
+batch_reply_release (BatchReply * reply)
+{
+	reply->pending--;
+	if (reply->pending > 0) {
+		return;
 	}
-	g_match_info_free(genericmatch);
 
-	return FALSE;
+	GVariant * errors = g_variant_new_strv(reply->errors, -1);
+	g_dbus_method_invocation_return_value(reply->invocation, g_variant_new_tuple(&errors, 1));
+
+	g_object_unref(reply->invocation);
+	g_free(reply->errors);
+	g_free(reply);
 }
 
-/* We're goin' down cap'n */
+/* One of the overlays in a DispatchURLs call is done */
 static void
-name_lost (GDBusConnection * con, const gchar * name, gpointer user_data)
+batch_overlay_sent_cb (gboolean sent, gpointer user_data)
 {
-	GMainLoop * mainloop = (GMainLoop *)user_data;
-	g_warning("Unable to get name '%s'", name);
-	g_main_loop_quit(mainloop);
-	return;
+	BatchOverlay * overlay = (BatchOverlay *)user_data;
+	BatchReply * reply = overlay->reply;
+
+	if (!sent) {
+		report_bad_url(reply->invocation, overlay->url);
+		reply->errors[overlay->index] = ERROR_BAD_URL_NAME;
+	}
+
+	batch_reply_release(reply);
+
+	g_free(overlay);
 }
 
-/* Callback when we're connected to dbus */
+/* The URLs of a DispatchURLs call that go to the same app */
+typedef struct {
+	const gchar * appid;
+	GArray * indexes;
+	GPtrArray * urls;
+} BatchGroup;
+
+/* Check each of the URLs like DispatchURL does, but send all of the
+   URLs for an app together so it gets started once */
 static void
-bus_got (GObject * obj, GAsyncResult * res, gpointer user_data)
+dispatch_urls_finish (UrlJob * job)
 {
-	GMainLoop * mainloop = (GMainLoop *)user_data;
-	GDBusConnection * bus = NULL;
-	GError * error = NULL;
+	BatchReply * reply = g_new0(BatchReply, 1);
+	reply->invocation = g_object_ref(job->invocation);
+	reply->errors = g_new0(const gchar *, job->count + 1);
+	reply->pending = 1; /* Released below */
+
+	GHashTable * groupids = g_hash_table_new(g_str_hash, g_str_equal);
+	GPtrArray * groups = g_ptr_array_new();
+	guint i;
+
+	for (i = 0; i < job->count; i++) {
+		const gchar * url = job->urls[i];
+		const gchar * appid = job->appids[i];
+
+		reply->errors[i] = "";
+
+		/* Check for the 'unconfined' app id which is causing problems */
+		if (appid == NULL || g_strcmp0(appid, "unconfined") == 0) {
+			report_bad_url(job->invocation, url);
+			reply->errors[i] = ERROR_BAD_URL_NAME;
+			continue;
+		}
 
-	bus = g_bus_get_finish(res, &error);
+		/* Check to see if we're allowed to use it */
+		if (dispatcher_appid_restrict(appid, job->packages[i])) {
+			reply->errors[i] = ERROR_RESTRICTED_URL_NAME;
+			continue;
+		}
 
-	if (error != NULL) {
-		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
-			g_error("Unable to connect to D-Bus: %s", error->message);
-			g_main_loop_quit(mainloop);
+		if (dispatcher_is_overlay(appid)) {
+			BatchOverlay * overlay = g_new0(BatchOverlay, 1);
+			overlay->reply = reply;
+			overlay->index = i;
+			overlay->url = url;
+
+			reply->pending++;
+			dispatcher_send_to_overlay(
+				appid,
+				url,
+				g_dbus_method_invocation_get_sender(job->invocation),
+				batch_overlay_sent_cb,
+				overlay);
+			continue;
 		}
-		g_error_free(error);
-		return;
-	}
 
-	register_dbus_errors();
+		BatchGroup * group = (BatchGroup *)g_hash_table_lookup(groupids, appid);
+		if (group == NULL) {
+			group = g_new0(BatchGroup, 1);
+			group->appid = appid;
+			group->indexes = g_array_new(FALSE, FALSE, sizeof(guint));
+			group->urls = g_ptr_array_new();
 
-	g_dbus_interface_skeleton_export(G_DBUS_INTERFACE_SKELETON(skel), bus, "/com/canonical/URLDispatcher", &error);
-	if (error != NULL) {
-		g_error("Unable to export interface skeleton: %s", error->message);
-		g_main_loop_quit(mainloop);
-		return;
+			g_hash_table_insert(groupids, (gpointer)appid, group);
+			g_ptr_array_add(groups, group);
+		}
+
+		g_array_append_val(group->indexes, i);
+		g_ptr_array_add(group->urls, (gpointer)url);
 	}
 
-	g_bus_own_name_on_connection(bus,
-		"com.canonical.URLDispatcher",
-		G_BUS_NAME_OWNER_FLAGS_NONE, /* flags */
-		NULL, /* name acquired */
-		name_lost,
-		user_data, NULL); /* user data */
+	/* In the order the apps were first asked for */
+	for (i = 0; i < groups->len; i++) {
+		BatchGroup * group = (BatchGroup *)g_ptr_array_index(groups, i);
+		g_ptr_array_add(group->urls, NULL);
+
+		if (!send_to_app_urls(group->appid, (const gchar * const *)group->urls->pdata)) {
+			guint j;
+			for (j = 0; j < group->indexes->len; j++) {
+				guint index = g_array_index(group->indexes, guint, j);
+				report_bad_url(job->invocation, job->urls[index]);
+				reply->errors[index] = ERROR_BAD_URL_NAME;
+			}
+		}
+
+		g_array_free(group->indexes, TRUE);
+		g_ptr_array_free(group->urls, TRUE);
+		g_free(group);
+	}
 
-	g_object_unref(bus);
+	g_ptr_array_free(groups, TRUE);
+	g_hash_table_destroy(groupids);
 
-	return;
+	batch_reply_release(reply);
 }
 
-/* Initialize all the globals */
-gboolean
+/* Send back the AppIDs for a TestURL */
+static void
+test_url_finish (UrlJob * job)
+{
+	if (job->badurl != NULL) {
+		bad_url(job->invocation, job->badurl);
+		return;
+	}
+
+	GVariantBuilder builder;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_ARRAY);
+
+	guint i;
+	for (i = 0; i < job->count; i++) {
+		g_variant_builder_add_value(&builder, g_variant_new_string(job->appids[i]));
+	}
+
+	GVariant * varray = g_variant_builder_end(&builder);
+	GVariant * tuple = g_variant_new_tuple(&varray, 1);
+	g_dbus_method_invocation_return_value(job->invocation, tuple);
+}
+
+/* Send back an (appid, error) pair for each URL of a TestURLs call,
+   nobody gets a problem report for a batch lookup */
+static void
+test_batch_reply (TestBatch * batch)
+{
+	GVariantBuilder builder;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(ss)"));
+
+	guint i;
+	for (i = 0; i < batch->count; i++) {
+		if (batch->appids[i] != NULL) {
+			g_variant_builder_add(&builder, "(ss)", batch->appids[i], "");
+		} else {
+			g_variant_builder_add(&builder, "(ss)", "", ERROR_BAD_URL_NAME);
+		}
+	}
+
+	GVariant * varray = g_variant_builder_end(&builder);
+	g_dbus_method_invocation_return_value(batch->invocation, g_variant_new_tuple(&varray, 1));
+}
+
+/* Hand the AppIDs of one chunk to its TestURLs batch */
+static void
+test_urls_finish (UrlJob * job)
+{
+	TestBatch * batch = job->batch;
+
+	guint i;
+	for (i = 0; i < job->count; i++) {
+		batch->appids[job->offset + i] = job->appids[i];
+		job->appids[i] = NULL;
+	}
+
+	batch->pending--;
+	if (batch->pending > 0) {
+		return;
+	}
+
+	test_batch_reply(batch);
+
+	for (i = 0; i < batch->count; i++) {
+		g_free(batch->appids[i]);
+	}
+	g_free(batch->appids);
+	g_object_unref(batch->invocation);
+	g_free(batch);
+}
+
+/* Main thread side of a job */
+static void
+job_finish (UrlJob * job)
+{
+	switch (job->type) {
+	case JOB_DISPATCH_URL:
+		dispatch_url_finish(job);
+		break;
+	case JOB_DISPATCH_URLS:
+		dispatch_urls_finish(job);
+		break;
+	case JOB_TEST_URL:
+		test_url_finish(job);
+		break;
+	case JOB_TEST_URLS:
+		test_urls_finish(job);
+		break;
+	}
+
+	job_free(job);
+
+	if (!served) {
+		served = TRUE;
+		g_debug("First request served %" G_GINT64_FORMAT " us after starting", g_get_monotonic_time() - starttime);
+		PROBE2(startup, "served", g_get_monotonic_time() - starttime);
+	}
+}
+
+/* Finish all the jobs the workers have handed back */
+static gboolean
+finished_drain (gpointer user_data)
+{
+	UrlJob * job = NULL;
+
+	while (finished != NULL && (job = (UrlJob *)g_async_queue_try_pop(finished)) != NULL) {
+		job_finish(job);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Runs on a worker thread with its own database connection */
+static void
+worker_resolve (gpointer data, gpointer user_data)
+{
+	UrlJob * job = (UrlJob *)data;
+
+	/* There are as many sources as workers, so there's always one */
+	RouteSource * source = (RouteSource *)g_async_queue_pop(workersources);
+	g_private_set(&threadsource, source);
+
+	job_resolve(job);
+
+	g_private_set(&threadsource, NULL);
+	g_async_queue_push(workersources, source);
+
+	/* Not g_main_context_invoke() as that could run it right here */
+	g_async_queue_push(finished, job);
+
+	GSource * idle = g_idle_source_new();
+	g_source_set_callback(idle, finished_drain, NULL, NULL);
+	g_source_attach(idle, maincontext);
+	g_source_unref(idle);
+}
+
+/* Someone is waiting on the screen for a dispatch, they go ahead of
+   any TestURL batches, otherwise it's first come first served */
+static gint
+job_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	const UrlJob * joba = (const UrlJob *)a;
+	const UrlJob * jobb = (const UrlJob *)b;
+	gboolean testa = joba->type == JOB_TEST_URL || joba->type == JOB_TEST_URLS;
+	gboolean testb = jobb->type == JOB_TEST_URL || jobb->type == JOB_TEST_URLS;
+
+	if (testa != testb) {
+		return testa ? 1 : -1;
+	}
+
+	if (joba->sequence == jobb->sequence) {
+		return 0;
+	}
+	return joba->sequence < jobb->sequence ? -1 : 1;
+}
+
+/* Resolve on a worker if we have them, otherwise right here. Until the
+   database is open they're parked, setup_finished() runs them. */
+static void
+job_run (UrlJob * job)
+{
+	if (!setupdone) {
+		g_queue_push_tail(&setupqueue, job);
+		return;
+	}
+
+	if (workers == NULL) {
+		job_resolve(job);
+		job_finish(job);
+		return;
+	}
+
+	GError * error = NULL;
+
+	job->sequence = jobsequence++;
+	g_thread_pool_push(workers, job, &error);
+
+	if (error != NULL) {
+		/* It's still queued, just waiting on the threads we have */
+		g_warning("Unable to start URL worker: %s", error->message);
+		g_error_free(error);
+	}
+}
+
+/* Get a URL off of the bus */
+static gboolean
+dispatch_url_cb (GDBusMethodInvocation * invocation, GVariant * parameters)
+{
+	const gchar * url = NULL;
+	const gchar * package = NULL;
+
+	/* Not copied, the message stays around with the invocation */
+	g_variant_get(parameters, "(&s&s)", &url, &package);
+
+	/* Nice debugging message depending on whether the @package variable
+	   is valid from DBus */
+	if (package == NULL || package[0] == '\0') {
+		g_debug("Dispatching URL: " MESSAGE_URL_FORMAT, MESSAGE_URL(url));
+	} else {
+		g_debug("Dispatching Restricted URL: " MESSAGE_URL_FORMAT, MESSAGE_URL(url));
+		g_debug("Package restriction: %s", package);
+	}
+
+	DispatchTiming timing;
+	dispatch_timing_start(&timing);
+
+	/* Check to ensure the URL is valid coming from DBus */
+	if (url == NULL || url[0] == '\0' || url_too_long(url)) {
+		dispatch_timing_mark(&timing, DISPATCH_STAGE_PARSE);
+		bad_url(invocation, url);
+		dispatch_replied(&timing, DISPATCH_OUTCOME_BAD_URL);
+		return TRUE;
+	}
+
+	UrlJob * job = job_new(JOB_DISPATCH_URL, invocation, 1);
+	job->timing = timing;
+	job->urls[0] = url;
+	job->packages[0] = package;
+
+	job_run(job);
+
+	return TRUE;
+}
+
+/* Get a batch of URLs off of the bus, each one with its own package
+   restriction, and reply with how each of them went */
+static gboolean
+dispatch_urls_cb (GDBusMethodInvocation * invocation, GVariant * parameters)
+{
+	GVariant * urls = g_variant_get_child_value(parameters, 0);
+	UrlJob * job = job_new(JOB_DISPATCH_URLS, invocation, g_variant_n_children(urls));
+
+	GVariantIter iter;
+	const gchar * url = NULL;
+	const gchar * package = NULL;
+	guint i = 0;
+
+	g_variant_iter_init(&iter, urls);
+	while (g_variant_iter_next(&iter, "(&s&s)", &url, &package)) {
+		g_debug("Dispatching URL in batch: " MESSAGE_URL_FORMAT, MESSAGE_URL(url));
+
+		job->urls[i] = url;
+		job->packages[i] = package;
+		i++;
+	}
+
+	/* The strings are in the message, not in @urls */
+	g_variant_unref(urls);
+
+	job_run(job);
+
+	return TRUE;
+}
+
+/* Test a URL to find it's AppID */
+static gboolean
+test_url_cb (GDBusMethodInvocation * invocation, GVariant * parameters)
+{
+	const gchar ** urls = NULL;
+	g_variant_get(parameters, "(^a&s)", &urls);
+
+	if (urls == NULL || urls[0] == NULL || urls[0][0] == '\0') {
+		/* Right off the bat, let's deal with these */
+		g_free(urls);
+		return bad_url(invocation, NULL);
+	}
+
+	UrlJob * job = job_new(JOB_TEST_URL, invocation, g_strv_length((gchar **)urls));
+	g_free(job->urls);
+	job->urls = urls;
+
+	job_run(job);
+
+	return TRUE;
+}
+
+/* Test a lot of URLs to find their AppIDs, each one gets its own result
+   so one bad URL doesn't spoil the rest */
+static gboolean
+test_urls_cb (GDBusMethodInvocation * invocation, GVariant * parameters)
+{
+	const gchar ** urls = NULL;
+	g_variant_get(parameters, "(^a&s)", &urls);
+
+	guint count = urls != NULL ? g_strv_length((gchar **)urls) : 0;
+
+	if (count == 0) {
+		g_free(urls);
+		GVariant * varray = g_variant_new_array(G_VARIANT_TYPE("(ss)"), NULL, 0);
+		g_dbus_method_invocation_return_value(invocation, g_variant_new_tuple(&varray, 1));
+		return TRUE;
+	}
+
+	TestBatch * batch = g_new0(TestBatch, 1);
+	batch->invocation = g_object_ref(invocation);
+	batch->count = count;
+	batch->appids = g_new0(gchar *, count + 1);
+	batch->pending = (count + TEST_CHUNK_SIZE - 1) / TEST_CHUNK_SIZE;
+
+	g_debug("Testing %u URLs in %u chunks", count, batch->pending);
+
+	/* Jobs can finish right away without workers, so the chunks are
+	   all counted in pending before the first one is run */
+	guint offset;
+	for (offset = 0; offset < count; offset += TEST_CHUNK_SIZE) {
+		UrlJob * job = job_new(JOB_TEST_URLS, invocation, MIN(TEST_CHUNK_SIZE, count - offset));
+		job->batch = batch;
+		job->offset = offset;
+
+		guint i;
+		for (i = 0; i < job->count; i++) {
+			job->urls[i] = urls[offset + i];
+		}
+
+		job_run(job);
+	}
+
+	g_free(urls);
+
+	return TRUE;
+}
+
+/* Add a URL from the database into the routing trie */
+static void
+trie_add_url (const gchar * protocol, const gchar * domainsuffix, const gchar * appid, gpointer user_data)
+{
+	if (!url_trie_insert((UrlTrie *)user_data, protocol, domainsuffix, appid)) {
+		g_debug("Protocol '%s' for domain '%s' already handled, ignoring '%s'", protocol, domainsuffix, appid);
+	}
+}
+
+/* Whether @a and @b are the same index file. update-directory renames
+   a new one into place, so any change gives it a new inode. */
+static gboolean
+index_same_file (const struct stat * a, const struct stat * b)
+{
+	return a->st_dev == b->st_dev &&
+		a->st_ino == b->st_ino &&
+		a->st_size == b->st_size &&
+		a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+		a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/* A trie over the index update-directory wrote, if it was written from
+   the database as @source sees it now. NULL means build one instead. */
+static UrlTrie *
+index_url_trie (RouteSource * source)
+{
+	gint64 generation = 0;
+	if (!url_db_get_generation(source->db, &generation)) {
+		return NULL;
+	}
+
+	/* Before opening it, if it gets replaced in between we'll just
+	   map the new one again */
+	struct stat indexstat;
+	if (stat(indexfilename, &indexstat) != 0) {
+		return NULL;
+	}
+
+	UrlIndex * index = url_index_open(indexfilename);
+	if (index == NULL) {
+		return NULL;
+	}
+
+	UrlTrie * trie = NULL;
+	if (url_index_get_generation(index) == generation) {
+		trie = url_trie_new_for_index(index);
+		source->index = indexstat;
+	} else {
+		g_debug("Routing index is out of date, generation %" G_GINT64_FORMAT " not %" G_GINT64_FORMAT, url_index_get_generation(index), generation);
+	}
+
+	url_index_unref(index);
+	return trie;
+}
+
+/* Whether what @source last built the trie from is unchanged. That's
+   a stat() of the index when it was mapped, update-directory rewrites
+   it after every change, so the database is only looked at every
+   INDEX_RECHECK_INTERVAL in case it didn't get that far. A trie read
+   from SQL had no usable index to go by, so it's checked against the
+   database's data version each time. The data version is left in
+   @version for the rebuild. */
+static gboolean
+route_source_current (RouteSource * source, gint64 * version)
+{
+	gboolean samefile = FALSE;
+
+	if (source->built && source->mapped) {
+		struct stat indexstat;
+		samefile = stat(indexfilename, &indexstat) == 0 && index_same_file(&indexstat, &source->index);
+
+		if (samefile) {
+			gint64 now = g_get_monotonic_time();
+			if (now - source->checked < INDEX_RECHECK_INTERVAL) {
+				return TRUE;
+			}
+			source->checked = now;
+		}
+	}
+
+	if (!url_db_get_data_version(source->db, version)) {
+		/* Can't tell, keep what we have */
+		return TRUE;
+	}
+
+	return source->built && (samefile || !source->mapped) && *version == source->version;
+}
+
+/* Get a reference to the routing trie, rebuilding it if the database
+   has been changed by update-directory since @source last looked. The
+   index is used when it's current, otherwise it's read from SQL. Each
+   connection notices a change on its own, so with workers the trie
+   can get rebuilt once per worker. */
+static UrlTrie *
+get_url_trie (RouteSource * source)
+{
+	gint64 version = 0;
+
+	if (!route_source_current(source, &version)) {
+		/* One at a time so older data can't replace newer */
+		g_mutex_lock(&rebuildlock);
+
+		UrlTrie * trie = index_url_trie(source);
+		gboolean mapped = trie != NULL;
+
+		if (!mapped) {
+			trie = url_trie_new();
+		}
+
+		if (mapped || url_db_foreach_url(source->db, trie_add_url, trie)) {
+			source->version = version;
+			source->built = TRUE;
+			source->mapped = mapped;
+			source->checked = g_get_monotonic_time();
+
+			if (mapped) {
+				g_debug("Mapped routing index with %u handlers", url_trie_size(trie));
+			} else {
+				g_debug("Built routing trie with %u handlers", url_trie_size(trie));
+			}
+
+			g_mutex_lock(&routelock);
+			UrlTrie * oldtrie = urltrie;
+			urltrie = trie;
+			/* Anything we remember could have changed */
+			url_cache_clear(urlcache);
+			g_mutex_unlock(&routelock);
+
+			if (oldtrie != NULL) {
+				url_trie_unref(oldtrie);
+			}
+		} else {
+			url_trie_unref(trie);
+		}
+
+		g_mutex_unlock(&rebuildlock);
+	}
+
+	g_mutex_lock(&routelock);
+	UrlTrie * trie = urltrie != NULL ? url_trie_ref(urltrie) : NULL;
+	g_mutex_unlock(&routelock);
+
+	return trie;
+}
+
+/* Turn the pieces of an appid:// URL into an AppID */
+static gboolean
+appid_url_to_appid (const UrlParts * parts, gchar ** out_appid)
+{
+	gchar * package = g_strndup(parts->package.start, parts->package.len);
+	gchar * app = g_strndup(parts->app.start, parts->app.len);
+	gchar * version = g_strndup(parts->version.start, parts->version.len);
+
+	*out_appid = ubuntu_app_launch_triplet_to_app_id(package, app, version);
+
+	g_free(package);
+	g_free(app);
+	g_free(version);
+
+	return *out_appid != NULL;
+}
+
+/* Get a reference to the routing trie from the database this thread uses */
+static UrlTrie *
+thread_url_trie (void)
+{
+	RouteSource * source = (RouteSource *)g_private_get(&threadsource);
+	UrlTrie * trie = NULL;
+
+	if (source != NULL) {
+		trie = get_url_trie(source);
+	} else {
+		g_mutex_lock(&mainsourcelock);
+		if (mainsource.db != NULL) {
+			trie = get_url_trie(&mainsource);
+		}
+		g_mutex_unlock(&mainsourcelock);
+	}
+
+	return trie;
+}
+
+/* Find the AppID for a parsed URL. The routing trie is only fetched
+   the first time one is needed and left in @trie, so a batch of URLs
+   all get resolved against the same routing data. The caller unrefs it. */
+static gboolean
+parts_to_appid (const gchar * url, const UrlParts * parts, UrlTrie ** trie, gchar ** out_appid, const gchar ** out_url)
+{
+	switch (parts->kind) {
+	case URL_KIND_APPID:
+		/* Special case the app id */
+		return appid_url_to_appid(parts, out_appid);
+	case URL_KIND_APPLICATION:
+		/* Special case the application URL */
+		*out_appid = g_strndup(parts->desktop.start, parts->desktop.len);
+		return TRUE;
+	case URL_KIND_GENERIC:
+		break;
+	case URL_KIND_INVALID:
+		return FALSE;
+	}
+
+	/* Check the URL db, intents already have their package as the domain */
+	if (*trie == NULL) {
+		*trie = thread_url_trie();
+	}
+
+	if (*trie == NULL) {
+		return FALSE;
+	}
+
+	const gchar * domain = parts->domain.start != NULL ? parts->domain.start : "";
+	const gchar * found = NULL;
+	gchar * appid = NULL;
+
+	g_mutex_lock(&routelock);
+	gboolean cached = url_cache_lookup(urlcache, parts->protocol.start, parts->protocol.len, domain, parts->domain.len, &found);
+	appid = g_strdup(found);
+	g_mutex_unlock(&routelock);
+
+	if (!cached) {
+		found = url_trie_lookup(*trie, parts->protocol.start, parts->protocol.len, domain, parts->domain.len);
+		appid = g_strdup(found);
+
+		g_mutex_lock(&routelock);
+		/* Don't remember answers from a trie that's been replaced */
+		if (*trie == urltrie) {
+			url_cache_insert(urlcache, parts->protocol.start, parts->protocol.len, domain, parts->domain.len, found);
+		}
+		g_mutex_unlock(&routelock);
+	}
+
+	g_debug("Protocol '%.*s' for domain '%.*s' resulting in app id '%s'", (int)parts->protocol.len, parts->protocol.start, (int)parts->domain.len, domain, appid);
+
+	if (appid == NULL) {
+		return FALSE;
+	}
+
+	*out_appid = appid;
+	if (out_url != NULL) {
+		*out_url = url;
+	}
+
+	return TRUE;
+}
+
+/* Find the AppID for @url, as parts_to_appid() does. The parse time
+   goes in @timing if there is one. */
+static gboolean
+url_to_appid (const gchar * url, UrlTrie ** trie, gchar ** out_appid, const gchar ** out_url, DispatchTiming * timing)
+{
+	gint64 start = PROBE_START(url_to_appid);
+	UrlParts parts;
+
+	if (url_too_long(url)) {
+		g_debug("URL longer than %u bytes: " MESSAGE_URL_FORMAT, urllimit, MESSAGE_URL(url));
+		return FALSE;
+	}
+
+	url_parse(url, &parts);
+
+	if (timing != NULL) {
+		dispatch_timing_mark(timing, DISPATCH_STAGE_PARSE);
+	}
+
+	gboolean found = parts_to_appid(url, &parts, trie, out_appid, out_url);
+
+	PROBE6(url_to_appid, url, strnlen(url, urllimit), parts.protocol.start, parts.protocol.len, found ? *out_appid : NULL, PROBE_SINCE(start));
+
+	return found;
+}
+
+/* The core of the URL handling */
+gboolean
+dispatcher_url_to_appid (const gchar * url, gchar ** out_appid, const gchar ** out_url)
+{
+	g_return_val_if_fail(url != NULL, FALSE);
+	g_return_val_if_fail(out_appid != NULL, FALSE);
+
+	/* Callers want an answer now. The main thread keeps its loop going
+	   until setup is done, other threads wait on the setup thread. */
+	if (g_thread_self() == mainthread) {
+		while (!setupdone) {
+			g_main_context_iteration(maincontext, TRUE);
+		}
+	} else {
+		g_mutex_lock(&setuplock);
+		while (!setupopened) {
+			g_cond_wait(&setupcond, &setuplock);
+		}
+		g_mutex_unlock(&setuplock);
+	}
+
+	UrlTrie * trie = NULL;
+	gboolean found = url_to_appid(url, &trie, out_appid, out_url, NULL);
+
+	if (trie != NULL) {
+		url_trie_unref(trie);
+	}
+
+	return found;
+}
+
+/* We're on the bus, log how long it took to get here */
+static void
+name_acquired (GDBusConnection * con, const gchar * name, gpointer user_data)
+{
+	g_debug("Name '%s' owned %" G_GINT64_FORMAT " us after starting", name, g_get_monotonic_time() - starttime);
+	PROBE2(startup, "name-acquired", g_get_monotonic_time() - starttime);
+}
+
+/* We're goin' down cap'n */
+static void
+name_lost (GDBusConnection * con, const gchar * name, gpointer user_data)
+{
+	GMainLoop * mainloop = (GMainLoop *)user_data;
+	g_warning("Unable to get name '%s'", name);
+	g_main_loop_quit(mainloop);
+	return;
+}
+
+static void method_call (GDBusConnection * con, const gchar * sender, const gchar * path, const gchar * interface, const gchar * method, GVariant * parameters, GDBusMethodInvocation * invocation, gpointer user_data);
+
+/* Callback when we're connected to dbus */
+static void
+bus_got (GObject * obj, GAsyncResult * res, gpointer user_data)
+{
+	GMainLoop * mainloop = (GMainLoop *)user_data;
+	GDBusConnection * bus = NULL;
+	GError * error = NULL;
+
+	bus = g_bus_get_finish(res, &error);
+
+	if (error != NULL) {
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_error("Unable to connect to D-Bus: %s", error->message);
+			g_main_loop_quit(mainloop);
+		}
+		g_error_free(error);
+		return;
+	}
+
+	register_dbus_errors();
+
+	static const GDBusInterfaceVTable vtable = {
+		method_call,
+		NULL, /* get property */
+		NULL, /* set property */
+	};
+
+	objectid = g_dbus_connection_register_object(bus,
+		"/com/canonical/URLDispatcher",
+		service_iface_com_canonical_urldispatcher_interface_info(),
+		&vtable,
+		NULL, NULL, /* user data */
+		&error);
+	if (error != NULL) {
+		g_error("Unable to export interface: %s", error->message);
+		g_main_loop_quit(mainloop);
+		return;
+	}
+
+	/* Keep it for everything we send, and send what was waiting for it */
+	egress = bus;
+	pid_cache_set_connection(pidcache, egress);
+
+	dispatcher_own_name(mainloop);
+
+	gchar ** urls = NULL;
+	while ((urls = (gchar **)g_queue_pop_head(&dashqueue)) != NULL) {
+		dash_send(egress, (const gchar * const *)urls);
+		g_strfreev(urls);
+	}
+
+	return;
+}
+
+/* Reads a count from the environment, @fallback if it isn't set
+   or isn't usable */
+static guint
+get_env_count (const gchar * name, guint fallback, guint max)
+{
+	const gchar * envcount = g_getenv(name);
+	if (G_LIKELY(envcount == NULL)) {
+		return fallback;
+	}
+
+	gchar * end = NULL;
+	guint64 count = g_ascii_strtoull(envcount, &end, 10);
+	if (end == envcount || *end != '\0' || count > max) {
+		g_warning("Invalid value '%s' for %s, using %u", envcount, name, fallback);
+		return fallback;
+	}
+
+	return (guint)count;
+}
+
+/* Size of the lookup cache, zero turns it off */
+static guint
+get_cache_size (void)
+{
+	return get_env_count("URL_DISPATCHER_LOOKUP_CACHE_SIZE", DEFAULT_CACHE_SIZE, G_MAXUINT);
+}
+
+/* Close the workers' connections, none can be in use */
+static void
+workersources_close (void)
+{
+	RouteSource * source = NULL;
+	while ((source = (RouteSource *)g_async_queue_try_pop(workersources)) != NULL) {
+		url_db_close(source->db);
+		g_free(source);
+	}
+	g_clear_pointer(&workersources, g_async_queue_unref);
+}
+
+/* Start the threads that find AppIDs, each gets its own read only
+   connection to the database. Needs to happen before the first trie
+   is built so they don't miss a change. */
+static void
+workers_start (guint count)
+{
+	if (count == 0) {
+		return;
+	}
+
+	workersources = g_async_queue_new();
+
+	guint i;
+	for (i = 0; i < count; i++) {
+		RouteSource * source = g_new0(RouteSource, 1);
+		source->db = url_db_open_readonly();
+
+		if (source->db == NULL) {
+			g_free(source);
+			break;
+		}
+
+		/* Built from the same data as the main thread's trie */
+		source->built = url_db_get_data_version(source->db, &source->version);
+		g_mutex_lock(&mainsourcelock);
+		source->mapped = mainsource.mapped;
+		source->index = mainsource.index;
+		g_mutex_unlock(&mainsourcelock);
+		g_async_queue_push(workersources, source);
+	}
+
+	gint opened = g_async_queue_length(workersources);
+	if (opened <= 0) {
+		g_warning("Unable to open the URL database for workers, finding AppIDs on the main thread");
+		g_clear_pointer(&workersources, g_async_queue_unref);
+		return;
+	}
+
+	GError * error = NULL;
+	workers = g_thread_pool_new(worker_resolve, NULL, opened, FALSE, &error);
+	if (error != NULL) {
+		/* Shouldn't happen when not exclusive, but we can live without them */
+		g_warning("Unable to create URL workers, finding AppIDs on the main thread: %s", error->message);
+		g_error_free(error);
+
+		if (workers != NULL) {
+			g_thread_pool_free(workers, TRUE, TRUE);
+			workers = NULL;
+		}
+		workersources_close();
+		return;
+	}
+
+	g_thread_pool_set_sort_function(workers, job_compare, NULL);
+	finished = g_async_queue_new();
+
+	g_debug("Finding AppIDs with %d workers", opened);
+}
+
+/* Let the queued jobs finish, and reply to them, before we
+   close things down */
+static void
+workers_stop (void)
+{
+	if (workers == NULL) {
+		return;
+	}
+
+	g_thread_pool_free(workers, FALSE, TRUE);
+	workers = NULL;
+
+	finished_drain(NULL);
+	g_clear_pointer(&finished, g_async_queue_unref);
+
+	workersources_close();
+}
+
+/* Lookup cache counters, mostly to tune the size */
+void
+dispatcher_get_cache_stats (guint64 * hits, guint64 * misses)
+{
+	g_return_if_fail(urlcache != NULL);
+
+	url_cache_get_stats(urlcache, hits, misses);
+}
+
+/* Dispatch latencies and the other counters, for the GetStatistics
+   D-Bus method */
+static gboolean
+get_statistics_cb (GDBusMethodInvocation * invocation, GVariant * parameters)
+{
+	GVariantBuilder stages;
+	g_variant_builder_init(&stages, G_VARIANT_TYPE("a(sstttt)"));
+
+	guint outcome, stage;
+	for (outcome = 0; outcome < DISPATCH_OUTCOME_COUNT; outcome++) {
+		for (stage = 0; stage < DISPATCH_STAGE_COUNT; stage++) {
+			guint64 p50 = 0, p90 = 0, p99 = 0;
+			guint64 count = dispatch_stats_get(dispatchstats, outcome, stage, &p50, &p90, &p99);
+
+			g_variant_builder_add(&stages, "(sstttt)",
+				dispatch_outcome_name(outcome),
+				dispatch_stage_name(stage),
+				count, p50, p90, p99);
+		}
+	}
+
+	guint64 hits = 0, misses = 0;
+	g_mutex_lock(&routelock);
+	url_cache_get_stats(urlcache, &hits, &misses);
+	g_mutex_unlock(&routelock);
+
+	LaunchQueueStats launchstats;
+	launch_queue_get_stats(launchqueue, &launchstats);
+
+	ProblemLimiterStats problemstats;
+	problem_limiter_get_stats(problemlimiter, &problemstats);
+
+	GVariantBuilder counters;
+	g_variant_builder_init(&counters, G_VARIANT_TYPE("a{st}"));
+	g_variant_builder_add(&counters, "{st}", "cache-hits", hits);
+	g_variant_builder_add(&counters, "{st}", "cache-misses", misses);
+	g_variant_builder_add(&counters, "{st}", "launches", launchstats.launched);
+	g_variant_builder_add(&counters, "{st}", "launches-coalesced", launchstats.coalesced);
+	g_variant_builder_add(&counters, "{st}", "launches-failed", launchstats.failed);
+	g_variant_builder_add(&counters, "{st}", "launch-queue-max-depth", (guint64)launchstats.max_depth);
+	g_variant_builder_add(&counters, "{st}", "reports-filed", problemstats.reported);
+	g_variant_builder_add(&counters, "{st}", "reports-suppressed", problemstats.suppressed);
+
+	g_dbus_method_invocation_return_value(invocation, g_variant_new("(a(sstttt)a{st})", &stages, &counters));
+
+	return TRUE;
+}
+
+/* All of our methods come through here. A generated skeleton would
+   copy every argument before we got to look at it, these are read
+   straight from the message, so a huge URL is only looked at up to
+   the limit. */
+static void
+method_call (GDBusConnection * con, const gchar * sender, const gchar * path, const gchar * interface, const gchar * method, GVariant * parameters, GDBusMethodInvocation * invocation, gpointer user_data)
+{
+	if (g_strcmp0(method, "DispatchURL") == 0) {
+		dispatch_url_cb(invocation, parameters);
+	} else if (g_strcmp0(method, "DispatchURLs") == 0) {
+		dispatch_urls_cb(invocation, parameters);
+	} else if (g_strcmp0(method, "TestURL") == 0) {
+		test_url_cb(invocation, parameters);
+	} else if (g_strcmp0(method, "TestURLs") == 0) {
+		test_urls_cb(invocation, parameters);
+	} else if (g_strcmp0(method, "GetStatistics") == 0) {
+		get_statistics_cb(invocation, parameters);
+	} else {
+		/* GDBus checks against the interface, so not really */
+		g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method '%s'", method);
+	}
+}
+
+/* Asks for the name once we're on the bus, and again if we had to
+   take it back after releasing it. Losing it quits @mainloop. */
+void
+dispatcher_own_name (GMainLoop * mainloop)
+{
+	if (egress == NULL || ownerid != 0) {
+		return;
+	}
+
+	ownerid = g_bus_own_name_on_connection(egress,
+		"com.canonical.URLDispatcher",
+		G_BUS_NAME_OWNER_FLAGS_NONE, /* flags */
+		name_acquired,
+		name_lost,
+		mainloop, NULL); /* user data */
+}
+
+/* Gives up the name so new callers start another instance. This waits
+   for the bus to let go of it, so the calls it sent here before then
+   are already queued on the main loop when it returns. */
+void
+dispatcher_release_name ()
+{
+	if (ownerid != 0) {
+		g_bus_unown_name(ownerid);
+		ownerid = 0;
+	}
+}
+
+/* Run the jobs that came in while the database was being opened */
+static void
+setup_queue_run (void)
+{
+	UrlJob * job = NULL;
+
+	setupdone = TRUE;
+
+	if (!g_queue_is_empty(&setupqueue)) {
+		g_debug("Running %u requests that came in during setup", g_queue_get_length(&setupqueue));
+	}
+
+	while ((job = (UrlJob *)g_queue_pop_head(&setupqueue)) != NULL) {
+		job_run(job);
+	}
+}
+
+/* Back on the main thread once the database is open */
+static gboolean
+setup_finished (gpointer user_data)
+{
+	if (setupfailed) {
+		/* Without the database they're all bad URLs, but they still
+		   get a reply before we go */
+		setup_queue_run();
+		g_main_loop_quit((GMainLoop *)user_data);
+		return G_SOURCE_REMOVE;
+	}
+
+	/* Zero, the default, finds AppIDs on the main thread */
+	workers_start(get_env_count("URL_DISPATCHER_WORKERS", 0, MAX_WORKERS));
+
+	g_debug("Routing ready %" G_GINT64_FORMAT " us after starting", g_get_monotonic_time() - starttime);
+	PROBE2(startup, "ready", g_get_monotonic_time() - starttime);
+
+	setup_queue_run();
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Opens the database and builds the routing trie while the main thread
+   connects to the bus, so the name is owned without waiting on either */
+static gpointer
+setup_thread (gpointer user_data)
+{
+	UrlDb * db = url_db_create_database();
+
+	g_mutex_lock(&mainsourcelock);
+	mainsource.db = db;
+	UrlTrie * trie = db != NULL ? get_url_trie(&mainsource) : NULL;
+	g_mutex_unlock(&mainsourcelock);
+
+	if (trie != NULL) {
+		url_trie_unref(trie);
+	}
+
+	if (db == NULL) {
+		g_warning("Unable to open the URL database");
+		setupfailed = TRUE;
+	}
+
+	g_mutex_lock(&setuplock);
+	setupopened = TRUE;
+	g_cond_broadcast(&setupcond);
+	g_mutex_unlock(&setuplock);
+
+	g_source_attach(setupsource, maincontext);
+
+	return NULL;
+}
+
+/* Initialize all the globals */
+gboolean
 dispatcher_init (GMainLoop * mainloop, OverlayTracker * intracker)
 {
+	starttime = g_get_monotonic_time();
+	lastactive = starttime;
+	served = FALSE;
+	setupdone = FALSE;
+	setupopened = FALSE;
+	mainthread = g_thread_self();
+	setupfailed = FALSE;
+
 	tracker = intracker;
 	cancellable = g_cancellable_new();
-
-	urldb = url_db_create_database();
-	g_return_val_if_fail(urldb != NULL, FALSE);
-
-	applicationre = g_regex_new("^application:///([a-zA-Z0-9_\\.-]*)\\.desktop$", 0, 0, NULL);
-	appidre = g_regex_new("^appid://([a-z0-9\\.-]*)/([a-zA-Z0-9-]*)/([a-zA-Z0-9\\.-]*)$", 0, 0, NULL);
-	genericre = g_regex_new("^([a-z][a-z0-9]*):(?://(?:.*@)?([a-zA-Z0-9\\.-]*)(?::[0-9]*)?/?)?(.*)?$", 0, 0, NULL);
-	intentre = g_regex_new("^intent://.*package=([a-zA-Z0-9\\.]*);.*$", 0, 0, NULL);
+	urlcache = url_cache_new(get_cache_size());
+	overlays = overlays_new();
+	pidcache = pid_cache_new();
+	dispatchstats = dispatch_stats_new();
+	problemlimiter = problem_limiter_new((gint64)get_env_count("URL_DISPATCHER_REPORT_INTERVAL", DEFAULT_REPORT_INTERVAL, MAX_REPORT_INTERVAL) * G_USEC_PER_SEC);
+	maincontext = g_main_context_ref_thread_default();
+	launchqueue = launch_queue_new(launch_app, NULL);
+	urllimit = get_env_count("URL_DISPATCHER_MAX_URL_LENGTH", DEFAULT_URL_LIMIT, MAX_URL_LIMIT);
+	indexfilename = url_db_index_filename();
+
+	/* Build the routing trie before the first URL shows up, without
+	   holding up getting on the bus */
+	setupsource = g_idle_source_new();
+	g_source_set_callback(setupsource, setup_finished, mainloop, NULL);
+	setupthread = g_thread_new("url-setup", setup_thread, NULL);
 
 	g_bus_get(G_BUS_TYPE_SESSION, cancellable, bus_got, mainloop);
 
-	skel = service_iface_com_canonical_urldispatcher_skeleton_new();
-	g_signal_connect(skel, "handle-dispatch-url", G_CALLBACK(dispatch_url_cb), NULL);
-	g_signal_connect(skel, "handle-test-url", G_CALLBACK(test_url_cb), NULL);
-
 	return TRUE;
 }
 
-/* Clean up all the globals */
+/* Clean up all the globals, FALSE if they never got set up */
 gboolean
 dispatcher_shutdown ()
 {
 	g_cancellable_cancel(cancellable);
+	dispatcher_release_name();
+
+	g_clear_pointer(&setupthread, g_thread_join);
+	g_source_destroy(setupsource);
+	g_clear_pointer(&setupsource, g_source_unref);
+	/* Setup didn't get back to the main loop, reply to what's parked */
+	if (!setupdone) {
+		setup_queue_run();
+	}
+	workers_stop();
 
 	g_object_unref(cancellable);
-	g_object_unref(skel);
-	g_regex_unref(applicationre);
-	g_regex_unref(appidre);
-	g_regex_unref(genericre);
-	g_regex_unref(intentre);
-	sqlite3_close(urldb);
+	if (objectid != 0) {
+		g_dbus_connection_unregister_object(egress, objectid);
+		objectid = 0;
+	}
+	guint64 hits = 0, misses = 0;
+	url_cache_get_stats(urlcache, &hits, &misses);
+	g_debug("Lookup cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses", hits, misses);
+
+	g_clear_pointer(&urlcache, url_cache_free);
+
+	/* Acknowledged already, so they still get started */
+	LaunchQueueStats launchstats;
+	launch_queue_flush(launchqueue);
+	launch_queue_get_stats(launchqueue, &launchstats);
+	g_clear_pointer(&launchqueue, launch_queue_free);
+	g_debug("Launch queue: %" G_GUINT64_FORMAT " started, %" G_GUINT64_FORMAT " coalesced, %" G_GUINT64_FORMAT " failed, up to %u deep, %" G_GUINT64_FORMAT " us worst latency",
+		launchstats.launched, launchstats.coalesced, launchstats.failed, launchstats.max_depth, launchstats.latency_max);
+	g_clear_pointer(&overlays, overlay_registry_free);
+	g_queue_foreach(&dashqueue, (GFunc)g_strfreev, NULL);
+	g_queue_clear(&dashqueue);
+	g_clear_pointer(&pidcache, pid_cache_free);
+
+	ProblemLimiterStats problemstats;
+	problem_limiter_get_stats(problemlimiter, &problemstats);
+	g_debug("Bad URL reports: %" G_GUINT64_FORMAT " filed, %" G_GUINT64_FORMAT " suppressed", problemstats.reported, problemstats.suppressed);
+	g_clear_pointer(&problemlimiter, problem_limiter_free);
+
+	guint64 p50 = 0, p99 = 0;
+	guint64 dispatched = dispatch_stats_get(dispatchstats, DISPATCH_OUTCOME_LAUNCHED, DISPATCH_STAGE_TOTAL, &p50, NULL, &p99);
+	g_debug("Dispatches launched: %" G_GUINT64_FORMAT ", %" G_GUINT64_FORMAT " ns median, %" G_GUINT64_FORMAT " ns p99", dispatched, p50, p99);
+	g_clear_pointer(&dispatchstats, dispatch_stats_free);
+
+	g_clear_object(&egress);
+	g_clear_pointer(&urltrie, url_trie_unref);
+	g_clear_pointer(&maincontext, g_main_context_unref);
+	if (mainsource.db != NULL) {
+		url_db_close(mainsource.db);
+		mainsource.db = NULL;
+	}
+	mainsource.built = FALSE;
+	mainsource.mapped = FALSE;
+	g_clear_pointer(&indexfilename, g_free);
 
-	return TRUE;
+	return !setupfailed;
 }
@@ -22,16 +22,25 @@
 
 #include <gio/gio.h>
 #include "overlay-tracker.h"
+#include "launch-queue.h"
 
 G_BEGIN_DECLS
 
+typedef void (*DispatcherSentFunc) (gboolean sent, gpointer user_data);
+
 gboolean dispatcher_init (GMainLoop * mainloop, OverlayTracker * tracker);
 gboolean dispatcher_shutdown ();
 gboolean dispatcher_url_to_appid (const gchar * url, gchar ** out_appid, const gchar ** out_url);
 gboolean dispatcher_appid_restrict (const gchar * appid, const gchar * package);
 gboolean dispatcher_is_overlay (const gchar * appid);
 gboolean dispatcher_send_to_app (const gchar * appid, const gchar * url);
-gboolean dispatcher_send_to_overlay (const gchar * app_id, const gchar * url, GDBusConnection * conn, const gchar * sender);
+void dispatcher_send_to_overlay (const gchar * app_id, const gchar * url, const gchar * sender, DispatcherSentFunc func, gpointer user_data);
+void dispatcher_get_cache_stats (guint64 * hits, guint64 * misses);
+void dispatcher_flush_launches ();
+void dispatcher_get_launch_stats (LaunchQueueStats * stats);
+gint64 dispatcher_idle_since ();
+void dispatcher_own_name (GMainLoop * mainloop);
+void dispatcher_release_name ();
 
 G_END_DECLS
 
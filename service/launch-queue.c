@@ -0,0 +1,217 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/* Starts applications off of the main loop. A request for an app
+   that isn't starting goes to the launch thread right away. Requests
+   for it that come in while that start is going are put together, in
+   the order they came in, and become one more start once it's done.
+   Starts happen one at a time in the order they were asked for. */
+
+#include "launch-queue.h"
+
+typedef struct {
+	gchar * appid;
+	GPtrArray * urls; /* NULL terminated */
+	gint64 requested; /* First request, for the latency */
+} LaunchEntry;
+
+struct _LaunchQueue {
+	LaunchQueueFunc func;
+	gpointer user_data;
+	GThreadPool * launcher;
+
+	GMutex lock; /* Protects everything below */
+	GCond done;
+	GHashTable * starting; /* appids with a start in flight */
+	GHashTable * waiting; /* appid -> LaunchEntry to start after it */
+	guint inflight;
+	LaunchQueueStats stats;
+};
+
+static LaunchEntry *
+entry_new (const gchar * appid)
+{
+	LaunchEntry * entry = g_new0(LaunchEntry, 1);
+	entry->appid = g_strdup(appid);
+	entry->urls = g_ptr_array_new_with_free_func(g_free);
+	g_ptr_array_add(entry->urls, NULL);
+	entry->requested = g_get_monotonic_time();
+	return entry;
+}
+
+static void
+entry_free (LaunchEntry * entry)
+{
+	g_free(entry->appid);
+	g_ptr_array_free(entry->urls, TRUE);
+	g_free(entry);
+}
+
+/* Adds the ones it doesn't already have */
+static void
+entry_add_urls (LaunchEntry * entry, const gchar * const * urls)
+{
+	guint i, j;
+
+	for (i = 0; urls[i] != NULL; i++) {
+		gboolean found = FALSE;
+		for (j = 0; j + 1 < entry->urls->len && !found; j++) {
+			found = g_strcmp0(g_ptr_array_index(entry->urls, j), urls[i]) == 0;
+		}
+
+		if (!found) {
+			g_ptr_array_index(entry->urls, entry->urls->len - 1) = g_strdup(urls[i]);
+			g_ptr_array_add(entry->urls, NULL);
+		}
+	}
+}
+
+/* On the launch thread */
+static void
+entry_launch (gpointer data, gpointer user_data)
+{
+	LaunchEntry * entry = (LaunchEntry *)data;
+	LaunchQueue * queue = (LaunchQueue *)user_data;
+
+	gboolean launched = queue->func(entry->appid, (const gchar * const *)entry->urls->pdata, queue->user_data);
+	guint64 latency = g_get_monotonic_time() - entry->requested;
+
+	g_mutex_lock(&queue->lock);
+
+	if (launched) {
+		queue->stats.launched++;
+	} else {
+		queue->stats.failed++;
+	}
+	queue->stats.latency_total += latency;
+	queue->stats.latency_max = MAX(queue->stats.latency_max, latency);
+
+	/* What came in while we were starting is next, it takes
+	   over our place in flight */
+	gpointer key = NULL;
+	gpointer next = NULL;
+	if (g_hash_table_lookup_extended(queue->waiting, entry->appid, &key, &next)) {
+		g_hash_table_steal(queue->waiting, entry->appid);
+		g_thread_pool_push(queue->launcher, next, NULL);
+	} else {
+		g_hash_table_remove(queue->starting, entry->appid);
+		queue->inflight--;
+		g_cond_broadcast(&queue->done);
+	}
+
+	g_mutex_unlock(&queue->lock);
+
+	entry_free(entry);
+}
+
+/* @func is called for each start from a thread of our own */
+LaunchQueue *
+launch_queue_new (LaunchQueueFunc func, gpointer user_data)
+{
+	g_return_val_if_fail(func != NULL, NULL);
+
+	LaunchQueue * queue = g_new0(LaunchQueue, 1);
+
+	queue->func = func;
+	queue->user_data = user_data;
+	queue->launcher = g_thread_pool_new(entry_launch, queue, 1, FALSE, NULL);
+
+	g_mutex_init(&queue->lock);
+	g_cond_init(&queue->done);
+	queue->starting = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	queue->waiting = g_hash_table_new(g_str_hash, g_str_equal);
+
+	return queue;
+}
+
+/* Whatever is still waiting gets started first */
+void
+launch_queue_free (LaunchQueue * queue)
+{
+	g_return_if_fail(queue != NULL);
+
+	launch_queue_flush(queue);
+
+	g_thread_pool_free(queue->launcher, FALSE, TRUE);
+	g_hash_table_unref(queue->starting);
+	g_hash_table_unref(queue->waiting);
+
+	g_mutex_clear(&queue->lock);
+	g_cond_clear(&queue->done);
+
+	g_free(queue);
+}
+
+/* Start @appid with @urls, all of them go to the app in one start */
+void
+launch_queue_push (LaunchQueue * queue, const gchar * appid, const gchar * const * urls)
+{
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(appid != NULL);
+	g_return_if_fail(urls != NULL);
+
+	g_mutex_lock(&queue->lock);
+
+	LaunchEntry * entry = (LaunchEntry *)g_hash_table_lookup(queue->waiting, appid);
+	if (entry != NULL) {
+		entry_add_urls(entry, urls);
+		queue->stats.coalesced++;
+		g_mutex_unlock(&queue->lock);
+		return;
+	}
+
+	entry = entry_new(appid);
+	entry_add_urls(entry, urls);
+
+	if (g_hash_table_contains(queue->starting, appid)) {
+		g_hash_table_insert(queue->waiting, entry->appid, entry);
+	} else {
+		g_hash_table_add(queue->starting, g_strdup(appid));
+		queue->inflight++;
+		g_thread_pool_push(queue->launcher, entry, NULL);
+	}
+
+	guint depth = g_hash_table_size(queue->waiting) + queue->inflight;
+	queue->stats.max_depth = MAX(queue->stats.max_depth, depth);
+
+	g_mutex_unlock(&queue->lock);
+}
+
+/* Block until all the starts, including the ones waiting on them,
+   have returned */
+void
+launch_queue_flush (LaunchQueue * queue)
+{
+	g_return_if_fail(queue != NULL);
+
+	g_mutex_lock(&queue->lock);
+	while (queue->inflight > 0) {
+		g_cond_wait(&queue->done, &queue->lock);
+	}
+	g_mutex_unlock(&queue->lock);
+}
+
+void
+launch_queue_get_stats (LaunchQueue * queue, LaunchQueueStats * stats)
+{
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(stats != NULL);
+
+	g_mutex_lock(&queue->lock);
+	*stats = queue->stats;
+	stats->depth = g_hash_table_size(queue->waiting) + queue->inflight;
+	g_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,51 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LAUNCH_QUEUE_H
+#define LAUNCH_QUEUE_H 1
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LaunchQueue LaunchQueue;
+
+/* Called on the launch thread, not the main loop */
+typedef gboolean (*LaunchQueueFunc) (const gchar * appid, const gchar * const * urls, gpointer user_data);
+
+typedef struct {
+	guint depth; /* Waiting to start, or starting now */
+	guint max_depth;
+	guint64 launched;
+	guint64 coalesced;
+	guint64 failed;
+	guint64 latency_total; /* Microseconds from the first request to started */
+	guint64 latency_max;
+} LaunchQueueStats;
+
+LaunchQueue * launch_queue_new                      (LaunchQueueFunc func,
+                                                     gpointer       user_data);
+void          launch_queue_free                     (LaunchQueue *  queue);
+void          launch_queue_push                     (LaunchQueue *  queue,
+                                                     const gchar *  appid,
+                                                     const gchar * const * urls);
+void          launch_queue_flush                    (LaunchQueue *  queue);
+void          launch_queue_get_stats                (LaunchQueue *  queue,
+                                                     LaunchQueueStats * stats);
+
+G_END_DECLS
+
+#endif /* LAUNCH_QUEUE_H */
@@ -0,0 +1,254 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Keeps the set of AppIDs that have an overlay desktop file in one of
+   the overlay directories, so checking for one doesn't touch the file
+   system. The directories are watched and the file named in each event
+   is looked at again, rather than trusting the event type, so a file
+   that is added and removed quickly ends up in whatever state it was
+   really left in. Events are delivered to the main context that was
+   the thread default when the registry was made. */
+
+#include <string.h>
+#include "overlay-registry.h"
+
+#define DESKTOP_SUFFIX ".desktop"
+
+typedef struct {
+	gchar * path;
+	GFile * file;
+	GFileMonitor * monitor; /* NULL if we couldn't watch it */
+	GHashTable * appids;
+} OverlayDir;
+
+struct _OverlayRegistry {
+	GPtrArray * dirs;
+};
+
+/* The AppID for an overlay desktop file name, or NULL if it isn't one */
+static gchar *
+appid_from_name (const gchar * name)
+{
+	if (!g_str_has_suffix(name, DESKTOP_SUFFIX)) {
+		return NULL;
+	}
+
+	gsize len = strlen(name) - strlen(DESKTOP_SUFFIX);
+	if (len == 0) {
+		return NULL;
+	}
+
+	return g_strndup(name, len);
+}
+
+/* Look at a single file in the directory and update the set to match */
+static void
+dir_check_file (OverlayDir * dir, const gchar * name)
+{
+	gchar * appid = appid_from_name(name);
+	if (appid == NULL) {
+		return;
+	}
+
+	gchar * path = g_build_filename(dir->path, name, NULL);
+	gboolean exists = g_file_test(path, G_FILE_TEST_EXISTS);
+	g_free(path);
+
+	if (exists) {
+		g_debug("Overlay available: %s", appid);
+		g_hash_table_add(dir->appids, appid);
+	} else {
+		if (g_hash_table_remove(dir->appids, appid)) {
+			g_debug("Overlay removed: %s", appid);
+		}
+		g_free(appid);
+	}
+}
+
+/* Throw away what we know about the directory and read it again */
+static void
+dir_rescan (OverlayDir * dir)
+{
+	g_hash_table_remove_all(dir->appids);
+
+	GDir * gdir = g_dir_open(dir->path, 0, NULL);
+	if (gdir == NULL) {
+		return;
+	}
+
+	const gchar * name = NULL;
+	while ((name = g_dir_read_name(gdir)) != NULL) {
+		gchar * appid = appid_from_name(name);
+		if (appid != NULL) {
+			g_hash_table_add(dir->appids, appid);
+		}
+	}
+
+	g_dir_close(gdir);
+}
+
+/* Something changed in the directory, or the directory itself */
+static void
+dir_changed (GFileMonitor * monitor, GFile * file, GFile * other, GFileMonitorEvent event, gpointer user_data)
+{
+	OverlayDir * dir = (OverlayDir *)user_data;
+
+	switch (event) {
+	case G_FILE_MONITOR_EVENT_CHANGED:
+	case G_FILE_MONITOR_EVENT_PRE_UNMOUNT:
+		/* Contents don't matter, only existence */
+		return;
+	default:
+		break;
+	}
+
+	GFile * files[2] = { file, other };
+	int i;
+	for (i = 0; i < 2; i++) {
+		if (files[i] == NULL) {
+			continue;
+		}
+
+		/* The directory showing up or going away */
+		if (g_file_equal(files[i], dir->file)) {
+			dir_rescan(dir);
+			continue;
+		}
+
+		GFile * parent = g_file_get_parent(files[i]);
+		gboolean ours = parent != NULL && g_file_equal(parent, dir->file);
+		g_clear_object(&parent);
+
+		if (!ours) {
+			continue;
+		}
+
+		gchar * name = g_file_get_basename(files[i]);
+		dir_check_file(dir, name);
+		g_free(name);
+	}
+}
+
+static void
+dir_free (gpointer data)
+{
+	OverlayDir * dir = (OverlayDir *)data;
+
+	if (dir->monitor != NULL) {
+		g_signal_handlers_disconnect_by_data(dir->monitor, dir);
+		g_file_monitor_cancel(dir->monitor);
+		g_object_unref(dir->monitor);
+	}
+
+	g_hash_table_unref(dir->appids);
+	g_object_unref(dir->file);
+	g_free(dir->path);
+	g_free(dir);
+}
+
+static OverlayDir *
+dir_new (const gchar * path)
+{
+	OverlayDir * dir = g_new0(OverlayDir, 1);
+	GError * error = NULL;
+
+	dir->path = g_strdup(path);
+	dir->file = g_file_new_for_path(path);
+	dir->appids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	/* Watch before reading so nothing slips in between, this works
+	   for directories that don't exist yet as well */
+	dir->monitor = g_file_monitor_directory(dir->file, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+	if (error != NULL) {
+		g_warning("Unable to watch overlay directory '%s', checking it on every URL: %s", path, error->message);
+		g_error_free(error);
+		dir->monitor = NULL;
+	} else {
+		g_signal_connect(dir->monitor, "changed", G_CALLBACK(dir_changed), dir);
+	}
+
+	dir_rescan(dir);
+
+	return dir;
+}
+
+/* Build a registry for the NULL terminated list of @dirs */
+OverlayRegistry *
+overlay_registry_new (const gchar * const * dirs)
+{
+	g_return_val_if_fail(dirs != NULL, NULL);
+
+	OverlayRegistry * registry = g_new0(OverlayRegistry, 1);
+	registry->dirs = g_ptr_array_new_with_free_func(dir_free);
+
+	int i;
+	for (i = 0; dirs[i] != NULL; i++) {
+		g_ptr_array_add(registry->dirs, dir_new(dirs[i]));
+	}
+
+	return registry;
+}
+
+void
+overlay_registry_free (OverlayRegistry * registry)
+{
+	g_return_if_fail(registry != NULL);
+
+	g_ptr_array_unref(registry->dirs);
+	g_free(registry);
+}
+
+/* Whether any of the directories has an overlay for @appid */
+gboolean
+overlay_registry_contains (OverlayRegistry * registry, const gchar * appid)
+{
+	g_return_val_if_fail(registry != NULL, FALSE);
+	g_return_val_if_fail(appid != NULL, FALSE);
+
+	guint i;
+	for (i = 0; i < registry->dirs->len; i++) {
+		OverlayDir * dir = (OverlayDir *)g_ptr_array_index(registry->dirs, i);
+
+		if (G_UNLIKELY(dir->monitor == NULL)) {
+			gchar * name = g_strdup_printf("%s" DESKTOP_SUFFIX, appid);
+			dir_check_file(dir, name);
+			g_free(name);
+		}
+
+		if (g_hash_table_contains(dir->appids, appid)) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* Number of overlays, counting ones in more than one directory twice */
+guint
+overlay_registry_size (OverlayRegistry * registry)
+{
+	g_return_val_if_fail(registry != NULL, 0);
+
+	guint size = 0;
+	guint i;
+	for (i = 0; i < registry->dirs->len; i++) {
+		OverlayDir * dir = (OverlayDir *)g_ptr_array_index(registry->dirs, i);
+		size += g_hash_table_size(dir->appids);
+	}
+
+	return size;
+}
@@ -0,0 +1,35 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef OVERLAY_REGISTRY_H
+#define OVERLAY_REGISTRY_H 1
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _OverlayRegistry OverlayRegistry;
+
+OverlayRegistry * overlay_registry_new              (const gchar * const * dirs);
+void          overlay_registry_free                 (OverlayRegistry * registry);
+gboolean      overlay_registry_contains             (OverlayRegistry * registry,
+                                                     const gchar *  appid);
+guint         overlay_registry_size                 (OverlayRegistry * registry);
+
+G_END_DECLS
+
+#endif /* OVERLAY_REGISTRY_H */
@@ -23,4 +23,5 @@ class OverlayTrackerIface {
 public:
 	virtual ~OverlayTrackerIface() = default;
 	virtual bool addOverlay (const char * appid, unsigned long pid, const char * url) = 0;
+	virtual unsigned int overlayCount () = 0;
 };
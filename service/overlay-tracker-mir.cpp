@@ -19,9 +19,13 @@
 
 #include "overlay-tracker-mir.h"
 #include <ubuntu-app-launch.h>
+#include "probes.h"
 
 static const char * HELPER_TYPE = "url-overlay";
 
+/* Tracepoints, see probes.h */
+PROBE_SEMAPHORE(add_overlay);
+
 OverlayTrackerMir::OverlayTrackerMir () 
 	: thread([this] {
 		/* Setup Helper Observer */
@@ -32,20 +36,25 @@ OverlayTrackerMir::OverlayTrackerMir ()
 		ubuntu_app_launch_observer_delete_helper_stop(untrustedHelperStoppedStatic, HELPER_TYPE, this);
 		})
 {
-	mir = std::shared_ptr<MirConnection>([] {
-			gchar * path = g_build_filename(g_get_user_runtime_dir(), "mir_socket_trusted", NULL);
-			MirConnection * con = mir_connect_sync(path, "url-dispatcher");
-			g_free(path);
-			return con;
-		}(),
-		[] (MirConnection * connection) {
-			if (connection != nullptr)
-				mir_connection_release(connection);
-		});
-
-	if (!mir) {
-		throw std::runtime_error("Unable to connect to Mir");
-	}
+	/* Connecting blocks, so it happens on our thread while the service
+	   gets on with starting up. Everything that uses the connection
+	   runs on the thread too, so it's queued up behind it. */
+	thread.executeOnThread([this] {
+		mir = std::shared_ptr<MirConnection>([] {
+				gchar * path = g_build_filename(g_get_user_runtime_dir(), "mir_socket_trusted", NULL);
+				MirConnection * con = mir_connect_sync(path, "url-dispatcher");
+				g_free(path);
+				return con;
+			}(),
+			[] (MirConnection * connection) {
+				if (connection != nullptr)
+					mir_connection_release(connection);
+			});
+
+		if (!mir) {
+			g_warning("Unable to connect to Mir");
+		}
+	});
 }
 
 /* Enforce a shutdown order, sessions before connection */
@@ -56,10 +65,9 @@ OverlayTrackerMir::~OverlayTrackerMir ()
 			removeSession(std::get<2>(*ongoingSessions.begin()).get());
 		}
 
+		mir.reset();
 		return true;
 	});
-
-	mir.reset();
 }
 
 bool
@@ -67,10 +75,16 @@ OverlayTrackerMir::addOverlay (const char * appid, unsigned long pid, const char
 {
 	std::string sappid(appid);
 	std::string surl(url);
+	gint64 start = PROBE_START(add_overlay);
 
-	return thread.executeOnThread<bool>([this, sappid, pid, surl] {
+	bool added = thread.executeOnThread<bool>([this, sappid, pid, surl] {
 		g_debug("Setting up over lay for PID %d with '%s'", pid, sappid.c_str());
 
+		if (!mir) {
+			g_critical("No Mir connection for overlay of %d with appid '%s'", pid, sappid.c_str());
+			return false;
+		}
+
 		auto session = std::shared_ptr<MirPromptSession>(
 			mir_connection_create_prompt_session_sync(mir.get(), pid, sessionStateChangedStatic, this),
 			[] (MirPromptSession * session) { if (session) mir_prompt_session_release_sync(session); });
@@ -90,6 +104,20 @@ OverlayTrackerMir::addOverlay (const char * appid, unsigned long pid, const char
 		g_free(instance);
 		return true;
 	});
+
+	/* Includes the hop over to the Mir thread and back */
+	PROBE5(add_overlay, appid, pid, surl.length(), added, PROBE_SINCE(start));
+
+	return added;
+}
+
+/* Sessions that are still up */
+unsigned int
+OverlayTrackerMir::overlayCount ()
+{
+	return thread.executeOnThread<unsigned int>([this] {
+		return ongoingSessions.size();
+	});
 }
 
 void
@@ -37,6 +37,7 @@ public:
 	OverlayTrackerMir (); 
 	~OverlayTrackerMir (); 
 	bool addOverlay (const char * appid, unsigned long pid, const char * url) override;
+	unsigned int overlayCount () override;
 
 private:
 	void removeSession (MirPromptSession * session);
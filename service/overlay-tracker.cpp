@@ -52,3 +52,10 @@ overlay_tracker_add (OverlayTracker * tracker, const char * appid, unsigned long
 
 	return reinterpret_cast<OverlayTrackerIface *>(tracker)->addOverlay(appid, pid, url) ? TRUE : FALSE;
 }
+
+guint
+overlay_tracker_count (OverlayTracker * tracker) {
+	g_return_val_if_fail(tracker != nullptr, 0);
+
+	return reinterpret_cast<OverlayTrackerIface *>(tracker)->overlayCount();
+}
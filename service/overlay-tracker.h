@@ -25,4 +25,5 @@ typedef struct _OverlayTracker OverlayTracker;
 OverlayTracker * overlay_tracker_new ();
 void overlay_tracker_delete (OverlayTracker * tracker);
 gboolean overlay_tracker_add (OverlayTracker * tracker, const char * appid, unsigned long pid, const char * url);
+guint overlay_tracker_count (OverlayTracker * tracker);
 
@@ -0,0 +1,307 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Finds the PID behind a bus name without blocking. Answers are kept
+   until the bus says the name has gone away, and asking about a name
+   that is already being looked up waits on the same call. Lookups made
+   before there is a connection are sent once it is set. Only the names
+   we know or are asking about are watched, so the bus doesn't send us
+   every name change on the session. */
+
+#include "pid-cache.h"
+
+typedef struct {
+	PidCacheFunc func;
+	gpointer user_data;
+} PidWaiter;
+
+typedef struct {
+	PidCache * cache; /* NULL once the cache is gone */
+	gchar * sender;
+	GArray * waiters;
+	gboolean vanished; /* Name went away while we were asking */
+} PidLookup;
+
+struct _PidCache {
+	GDBusConnection * bus;
+	GHashTable * watches; /* sender -> NameOwnerChanged subscription */
+	GHashTable * pids; /* sender -> PID */
+	GHashTable * lookups; /* sender -> PidLookup, in flight or waiting for the bus */
+	GCancellable * cancellable;
+};
+
+static void
+lookup_free (PidLookup * lookup)
+{
+	g_array_unref(lookup->waiters);
+	g_free(lookup->sender);
+	g_free(lookup);
+}
+
+/* Tell everyone that was waiting, the lookup is done with after this */
+static void
+lookup_finish (PidLookup * lookup, guint32 pid, const GError * error)
+{
+	guint i;
+	for (i = 0; i < lookup->waiters->len; i++) {
+		PidWaiter * waiter = &g_array_index(lookup->waiters, PidWaiter, i);
+		waiter->func(lookup->sender, pid, error, waiter->user_data);
+	}
+}
+
+static void name_owner_changed (GDBusConnection * bus, const gchar * sender_name, const gchar * object_path, const gchar * interface_name, const gchar * signal_name, GVariant * params, gpointer user_data);
+
+/* Hear about @sender leaving the bus, a match on arg0 so that it's
+   only that name */
+static void
+watch_name (PidCache * cache, const gchar * sender)
+{
+	if (g_hash_table_contains(cache->watches, sender)) {
+		return;
+	}
+
+	guint subscription = g_dbus_connection_signal_subscribe(cache->bus,
+		"org.freedesktop.DBus", /* sender */
+		"org.freedesktop.DBus", /* interface */
+		"NameOwnerChanged", /* signal */
+		"/org/freedesktop/DBus", /* path */
+		sender, /* arg0 */
+		G_DBUS_SIGNAL_FLAGS_NONE,
+		name_owner_changed,
+		cache,
+		NULL); /* user data free */
+
+	g_hash_table_insert(cache->watches, g_strdup(sender), GUINT_TO_POINTER(subscription));
+}
+
+static void
+unwatch_name (PidCache * cache, const gchar * sender)
+{
+	gpointer subscription = NULL;
+	if (g_hash_table_lookup_extended(cache->watches, sender, NULL, &subscription)) {
+		g_dbus_connection_signal_unsubscribe(cache->bus, GPOINTER_TO_UINT(subscription));
+		g_hash_table_remove(cache->watches, sender);
+	}
+}
+
+static void
+lookup_cb (GObject * obj, GAsyncResult * res, gpointer user_data)
+{
+	PidLookup * lookup = (PidLookup *)user_data;
+	GError * error = NULL;
+
+	GVariant * pid_tuple = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, &error);
+
+	/* The cache was freed and the waiters already told */
+	if (lookup->cache == NULL) {
+		g_clear_error(&error);
+		if (pid_tuple != NULL) {
+			g_variant_unref(pid_tuple);
+		}
+		lookup_free(lookup);
+		return;
+	}
+
+	PidCache * cache = lookup->cache;
+	g_hash_table_steal(cache->lookups, lookup->sender);
+
+	guint32 pid = 0;
+	if (error == NULL) {
+		g_variant_get(pid_tuple, "(u)", &pid);
+		g_variant_unref(pid_tuple);
+
+		if (!lookup->vanished) {
+			g_hash_table_insert(cache->pids, g_strdup(lookup->sender), GUINT_TO_POINTER(pid));
+		}
+	} else {
+		/* Nothing to forget */
+		unwatch_name(cache, lookup->sender);
+	}
+
+	lookup_finish(lookup, pid, error);
+
+	g_clear_error(&error);
+	lookup_free(lookup);
+}
+
+/* The watch goes out on the bus first, so the name can't leave
+   between the answer and us hearing about it */
+static void
+lookup_start (PidCache * cache, PidLookup * lookup)
+{
+	watch_name(cache, lookup->sender);
+
+	g_dbus_connection_call(cache->bus,
+		"org.freedesktop.DBus",
+		"/",
+		"org.freedesktop.DBus",
+		"GetConnectionUnixProcessID",
+		g_variant_new("(s)", lookup->sender),
+		G_VARIANT_TYPE("(u)"),
+		G_DBUS_CALL_FLAGS_NONE,
+		-1, /* timeout */
+		cache->cancellable,
+		lookup_cb,
+		lookup);
+}
+
+/* Forget names as soon as they leave the bus */
+static void
+name_owner_changed (GDBusConnection * bus, const gchar * sender_name, const gchar * object_path, const gchar * interface_name, const gchar * signal_name, GVariant * params, gpointer user_data)
+{
+	PidCache * cache = (PidCache *)user_data;
+	const gchar * name = NULL;
+	const gchar * newowner = NULL;
+
+	g_variant_get(params, "(&s&s&s)", &name, NULL, &newowner);
+
+	if (newowner[0] != '\0') {
+		return;
+	}
+
+	g_hash_table_remove(cache->pids, name);
+	unwatch_name(cache, name);
+
+	PidLookup * lookup = (PidLookup *)g_hash_table_lookup(cache->lookups, name);
+	if (lookup != NULL) {
+		lookup->vanished = TRUE;
+	}
+}
+
+PidCache *
+pid_cache_new ()
+{
+	PidCache * cache = g_new0(PidCache, 1);
+
+	cache->watches = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	cache->pids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	cache->lookups = g_hash_table_new(g_str_hash, g_str_equal);
+	cache->cancellable = g_cancellable_new();
+
+	return cache;
+}
+
+/* Anyone still waiting is told the lookup was cancelled */
+void
+pid_cache_free (PidCache * cache)
+{
+	g_return_if_fail(cache != NULL);
+
+	g_cancellable_cancel(cache->cancellable);
+
+	GError * error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CANCELLED, "PID cache shutting down");
+
+	GHashTableIter iter;
+	gpointer value = NULL;
+	g_hash_table_iter_init(&iter, cache->lookups);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		PidLookup * lookup = (PidLookup *)value;
+		g_hash_table_iter_steal(&iter);
+
+		lookup_finish(lookup, 0, error);
+		g_array_set_size(lookup->waiters, 0);
+
+		if (cache->bus != NULL) {
+			/* Freed when the call comes back */
+			lookup->cache = NULL;
+		} else {
+			lookup_free(lookup);
+		}
+	}
+
+	g_error_free(error);
+
+	if (cache->bus != NULL) {
+		g_hash_table_iter_init(&iter, cache->watches);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			g_dbus_connection_signal_unsubscribe(cache->bus, GPOINTER_TO_UINT(value));
+		}
+		g_object_unref(cache->bus);
+	}
+
+	g_hash_table_unref(cache->watches);
+	g_hash_table_unref(cache->lookups);
+	g_hash_table_unref(cache->pids);
+	g_object_unref(cache->cancellable);
+	g_free(cache);
+}
+
+/* The bus to ask, lookups waiting for it go out now */
+void
+pid_cache_set_connection (PidCache * cache, GDBusConnection * bus)
+{
+	g_return_if_fail(cache != NULL);
+	g_return_if_fail(G_IS_DBUS_CONNECTION(bus));
+	g_return_if_fail(cache->bus == NULL);
+
+	cache->bus = g_object_ref(bus);
+
+	GHashTableIter iter;
+	gpointer value = NULL;
+	g_hash_table_iter_init(&iter, cache->lookups);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		lookup_start(cache, (PidLookup *)value);
+	}
+}
+
+/* Calls @func with the PID of @sender, right away if we know it.
+   Otherwise it's called from the main loop once the bus answers. */
+void
+pid_cache_lookup (PidCache * cache, const gchar * sender, PidCacheFunc func, gpointer user_data)
+{
+	g_return_if_fail(cache != NULL);
+	g_return_if_fail(sender != NULL);
+	g_return_if_fail(func != NULL);
+
+	gpointer pid = NULL;
+	if (g_hash_table_lookup_extended(cache->pids, sender, NULL, &pid)) {
+		func(sender, GPOINTER_TO_UINT(pid), NULL, user_data);
+		return;
+	}
+
+	PidWaiter waiter = {
+		.func = func,
+		.user_data = user_data
+	};
+
+	PidLookup * lookup = (PidLookup *)g_hash_table_lookup(cache->lookups, sender);
+	if (lookup != NULL) {
+		g_array_append_val(lookup->waiters, waiter);
+		return;
+	}
+
+	lookup = g_new0(PidLookup, 1);
+	lookup->cache = cache;
+	lookup->sender = g_strdup(sender);
+	lookup->waiters = g_array_new(FALSE, FALSE, sizeof(PidWaiter));
+	g_array_append_val(lookup->waiters, waiter);
+
+	g_hash_table_insert(cache->lookups, lookup->sender, lookup);
+
+	if (cache->bus != NULL) {
+		lookup_start(cache, lookup);
+	}
+}
+
+/* Number of names we know the PID of */
+guint
+pid_cache_size (PidCache * cache)
+{
+	g_return_val_if_fail(cache != NULL, 0);
+
+	return g_hash_table_size(cache->pids);
+}
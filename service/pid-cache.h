@@ -0,0 +1,41 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PID_CACHE_H
+#define PID_CACHE_H 1
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PidCache PidCache;
+
+typedef void (*PidCacheFunc) (const gchar * sender, guint32 pid, const GError * error, gpointer user_data);
+
+PidCache *    pid_cache_new                         ();
+void          pid_cache_free                        (PidCache *     cache);
+void          pid_cache_set_connection              (PidCache *     cache,
+                                                     GDBusConnection * bus);
+void          pid_cache_lookup                      (PidCache *     cache,
+                                                     const gchar *  sender,
+                                                     PidCacheFunc   func,
+                                                     gpointer       user_data);
+guint         pid_cache_size                        (PidCache *     cache);
+
+G_END_DECLS
+
+#endif /* PID_CACHE_H */
@@ -0,0 +1,79 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PROBES_H
+#define PROBES_H 1
+
+/* Static tracepoints under the "url_dispatcher" provider, for perf,
+   bpftrace or SystemTap:
+
+     bpftrace -e 'usdt:./url-dispatcher:url_dispatcher:url_to_appid
+         { printf("%s %d ns\n", str(arg0), arg5); }'
+
+   With sys/sdt.h each probe is a nop until something attaches to it.
+   Each one also has a semaphore that the tracer counts up while it's
+   attached, so its arguments and start time are only worked out then.
+   The file with the probe defines the semaphore with PROBE_SEMAPHORE().
+   Without sys/sdt.h the probes and their arguments compile away. */
+
+#include <glib.h>
+#include <time.h>
+
+#ifdef HAVE_SYS_SDT_H
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+/* Nanoseconds, for working out how long something took */
+static inline gint64
+probe_now (void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (gint64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+#define PROBE_SEMAPHORE(name) unsigned short url_dispatcher_##name##_semaphore __attribute__((section(".probes"))) = 0
+#define PROBE_ENABLED(name) G_UNLIKELY(url_dispatcher_##name##_semaphore != 0)
+
+/* Start timing for @name, the duration is zero if it got attached to
+   in between */
+#define PROBE_START(name) (PROBE_ENABLED(name) ? probe_now() : 0)
+#define PROBE_SINCE(start) ((start) != 0 ? probe_now() - (start) : 0)
+
+#define PROBE2(name, a, b) do { if (PROBE_ENABLED(name)) { DTRACE_PROBE2(url_dispatcher, name, a, b); } } while (0)
+#define PROBE3(name, a, b, c) do { if (PROBE_ENABLED(name)) { DTRACE_PROBE3(url_dispatcher, name, a, b, c); } } while (0)
+#define PROBE4(name, a, b, c, d) do { if (PROBE_ENABLED(name)) { DTRACE_PROBE4(url_dispatcher, name, a, b, c, d); } } while (0)
+#define PROBE5(name, a, b, c, d, e) do { if (PROBE_ENABLED(name)) { DTRACE_PROBE5(url_dispatcher, name, a, b, c, d, e); } } while (0)
+#define PROBE6(name, a, b, c, d, e, f) do { if (PROBE_ENABLED(name)) { DTRACE_PROBE6(url_dispatcher, name, a, b, c, d, e, f); } } while (0)
+
+#else /* HAVE_SYS_SDT_H */
+
+/* Never run, but the arguments count as used */
+#define PROBE_SEMAPHORE(name) extern unsigned short url_dispatcher_##name##_semaphore
+#define PROBE_ENABLED(name) FALSE
+#define PROBE_START(name) 0
+#define PROBE_SINCE(start) ((void)(start), 0)
+#define PROBE2(name, a, b) do { if (0) { (void)(a); (void)(b); } } while (0)
+#define PROBE3(name, a, b, c) do { if (0) { (void)(a); (void)(b); (void)(c); } } while (0)
+#define PROBE4(name, a, b, c, d) do { if (0) { (void)(a); (void)(b); (void)(c); (void)(d); } } while (0)
+#define PROBE5(name, a, b, c, d, e) do { if (0) { (void)(a); (void)(b); (void)(c); (void)(d); (void)(e); } } while (0)
+#define PROBE6(name, a, b, c, d, e, f) do { if (0) { (void)(a); (void)(b); (void)(c); (void)(d); (void)(e); (void)(f); } } while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* PROBES_H */
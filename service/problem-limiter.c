@@ -0,0 +1,132 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Decides which problem reports actually get filed. Each report forks
+   a process, so a client sending us garbage gets one report per
+   signature every @interval and the rest are only counted. The count
+   goes along with the next report that is filed. Main thread only. */
+
+#include "problem-limiter.h"
+
+typedef struct {
+	gint64 reported; /* When the last report was let through */
+	guint suppressed; /* Since then */
+} ProblemEntry;
+
+struct _ProblemLimiter {
+	gint64 interval;
+	GHashTable * entries; /* "sender signature" -> ProblemEntry */
+	gint64 pruned;
+	ProblemLimiterStats stats;
+};
+
+/* At most one report per sender and signature every @interval
+   microseconds */
+ProblemLimiter *
+problem_limiter_new (gint64 interval)
+{
+	g_return_val_if_fail(interval >= 0, NULL);
+
+	ProblemLimiter * limiter = g_new0(ProblemLimiter, 1);
+
+	limiter->interval = interval;
+	limiter->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+	return limiter;
+}
+
+void
+problem_limiter_free (ProblemLimiter * limiter)
+{
+	g_return_if_fail(limiter != NULL);
+
+	g_hash_table_destroy(limiter->entries);
+	g_free(limiter);
+}
+
+static gboolean
+entry_expired (gpointer key, gpointer value, gpointer user_data)
+{
+	ProblemEntry * entry = (ProblemEntry *)value;
+	gint64 before = *(gint64 *)user_data;
+
+	return entry->reported <= before;
+}
+
+/* Senders come and go, so forget the ones that have been quiet for an
+   interval. Anything they had suppressed was counted already. */
+static void
+prune (ProblemLimiter * limiter, gint64 now)
+{
+	if (now - limiter->pruned < limiter->interval) {
+		return;
+	}
+
+	gint64 before = now - limiter->interval;
+	g_hash_table_foreach_remove(limiter->entries, entry_expired, &before);
+	limiter->pruned = now;
+}
+
+/* Whether a report for @signature from @sender should be filed at time
+   @now, in microseconds. When it should, @suppressed is set to how many
+   were held back since the last one. */
+gboolean
+problem_limiter_check (ProblemLimiter * limiter, const gchar * sender, const gchar * signature, gint64 now, guint * suppressed)
+{
+	g_return_val_if_fail(limiter != NULL, FALSE);
+	g_return_val_if_fail(signature != NULL, FALSE);
+
+	prune(limiter, now);
+
+	gchar * key = g_strconcat(sender != NULL ? sender : "", " ", signature, NULL);
+	ProblemEntry * entry = (ProblemEntry *)g_hash_table_lookup(limiter->entries, key);
+
+	if (entry != NULL && now - entry->reported < limiter->interval) {
+		entry->suppressed++;
+		limiter->stats.suppressed++;
+		g_free(key);
+		return FALSE;
+	}
+
+	if (entry == NULL) {
+		entry = g_new0(ProblemEntry, 1);
+		g_hash_table_insert(limiter->entries, key, entry);
+	} else {
+		g_free(key);
+	}
+
+	if (suppressed != NULL) {
+		*suppressed = entry->suppressed;
+	}
+
+	entry->reported = now;
+	entry->suppressed = 0;
+	limiter->stats.reported++;
+
+	return TRUE;
+}
+
+/* How many reports were filed and held back */
+void
+problem_limiter_get_stats (ProblemLimiter * limiter, ProblemLimiterStats * stats)
+{
+	g_return_if_fail(limiter != NULL);
+	g_return_if_fail(stats != NULL);
+
+	*stats = limiter->stats;
+	stats->keys = g_hash_table_size(limiter->entries);
+}
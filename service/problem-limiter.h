@@ -0,0 +1,45 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PROBLEM_LIMITER_H
+#define PROBLEM_LIMITER_H 1
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _ProblemLimiter ProblemLimiter;
+
+typedef struct {
+	guint64 reported;
+	guint64 suppressed;
+	guint keys; /* Senders and signatures being tracked */
+} ProblemLimiterStats;
+
+ProblemLimiter * problem_limiter_new                (gint64         interval);
+void          problem_limiter_free                  (ProblemLimiter * limiter);
+gboolean      problem_limiter_check                 (ProblemLimiter * limiter,
+                                                     const gchar *  sender,
+                                                     const gchar *  signature,
+                                                     gint64         now,
+                                                     guint *        suppressed);
+void          problem_limiter_get_stats             (ProblemLimiter * limiter,
+                                                     ProblemLimiterStats * stats);
+
+G_END_DECLS
+
+#endif /* PROBLEM_LIMITER_H */
@@ -21,7 +21,11 @@
 #include <glib-unix.h>
 #include "dispatcher.h"
 
+#define MAX_IDLE_TIMEOUT 86400 /* s */
+
 GMainLoop * mainloop = NULL;
+static OverlayTracker * tracker = NULL;
+static guint idletimeout = 0; /* s, zero to keep running */
 
 static gboolean
 sig_term (gpointer user_data)
@@ -31,6 +35,87 @@ sig_term (gpointer user_data)
 	return G_SOURCE_CONTINUE;
 }
 
+/* Reads how long to wait with nothing to do before exiting, when
+   started on demand over D-Bus we don't need to stay around */
+static guint
+get_idle_timeout (void)
+{
+	const gchar * envtimeout = g_getenv("URL_DISPATCHER_IDLE_TIMEOUT");
+	if (G_LIKELY(envtimeout == NULL)) {
+		return 0;
+	}
+
+	gchar * end = NULL;
+	guint64 timeout = g_ascii_strtoull(envtimeout, &end, 10);
+	if (end == envtimeout || *end != '\0' || timeout > MAX_IDLE_TIMEOUT) {
+		g_warning("Invalid value '%s' for URL_DISPATCHER_IDLE_TIMEOUT, not exiting when idle", envtimeout);
+		return 0;
+	}
+
+	return (guint)timeout;
+}
+
+/* When we last had something to do, zero if we still do. The overlays
+   go away with us, so they count too. */
+static gint64
+idle_since (void)
+{
+	gint64 since = dispatcher_idle_since();
+
+	if (since != 0 && tracker != NULL && overlay_tracker_count(tracker) > 0) {
+		since = 0;
+	}
+
+	return since;
+}
+
+static gboolean idle_check (gpointer user_data);
+
+/* Runs after the name is released, at a lower priority than the calls
+   the bus sent us before letting go of it, so they've all been started
+   by now. With nothing to do we exit right away, so activation isn't
+   left waiting on a job that's still running. Otherwise we take the
+   name back and finish what came in. */
+static gboolean
+release_check (gpointer user_data)
+{
+	if (idle_since() != 0) {
+		g_debug("Idle for %u seconds, exiting", idletimeout);
+		g_main_loop_quit(mainloop);
+		return G_SOURCE_REMOVE;
+	}
+
+	g_debug("Busy after releasing the name, taking it back");
+	dispatcher_own_name(mainloop);
+	g_timeout_add_seconds(idletimeout, idle_check, NULL);
+	return G_SOURCE_REMOVE;
+}
+
+/* Checks whether we've had nothing to do for long enough. Rather than
+   waking up all the time it sleeps until the soonest we could exit. */
+static gboolean
+idle_check (gpointer user_data)
+{
+	gint64 since = idle_since();
+	guint wait = idletimeout;
+
+	if (since != 0) {
+		gint64 idle = (g_get_monotonic_time() - since) / G_USEC_PER_SEC;
+
+		if (idle >= idletimeout) {
+			/* New callers start a new instance */
+			dispatcher_release_name();
+			g_idle_add_full(G_PRIORITY_LOW, release_check, NULL, NULL);
+			return G_SOURCE_REMOVE;
+		}
+
+		wait = idletimeout - idle;
+	}
+
+	g_timeout_add_seconds(wait, idle_check, NULL);
+	return G_SOURCE_REMOVE;
+}
+
 /* Where it all begins */
 int
 main (int argc, char * argv[])
@@ -39,19 +124,24 @@ main (int argc, char * argv[])
 
 	guint term_source = g_unix_signal_add(SIGTERM, sig_term, mainloop);
 
-	OverlayTracker * tracker = overlay_tracker_new();
+	tracker = overlay_tracker_new();
 	if (!dispatcher_init(mainloop, tracker)) {
 		return -1;
 	}
 
+	idletimeout = get_idle_timeout();
+	if (idletimeout > 0) {
+		g_timeout_add_seconds(idletimeout, idle_check, NULL);
+	}
+
 	/* Run Main */
 	g_main_loop_run(mainloop);
 
 	/* Clean up globals */
-	dispatcher_shutdown();
+	int status = dispatcher_shutdown() ? 0 : -1;
 	overlay_tracker_delete(tracker);
 	g_source_remove(term_source);
 	g_main_loop_unref(mainloop);
 
-	return 0;
+	return status;
 }
@@ -17,23 +17,85 @@
  *
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <json-glib/json-glib.h>
 #include "url-db.h"
+#include "url-index.h"
+#include "probes.h"
 #include "recoverable-problem.h"
 
+/* Files committed together, a directory full of them doesn't hold
+   the write lock for the whole pass */
+#define BATCH_SIZE 1000
+#define MAX_THREADS 64
+
+#define FNV_OFFSET_BASIS G_GUINT64_CONSTANT(14695981039346656037)
+#define FNV_PRIME G_GUINT64_CONSTANT(1099511628211)
+
+/* Tracepoints, see probes.h */
+PROBE_SEMAPHORE(update_file);
+
+/* One of the URLs in a file */
 typedef struct {
-	const gchar * filename;
-	sqlite3 * db;
-} urldata_t;
+	gchar * protocol;
+	gchar * suffix;
+} UrlEntry;
+
+/* A file that is out of date, the parsing threads fill in its URLs
+   and the main thread writes them to the database */
+typedef struct {
+	gchar * filename;
+	UrlDbFileStamp stamp;
+	gboolean known; /* Already in the database */
+	guint64 dbhash; /* What the database has, 0 if nothing */
+	gboolean unchanged; /* Only touched, the URLs in the database stay */
+	guint index; /* Where it is in the directory */
+	GPtrArray * urls; /* Empty if it didn't parse */
+} UrlFile;
+
+static void
+url_entry_free (gpointer data)
+{
+	UrlEntry * entry = (UrlEntry *)data;
+
+	g_free(entry->protocol);
+	g_free(entry->suffix);
+	g_free(entry);
+}
+
+static UrlFile *
+url_file_new (const gchar * filename, const UrlDbFileStamp * stamp, gboolean known, guint64 dbhash, guint index)
+{
+	UrlFile * file = g_new0(UrlFile, 1);
+	file->filename = g_strdup(filename);
+	file->stamp = *stamp;
+	file->known = known;
+	file->dbhash = dbhash;
+	file->index = index;
+	file->urls = g_ptr_array_new_with_free_func(url_entry_free);
+	return file;
+}
+
+static void
+url_file_free (UrlFile * file)
+{
+	g_ptr_array_free(file->urls, TRUE);
+	g_free(file->filename);
+	g_free(file);
+}
 
 static void
 each_url (JsonArray * array, guint index, JsonNode * value, gpointer user_data)
 {
-	urldata_t * urldata = (urldata_t *)user_data;
+	UrlFile * file = (UrlFile *)user_data;
 
 	if (!JSON_NODE_HOLDS_OBJECT(value)) {
-		g_warning("File %s: Array entry %d not an object", urldata->filename, index);
+		g_warning("File %s: Array entry %d not an object", file->filename, index);
 		return;
 	}
 
@@ -51,7 +113,7 @@ each_url (JsonArray * array, guint index, JsonNode * value, gpointer user_data)
 	}
 
 	if (protocol == NULL) {
-		g_warning("File %s: Array entry %d doesn't contain a 'protocol'", urldata->filename, index);
+		g_warning("File %s: Array entry %d doesn't contain a 'protocol'", file->filename, index);
 		return;
 	}
 
@@ -60,40 +122,73 @@ each_url (JsonArray * array, guint index, JsonNode * value, gpointer user_data)
 		   there because otherwise things will get crazy as we're handling
 		   it by package lookup in the service. */
 		if (suffix == NULL) {
-			g_warning("File %s: Array entry %d is an 'intent' protocol but doesn't have a package name", urldata->filename, index);
+			g_warning("File %s: Array entry %d is an 'intent' protocol but doesn't have a package name", file->filename, index);
 			return;
 		}
 	}
 
-	if (!url_db_insert_url(urldata->db, urldata->filename, protocol, suffix)) {
-		const gchar * additional[7] = {
-			"Filename",
-			NULL,
-			"Protocol",
-			NULL,
-			"Suffix",
-			NULL,
-			NULL
-		};
-		additional[1] = urldata->filename;
-		additional[3] = protocol;
-		additional[5] = suffix;
+	UrlEntry * entry = g_new0(UrlEntry, 1);
+	entry->protocol = g_strdup(protocol);
+	entry->suffix = g_strdup(suffix);
+	g_ptr_array_add(file->urls, entry);
+}
 
-		report_recoverable_problem("url-dispatcher-update-sqlite-insert-error", 0, TRUE, additional);
+/* FNV-1a, the files are a few hundred bytes so there's nothing to
+   gain from anything fancier. Never 0, that's an unknown hash. */
+static guint64
+hash_contents (const gchar * contents, gsize length)
+{
+	guint64 hash = FNV_OFFSET_BASIS;
+	gsize i;
+
+	for (i = 0; i < length; i++) {
+		hash ^= (guchar)contents[i];
+		hash *= FNV_PRIME;
 	}
+
+	return hash != 0 ? hash : 1;
 }
 
+/* Runs on the parsing threads, hands @data back on the queue in
+   @user_data when it's done */
 static void
-insert_urls_from_file (const gchar * filename, sqlite3 * db)
+parse_urls_from_file (gpointer data, gpointer user_data)
 {
+	UrlFile * file = (UrlFile *)data;
+	GAsyncQueue * parsed = (GAsyncQueue *)user_data;
+	const gchar * filename = file->filename;
+
 	GError * error = NULL;
+	gchar * contents = NULL;
+	gsize length = 0;
+	g_file_get_contents(filename, &contents, &length, &error);
+
+	if (error != NULL) {
+		g_warning("Unable to read '%s': %s", filename, error->message);
+		g_error_free(error);
+		g_async_queue_push(parsed, file);
+		return;
+	}
+
+	/* Upgrades and restores touch files without changing them */
+	file->stamp.hash = hash_contents(contents, length);
+	if (file->stamp.hash == file->dbhash) {
+		g_debug("\tunchanged: %s", filename);
+		file->unchanged = TRUE;
+		g_free(contents);
+		g_async_queue_push(parsed, file);
+		return;
+	}
+
 	JsonParser * parser = json_parser_new();
-	json_parser_load_from_file(parser, filename, &error);
+	json_parser_load_from_data(parser, contents, length, &error);
+	g_free(contents);
 
 	if (error != NULL) {
 		g_warning("Unable to parse JSON in '%s': %s", filename, error->message);
 		g_object_unref(parser);
 		g_error_free(error);
+		g_async_queue_push(parsed, file);
 		return;
 	}
 
@@ -101,55 +196,93 @@ insert_urls_from_file (const gchar * filename, sqlite3 * db)
 	if (!JSON_NODE_HOLDS_ARRAY(rootnode)) {
 		g_warning("File '%s' does not have an array as its root node", filename);
 		g_object_unref(parser);
+		g_async_queue_push(parsed, file);
 		return;
 	}
 
 	JsonArray * rootarray = json_node_get_array(rootnode);
+	json_array_foreach_element(rootarray, each_url, file);
 
-	urldata_t urldata = {
-		.filename = filename,
-		.db = db
-	};
+	g_object_unref(parser);
+	g_async_queue_push(parsed, file);
+}
 
-	json_array_foreach_element(rootarray, each_url, &urldata);
+/* Puts the URLs of @file in the database in place of the ones it had.
+   One that didn't parse still gets its stamp, so it isn't tried again
+   until it changes. One that didn't change only gets its stamp. */
+static void
+write_file (UrlFile * file, UrlDb * db)
+{
+	gint64 start = PROBE_START(update_file);
 
-	g_object_unref(parser);
+	if (!url_db_set_file_stamp(db, file->filename, &file->stamp) || (file->known && !file->unchanged && !url_db_remove_file_urls(db, file->filename))) {
+		const gchar * additional[7] = {
+			"Filename",
+			NULL,
+			NULL
+		};
+		additional[1] = file->filename;
+
+		report_recoverable_problem("url-dispatcher-update-sqlite-fileupdate-error", 0, TRUE, additional);
+		return;
+	}
+
+	guint i;
+	for (i = 0; i < file->urls->len; i++) {
+		UrlEntry * entry = (UrlEntry *)g_ptr_array_index(file->urls, i);
+
+		if (!url_db_insert_url(db, file->filename, entry->protocol, entry->suffix)) {
+			const gchar * additional[7] = {
+				"Filename",
+				NULL,
+				"Protocol",
+				NULL,
+				"Suffix",
+				NULL,
+				NULL
+			};
+			additional[1] = file->filename;
+			additional[3] = entry->protocol;
+			additional[5] = entry->suffix;
+
+			report_recoverable_problem("url-dispatcher-update-sqlite-insert-error", 0, TRUE, additional);
+		}
+	}
+
+	PROBE3(update_file, file->filename, !file->unchanged, PROBE_SINCE(start));
 }
 
+/* Whether @name in @dirfd changed since it was put in the database,
+   if it did @stamp is what it looks like now, @known whether the
+   database has it and @dbhash what its contents were. Anything
+   different is a change, times within the same second and times
+   going backwards included. */
 static gboolean
-check_file_outofdate (const gchar * filename, sqlite3 * db)
+check_file_outofdate (int dirfd, const gchar * name, const gchar * filename, UrlDb * db, UrlDbFileStamp * stamp, gboolean * known, guint64 * dbhash)
 {
 	g_debug("Processing file: %s", filename);
 
-	GTimeVal dbtime = {0};
-	GTimeVal filetime = {0};
-
-	GFile * file = g_file_new_for_path(filename);
-	g_return_val_if_fail(file != NULL, FALSE);
-
-	GFileInfo * info = g_file_query_info(file, G_FILE_ATTRIBUTE_TIME_MODIFIED, G_FILE_QUERY_INFO_NONE, NULL, NULL);
-	g_file_info_get_modification_time(info, &filetime);
+	struct stat info;
+	if (fstatat(dirfd, name, &info, 0) != 0) {
+		g_warning("Unable to stat '%s': %s", filename, g_strerror(errno));
+		return FALSE;
+	}
 
-	g_object_unref(info);
-	g_object_unref(file);
+	stamp->mtime = (gint64)info.st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) + info.st_mtim.tv_nsec;
+	stamp->size = info.st_size;
+	stamp->inode = info.st_ino;
+	stamp->hash = 0;
+	*dbhash = 0;
 
-	if (url_db_get_file_motification_time(db, filename, &dbtime)) {
-		if (filetime.tv_sec <= dbtime.tv_sec) {
+	UrlDbFileStamp dbstamp;
+	*known = url_db_get_file_stamp(db, filename, &dbstamp);
+	if (*known) {
+		if (dbstamp.mtime == stamp->mtime && dbstamp.size == stamp->size && dbstamp.inode == stamp->inode) {
 			g_debug("\tup-to-date: %s", filename);
 			return FALSE;
 		}
-	}
-
-	if (!url_db_set_file_motification_time(db, filename, &filetime)) {
-		const gchar * additional[7] = {
-			"Filename",
-			NULL,
-			NULL
-		};
-		additional[1] = filename;
 
-		report_recoverable_problem("url-dispatcher-update-sqlite-fileupdate-error", 0, TRUE, additional);
-		return FALSE;
+		*dbhash = dbstamp.hash;
 	}
 
 	return TRUE;
@@ -161,7 +294,7 @@ remove_file (gpointer key, gpointer value, gpointer user_data)
 {
 	const gchar * filename = (const gchar *)key;
 	g_debug("  Removing file: %s", filename);
-	if (!url_db_remove_file((sqlite3*)user_data, filename)) {
+	if (!url_db_remove_file((UrlDb *)user_data, filename)) {
 		g_warning("Unable to remove file: %s", filename);
 		const gchar * additional[3] = {
 			"Filename",
@@ -174,33 +307,119 @@ remove_file (gpointer key, gpointer value, gpointer user_data)
 	}
 }
 
-/* In the beginning, there was main, and that was good */
-int
-main (int argc, char * argv[])
+/* Writes the files coming back from the parsing threads in directory
+   order, so which of a file's URLs wins doesn't depend on which thread
+   was quickest. A transaction is only started when there's something
+   to write, so the write lock isn't held while files are being looked
+   at and parsed. */
+typedef struct {
+	UrlDb * db;
+	GPtrArray * files; /* Came back ahead of their turn, by index */
+	guint next;        /* Index of the next file to write */
+	guint batchcount;  /* Files written in the open transaction */
+	gboolean begun;    /* Whether there's an open transaction */
+	gboolean batched;  /* FALSE once a batch couldn't be committed */
+} FileWriter;
+
+static void
+file_writer_init (FileWriter * writer, UrlDb * db)
 {
-	if (argc != 2) {
-		g_printerr("Usage: %s <directory>\n", argv[0]);
-		return 1;
+	writer->db = db;
+	writer->files = g_ptr_array_new();
+	writer->next = 0;
+	writer->batchcount = 0;
+	writer->begun = FALSE;
+	writer->batched = TRUE;
+}
+
+/* Makes sure there's a transaction for the next change */
+static gboolean
+file_writer_begin (FileWriter * writer)
+{
+	if (writer->batched && !writer->begun) {
+		writer->batched = url_db_begin(writer->db);
+		writer->begun = writer->batched;
 	}
 
-	sqlite3 * db = url_db_create_database();
-	g_return_val_if_fail(db != NULL, -1);
+	return writer->batched;
+}
 
-	/* Check out what we got and recover */
-	gchar * dirname = g_strdup(argv[1]);
-	if (!g_file_test(dirname, G_FILE_TEST_IS_DIR) && !g_str_has_suffix(dirname, "/")) {
-		gchar * upone = g_path_get_dirname(dirname);
-		/* Upstart will give us filenames a bit, let's handle them */
-		if (g_file_test(upone, G_FILE_TEST_IS_DIR)) {
-			g_free(dirname);
-			dirname = upone;
-		} else {
-			/* If the dirname function doesn't help, stick with what
-			   we were given, the whole thing coulda been deleted */
-			g_free(upone);
+/* Takes @file from the parsing threads, and writes it along with any
+   that were waiting on it. Once a batch can't be committed the rest
+   are dropped. */
+static void
+file_writer_take (FileWriter * writer, UrlFile * file)
+{
+	if (file->index >= writer->files->len) {
+		g_ptr_array_set_size(writer->files, file->index + 1);
+	}
+	g_ptr_array_index(writer->files, file->index) = file;
+
+	while (writer->next < writer->files->len && g_ptr_array_index(writer->files, writer->next) != NULL) {
+		UrlFile * ready = (UrlFile *)g_ptr_array_index(writer->files, writer->next);
+		g_ptr_array_index(writer->files, writer->next) = NULL;
+		writer->next++;
+
+		if (file_writer_begin(writer)) {
+			write_file(ready, writer->db);
+
+			if (++writer->batchcount == BATCH_SIZE) {
+				writer->batched = url_db_commit(writer->db);
+				writer->begun = FALSE;
+				writer->batchcount = 0;
+			}
 		}
+
+		url_file_free(ready);
+	}
+}
+
+/* Commits what's left, FALSE if anything couldn't be. A failed batch
+   is rolled back. */
+static gboolean
+file_writer_finish (FileWriter * writer)
+{
+	if (writer->begun) {
+		writer->batched = url_db_commit(writer->db) && writer->batched;
+		writer->begun = FALSE;
+	}
+
+	if (!writer->batched) {
+		url_db_rollback(writer->db);
+	}
+
+	g_ptr_array_free(writer->files, TRUE);
+	writer->files = NULL;
+
+	return writer->batched;
+}
+
+/* Parsing threads, one for each core unless the environment says
+   otherwise */
+static gint
+get_thread_count (void)
+{
+	const gchar * envthreads = g_getenv("URL_DISPATCHER_UPDATE_THREADS");
+	if (G_LIKELY(envthreads == NULL)) {
+		return g_get_num_processors();
+	}
+
+	gchar * end = NULL;
+	guint64 threads = g_ascii_strtoull(envthreads, &end, 10);
+	if (end == envthreads || *end != '\0' || threads == 0 || threads > MAX_THREADS) {
+		g_warning("Invalid value '%s' for URL_DISPATCHER_UPDATE_THREADS, using one per core", envthreads);
+		return g_get_num_processors();
 	}
 
+	return (gint)threads;
+}
+
+/* Brings what the database has for @dirname up to date, adding and
+   updating its files and removing the ones that are gone. If it can't,
+   what it had done is rolled back and it returns FALSE. */
+static gboolean
+update_directory (UrlDb * db, const gchar * dirname)
+{
 	/* Get the current files in the directory in the DB so we
 	   know if any got dropped */
 	GHashTable * startingdb = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
@@ -211,35 +430,128 @@ main (int argc, char * argv[])
 	}
 	g_list_free(files);
 
+	/* All the changes go in as batches of files, one commit each */
+	FileWriter writer;
+	file_writer_init(&writer, db);
+	gboolean batched = TRUE;
+
+	/* Files are parsed on threads while we go through the directory,
+	   this thread is the only one that touches the database. It
+	   writes the ones that are done as it goes. */
+	GAsyncQueue * parsed = g_async_queue_new();
+	GThreadPool * parsers = g_thread_pool_new(parse_urls_from_file, parsed, get_thread_count(), FALSE, NULL);
+	guint queued = 0;
+	guint written = 0;
 
 	/* Open the directory on the file system and start going
 	   through it */
 	if (g_file_test(dirname, G_FILE_TEST_IS_DIR)) {
-		GDir * dir = g_dir_open(dirname, 0, NULL);
-		g_return_val_if_fail(dir != NULL, -1);
+		/* Without them none of the files would be seen, so don't
+		   remove any either. The files are looked at relative to the
+		   descriptor, not by path. */
+		GError * error = NULL;
+		GDir * dir = g_dir_open(dirname, 0, &error);
+		if (error != NULL) {
+			g_warning("Unable to open directory '%s': %s", dirname, error->message);
+			g_error_free(error);
+			batched = FALSE;
+		}
+
+		int dirfd = dir != NULL ? open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+		if (dir != NULL && dirfd < 0) {
+			g_warning("Unable to open directory '%s': %s", dirname, g_strerror(errno));
+			batched = FALSE;
+		}
 
 		const gchar * name = NULL;
-		while ((name = g_dir_read_name(dir)) != NULL) {
+		while (batched && (name = g_dir_read_name(dir)) != NULL) {
 			if (g_str_has_suffix(name, ".url-dispatcher")) {
 				gchar * fullname = g_build_filename(dirname, name, NULL);
-
-				if (check_file_outofdate(fullname, db)) {
-					insert_urls_from_file(fullname, db);
+				gint64 start = PROBE_START(update_file);
+				UrlDbFileStamp stamp;
+				gboolean known;
+				guint64 dbhash;
+
+				if (check_file_outofdate(dirfd, name, fullname, db, &stamp, &known, &dbhash)) {
+					GError * error = NULL;
+					g_thread_pool_push(parsers, url_file_new(fullname, &stamp, known, dbhash, queued++), &error);
+
+					if (error != NULL) {
+						/* It's still queued, just waiting on the threads we have */
+						g_warning("Unable to start parsing thread: %s", error->message);
+						g_error_free(error);
+					}
+				} else {
+					PROBE3(update_file, fullname, FALSE, PROBE_SINCE(start));
 				}
 
 				g_hash_table_remove(startingdb, fullname);
 				g_free(fullname);
+
+				UrlFile * file = NULL;
+				while ((file = (UrlFile *)g_async_queue_try_pop(parsed)) != NULL) {
+					file_writer_take(&writer, file);
+					written++;
+				}
 			}
 		}
 
-		g_dir_close(dir);
+		if (dirfd >= 0) {
+			close(dirfd);
+		}
+		if (dir != NULL) {
+			g_dir_close(dir);
+		}
 	}
 
+	/* The rest of them, as the threads finish */
+	for (; written < queued; written++) {
+		file_writer_take(&writer, (UrlFile *)g_async_queue_pop(parsed));
+	}
+
+	g_thread_pool_free(parsers, FALSE, TRUE);
+	g_async_queue_unref(parsed);
+
 	/* Remove deleted files */
-	g_hash_table_foreach(startingdb, remove_file, db);
+	if (batched && g_hash_table_size(startingdb) > 0 && file_writer_begin(&writer)) {
+		g_hash_table_foreach(startingdb, remove_file, db);
+	}
 	g_hash_table_destroy(startingdb);
 
-	int close_status = sqlite3_close(db);
+	/* Leave the files in the failed batch to be tried again next time */
+	batched = file_writer_finish(&writer) && batched;
+	if (!batched) {
+		const gchar * additional[3] = {
+			"Directory",
+			NULL,
+			NULL
+		};
+		additional[1] = dirname;
+
+		report_recoverable_problem("url-dispatcher-update-transaction-error", 0, TRUE, additional);
+	}
+
+	return batched;
+}
+
+/* So the service can map it instead of reading all of the URLs */
+static void
+update_index (UrlDb * db)
+{
+	gchar * indexname = url_db_index_filename();
+	if (!url_index_update(db, indexname)) {
+		/* The dispatcher keeps using an index until it's replaced, so
+		   don't leave an old one behind for it */
+		g_warning("Unable to update the URL index: %s", indexname);
+		g_unlink(indexname);
+	}
+	g_free(indexname);
+}
+
+static void
+close_database (UrlDb * db)
+{
+	int close_status = url_db_close(db);
 	if (close_status != SQLITE_OK) {
 		const gchar * additional[3] = {
 			"SQLiteStatus",
@@ -252,9 +564,123 @@ main (int argc, char * argv[])
 		report_recoverable_problem("url-dispatcher-sqlite-close-error", 0, TRUE, additional);
 		g_free(status);
 	}
+}
 
-	g_debug("Directory '%s' is up-to-date", dirname);
+static void
+add_directory (GPtrArray * dirnames, const gchar * dirname)
+{
+	guint i;
+	for (i = 0; i < dirnames->len; i++) {
+		if (g_strcmp0(g_ptr_array_index(dirnames, i), dirname) == 0) {
+			return;
+		}
+	}
+
+	g_ptr_array_add(dirnames, g_strdup(dirname));
+}
+
+/* Indexes @dirs, and every directory the database already has files
+   from, into a new database that then replaces it. Nothing reading it
+   sees the database partly built. */
+static gboolean
+rebuild (gchar ** dirs, int count)
+{
+	gint64 start = g_get_monotonic_time();
+	GPtrArray * dirnames = g_ptr_array_new_with_free_func(g_free);
+	int i;
+
+	for (i = 0; i < count; i++) {
+		add_directory(dirnames, dirs[i]);
+	}
+
+	/* It may well be broken, that's why we're here */
+	UrlDb * olddb = url_db_create_database();
+	if (olddb != NULL) {
+		GList * files = url_db_files_for_dir(olddb, NULL);
+		GList * cur;
+		for (cur = files; cur != NULL; cur = g_list_next(cur)) {
+			gchar * dirname = g_path_get_dirname((const gchar *)cur->data);
+			add_directory(dirnames, dirname);
+			g_free(dirname);
+		}
+		g_list_free_full(files, g_free);
+		url_db_close(olddb);
+	}
+
+	UrlDb * db = url_db_create_shadow_database();
+	if (db == NULL) {
+		g_warning("Unable to create a database to rebuild into");
+		g_ptr_array_free(dirnames, TRUE);
+		return FALSE;
+	}
+
+	guint j;
+	for (j = 0; j < dirnames->len; j++) {
+		if (!update_directory(db, g_ptr_array_index(dirnames, j))) {
+			url_db_discard_shadow_database(db);
+			g_ptr_array_free(dirnames, TRUE);
+			return FALSE;
+		}
+	}
+
+	if (!url_db_replace_database(db)) {
+		g_ptr_array_free(dirnames, TRUE);
+		return FALSE;
+	}
+
+	db = url_db_create_database();
+	if (db != NULL) {
+		update_index(db);
+		close_database(db);
+	}
+
+	g_debug("Rebuilt the URL database from %u directories in %" G_GINT64_FORMAT " us", dirnames->len, g_get_monotonic_time() - start);
+	g_ptr_array_free(dirnames, TRUE);
+
+	return TRUE;
+}
+
+/* In the beginning, there was main, and that was good */
+int
+main (int argc, char * argv[])
+{
+	if (argc >= 2 && g_strcmp0(argv[1], "--rebuild") == 0) {
+		return rebuild(argv + 2, argc - 2) ? 0 : -1;
+	}
+
+	if (argc != 2) {
+		g_printerr("Usage: %s <directory>\n", argv[0]);
+		g_printerr("       %s --rebuild [directory...]\n", argv[0]);
+		return 1;
+	}
+
+	UrlDb * db = url_db_create_database();
+	g_return_val_if_fail(db != NULL, -1);
+
+	/* Check out what we got and recover */
+	gchar * dirname = g_strdup(argv[1]);
+	if (!g_file_test(dirname, G_FILE_TEST_IS_DIR) && !g_str_has_suffix(dirname, "/")) {
+		gchar * upone = g_path_get_dirname(dirname);
+		/* Upstart will give us filenames a bit, let's handle them */
+		if (g_file_test(upone, G_FILE_TEST_IS_DIR)) {
+			g_free(dirname);
+			dirname = upone;
+		} else {
+			/* If the dirname function doesn't help, stick with what
+			   we were given, the whole thing coulda been deleted */
+			g_free(upone);
+		}
+	}
+
+	gboolean updated = update_directory(db, dirname);
+
+	update_index(db);
+	close_database(db);
+
+	if (updated) {
+		g_debug("Directory '%s' is up-to-date", dirname);
+	}
 	g_free(dirname);
 
-	return 0;
+	return updated ? 0 : -1;
 }
@@ -0,0 +1,214 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* A fixed size cache of which AppID handles a protocol and domain,
+   dropping the least recently used entry when it's full. A NULL AppID
+   is cached as well so that URLs nobody handles are cheap to turn
+   down. Domains are compared ignoring ASCII case, like the trie. */
+
+#include "url-cache.h"
+
+/* Longest domain name DNS allows, longer ones aren't real hosts and
+   would only push the real entries out */
+#define MAX_DOMAIN_LENGTH 253
+
+typedef struct {
+	GList link; /* In the LRU queue, data points back to us */
+	gchar * key;
+	gchar * appid;
+} UrlCacheEntry;
+
+struct _UrlCache {
+	guint size;
+	GHashTable * entries; /* Keys are owned by the entries */
+	GQueue lru; /* Most recently used at the head */
+	GString * scratch; /* Reused to build keys for lookups */
+	guint64 hits;
+	guint64 misses;
+};
+
+static void
+entry_free (UrlCacheEntry * entry)
+{
+	g_free(entry->key);
+	g_free(entry->appid);
+	g_free(entry);
+}
+
+/* Protocols can't have a ':' in them so "protocol:domain" is unique */
+static const gchar *
+build_key (UrlCache * cache, const gchar * protocol, gsize protocollen, const gchar * domain, gsize domainlen)
+{
+	gsize i;
+
+	g_string_truncate(cache->scratch, 0);
+	g_string_append_len(cache->scratch, protocol, protocollen);
+	g_string_append_c(cache->scratch, ':');
+	for (i = 0; i < domainlen; i++) {
+		g_string_append_c(cache->scratch, g_ascii_tolower(domain[i]));
+	}
+
+	return cache->scratch->str;
+}
+
+/* A @size of zero makes a cache that never holds anything */
+UrlCache *
+url_cache_new (guint size)
+{
+	UrlCache * cache = g_new0(UrlCache, 1);
+
+	cache->size = size;
+	cache->entries = g_hash_table_new(g_str_hash, g_str_equal);
+	g_queue_init(&cache->lru);
+	cache->scratch = g_string_new(NULL);
+
+	return cache;
+}
+
+void
+url_cache_free (UrlCache * cache)
+{
+	g_return_if_fail(cache != NULL);
+
+	url_cache_clear(cache);
+	g_hash_table_unref(cache->entries);
+	g_string_free(cache->scratch, TRUE);
+	g_free(cache);
+}
+
+/* Returns TRUE if there was an entry, @appid is set to what was
+   cached which can be NULL. The string is only valid until the
+   cache is next changed. */
+gboolean
+url_cache_lookup (UrlCache * cache, const gchar * protocol, gsize protocollen, const gchar * domain, gsize domainlen, const gchar ** appid)
+{
+	g_return_val_if_fail(cache != NULL, FALSE);
+	g_return_val_if_fail(protocol != NULL, FALSE);
+	g_return_val_if_fail(appid != NULL, FALSE);
+
+	*appid = NULL;
+
+	if (domain == NULL) {
+		domainlen = 0;
+	}
+
+	if (domainlen > MAX_DOMAIN_LENGTH) {
+		cache->misses++;
+		return FALSE;
+	}
+
+	const gchar * key = build_key(cache, protocol, protocollen, domain, domainlen);
+	UrlCacheEntry * entry = (UrlCacheEntry *)g_hash_table_lookup(cache->entries, key);
+
+	if (entry == NULL) {
+		cache->misses++;
+		return FALSE;
+	}
+
+	cache->hits++;
+
+	g_queue_unlink(&cache->lru, &entry->link);
+	g_queue_push_head_link(&cache->lru, &entry->link);
+
+	*appid = entry->appid;
+	return TRUE;
+}
+
+/* Remember what handles a protocol and domain, @appid can be NULL
+   to remember that nothing does */
+void
+url_cache_insert (UrlCache * cache, const gchar * protocol, gsize protocollen, const gchar * domain, gsize domainlen, const gchar * appid)
+{
+	g_return_if_fail(cache != NULL);
+	g_return_if_fail(protocol != NULL);
+
+	if (cache->size == 0) {
+		return;
+	}
+
+	if (domain == NULL) {
+		domainlen = 0;
+	}
+
+	if (domainlen > MAX_DOMAIN_LENGTH) {
+		return;
+	}
+
+	const gchar * key = build_key(cache, protocol, protocollen, domain, domainlen);
+	UrlCacheEntry * entry = (UrlCacheEntry *)g_hash_table_lookup(cache->entries, key);
+
+	if (entry != NULL) {
+		g_free(entry->appid);
+		entry->appid = g_strdup(appid);
+
+		g_queue_unlink(&cache->lru, &entry->link);
+		g_queue_push_head_link(&cache->lru, &entry->link);
+		return;
+	}
+
+	if (cache->lru.length >= cache->size) {
+		GList * oldest = g_queue_pop_tail_link(&cache->lru);
+		UrlCacheEntry * old = (UrlCacheEntry *)oldest->data;
+
+		g_hash_table_remove(cache->entries, old->key);
+		entry_free(old);
+	}
+
+	entry = g_new0(UrlCacheEntry, 1);
+	entry->link.data = entry;
+	entry->key = g_strdup(key);
+	entry->appid = g_strdup(appid);
+
+	g_hash_table_insert(cache->entries, entry->key, entry);
+	g_queue_push_head_link(&cache->lru, &entry->link);
+}
+
+/* Drop everything, the counters are kept */
+void
+url_cache_clear (UrlCache * cache)
+{
+	g_return_if_fail(cache != NULL);
+
+	g_hash_table_remove_all(cache->entries);
+
+	GList * link;
+	while ((link = g_queue_pop_head_link(&cache->lru)) != NULL) {
+		entry_free((UrlCacheEntry *)link->data);
+	}
+}
+
+/* Number of entries in the cache */
+guint
+url_cache_size (UrlCache * cache)
+{
+	g_return_val_if_fail(cache != NULL, 0);
+
+	return cache->lru.length;
+}
+
+void
+url_cache_get_stats (UrlCache * cache, guint64 * hits, guint64 * misses)
+{
+	g_return_if_fail(cache != NULL);
+
+	if (hits != NULL) {
+		*hits = cache->hits;
+	}
+	if (misses != NULL) {
+		*misses = cache->misses;
+	}
+}
@@ -0,0 +1,49 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef URL_CACHE_H
+#define URL_CACHE_H 1
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _UrlCache UrlCache;
+
+UrlCache *    url_cache_new                         (guint          size);
+void          url_cache_free                        (UrlCache *     cache);
+gboolean      url_cache_lookup                      (UrlCache *     cache,
+                                                     const gchar *  protocol,
+                                                     gsize          protocollen,
+                                                     const gchar *  domain,
+                                                     gsize          domainlen,
+                                                     const gchar ** appid);
+void          url_cache_insert                      (UrlCache *     cache,
+                                                     const gchar *  protocol,
+                                                     gsize          protocollen,
+                                                     const gchar *  domain,
+                                                     gsize          domainlen,
+                                                     const gchar *  appid);
+void          url_cache_clear                       (UrlCache *     cache);
+guint         url_cache_size                        (UrlCache *     cache);
+void          url_cache_get_stats                   (UrlCache *     cache,
+                                                     guint64 *      hits,
+                                                     guint64 *      misses);
+
+G_END_DECLS
+
+#endif /* URL_CACHE_H */
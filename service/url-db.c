@@ -18,13 +18,124 @@
  */
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include "url-db.h"
+#include "probes.h"
 #include "create-db-sql.h"
 
-#define DB_SCHEMA_VERSION "1"
+#define DB_SCHEMA_VERSION "3"
+#define BUSY_TIMEOUT 5000 /* ms, another writer can be partway through a batch */
+
+/* Tracepoints, see probes.h */
+PROBE_SEMAPHORE(find_url);
+
+/* A shadow database is a scratch file until it replaces the real one,
+   so it's loaded without a journal or syncing. The URL index and the
+   generation triggers only slow the load down, they're put back by
+   create_db_sql when it's done. */
+#define SHADOW_LOAD_SQL \
+	"pragma journal_mode = off;" \
+	"pragma synchronous = off;" \
+	"drop index if exists urls_index;" \
+	"drop trigger if exists configfiles_insert_generation;" \
+	"drop trigger if exists configfiles_delete_generation;" \
+	"drop trigger if exists urls_insert_generation;" \
+	"drop trigger if exists urls_delete_generation;"
+
+/* Without the index "insert or replace" couldn't replace anything, so
+   take out what it would have. NULL suffixes are never the same in
+   the index, so they're all kept. */
+#define SHADOW_DEDUPLICATE_SQL \
+	"delete from urls where domainsuffix is not null and rowid not in " \
+	"(select max(rowid) from urls where domainsuffix is not null group by sourcefile, protocol, domainsuffix);"
+
+/* Every statement we run, they're prepared the first time they're
+   used and then kept for the life of the connection */
+typedef enum {
+	STMT_GET_FILE_STAMP,
+	STMT_UPDATE_FILE_STAMP,
+	STMT_INSERT_FILE,
+	STMT_INSERT_URL,
+	STMT_FIND_URL,
+	STMT_FOREACH_URL,
+	STMT_DATA_VERSION,
+	STMT_GENERATION,
+	STMT_FILES_FOR_DIR,
+	STMT_REMOVE_FILE_URLS,
+	STMT_REMOVE_FILE,
+	STMT_COUNT
+} UrlDbStatement;
+
+static const gchar * statement_sql[STMT_COUNT] = {
+	[STMT_GET_FILE_STAMP] =
+		"select mtime, size, inode, hash from configfiles where name = ?1",
+	/* Not "insert or replace", that would give the file a new rowid
+	   and leave its URLs pointing at the old one */
+	[STMT_UPDATE_FILE_STAMP] =
+		"update configfiles set mtime = ?2, size = ?3, inode = ?4, hash = ?5 where name = ?1",
+	[STMT_INSERT_FILE] =
+		"insert into configfiles (name, mtime, size, inode, hash) values (?1, ?2, ?3, ?4, ?5)",
+	[STMT_INSERT_URL] =
+		"insert or replace into urls select rowid, ?2, ?3 from configfiles where name = ?1",
+	/* Matches only on whole domain labels, so "foo.com" handles "m.foo.com"
+	   but not "badfoo.com", a leading dot on the suffix is ignored. This is
+	   the reference for the routing trie the service builds. */
+	[STMT_FIND_URL] =
+		"select configfiles.name from configfiles, urls where urls.sourcefile = configfiles.rowid and urls.protocol = ?1 and (ltrim(urls.domainsuffix, '.') = '' or ?2 like ltrim(urls.domainsuffix, '.') or ?2 like '%.' || ltrim(urls.domainsuffix, '.')) order by length(ltrim(urls.domainsuffix, '.')) desc, urls.rowid limit 1",
+	[STMT_FOREACH_URL] =
+		"select urls.protocol, urls.domainsuffix, configfiles.name from configfiles, urls where urls.sourcefile = configfiles.rowid order by urls.rowid",
+	[STMT_DATA_VERSION] =
+		"pragma data_version",
+	[STMT_GENERATION] =
+		"select value from generation",
+	[STMT_FILES_FOR_DIR] =
+		"select name from configfiles where name like ?1",
+	[STMT_REMOVE_FILE_URLS] =
+		"delete from urls where sourcefile in (select rowid from configfiles where name = ?1)",
+	[STMT_REMOVE_FILE] =
+		"delete from configfiles where name = ?1",
+};
+
+struct _UrlDb {
+	sqlite3 * db;
+	sqlite3_stmt * stmts[STMT_COUNT];
+};
+
+/* Get a statement ready to have its parameters bound, it has to be
+   given back with statement_release() when done */
+static sqlite3_stmt *
+statement_get (UrlDb * db, UrlDbStatement id)
+{
+	if (G_LIKELY(db->stmts[id] != NULL)) {
+		return db->stmts[id];
+	}
 
-sqlite3 *
-url_db_create_database ()
+	if (sqlite3_prepare_v2(db->db,
+			statement_sql[id],
+			-1, /* length */
+			&db->stmts[id],
+			NULL) != SQLITE_OK) {
+		g_warning("Unable to parse SQL '%s': %s", statement_sql[id], sqlite3_errmsg(db->db));
+		db->stmts[id] = NULL;
+		return NULL;
+	}
+
+	return db->stmts[id];
+}
+
+/* Reset so the statement doesn't hold a read transaction open, and
+   clear the bindings as they're bound SQLITE_STATIC to our caller's
+   strings */
+static void
+statement_release (sqlite3_stmt * stmt)
+{
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+}
+
+/* Where files in the cache live, making the directory if it isn't there */
+static gchar *
+cache_filename (const gchar * basename)
 {
 	const gchar * cachedir = g_getenv("URL_DISPATCHER_CACHE_DIR"); /* Mostly for testing */
 
@@ -43,24 +154,115 @@ url_db_create_database ()
 		}
 	}
 
-	gchar * dbfilename = g_build_filename(urldispatchercachedir, "urls-" DB_SCHEMA_VERSION ".db", NULL);
+	gchar * filename = g_build_filename(urldispatchercachedir, basename, NULL);
 	g_free(urldispatchercachedir);
 
+	return filename;
+}
+
+/* Where the database lives */
+static gchar *
+database_filename (void)
+{
+	return cache_filename("urls-" DB_SCHEMA_VERSION ".db");
+}
+
+/* Where update-directory leaves the routing index, next to the database */
+gchar *
+url_db_index_filename ()
+{
+	return cache_filename("urls-" DB_SCHEMA_VERSION ".index");
+}
+
+/* Where a rebuilt database is put together before it's copied into
+   the real one */
+static gchar *
+shadow_filename (void)
+{
+	return cache_filename("urls-" DB_SCHEMA_VERSION ".db.new");
+}
+
+/* Databases with an older schema are never read again, nor are the
+   files they leave next to them */
+static void
+remove_old_databases (void)
+{
+	const gchar * suffixes[] = { ".db", ".db-wal", ".db-shm", ".db-journal", ".index" };
+	guint64 current = g_ascii_strtoull(DB_SCHEMA_VERSION, NULL, 10);
+	guint64 version;
+	guint i;
+
+	for (version = 1; version < current; version++) {
+		for (i = 0; i < G_N_ELEMENTS(suffixes); i++) {
+			gchar * basename = g_strdup_printf("urls-%" G_GUINT64_FORMAT "%s", version, suffixes[i]);
+			gchar * filename = cache_filename(basename);
+
+			if (filename != NULL && g_unlink(filename) == 0) {
+				g_debug("Removed old URL database file '%s'", filename);
+			}
+
+			g_free(filename);
+			g_free(basename);
+		}
+	}
+}
+
+/* Open @dbfilename with @flags */
+static sqlite3 *
+database_open_file (const gchar * dbfilename, int flags)
+{
 	int open_status = SQLITE_ERROR;
 	sqlite3 * db = NULL;
 
-	open_status = sqlite3_open(dbfilename, &db);
+	open_status = sqlite3_open_v2(dbfilename, &db, flags, NULL);
 	if (open_status != SQLITE_OK) {
 		g_warning("Unable to open URL database: %s", sqlite3_errmsg(db));
-		g_free(dbfilename);
 		if (db != NULL) {
 			sqlite3_close(db);
 		}
 		return NULL;
 	}
 
+	sqlite3_busy_timeout(db, BUSY_TIMEOUT);
+
+	return db;
+}
+
+/* Open the database file with @flags */
+static sqlite3 *
+database_open (int flags)
+{
+	gchar * dbfilename = database_filename();
+	if (dbfilename == NULL) {
+		return NULL;
+	}
+
+	sqlite3 * db = database_open_file(dbfilename, flags);
 	g_free(dbfilename);
 
+	return db;
+}
+
+UrlDb *
+url_db_create_database ()
+{
+	gchar * dbfilename = database_filename();
+	if (dbfilename == NULL) {
+		return NULL;
+	}
+
+	/* A new one replaces whatever an older version had */
+	if (!g_file_test(dbfilename, G_FILE_TEST_EXISTS)) {
+		remove_old_databases();
+	}
+
+	sqlite3 * db = database_open_file(dbfilename, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+	g_free(dbfilename);
+
+	if (db == NULL) {
+		return NULL;
+	}
+
 	int exec_status = SQLITE_ERROR;
 	char * failstring = NULL;
 
@@ -78,43 +280,251 @@ url_db_create_database ()
 		return NULL;
 	}
 
-	return db;
+	UrlDb * urldb = g_new0(UrlDb, 1);
+	urldb->db = db;
+
+	return urldb;
+}
+
+/* A connection that can only read, for looking up URLs off of the main
+   thread. The database has to have been created already. */
+UrlDb *
+url_db_open_readonly ()
+{
+	sqlite3 * db = database_open(SQLITE_OPEN_READONLY);
+	if (db == NULL) {
+		return NULL;
+	}
+
+	UrlDb * urldb = g_new0(UrlDb, 1);
+	urldb->db = db;
+
+	return urldb;
+}
+
+/* Drops the cached statements and closes the connection, returns
+   the status from closing it */
+int
+url_db_close (UrlDb * db)
+{
+	g_return_val_if_fail(db != NULL, SQLITE_MISUSE);
+
+	int i;
+	for (i = 0; i < STMT_COUNT; i++) {
+		if (db->stmts[i] != NULL) {
+			sqlite3_finalize(db->stmts[i]);
+		}
+	}
+
+	int close_status = sqlite3_close(db->db);
+	g_free(db);
+
+	return close_status;
+}
+
+/* The underlying connection, for things that aren't wrapped here */
+sqlite3 *
+url_db_get_connection (UrlDb * db)
+{
+	g_return_val_if_fail(db != NULL, NULL);
+
+	return db->db;
+}
+
+/* Runs SQL that doesn't have any parameters or results */
+static gboolean
+exec_sql (UrlDb * db, const gchar * sql)
+{
+	char * failstring = NULL;
+
+	if (sqlite3_exec(db->db, sql, NULL, NULL, &failstring) != SQLITE_OK) {
+		g_warning("Unable to execute '%s': %s", sql, failstring);
+		sqlite3_free(failstring);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* A new, empty database for url_db_replace_database() to put in place
+   of the real one. Nothing else can see it until then. */
+UrlDb *
+url_db_create_shadow_database ()
+{
+	gchar * filename = shadow_filename();
+	if (filename == NULL) {
+		return NULL;
+	}
+
+	/* Left over from a rebuild that didn't finish */
+	g_unlink(filename);
+
+	sqlite3 * db = database_open_file(filename, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+	g_free(filename);
+
+	if (db == NULL) {
+		return NULL;
+	}
+
+	UrlDb * urldb = g_new0(UrlDb, 1);
+	urldb->db = db;
+
+	if (!exec_sql(urldb, create_db_sql) || !exec_sql(urldb, SHADOW_LOAD_SQL)) {
+		url_db_discard_shadow_database(urldb);
+		return NULL;
+	}
+
+	return urldb;
 }
 
+/* Closes a shadow database without it replacing anything */
+void
+url_db_discard_shadow_database (UrlDb * shadow)
+{
+	g_return_if_fail(shadow != NULL);
+
+	url_db_close(shadow);
+
+	gchar * filename = shadow_filename();
+	if (filename != NULL) {
+		g_unlink(filename);
+		g_free(filename);
+	}
+}
+
+/* The generation the real database @db is at, -1 if it can't be read */
+static gint64
+database_get_generation (sqlite3 * db)
+{
+	gint64 generation = -1;
+	sqlite3_stmt * stmt = NULL;
+
+	if (sqlite3_prepare_v2(db, "select value from generation", -1, &stmt, NULL) == SQLITE_OK &&
+			sqlite3_step(stmt) == SQLITE_ROW) {
+		generation = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+
+	return generation;
+}
+
+/* Finishes @shadow and copies it into the real database as a single
+   write, readers see all of the old one or all of the new one. It's
+   copied into the file rather than renamed over it so anyone who has
+   it open, or opens it meanwhile, stays on the same file and log, and
+   only waits on the lock like for any other writer. @shadow is
+   discarded either way. */
+gboolean
+url_db_replace_database (UrlDb * shadow)
+{
+	g_return_val_if_fail(shadow != NULL, FALSE);
+
+	gboolean replaced = FALSE;
+	sqlite3 * db = database_open(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+	if (db == NULL) {
+		url_db_discard_shadow_database(shadow);
+		return FALSE;
+	}
+
+	/* Ahead of any index still around for the old one, whatever
+	   happened to it */
+	gint64 generation = MAX(database_get_generation(db) + 1, g_get_real_time());
+	gchar * generation_sql = g_strdup_printf("update generation set value = %" G_GINT64_FORMAT ";", generation);
+
+	gboolean finished = exec_sql(shadow, SHADOW_DEDUPLICATE_SQL) &&
+		exec_sql(shadow, create_db_sql) &&
+		exec_sql(shadow, generation_sql);
+	g_free(generation_sql);
+
+	if (finished) {
+		/* In one go, the copy holds the write lock until it's committed */
+		sqlite3_backup * backup = sqlite3_backup_init(db, "main", shadow->db, "main");
+		if (backup != NULL) {
+			int step_status = sqlite3_backup_step(backup, -1);
+			int finish_status = sqlite3_backup_finish(backup);
+			replaced = step_status == SQLITE_DONE && finish_status == SQLITE_OK;
+		}
+
+		if (replaced) {
+			g_debug("Replaced URL database, generation %" G_GINT64_FORMAT, generation);
+		} else {
+			g_warning("Unable to replace URL database: %s", sqlite3_errmsg(db));
+		}
+	}
+
+	sqlite3_close(db);
+	url_db_discard_shadow_database(shadow);
+
+	return replaced;
+}
+
+/* Starts a transaction that the following changes are a part of, each
+   one committing on its own is most of the cost of a big update. The
+   write lock is taken right away so another writer can't come in
+   between our reads and writes. */
 gboolean
-url_db_get_file_motification_time (sqlite3 * db, const gchar * filename, GTimeVal * timeval)
+url_db_begin (UrlDb * db)
+{
+	g_return_val_if_fail(db != NULL, FALSE);
+
+	return exec_sql(db, "begin immediate");
+}
+
+gboolean
+url_db_commit (UrlDb * db)
+{
+	g_return_val_if_fail(db != NULL, FALSE);
+
+	return exec_sql(db, "commit");
+}
+
+/* Throws away the changes since url_db_begin(), SQLite may have already
+   done that itself if a statement failed badly enough */
+void
+url_db_rollback (UrlDb * db)
+{
+	g_return_if_fail(db != NULL);
+
+	if (!sqlite3_get_autocommit(db->db)) {
+		exec_sql(db, "rollback");
+	}
+}
+
+/* What is known about @filename from when its URLs were read */
+gboolean
+url_db_get_file_stamp (UrlDb * db, const gchar * filename, UrlDbFileStamp * stamp)
 {
 	g_return_val_if_fail(db != NULL, FALSE);
 	g_return_val_if_fail(filename != NULL, FALSE);
-	g_return_val_if_fail(timeval != NULL, FALSE);
+	g_return_val_if_fail(stamp != NULL, FALSE);
 
-	timeval->tv_sec = 0;
-	timeval->tv_usec = 0;
+	stamp->mtime = 0;
+	stamp->size = -1;
+	stamp->inode = 0;
+	stamp->hash = 0;
 
-	sqlite3_stmt * stmt;
-	if (sqlite3_prepare_v2(db,
-			"select timestamp from configfiles where name = ?1",
-			-1, /* length */
-			&stmt,
-			NULL) != SQLITE_OK) {
-		g_warning("Unable to parse SQL to get file times: %s", sqlite3_errmsg(db));
+	sqlite3_stmt * stmt = statement_get(db, STMT_GET_FILE_STAMP);
+	if (stmt == NULL) {
 		return FALSE;
 	}
 
-	sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_STATIC);
 
 	gboolean valueset = FALSE;
 	int exec_status = SQLITE_ROW;
 	while ((exec_status = sqlite3_step(stmt)) == SQLITE_ROW) {
-		if (timeval->tv_sec != 0) {
+		if (valueset) {
 			g_warning("Seemingly two timestamps for the same file");
 		}
 
-		timeval->tv_sec = sqlite3_column_int(stmt, 0);
+		stamp->mtime = sqlite3_column_int64(stmt, 0);
+		stamp->size = sqlite3_column_int64(stmt, 1);
+		stamp->inode = (guint64)sqlite3_column_int64(stmt, 2);
+		stamp->hash = (guint64)sqlite3_column_int64(stmt, 3);
 		valueset = TRUE;
 	}
 
-	sqlite3_finalize(stmt);
+	statement_release(stmt);
 
 	if (exec_status != SQLITE_DONE) {
 		g_warning("Unable to execute insert");
@@ -124,41 +534,86 @@ url_db_get_file_motification_time (sqlite3 * db, const gchar * filename, GTimeVa
 	return valueset;
 }
 
-gboolean
-url_db_set_file_motification_time (sqlite3 * db, const gchar * filename, GTimeVal * timeval)
+/* Binds the stamp and runs one of the statements that sets it */
+static gboolean
+exec_stamp_statement (UrlDb * db, UrlDbStatement id, const gchar * filename, const UrlDbFileStamp * stamp)
 {
-	g_return_val_if_fail(db != NULL, FALSE);
-	g_return_val_if_fail(filename != NULL, FALSE);
-	g_return_val_if_fail(timeval != NULL, FALSE);
-
-	sqlite3_stmt * stmt;
-	if (sqlite3_prepare_v2(db,
-			"insert or replace into configfiles values (?1, ?2)",
-			-1, /* length */
-			&stmt,
-			NULL) != SQLITE_OK) {
-		g_warning("Unable to parse SQL to set file times: %s", sqlite3_errmsg(db));
+	sqlite3_stmt * stmt = statement_get(db, id);
+	if (stmt == NULL) {
 		return FALSE;
 	}
 
-	sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_TRANSIENT);
-	sqlite3_bind_int(stmt, 2, timeval->tv_sec);
+	sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 2, stamp->mtime);
+	sqlite3_bind_int64(stmt, 3, stamp->size);
+	sqlite3_bind_int64(stmt, 4, (sqlite3_int64)stamp->inode);
+	sqlite3_bind_int64(stmt, 5, (sqlite3_int64)stamp->hash);
 
 	int exec_status = SQLITE_ROW;
 	while ((exec_status = sqlite3_step(stmt)) == SQLITE_ROW) {}
 
-	sqlite3_finalize(stmt);
+	statement_release(stmt);
 
 	if (exec_status != SQLITE_DONE) {
-		g_warning("Unable to execute insert");
+		g_warning("Unable to execute insert: %s", sqlite3_errmsg(db->db));
 		return FALSE;
 	}
 
 	return TRUE;
 }
 
+/* Adds @filename if it's new, otherwise it keeps its URLs and only
+   the stamp changes */
 gboolean
-url_db_insert_url (sqlite3 * db, const gchar * filename, const gchar * protocol, const gchar * domainsuffix)
+url_db_set_file_stamp (UrlDb * db, const gchar * filename, const UrlDbFileStamp * stamp)
+{
+	g_return_val_if_fail(db != NULL, FALSE);
+	g_return_val_if_fail(filename != NULL, FALSE);
+	g_return_val_if_fail(stamp != NULL, FALSE);
+
+	if (!exec_stamp_statement(db, STMT_UPDATE_FILE_STAMP, filename, stamp)) {
+		return FALSE;
+	}
+
+	if (sqlite3_changes(db->db) > 0) {
+		return TRUE;
+	}
+
+	return exec_stamp_statement(db, STMT_INSERT_FILE, filename, stamp);
+}
+
+gboolean
+url_db_get_file_motification_time (UrlDb * db, const gchar * filename, GTimeVal * timeval)
+{
+	g_return_val_if_fail(timeval != NULL, FALSE);
+
+	UrlDbFileStamp stamp;
+	gboolean valueset = url_db_get_file_stamp(db, filename, &stamp);
+
+	timeval->tv_sec = stamp.mtime / G_GINT64_CONSTANT(1000000000);
+	timeval->tv_usec = (stamp.mtime % G_GINT64_CONSTANT(1000000000)) / 1000;
+
+	return valueset;
+}
+
+/* A stamp with only the time, so it never matches what's on disk */
+gboolean
+url_db_set_file_motification_time (UrlDb * db, const gchar * filename, GTimeVal * timeval)
+{
+	g_return_val_if_fail(timeval != NULL, FALSE);
+
+	UrlDbFileStamp stamp = {
+		.mtime = (gint64)timeval->tv_sec * G_GINT64_CONSTANT(1000000000) + (gint64)timeval->tv_usec * 1000,
+		.size = -1,
+		.inode = 0,
+		.hash = 0
+	};
+
+	return url_db_set_file_stamp(db, filename, &stamp);
+}
+
+gboolean
+url_db_insert_url (UrlDb * db, const gchar * filename, const gchar * protocol, const gchar * domainsuffix)
 {
 	g_return_val_if_fail(db != NULL, FALSE);
 	g_return_val_if_fail(filename != NULL, FALSE);
@@ -168,35 +623,41 @@ url_db_insert_url (sqlite3 * db, const gchar * filename, const gchar * protocol,
 		domainsuffix = "";
 	}
 
-	sqlite3_stmt * stmt;
-	if (sqlite3_prepare_v2(db,
-			"insert or replace into urls select rowid, ?2, ?3 from configfiles where name = ?1",
-			-1, /* length */
-			&stmt,
-			NULL) != SQLITE_OK) {
-		g_warning("Unable to parse SQL to insert");
+	sqlite3_stmt * stmt = statement_get(db, STMT_INSERT_URL);
+	if (stmt == NULL) {
 		return FALSE;
 	}
 
-	sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 2, protocol, -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 3, domainsuffix, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, protocol, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 3, domainsuffix, -1, SQLITE_STATIC);
 
 	int exec_status = SQLITE_ROW;
 	while ((exec_status = sqlite3_step(stmt)) == SQLITE_ROW) {}
 
-	sqlite3_finalize(stmt);
+	statement_release(stmt);
 
 	if (exec_status != SQLITE_DONE) {
-		g_warning("Unable to execute insert: %s", sqlite3_errmsg(db));
+		g_warning("Unable to execute insert: %s", sqlite3_errmsg(db->db));
 		return FALSE;
 	}
 
 	return TRUE;
 }
 
+/* The AppID is the basename of the file without the suffix */
+static gchar *
+appid_from_filename (const gchar * filename)
+{
+	gchar * basename = g_path_get_basename(filename);
+	gchar * suffix = g_strrstr(basename, ".url-dispatcher");
+	if (suffix != NULL) /* This should never not happen, but it's too scary not to throw this 'if' in */
+		suffix[0] = '\0';
+	return basename;
+}
+
 gchar *
-url_db_find_url (sqlite3 * db, const gchar * protocol, const gchar * domainsuffix)
+url_db_find_url (UrlDb * db, const gchar * protocol, const gchar * domainsuffix)
 {
 	g_return_val_if_fail(db != NULL, NULL);
 	g_return_val_if_fail(protocol != NULL, NULL);
@@ -205,18 +666,14 @@ url_db_find_url (sqlite3 * db, const gchar * protocol, const gchar * domainsuffi
 		domainsuffix = "";
 	}
 
-	sqlite3_stmt * stmt;
-	if (sqlite3_prepare_v2(db,
-			"select configfiles.name from configfiles, urls where urls.sourcefile = configfiles.rowid and urls.protocol = ?1 and ?2 like '%' || urls.domainsuffix order by length(urls.domainsuffix) desc limit 1",
-			-1, /* length */
-			&stmt,
-			NULL) != SQLITE_OK) {
-		g_warning("Unable to parse SQL to find url: %s", sqlite3_errmsg(db));
+	gint64 start = PROBE_START(find_url);
+	sqlite3_stmt * stmt = statement_get(db, STMT_FIND_URL);
+	if (stmt == NULL) {
 		return NULL;
 	}
 
-	sqlite3_bind_text(stmt, 1, protocol, -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 2, domainsuffix, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(stmt, 1, protocol, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, domainsuffix, -1, SQLITE_STATIC);
 
 	gchar * filename = NULL;
 	int exec_status = SQLITE_ROW;
@@ -227,28 +684,110 @@ url_db_find_url (sqlite3 * db, const gchar * protocol, const gchar * domainsuffi
 	gchar * output = NULL;
 	if (filename != NULL) {
 		g_debug("Found file: '%s'", filename);
-		gchar * basename = g_path_get_basename(filename);
-		gchar * suffix = g_strrstr(basename, ".url-dispatcher");
-		if (suffix != NULL) /* This should never not happen, but it's too scary not to throw this 'if' in */
-			suffix[0] = '\0';
-		output = g_strdup(basename);
-		g_free(basename);
+		output = appid_from_filename(filename);
 		g_free(filename);
 	}
 
-	sqlite3_finalize(stmt);
+	statement_release(stmt);
 
 	if (exec_status != SQLITE_DONE) {
-		g_warning("Unable to execute insert: %s", sqlite3_errmsg(db));
+		g_warning("Unable to execute insert: %s", sqlite3_errmsg(db->db));
 		g_free(output);
 		return NULL;
 	}
 
+	PROBE4(find_url, protocol, domainsuffix, output, PROBE_SINCE(start));
+
 	return output;
 }
 
+/* Walks every URL in the database in the order they were added, @func
+   can't call back into url_db_foreach_url() on the same database */
+gboolean
+url_db_foreach_url (UrlDb * db, UrlDbUrlFunc func, gpointer user_data)
+{
+	g_return_val_if_fail(db != NULL, FALSE);
+	g_return_val_if_fail(func != NULL, FALSE);
+
+	sqlite3_stmt * stmt = statement_get(db, STMT_FOREACH_URL);
+	if (stmt == NULL) {
+		return FALSE;
+	}
+
+	int exec_status = SQLITE_ROW;
+	while ((exec_status = sqlite3_step(stmt)) == SQLITE_ROW) {
+		const gchar * protocol = (const gchar *)sqlite3_column_text(stmt, 0);
+		const gchar * domainsuffix = (const gchar *)sqlite3_column_text(stmt, 1);
+		const gchar * filename = (const gchar *)sqlite3_column_text(stmt, 2);
+
+		if (protocol == NULL || filename == NULL) {
+			continue;
+		}
+
+		gchar * appid = appid_from_filename(filename);
+		func(protocol, domainsuffix, appid, user_data);
+		g_free(appid);
+	}
+
+	statement_release(stmt);
+
+	if (exec_status != SQLITE_DONE) {
+		g_warning("Unable to list urls: %s", sqlite3_errmsg(db->db));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Changes whenever another connection commits to the database */
+gboolean
+url_db_get_data_version (UrlDb * db, gint64 * version)
+{
+	g_return_val_if_fail(db != NULL, FALSE);
+	g_return_val_if_fail(version != NULL, FALSE);
+
+	sqlite3_stmt * stmt = statement_get(db, STMT_DATA_VERSION);
+	if (stmt == NULL) {
+		return FALSE;
+	}
+
+	gboolean valueset = FALSE;
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		*version = sqlite3_column_int64(stmt, 0);
+		valueset = TRUE;
+	}
+
+	statement_release(stmt);
+
+	return valueset;
+}
+
+/* Counts changes to the files and URLs, unlike the data version it's
+   kept in the database so it means the same thing to every connection */
+gboolean
+url_db_get_generation (UrlDb * db, gint64 * generation)
+{
+	g_return_val_if_fail(db != NULL, FALSE);
+	g_return_val_if_fail(generation != NULL, FALSE);
+
+	sqlite3_stmt * stmt = statement_get(db, STMT_GENERATION);
+	if (stmt == NULL) {
+		return FALSE;
+	}
+
+	gboolean valueset = FALSE;
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		*generation = sqlite3_column_int64(stmt, 0);
+		valueset = TRUE;
+	}
+
+	statement_release(stmt);
+
+	return valueset;
+}
+
 GList *
-url_db_files_for_dir (sqlite3 * db, const gchar * dir)
+url_db_files_for_dir (UrlDb * db, const gchar * dir)
 {
 	g_return_val_if_fail(db != NULL, NULL);
 
@@ -256,18 +795,13 @@ url_db_files_for_dir (sqlite3 * db, const gchar * dir)
 		dir = "";
 	}
 
-	sqlite3_stmt * stmt;
-	if (sqlite3_prepare_v2(db,
-			"select name from configfiles where name like ?1",
-			-1, /* length */
-			&stmt,
-			NULL) != SQLITE_OK) {
-		g_warning("Unable to parse SQL to find files: %s", sqlite3_errmsg(db));
+	sqlite3_stmt * stmt = statement_get(db, STMT_FILES_FOR_DIR);
+	if (stmt == NULL) {
 		return NULL;
 	}
 
 	gchar * dir_search = g_strdup_printf("%s%%", dir);
-	sqlite3_bind_text(stmt, 1, dir_search, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(stmt, 1, dir_search, -1, SQLITE_STATIC);
 
 	GList * filelist = NULL;
 	int exec_status = SQLITE_ROW;
@@ -276,11 +810,11 @@ url_db_files_for_dir (sqlite3 * db, const gchar * dir)
 		filelist = g_list_prepend(filelist, name);
 	}
 
-	sqlite3_finalize(stmt);
+	statement_release(stmt);
 	g_free(dir_search);
 
 	if (exec_status != SQLITE_DONE) {
-		g_warning("Unable to execute insert: %s", sqlite3_errmsg(db));
+		g_warning("Unable to execute insert: %s", sqlite3_errmsg(db->db));
 		g_list_free_full(filelist, g_free);
 		return NULL;
 	}
@@ -288,72 +822,73 @@ url_db_files_for_dir (sqlite3 * db, const gchar * dir)
 	return filelist;
 }
 
-/* Remove a file from the database along with all URLs that were
-   built because of it. */
-gboolean
-url_db_remove_file (sqlite3 * db, const gchar * path)
+/* Runs a statement that only has the path to bind */
+static gboolean
+exec_path_statement (UrlDb * db, UrlDbStatement id, const gchar * path)
 {
-	g_return_val_if_fail(db != NULL, FALSE);
-	g_return_val_if_fail(path != NULL, FALSE);
-
-	/* Start a transaction so the database doesn't end up
-	   in an inconsistent state */
-	if (sqlite3_exec(db, "begin", NULL, NULL, NULL) != SQLITE_OK) {
-		g_warning("Unable to start transaction to delete: %s", sqlite3_errmsg(db));
+	sqlite3_stmt * stmt = statement_get(db, id);
+	if (stmt == NULL) {
 		return FALSE;
 	}
 
-	/* Remove all URLs for file */
-	sqlite3_stmt * stmt;
-	if (sqlite3_prepare_v2(db,
-			"delete from urls where sourcefile in (select rowid from configfiles where name = ?1);",
-			-1, /* length */
-			&stmt,
-			NULL) != SQLITE_OK) {
-		g_warning("Unable to parse SQL to remove urls: %s", sqlite3_errmsg(db));
-		goto rollback;
-	}
-
-	sqlite3_bind_text(stmt, 1, path, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
 
 	int exec_status = SQLITE_ROW;
 	while ((exec_status = sqlite3_step(stmt)) == SQLITE_ROW) {
 	}
 
-	sqlite3_finalize(stmt);
+	statement_release(stmt);
 
-	if (exec_status != SQLITE_DONE) {
-		g_warning("Unable to execute removal of URLs: %s", sqlite3_errmsg(db));
-		goto rollback;
-	}
+	return exec_status == SQLITE_DONE;
+}
 
-	/* Remove references to the file */
-	stmt = NULL;
+/* Drops the URLs of a file so they can be read again, the file
+   stays with its stamp */
+gboolean
+url_db_remove_file_urls (UrlDb * db, const gchar * path)
+{
+	g_return_val_if_fail(db != NULL, FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
 
-	if (sqlite3_prepare_v2(db,
-			"delete from configfiles where name = ?1;",
-			-1, /* length */
-			&stmt,
-			NULL) != SQLITE_OK) {
-		g_warning("Unable to parse SQL to remove urls: %s", sqlite3_errmsg(db));
-		goto rollback;
+	if (!exec_path_statement(db, STMT_REMOVE_FILE_URLS, path)) {
+		g_warning("Unable to execute removal of URLs: %s", sqlite3_errmsg(db->db));
+		return FALSE;
 	}
 
-	sqlite3_bind_text(stmt, 1, path, -1, SQLITE_TRANSIENT);
+	return TRUE;
+}
 
-	while ((exec_status = sqlite3_step(stmt)) == SQLITE_ROW) {
+/* Remove a file from the database along with all URLs that were
+   built because of it. */
+gboolean
+url_db_remove_file (UrlDb * db, const gchar * path)
+{
+	g_return_val_if_fail(db != NULL, FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
+
+	/* Start a transaction so the database doesn't end up
+	   in an inconsistent state, a savepoint so that it works
+	   inside of url_db_begin() too */
+	if (sqlite3_exec(db->db, "savepoint remove_file", NULL, NULL, NULL) != SQLITE_OK) {
+		g_warning("Unable to start transaction to delete: %s", sqlite3_errmsg(db->db));
+		return FALSE;
 	}
 
-	sqlite3_finalize(stmt);
+	/* Remove all URLs for file */
+	if (!exec_path_statement(db, STMT_REMOVE_FILE_URLS, path)) {
+		g_warning("Unable to execute removal of URLs: %s", sqlite3_errmsg(db->db));
+		goto rollback;
+	}
 
-	if (exec_status != SQLITE_DONE) {
-		g_warning("Unable to execute removal of file: %s", sqlite3_errmsg(db));
+	/* Remove references to the file */
+	if (!exec_path_statement(db, STMT_REMOVE_FILE, path)) {
+		g_warning("Unable to execute removal of file: %s", sqlite3_errmsg(db->db));
 		goto rollback;
 	}
 
 	/* Commit the full transaction */
-	if (sqlite3_exec(db, "commit", NULL, NULL, NULL) != SQLITE_OK) {
-		g_warning("Unable to commit transaction to delete: %s", sqlite3_errmsg(db));
+	if (sqlite3_exec(db->db, "release remove_file", NULL, NULL, NULL) != SQLITE_OK) {
+		g_warning("Unable to commit transaction to delete: %s", sqlite3_errmsg(db->db));
 		goto rollback;
 	}
 
@@ -361,8 +896,8 @@ url_db_remove_file (sqlite3 * db, const gchar * path)
 
 rollback:
 
-	if (sqlite3_exec(db, "rollback", NULL, NULL, NULL) != SQLITE_OK) {
-		g_warning("Unable to rollback transaction: %s", sqlite3_errmsg(db));
+	if (sqlite3_exec(db->db, "rollback to remove_file; release remove_file", NULL, NULL, NULL) != SQLITE_OK) {
+		g_warning("Unable to rollback transaction: %s", sqlite3_errmsg(db->db));
 	}
 	return FALSE;
 }
@@ -25,23 +25,60 @@
 
 G_BEGIN_DECLS
 
-sqlite3 *     url_db_create_database                ();
-gboolean      url_db_get_file_motification_time     (sqlite3 *      db,
+typedef struct _UrlDb UrlDb;
+
+/* What a file looked like when its URLs were read */
+typedef struct {
+	gint64 mtime; /* ns since the epoch */
+	gint64 size; /* -1 when it isn't known */
+	guint64 inode; /* 0 when it isn't known */
+	guint64 hash; /* Of the contents, 0 when it isn't known */
+} UrlDbFileStamp;
+
+typedef void (*UrlDbUrlFunc) (const gchar * protocol, const gchar * domainsuffix, const gchar * appid, gpointer user_data);
+
+UrlDb *       url_db_create_database                ();
+UrlDb *       url_db_open_readonly                  ();
+UrlDb *       url_db_create_shadow_database         ();
+gboolean      url_db_replace_database               (UrlDb *        shadow);
+void          url_db_discard_shadow_database        (UrlDb *        shadow);
+int           url_db_close                          (UrlDb *        db);
+sqlite3 *     url_db_get_connection                 (UrlDb *        db);
+gboolean      url_db_begin                          (UrlDb *        db);
+gboolean      url_db_commit                         (UrlDb *        db);
+void          url_db_rollback                       (UrlDb *        db);
+gboolean      url_db_get_file_motification_time     (UrlDb *        db,
                                                      const gchar *  filename,
                                                      GTimeVal *     timeval);
-gboolean      url_db_set_file_motification_time     (sqlite3 *      db,
+gboolean      url_db_set_file_motification_time     (UrlDb *        db,
                                                      const gchar *  filename,
                                                      GTimeVal *     timeval);
-gboolean      url_db_insert_url                     (sqlite3 *      db,
+gboolean      url_db_get_file_stamp                 (UrlDb *        db,
+                                                     const gchar *  filename,
+                                                     UrlDbFileStamp * stamp);
+gboolean      url_db_set_file_stamp                 (UrlDb *        db,
+                                                     const gchar *  filename,
+                                                     const UrlDbFileStamp * stamp);
+gboolean      url_db_insert_url                     (UrlDb *        db,
                                                      const gchar *  filename,
                                                      const gchar *  protocol,
                                                      const gchar *  domainsuffix);
-gchar *       url_db_find_url                       (sqlite3 *      db,
+gchar *       url_db_find_url                       (UrlDb *        db,
                                                      const gchar *  protocol,
                                                      const gchar *  domainsuffix);
-GList *       url_db_files_for_dir                  (sqlite3 *      db,
+gboolean      url_db_foreach_url                    (UrlDb *        db,
+                                                     UrlDbUrlFunc   func,
+                                                     gpointer       user_data);
+gboolean      url_db_get_data_version               (UrlDb *        db,
+                                                     gint64 *       version);
+gboolean      url_db_get_generation                 (UrlDb *        db,
+                                                     gint64 *       generation);
+gchar *       url_db_index_filename                 ();
+GList *       url_db_files_for_dir                  (UrlDb *        db,
                                                      const gchar *  dir);
-gboolean      url_db_remove_file                    (sqlite3 *      db,
+gboolean      url_db_remove_file_urls               (UrlDb *        db,
+                                                     const gchar *  path);
+gboolean      url_db_remove_file                    (UrlDb *        db,
                                                      const gchar *  path);
 
 G_END_DECLS
@@ -0,0 +1,588 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* A routing table that update-directory compiles out of the database
+   for the service to map, so it can route without reading the database
+   or building anything first. It gives the same answers as the routing
+   trie. The file is laid out as:
+
+     header | protocols | entries | strings
+
+   Protocols are sorted and each has a range of entries sorted by domain
+   suffix. The suffixes have their labels reversed and in lower case, so
+   "m.foo.com" is "com.foo.m" and a lookup is a search for the longest
+   one that the reversed domain starts with, cut at a label. Everything
+   is 32 bit offsets in the machine's byte order, it's a cache that is
+   rebuilt and not something to copy between machines. */
+
+#include <string.h>
+#include "url-index.h"
+
+#define INDEX_MAGIC "URLINDEX"
+#define INDEX_VERSION 1
+#define NO_STRING G_MAXUINT32
+
+typedef struct {
+	gchar magic[8];
+	guint32 version;
+	guint32 size;
+	gint64 generation; /* From the database when it was written */
+	guint32 protocols;
+	guint32 nprotocols;
+	guint32 entries;
+	guint32 nentries;
+	guint32 strings;
+	guint32 stringslen;
+} IndexHeader;
+
+typedef struct {
+	guint32 name;
+	guint32 namelen;
+	guint32 appid; /* Handles any domain, or NO_STRING */
+	guint32 appidlen;
+	guint32 first;
+	guint32 count;
+} IndexProtocol;
+
+typedef struct {
+	guint32 key;
+	guint32 keylen;
+	guint32 appid;
+	guint32 appidlen;
+} IndexEntry;
+
+struct _UrlIndex {
+	gint refcount;
+	GMappedFile * file;
+	const IndexHeader * header;
+	const IndexProtocol * protocols;
+	const IndexEntry * entries;
+	const gchar * strings;
+};
+
+/* A row from the database while the index is being written */
+typedef struct {
+	gchar * protocol;
+	gchar * key;
+	gchar * appid;
+	guint order;
+} IndexRow;
+
+/* Writes the labels of @domain in reverse order and in lower case,
+   the result is the same length */
+static void
+reverse_domain (const gchar * domain, gsize len, gchar * out)
+{
+	const gchar * end = domain + len;
+
+	while (TRUE) {
+		const gchar * start = end;
+		while (start > domain && start[-1] != '.') {
+			start--;
+		}
+
+		const gchar * cur;
+		for (cur = start; cur < end; cur++) {
+			*out++ = g_ascii_tolower(*cur);
+		}
+
+		if (start == domain) {
+			break;
+		}
+
+		*out++ = '.';
+		end = start - 1;
+	}
+}
+
+/* Byte order, the same as strcmp() on the strings when they're written */
+static gint
+bytes_compare (const gchar * a, gsize alen, const gchar * b, gsize blen)
+{
+	gint cmp = memcmp(a, b, MIN(alen, blen));
+
+	if (cmp != 0) {
+		return cmp;
+	}
+	if (alen == blen) {
+		return 0;
+	}
+	return alen < blen ? -1 : 1;
+}
+
+static void
+index_row_free (gpointer data)
+{
+	IndexRow * row = (IndexRow *)data;
+
+	g_free(row->protocol);
+	g_free(row->key);
+	g_free(row->appid);
+	g_free(row);
+}
+
+static void
+collect_row (const gchar * protocol, const gchar * domainsuffix, const gchar * appid, gpointer user_data)
+{
+	GPtrArray * rows = (GPtrArray *)user_data;
+
+	if (domainsuffix == NULL) {
+		domainsuffix = "";
+	}
+
+	/* A leading dot doesn't change which hosts are under the suffix */
+	while (domainsuffix[0] == '.') {
+		domainsuffix++;
+	}
+
+	gsize len = strlen(domainsuffix);
+
+	IndexRow * row = g_new0(IndexRow, 1);
+	row->protocol = g_strdup(protocol);
+	row->key = g_malloc(len + 1);
+	reverse_domain(domainsuffix, len, row->key);
+	row->key[len] = '\0';
+	row->appid = g_strdup(appid);
+	row->order = rows->len;
+
+	g_ptr_array_add(rows, row);
+}
+
+/* By protocol and key, then the order they were in the database */
+static gint
+row_compare (gconstpointer a, gconstpointer b)
+{
+	const IndexRow * rowa = *(const IndexRow **)a;
+	const IndexRow * rowb = *(const IndexRow **)b;
+
+	gint cmp = strcmp(rowa->protocol, rowb->protocol);
+	if (cmp == 0) {
+		cmp = strcmp(rowa->key, rowb->key);
+	}
+	if (cmp == 0) {
+		cmp = rowa->order < rowb->order ? -1 : 1;
+	}
+
+	return cmp;
+}
+
+/* Adds @str to the string pool if it isn't there already */
+static guint32
+pool_string (GByteArray * strings, GHashTable * pooled, const gchar * str, guint32 * len)
+{
+	gpointer offset = NULL;
+
+	*len = strlen(str);
+
+	if (g_hash_table_lookup_extended(pooled, str, NULL, &offset)) {
+		return GPOINTER_TO_UINT(offset);
+	}
+
+	guint32 start = strings->len;
+	g_byte_array_append(strings, (const guint8 *)str, *len + 1);
+	g_hash_table_insert(pooled, (gpointer)str, GUINT_TO_POINTER(start));
+
+	return start;
+}
+
+/* Lays out the file for the sorted @rows, NULL if it's too big */
+static GByteArray *
+index_build (GPtrArray * rows, gint64 generation)
+{
+	GArray * protocols = g_array_new(FALSE, TRUE, sizeof(IndexProtocol));
+	GArray * entries = g_array_new(FALSE, TRUE, sizeof(IndexEntry));
+	GByteArray * strings = g_byte_array_new();
+	GHashTable * pooled = g_hash_table_new(g_str_hash, g_str_equal);
+	IndexRow * previous = NULL;
+
+	guint i;
+	for (i = 0; i < rows->len; i++) {
+		IndexRow * row = (IndexRow *)g_ptr_array_index(rows, i);
+
+		if (previous == NULL || strcmp(previous->protocol, row->protocol) != 0) {
+			IndexProtocol protocol = { 0 };
+			protocol.name = pool_string(strings, pooled, row->protocol, &protocol.namelen);
+			protocol.appid = NO_STRING;
+			protocol.first = entries->len;
+			g_array_append_val(protocols, protocol);
+		} else if (strcmp(previous->key, row->key) == 0) {
+			/* The first one in the database wins, like the trie */
+			continue;
+		}
+
+		IndexProtocol * protocol = &g_array_index(protocols, IndexProtocol, protocols->len - 1);
+
+		if (row->key[0] == '\0') {
+			protocol->appid = pool_string(strings, pooled, row->appid, &protocol->appidlen);
+		} else {
+			IndexEntry entry = { 0 };
+			entry.key = pool_string(strings, pooled, row->key, &entry.keylen);
+			entry.appid = pool_string(strings, pooled, row->appid, &entry.appidlen);
+			g_array_append_val(entries, entry);
+			protocol->count++;
+		}
+
+		previous = row;
+	}
+
+	IndexHeader header;
+	memset(&header, 0, sizeof(IndexHeader));
+	memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+	header.version = INDEX_VERSION;
+	header.generation = generation;
+	header.protocols = sizeof(IndexHeader);
+	header.nprotocols = protocols->len;
+	header.entries = header.protocols + protocols->len * sizeof(IndexProtocol);
+	header.nentries = entries->len;
+	header.strings = header.entries + entries->len * sizeof(IndexEntry);
+	header.stringslen = strings->len;
+
+	guint64 size = (guint64)sizeof(IndexHeader) + (guint64)protocols->len * sizeof(IndexProtocol) + (guint64)entries->len * sizeof(IndexEntry) + strings->len;
+	GByteArray * contents = NULL;
+
+	if (size < G_MAXUINT32) {
+		header.size = (guint32)size;
+
+		contents = g_byte_array_sized_new(header.size);
+		g_byte_array_append(contents, (const guint8 *)&header, sizeof(IndexHeader));
+		g_byte_array_append(contents, (const guint8 *)protocols->data, protocols->len * sizeof(IndexProtocol));
+		g_byte_array_append(contents, (const guint8 *)entries->data, entries->len * sizeof(IndexEntry));
+		g_byte_array_append(contents, strings->data, strings->len);
+	}
+
+	g_hash_table_destroy(pooled);
+	g_byte_array_unref(strings);
+	g_array_free(entries, TRUE);
+	g_array_free(protocols, TRUE);
+
+	return contents;
+}
+
+/* Writes an index of everything in @db to @filename, replacing the
+   file in one go so a reader never sees half of it */
+gboolean
+url_index_write (UrlDb * db, const gchar * filename)
+{
+	g_return_val_if_fail(db != NULL, FALSE);
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	sqlite3 * conn = url_db_get_connection(db);
+
+	/* One read transaction so the generation goes with the rows */
+	if (sqlite3_exec(conn, "begin", NULL, NULL, NULL) != SQLITE_OK) {
+		g_warning("Unable to start transaction to index: %s", sqlite3_errmsg(conn));
+		return FALSE;
+	}
+
+	gint64 generation = 0;
+	GPtrArray * rows = g_ptr_array_new_with_free_func(index_row_free);
+	gboolean read = url_db_get_generation(db, &generation) && url_db_foreach_url(db, collect_row, rows);
+
+	sqlite3_exec(conn, "commit", NULL, NULL, NULL);
+
+	if (!read) {
+		g_warning("Unable to read the URLs to index");
+		g_ptr_array_unref(rows);
+		return FALSE;
+	}
+
+	g_ptr_array_sort(rows, row_compare);
+	GByteArray * contents = index_build(rows, generation);
+	g_ptr_array_unref(rows);
+
+	if (contents == NULL) {
+		g_warning("Too many URLs to index");
+		return FALSE;
+	}
+
+	GError * error = NULL;
+	g_file_set_contents(filename, (const gchar *)contents->data, contents->len, &error);
+	g_byte_array_unref(contents);
+
+	if (error != NULL) {
+		g_warning("Unable to write URL index '%s': %s", filename, error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+
+	g_debug("Wrote URL index '%s' for generation %" G_GINT64_FORMAT, filename, generation);
+	return TRUE;
+}
+
+/* Writes the index unless the one there already matches the database */
+gboolean
+url_index_update (UrlDb * db, const gchar * filename)
+{
+	g_return_val_if_fail(db != NULL, FALSE);
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	gint64 generation = 0;
+	UrlIndex * index = url_index_open(filename);
+
+	if (index != NULL) {
+		gboolean current = url_db_get_generation(db, &generation) && url_index_get_generation(index) == generation;
+		url_index_unref(index);
+
+		if (current) {
+			return TRUE;
+		}
+	}
+
+	return url_index_write(db, filename);
+}
+
+/* A table of @count items of @itemsize at @offset fits in the file */
+static gboolean
+section_valid (guint32 offset, guint32 count, gsize itemsize, gsize size)
+{
+	return offset % sizeof(guint32) == 0 && (guint64)offset + (guint64)count * itemsize <= size;
+}
+
+static gboolean
+header_valid (const IndexHeader * header, gsize size)
+{
+	if (header == NULL || size < sizeof(IndexHeader)) {
+		return FALSE;
+	}
+
+	if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+			header->version != INDEX_VERSION ||
+			header->size != size) {
+		return FALSE;
+	}
+
+	if (!section_valid(header->protocols, header->nprotocols, sizeof(IndexProtocol), size) ||
+			!section_valid(header->entries, header->nentries, sizeof(IndexEntry), size) ||
+			(guint64)header->strings + header->stringslen > size) {
+		return FALSE;
+	}
+
+	/* So that every string in it ends before the end of the pool */
+	const gchar * strings = (const gchar *)header + header->strings;
+	return header->stringslen == 0 || strings[header->stringslen - 1] == '\0';
+}
+
+/* Maps an index, NULL if there isn't one or it can't be used. Nothing
+   is read until it's looked in. */
+UrlIndex *
+url_index_open (const gchar * filename)
+{
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	GError * error = NULL;
+	GMappedFile * file = g_mapped_file_new(filename, FALSE, &error);
+
+	if (error != NULL) {
+		if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+			g_warning("Unable to map URL index '%s': %s", filename, error->message);
+		}
+		g_error_free(error);
+		return NULL;
+	}
+
+	const IndexHeader * header = (const IndexHeader *)g_mapped_file_get_contents(file);
+	if (!header_valid(header, g_mapped_file_get_length(file))) {
+		g_warning("URL index '%s' is not usable, ignoring it", filename);
+		g_mapped_file_unref(file);
+		return NULL;
+	}
+
+	UrlIndex * index = g_new0(UrlIndex, 1);
+	index->refcount = 1;
+	index->file = file;
+	index->header = header;
+	index->protocols = (const IndexProtocol *)((const gchar *)header + header->protocols);
+	index->entries = (const IndexEntry *)((const gchar *)header + header->entries);
+	index->strings = (const gchar *)header + header->strings;
+
+	return index;
+}
+
+/* Indexes don't change once they're mapped, the refcount is atomic so
+   they can be shared between threads */
+UrlIndex *
+url_index_ref (UrlIndex * index)
+{
+	g_return_val_if_fail(index != NULL, NULL);
+
+	g_atomic_int_inc(&index->refcount);
+	return index;
+}
+
+void
+url_index_unref (UrlIndex * index)
+{
+	g_return_if_fail(index != NULL);
+
+	if (!g_atomic_int_dec_and_test(&index->refcount)) {
+		return;
+	}
+
+	g_mapped_file_unref(index->file);
+	g_free(index);
+}
+
+/* The database generation the index was written from */
+gint64
+url_index_get_generation (UrlIndex * index)
+{
+	g_return_val_if_fail(index != NULL, 0);
+
+	return index->header->generation;
+}
+
+/* A string from the pool, NULL if it doesn't fit in the pool */
+static const gchar *
+index_string (UrlIndex * index, guint32 offset, guint32 len)
+{
+	if (offset == NO_STRING || (guint64)offset + len >= index->header->stringslen) {
+		return NULL;
+	}
+
+	const gchar * str = index->strings + offset;
+	if (str[len] != '\0') {
+		return NULL;
+	}
+
+	return str;
+}
+
+static const IndexProtocol *
+find_protocol (UrlIndex * index, const gchar * protocol, gsize len)
+{
+	guint low = 0;
+	guint high = index->header->nprotocols;
+
+	while (low < high) {
+		guint mid = low + (high - low) / 2;
+		const IndexProtocol * candidate = &index->protocols[mid];
+		const gchar * name = index_string(index, candidate->name, candidate->namelen);
+
+		if (name == NULL) {
+			return NULL;
+		}
+
+		gint cmp = bytes_compare(protocol, len, name, candidate->namelen);
+		if (cmp == 0) {
+			return candidate;
+		} else if (cmp < 0) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+
+	return NULL;
+}
+
+static const IndexEntry *
+find_entry (UrlIndex * index, const IndexProtocol * protocol, const gchar * key, gsize len)
+{
+	guint low = protocol->first;
+	guint high = protocol->first + protocol->count;
+
+	while (low < high) {
+		guint mid = low + (high - low) / 2;
+		const IndexEntry * candidate = &index->entries[mid];
+		const gchar * candidatekey = index_string(index, candidate->key, candidate->keylen);
+
+		if (candidatekey == NULL) {
+			return NULL;
+		}
+
+		gint cmp = bytes_compare(key, len, candidatekey, candidate->keylen);
+		if (cmp == 0) {
+			return candidate;
+		} else if (cmp < 0) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+
+	return NULL;
+}
+
+/* Finds the AppID registered for the longest suffix of @domain, the
+   strings don't need to be NULL terminated. Same as url_trie_lookup(). */
+const gchar *
+url_index_lookup (UrlIndex * index, const gchar * protocol, gsize protocollen, const gchar * domain, gsize domainlen)
+{
+	g_return_val_if_fail(index != NULL, NULL);
+	g_return_val_if_fail(protocol != NULL, NULL);
+
+	const IndexProtocol * entry = find_protocol(index, protocol, protocollen);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	const gchar * appid = index_string(index, entry->appid, entry->appidlen);
+
+	if (domain == NULL || domainlen == 0 || entry->count == 0) {
+		return appid;
+	}
+	if ((guint64)entry->first + entry->count > index->header->nentries) {
+		return appid;
+	}
+
+	gchar stackkey[256];
+	gchar * key = domainlen <= sizeof(stackkey) ? stackkey : g_malloc(domainlen);
+	reverse_domain(domain, domainlen, key);
+
+	/* Longest first, cutting a label off the end each time around */
+	gsize len = domainlen;
+	while (TRUE) {
+		const IndexEntry * found = find_entry(index, entry, key, len);
+		const gchar * foundappid = found != NULL ? index_string(index, found->appid, found->appidlen) : NULL;
+
+		if (foundappid != NULL) {
+			appid = foundappid;
+			break;
+		}
+
+		while (len > 0 && key[len - 1] != '.') {
+			len--;
+		}
+		if (len == 0) {
+			break;
+		}
+		len--;
+	}
+
+	if (key != stackkey) {
+		g_free(key);
+	}
+
+	return appid;
+}
+
+/* Number of handlers in the index */
+guint
+url_index_size (UrlIndex * index)
+{
+	g_return_val_if_fail(index != NULL, 0);
+
+	guint size = index->header->nentries;
+	guint i;
+	for (i = 0; i < index->header->nprotocols; i++) {
+		if (index->protocols[i].appid != NO_STRING) {
+			size++;
+		}
+	}
+
+	return size;
+}
@@ -0,0 +1,45 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef URL_INDEX_H
+#define URL_INDEX_H 1
+
+#include <glib.h>
+#include "url-db.h"
+
+G_BEGIN_DECLS
+
+typedef struct _UrlIndex UrlIndex;
+
+gboolean      url_index_write                       (UrlDb *        db,
+                                                     const gchar *  filename);
+gboolean      url_index_update                      (UrlDb *        db,
+                                                     const gchar *  filename);
+UrlIndex *    url_index_open                        (const gchar *  filename);
+UrlIndex *    url_index_ref                         (UrlIndex *     index);
+void          url_index_unref                       (UrlIndex *     index);
+gint64        url_index_get_generation              (UrlIndex *     index);
+const gchar * url_index_lookup                      (UrlIndex *     index,
+                                                     const gchar *  protocol,
+                                                     gsize          protocollen,
+                                                     const gchar *  domain,
+                                                     gsize          domainlen);
+guint         url_index_size                        (UrlIndex *     index);
+
+G_END_DECLS
+
+#endif /* URL_INDEX_H */
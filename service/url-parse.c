@@ -0,0 +1,312 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* A single pass scanner that accepts exactly what these regular
+   expressions used to accept, compiled with the GRegex defaults:
+
+     appid:       ^appid://([a-z0-9\.-]*)/([a-zA-Z0-9-]*)/([a-zA-Z0-9\.-]*)$
+     application: ^application:///([a-zA-Z0-9_\.-]*)\.desktop$
+     generic:     ^([a-z][a-z0-9]*):(?://(?:.*@)?([a-zA-Z0-9\.-]*)(?::[0-9]*)?/?)?(.*)?$
+     intent:      ^intent://.*package=([a-zA-Z0-9\.]*);.*$
+
+   Nothing is allocated, the results point back into the URL. The
+   input is expected to be valid UTF-8, which DBus guarantees. */
+
+#include <string.h>
+#include "url-parse.h"
+
+#define APPID_PREFIX "appid://"
+#define APPLICATION_PREFIX "application:///"
+#define INTENT_PREFIX "intent://"
+#define INTENT_PACKAGE "package="
+#define DESKTOP_SUFFIX ".desktop"
+
+static inline gboolean
+is_lower_digit (gchar c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+}
+
+static inline gboolean
+is_alnum (gchar c)
+{
+	return is_lower_digit(c) || (c >= 'A' && c <= 'Z');
+}
+
+/* [a-z0-9\.-] */
+static inline gboolean
+is_package_char (gchar c)
+{
+	return is_lower_digit(c) || c == '.' || c == '-';
+}
+
+/* [a-zA-Z0-9-] */
+static inline gboolean
+is_app_char (gchar c)
+{
+	return is_alnum(c) || c == '-';
+}
+
+/* [a-zA-Z0-9\.-], used for both versions and domains */
+static inline gboolean
+is_domain_char (gchar c)
+{
+	return is_alnum(c) || c == '.' || c == '-';
+}
+
+/* [a-zA-Z0-9_\.-] */
+static inline gboolean
+is_desktop_char (gchar c)
+{
+	return is_domain_char(c) || c == '_';
+}
+
+/* [a-zA-Z0-9\.] */
+static inline gboolean
+is_intent_char (gchar c)
+{
+	return is_alnum(c) || c == '.';
+}
+
+/* GRegex recognizes any Unicode newline by default, these are what
+   '.' won't match and what '$' is allowed to come before */
+static gsize
+newline_len (const gchar * p)
+{
+	switch ((guchar)p[0]) {
+	case '\r':
+		return p[1] == '\n' ? 2 : 1;
+	case '\n':
+	case '\v':
+	case '\f':
+		return 1;
+	case 0xC2: /* U+0085 */
+		return (guchar)p[1] == 0x85 ? 2 : 0;
+	case 0xE2: /* U+2028 and U+2029 */
+		return ((guchar)p[1] == 0x80 && ((guchar)p[2] == 0xA8 || (guchar)p[2] == 0xA9)) ? 3 : 0;
+	}
+
+	return 0;
+}
+
+/* Where a '$' would match: end of string or before a final newline */
+static gboolean
+at_end (const gchar * p)
+{
+	if (*p == '\0') {
+		return TRUE;
+	}
+
+	gsize len = newline_len(p);
+	return len != 0 && p[len] == '\0';
+}
+
+/* Where a '.*' starting at @p has to stop */
+static const gchar *
+line_end (const gchar * p)
+{
+	while (*p != '\0' && newline_len(p) == 0) {
+		p++;
+	}
+
+	return p;
+}
+
+static inline void
+span_set (UrlSpan * span, const gchar * start, const gchar * end)
+{
+	span->start = start;
+	span->len = end - start;
+}
+
+/* appid://package/app/version */
+static gboolean
+parse_appid (const gchar * url, UrlParts * parts)
+{
+	const gchar * p = url + strlen(APPID_PREFIX);
+	const gchar * start = p;
+
+	while (is_package_char(*p)) p++;
+	if (*p != '/') {
+		return FALSE;
+	}
+	span_set(&parts->package, start, p);
+
+	start = ++p;
+	while (is_app_char(*p)) p++;
+	if (*p != '/') {
+		return FALSE;
+	}
+	span_set(&parts->app, start, p);
+
+	start = ++p;
+	while (is_domain_char(*p)) p++;
+	if (!at_end(p)) {
+		return FALSE;
+	}
+	span_set(&parts->version, start, p);
+
+	return TRUE;
+}
+
+/* application:///desktop-id.desktop */
+static gboolean
+parse_application (const gchar * url, UrlParts * parts)
+{
+	const gchar * start = url + strlen(APPLICATION_PREFIX);
+	const gchar * p = start;
+
+	/* The suffix is made of characters we'd take anyway, so it has to
+	   be the tail of the run */
+	while (is_desktop_char(*p)) p++;
+	if (!at_end(p)) {
+		return FALSE;
+	}
+
+	gsize suffixlen = strlen(DESKTOP_SUFFIX);
+	if ((gsize)(p - start) < suffixlen || memcmp(p - suffixlen, DESKTOP_SUFFIX, suffixlen) != 0) {
+		return FALSE;
+	}
+
+	span_set(&parts->desktop, start, p - suffixlen);
+	return TRUE;
+}
+
+/* The greedy '.*' in front of 'package=' means the last one that is
+   followed by a ';' wins. Walking backwards from each ';' over the
+   package characters visits every byte at most twice. */
+static void
+parse_intent_package (const gchar * url, const gchar * end, UrlParts * parts)
+{
+	const gchar * low = url + strlen(INTENT_PREFIX);
+	gsize keylen = strlen(INTENT_PACKAGE);
+	const gchar * semi = end;
+
+	while (semi > low) {
+		semi--;
+		if (*semi != ';') {
+			continue;
+		}
+
+		const gchar * value = semi;
+		while (value > low && is_intent_char(value[-1])) {
+			value--;
+		}
+
+		if ((gsize)(value - low) >= keylen && memcmp(value - keylen, INTENT_PACKAGE, keylen) == 0) {
+			span_set(&parts->domain, value, semi);
+			return;
+		}
+
+		semi = value;
+	}
+}
+
+/* protocol:[//[userinfo@]domain[:port][/]]rest */
+static gboolean
+parse_generic (const gchar * url, UrlParts * parts)
+{
+	const gchar * p = url;
+
+	if (!(*p >= 'a' && *p <= 'z')) {
+		return FALSE;
+	}
+	while (is_lower_digit(*p)) p++;
+	if (*p != ':') {
+		return FALSE;
+	}
+	span_set(&parts->protocol, url, p);
+	p++;
+
+	/* Nothing in the pattern matches a newline, so only a final one
+	   is allowed */
+	const gchar * end = line_end(p);
+	if (!at_end(end)) {
+		return FALSE;
+	}
+
+	if (url_span_equal(&parts->protocol, "intent")) {
+		if (p[0] == '/' && p[1] == '/') {
+			parse_intent_package(url, end, parts);
+		}
+		return TRUE;
+	}
+
+	if (p[0] != '/' || p[1] != '/') {
+		return TRUE;
+	}
+	p += 2;
+
+	/* Userinfo runs until the last '@' on the line */
+	const gchar * q;
+	for (q = p; q < end; q++) {
+		if (*q == '@') {
+			p = q + 1;
+		}
+	}
+
+	const gchar * start = p;
+	while (is_domain_char(*p)) p++;
+	span_set(&parts->domain, start, p);
+
+	return TRUE;
+}
+
+/* Figure out which kind of URL we have and where its pieces are */
+UrlKind
+url_parse (const gchar * url, UrlParts * parts)
+{
+	g_return_val_if_fail(parts != NULL, URL_KIND_INVALID);
+
+	memset(parts, 0, sizeof(UrlParts));
+	parts->kind = URL_KIND_INVALID;
+
+	g_return_val_if_fail(url != NULL, URL_KIND_INVALID);
+
+	if (strncmp(url, APPID_PREFIX, strlen(APPID_PREFIX)) == 0 && parse_appid(url, parts)) {
+		parts->kind = URL_KIND_APPID;
+		return parts->kind;
+	}
+
+	if (strncmp(url, APPLICATION_PREFIX, strlen(APPLICATION_PREFIX)) == 0 && parse_application(url, parts)) {
+		parts->kind = URL_KIND_APPLICATION;
+		return parts->kind;
+	}
+
+	/* Leave nothing behind from the special cases */
+	memset(parts, 0, sizeof(UrlParts));
+
+	if (parse_generic(url, parts)) {
+		parts->kind = URL_KIND_GENERIC;
+	} else {
+		memset(parts, 0, sizeof(UrlParts));
+		parts->kind = URL_KIND_INVALID;
+	}
+
+	return parts->kind;
+}
+
+/* Compare a span to a NULL terminated string */
+gboolean
+url_span_equal (const UrlSpan * span, const gchar * str)
+{
+	g_return_val_if_fail(span != NULL, FALSE);
+	g_return_val_if_fail(str != NULL, FALSE);
+
+	gsize len = strlen(str);
+	return span->len == len && (len == 0 || memcmp(span->start, str, len) == 0);
+}
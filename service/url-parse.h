@@ -0,0 +1,61 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef URL_PARSE_H
+#define URL_PARSE_H 1
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+	URL_KIND_INVALID,
+	URL_KIND_APPID,        /* appid://package/app/version */
+	URL_KIND_APPLICATION,  /* application:///desktop-id.desktop */
+	URL_KIND_GENERIC       /* protocol:[//[userinfo@]domain[:port][/]]rest */
+} UrlKind;
+
+/* A view into the URL that was parsed, not NULL terminated */
+typedef struct {
+	const gchar * start;
+	gsize len;
+} UrlSpan;
+
+typedef struct {
+	UrlKind kind;
+
+	/* URL_KIND_GENERIC, for 'intent' the domain is the package= value */
+	UrlSpan protocol;
+	UrlSpan domain;
+
+	/* URL_KIND_APPID */
+	UrlSpan package;
+	UrlSpan app;
+	UrlSpan version;
+
+	/* URL_KIND_APPLICATION, without the .desktop suffix */
+	UrlSpan desktop;
+} UrlParts;
+
+UrlKind       url_parse                             (const gchar *  url,
+                                                     UrlParts *     parts);
+gboolean      url_span_equal                        (const UrlSpan * span,
+                                                     const gchar *  str);
+
+G_END_DECLS
+
+#endif /* URL_PARSE_H */
@@ -0,0 +1,283 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Routing table for the URL database. Each protocol has a tree of
+   domain labels stored from the top level domain down, so that
+   "m.foo.com" walks com -> foo -> m and the deepest node that has
+   an AppID wins. Matches only happen on whole labels, "foo.com"
+   doesn't claim "badfoo.com". Labels are compared ignoring ASCII
+   case, protocols are not. A trie can also be a view of a mapped
+   index, which has the same answers without building the tree. */
+
+#include <string.h>
+#include "url-trie.h"
+
+typedef struct _UrlTrieNode UrlTrieNode;
+struct _UrlTrieNode {
+	gchar * label;
+	gsize len;
+	gchar * appid;
+	GPtrArray * children; /* Sorted by label */
+};
+
+struct _UrlTrie {
+	gint refcount;
+	UrlTrieNode root; /* Children are the protocols */
+	guint size;
+	UrlIndex * index; /* Answers lookups instead of the nodes if set */
+};
+
+static void
+node_free (gpointer data)
+{
+	UrlTrieNode * node = (UrlTrieNode *)data;
+
+	g_free(node->label);
+	g_free(node->appid);
+	if (node->children != NULL) {
+		g_ptr_array_unref(node->children);
+	}
+	g_free(node);
+}
+
+static gint
+label_compare (const gchar * a, gsize alen, const gchar * b, gsize blen, gboolean nocase)
+{
+	gsize i;
+	for (i = 0; i < alen && i < blen; i++) {
+		guchar ac = nocase ? g_ascii_tolower(a[i]) : a[i];
+		guchar bc = nocase ? g_ascii_tolower(b[i]) : b[i];
+
+		if (ac != bc) {
+			return ac < bc ? -1 : 1;
+		}
+	}
+
+	if (alen == blen) {
+		return 0;
+	}
+	return alen < blen ? -1 : 1;
+}
+
+/* Binary search for the child, when not found @index is where it
+   would be inserted */
+static UrlTrieNode *
+node_find_child (UrlTrieNode * node, const gchar * label, gsize len, gboolean nocase, guint * index)
+{
+	guint low = 0;
+	guint high = node->children != NULL ? node->children->len : 0;
+
+	while (low < high) {
+		guint mid = low + (high - low) / 2;
+		UrlTrieNode * child = (UrlTrieNode *)g_ptr_array_index(node->children, mid);
+		gint cmp = label_compare(label, len, child->label, child->len, nocase);
+
+		if (cmp == 0) {
+			return child;
+		} else if (cmp < 0) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+
+	if (index != NULL) {
+		*index = low;
+	}
+	return NULL;
+}
+
+static UrlTrieNode *
+node_get_child (UrlTrieNode * node, const gchar * label, gsize len, gboolean nocase)
+{
+	guint index = 0;
+	UrlTrieNode * child = node_find_child(node, label, len, nocase, &index);
+
+	if (child != NULL) {
+		return child;
+	}
+
+	child = g_new0(UrlTrieNode, 1);
+	child->label = nocase ? g_ascii_strdown(label, len) : g_strndup(label, len);
+	child->len = len;
+
+	if (node->children == NULL) {
+		node->children = g_ptr_array_new_with_free_func(node_free);
+	}
+	g_ptr_array_insert(node->children, index, child);
+
+	return child;
+}
+
+/* Finds the label that ends at @end, returns where it starts
+   and sets @next to where the one before it ends, or NULL */
+static const gchar *
+label_before (const gchar * domain, const gchar * end, const gchar ** next)
+{
+	const gchar * start = end;
+
+	while (start > domain && start[-1] != '.') {
+		start--;
+	}
+
+	*next = start > domain ? start - 1 : NULL;
+	return start;
+}
+
+UrlTrie *
+url_trie_new ()
+{
+	UrlTrie * trie = g_new0(UrlTrie, 1);
+	trie->refcount = 1;
+	return trie;
+}
+
+/* A trie that looks up in @index, nothing can be inserted into it */
+UrlTrie *
+url_trie_new_for_index (UrlIndex * index)
+{
+	g_return_val_if_fail(index != NULL, NULL);
+
+	UrlTrie * trie = url_trie_new();
+	trie->index = url_index_ref(index);
+	trie->size = url_index_size(index);
+	return trie;
+}
+
+/* Tries are shared between threads once they're built, the refcount
+   is atomic but nothing else is locked so they shouldn't be changed
+   after that */
+UrlTrie *
+url_trie_ref (UrlTrie * trie)
+{
+	g_return_val_if_fail(trie != NULL, NULL);
+
+	g_atomic_int_inc(&trie->refcount);
+	return trie;
+}
+
+void
+url_trie_unref (UrlTrie * trie)
+{
+	g_return_if_fail(trie != NULL);
+
+	if (!g_atomic_int_dec_and_test(&trie->refcount)) {
+		return;
+	}
+
+	if (trie->root.children != NULL) {
+		g_ptr_array_unref(trie->root.children);
+	}
+	if (trie->index != NULL) {
+		url_index_unref(trie->index);
+	}
+	g_free(trie);
+}
+
+/* Adds a handler, if there is already one for the same protocol and
+   domain suffix the first one stays and FALSE is returned */
+gboolean
+url_trie_insert (UrlTrie * trie, const gchar * protocol, const gchar * domainsuffix, const gchar * appid)
+{
+	g_return_val_if_fail(trie != NULL, FALSE);
+	g_return_val_if_fail(protocol != NULL, FALSE);
+	g_return_val_if_fail(appid != NULL, FALSE);
+	g_return_val_if_fail(trie->index == NULL, FALSE);
+
+	if (domainsuffix == NULL) {
+		domainsuffix = "";
+	}
+
+	/* A leading dot doesn't change which hosts are under the suffix */
+	while (domainsuffix[0] == '.') {
+		domainsuffix++;
+	}
+
+	UrlTrieNode * node = node_get_child(&trie->root, protocol, strlen(protocol), FALSE);
+
+	if (domainsuffix[0] != '\0') {
+		const gchar * end = domainsuffix + strlen(domainsuffix);
+
+		while (end != NULL) {
+			const gchar * next = NULL;
+			const gchar * start = label_before(domainsuffix, end, &next);
+
+			node = node_get_child(node, start, end - start, TRUE);
+			end = next;
+		}
+	}
+
+	if (node->appid != NULL) {
+		return FALSE;
+	}
+
+	node->appid = g_strdup(appid);
+	trie->size++;
+
+	return TRUE;
+}
+
+/* Finds the AppID registered for the longest suffix of @domain, the
+   strings don't need to be NULL terminated */
+const gchar *
+url_trie_lookup (UrlTrie * trie, const gchar * protocol, gsize protocollen, const gchar * domain, gsize domainlen)
+{
+	g_return_val_if_fail(trie != NULL, NULL);
+	g_return_val_if_fail(protocol != NULL, NULL);
+
+	if (trie->index != NULL) {
+		return url_index_lookup(trie->index, protocol, protocollen, domain, domainlen);
+	}
+
+	UrlTrieNode * node = node_find_child(&trie->root, protocol, protocollen, FALSE, NULL);
+	if (node == NULL) {
+		return NULL;
+	}
+
+	const gchar * appid = node->appid;
+
+	if (domain == NULL || domainlen == 0) {
+		return appid;
+	}
+
+	const gchar * end = domain + domainlen;
+	while (end != NULL) {
+		const gchar * next = NULL;
+		const gchar * start = label_before(domain, end, &next);
+
+		node = node_find_child(node, start, end - start, TRUE, NULL);
+		if (node == NULL) {
+			break;
+		}
+
+		if (node->appid != NULL) {
+			appid = node->appid;
+		}
+		end = next;
+	}
+
+	return appid;
+}
+
+/* Number of handlers in the trie */
+guint
+url_trie_size (UrlTrie * trie)
+{
+	g_return_val_if_fail(trie != NULL, 0);
+
+	return trie->size;
+}
@@ -0,0 +1,45 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef URL_TRIE_H
+#define URL_TRIE_H 1
+
+#include <glib.h>
+#include "url-index.h"
+
+G_BEGIN_DECLS
+
+typedef struct _UrlTrie UrlTrie;
+
+UrlTrie *     url_trie_new                          ();
+UrlTrie *     url_trie_new_for_index                (UrlIndex *     index);
+UrlTrie *     url_trie_ref                          (UrlTrie *      trie);
+void          url_trie_unref                        (UrlTrie *      trie);
+gboolean      url_trie_insert                       (UrlTrie *      trie,
+                                                     const gchar *  protocol,
+                                                     const gchar *  domainsuffix,
+                                                     const gchar *  appid);
+const gchar * url_trie_lookup                       (UrlTrie *      trie,
+                                                     const gchar *  protocol,
+                                                     gsize          protocollen,
+                                                     const gchar *  domain,
+                                                     gsize          domainlen);
+guint         url_trie_size                         (UrlTrie *      trie);
+
+G_END_DECLS
+
+#endif /* URL_TRIE_H */
@@ -18,7 +18,11 @@
 
 #include <gtest/gtest.h>
 #include "url-db.h"
+#include "url-index.h"
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 class DirectoryUpdateTest : public ::testing::Test
 {
@@ -37,7 +41,8 @@ class DirectoryUpdateTest : public ::testing::Test
 			g_free(cachedir);
 		}
 
-		int get_file_count (sqlite3 * db) {
+		int get_file_count (UrlDb * urldb) {
+			sqlite3 * db = url_db_get_connection(urldb);
 			sqlite3_stmt * stmt;
 			if (sqlite3_prepare_v2(db,
 					"select count(*) from configfiles",
@@ -64,7 +69,8 @@ class DirectoryUpdateTest : public ::testing::Test
 			return retval;
 		}
 
-		int get_url_count (sqlite3 * db) {
+		int get_url_count (UrlDb * urldb) {
+			sqlite3 * db = url_db_get_connection(urldb);
 			sqlite3_stmt * stmt;
 			if (sqlite3_prepare_v2(db,
 					"select count(*) from urls",
@@ -91,7 +97,8 @@ class DirectoryUpdateTest : public ::testing::Test
 			return retval;
 		}
 
-		bool has_file (sqlite3 * db, const char * filename) {
+		bool has_file (UrlDb * urldb, const char * filename) {
+			sqlite3 * db = url_db_get_connection(urldb);
 			sqlite3_stmt * stmt;
 			if (sqlite3_prepare_v2(db,
 					"select count(*) from configfiles where name = ?1",
@@ -125,7 +132,8 @@ class DirectoryUpdateTest : public ::testing::Test
 			return retval == 1;
 		}
 
-		bool has_url (sqlite3 * db, const char * protocol, const char * domainsuffix) {
+		bool has_url (UrlDb * urldb, const char * protocol, const char * domainsuffix) {
+			sqlite3 * db = url_db_get_connection(urldb);
 			sqlite3_stmt * stmt;
 			if (sqlite3_prepare_v2(db,
 					"select count(*) from urls where protocol = ?1 and domainsuffix = ?2",
@@ -163,7 +171,7 @@ class DirectoryUpdateTest : public ::testing::Test
 
 TEST_F(DirectoryUpdateTest, DirDoesntExist)
 {
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	gchar * cmdline = g_strdup_printf("%s \"%s\"", UPDATE_DIRECTORY_TOOL, CMAKE_SOURCE_DIR "/this-does-not-exist");
 	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
@@ -172,12 +180,12 @@ TEST_F(DirectoryUpdateTest, DirDoesntExist)
 	EXPECT_EQ(0, get_file_count(db));
 	EXPECT_EQ(0, get_url_count(db));
 
-	sqlite3_close(db);
+	url_db_close(db);
 }
 
 TEST_F(DirectoryUpdateTest, SingleGoodItem)
 {
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	gchar * cmdline = g_strdup_printf("%s \"%s\"", UPDATE_DIRECTORY_TOOL, UPDATE_DIRECTORY_URLS);
 	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
@@ -189,13 +197,18 @@ TEST_F(DirectoryUpdateTest, SingleGoodItem)
 	EXPECT_TRUE(has_file(db, UPDATE_DIRECTORY_URLS "/single-good.url-dispatcher"));
 	EXPECT_TRUE(has_url(db, "http", "ubuntu.com"));
 
-	sqlite3_close(db);
+	/* It leaves an index the service can map */
+	gchar * indexfile = url_db_index_filename();
+	EXPECT_TRUE(g_file_test(indexfile, G_FILE_TEST_EXISTS));
+	g_free(indexfile);
+
+	url_db_close(db);
 }
 
 TEST_F(DirectoryUpdateTest, RerunAgain)
 {
 	gchar * cmdline = nullptr;
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	cmdline = g_strdup_printf("%s \"%s\"", UPDATE_DIRECTORY_TOOL, UPDATE_DIRECTORY_URLS);
 	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
@@ -218,12 +231,12 @@ TEST_F(DirectoryUpdateTest, RerunAgain)
 	EXPECT_EQ(1, get_file_count(db));
 	EXPECT_EQ(1, get_url_count(db));
 
-	sqlite3_close(db);
+	url_db_close(db);
 }
 
 TEST_F(DirectoryUpdateTest, VariedItems)
 {
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	gchar * cmdline = g_strdup_printf("%s \"%s\"", UPDATE_DIRECTORY_TOOL, UPDATE_DIRECTORY_VARIED);
 	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
@@ -267,13 +280,13 @@ TEST_F(DirectoryUpdateTest, VariedItems)
 	EXPECT_TRUE(has_file(db, UPDATE_DIRECTORY_VARIED "/dup-file-2.url-dispatcher"));
 	EXPECT_FALSE(has_url(db, "dupfile", "this.is.in.two.file.org"));
 
-	sqlite3_close(db);
+	url_db_close(db);
 }
 
 TEST_F(DirectoryUpdateTest, RemoveFile)
 {
 	gchar * cmdline;
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	/* A temporary directory to put files in */
 	gchar * datadir = g_build_filename(CMAKE_BINARY_DIR, "remove-file-data", nullptr);
@@ -311,13 +324,115 @@ TEST_F(DirectoryUpdateTest, RemoveFile)
 	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
 	g_free(cmdline);
 
-	sqlite3_close(db);
+	url_db_close(db);
+}
+
+TEST_F(DirectoryUpdateTest, SameSecondRewrite)
+{
+	gchar * cmdline;
+	UrlDb * db = url_db_create_database();
+
+	gchar * datadir = g_build_filename(CMAKE_BINARY_DIR, "same-second-data", nullptr);
+	g_mkdir_with_parents(datadir,  1 << 6 | 1 << 7 | 1 << 8); // 700
+	ASSERT_TRUE(g_file_test(datadir, (GFileTest)(G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR)));
+
+	gchar * filename = g_build_filename(datadir, "rewrite.url-dispatcher", nullptr);
+	g_file_set_contents(filename, "[ { \"protocol\": \"http\", \"domain-suffix\": \"one.com\" } ]", -1, nullptr);
+
+	struct timespec times[2] = {{1000000000, 100}, {1000000000, 100}};
+	ASSERT_EQ(0, utimensat(AT_FDCWD, filename, times, 0));
+
+	cmdline = g_strdup_printf("%s \"%s\"", UPDATE_DIRECTORY_TOOL, datadir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+
+	EXPECT_TRUE(has_url(db, "http", "one.com"));
+
+	/* Same size, same inode, same second: only the nanoseconds differ */
+	FILE * file = fopen(filename, "r+");
+	ASSERT_TRUE(file != nullptr);
+	fputs("[ { \"protocol\": \"http\", \"domain-suffix\": \"two.com\" } ]", file);
+	fclose(file);
+
+	times[0].tv_nsec = times[1].tv_nsec = 200;
+	ASSERT_EQ(0, utimensat(AT_FDCWD, filename, times, 0));
+
+	cmdline = g_strdup_printf("%s \"%s\"", UPDATE_DIRECTORY_TOOL, datadir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+
+	EXPECT_EQ(1, get_file_count(db));
+	EXPECT_EQ(1, get_url_count(db));
+	EXPECT_FALSE(has_url(db, "http", "one.com"));
+	EXPECT_TRUE(has_url(db, "http", "two.com"));
+
+	/* Cleanup */
+	cmdline = g_strdup_printf("rm -rf \"%s\"", datadir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+	g_free(filename);
+	g_free(datadir);
+
+	url_db_close(db);
+}
+
+TEST_F(DirectoryUpdateTest, TouchedUnchanged)
+{
+	gchar * cmdline;
+	UrlDb * db = url_db_create_database();
+
+	gchar * datadir = g_build_filename(CMAKE_BINARY_DIR, "touched-data", nullptr);
+	g_mkdir_with_parents(datadir,  1 << 6 | 1 << 7 | 1 << 8); // 700
+	ASSERT_TRUE(g_file_test(datadir, (GFileTest)(G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR)));
+
+	gchar * filename = g_build_filename(datadir, "touched.url-dispatcher", nullptr);
+	g_file_set_contents(filename, "[ { \"protocol\": \"http\", \"domain-suffix\": \"touched.com\" } ]", -1, nullptr);
+
+	struct timespec times[2] = {{1000000000, 0}, {1000000000, 0}};
+	ASSERT_EQ(0, utimensat(AT_FDCWD, filename, times, 0));
+
+	cmdline = g_strdup_printf("%s \"%s\"", UPDATE_DIRECTORY_TOOL, datadir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+
+	EXPECT_TRUE(has_url(db, "http", "touched.com"));
+
+	gint64 generation = 0;
+	EXPECT_TRUE(url_db_get_generation(db, &generation));
+
+	/* Like an upgrade putting the same file back */
+	times[0].tv_sec = times[1].tv_sec = 2000000000;
+	ASSERT_EQ(0, utimensat(AT_FDCWD, filename, times, 0));
+
+	cmdline = g_strdup_printf("%s \"%s\"", UPDATE_DIRECTORY_TOOL, datadir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+
+	/* The new time is kept, the URLs weren't touched */
+	GTimeVal timeval = {0, 0};
+	EXPECT_TRUE(url_db_get_file_motification_time(db, filename, &timeval));
+	EXPECT_EQ(2000000000, timeval.tv_sec);
+
+	gint64 touchedgeneration = 0;
+	EXPECT_TRUE(url_db_get_generation(db, &touchedgeneration));
+	EXPECT_EQ(generation, touchedgeneration);
+	EXPECT_EQ(1, get_url_count(db));
+	EXPECT_TRUE(has_url(db, "http", "touched.com"));
+
+	/* Cleanup */
+	cmdline = g_strdup_printf("rm -rf \"%s\"", datadir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+	g_free(filename);
+	g_free(datadir);
+
+	url_db_close(db);
 }
 
 TEST_F(DirectoryUpdateTest, RemoveDirectory)
 {
 	gchar * cmdline;
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	/* A temporary directory to put files in */
 	gchar * datadir = g_build_filename(CMAKE_BINARY_DIR, "remove-directory-data", nullptr);
@@ -351,12 +466,12 @@ TEST_F(DirectoryUpdateTest, RemoveDirectory)
 	EXPECT_EQ(0, get_url_count(db));
 
 	/* Cleanup */
-	sqlite3_close(db);
+	url_db_close(db);
 }
 
 TEST_F(DirectoryUpdateTest, IntentTest)
 {
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	gchar * cmdline = g_strdup_printf("%s \"%s\"", UPDATE_DIRECTORY_TOOL, UPDATE_DIRECTORY_INTENT);
 	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
@@ -373,5 +488,131 @@ TEST_F(DirectoryUpdateTest, IntentTest)
 	EXPECT_TRUE(has_url(db, "intent", "intent.mixed"));
 	EXPECT_TRUE(has_url(db, "intent", "intent.mixed.again"));
 
-	sqlite3_close(db);
+	url_db_close(db);
+}
+
+TEST_F(DirectoryUpdateTest, ManyFiles)
+{
+	gchar * cmdline;
+	UrlDb * db = url_db_create_database();
+
+	/* More files than go in one batch */
+	gchar * datadir = g_build_filename(CMAKE_BINARY_DIR, "many-files-data", nullptr);
+	g_mkdir_with_parents(datadir,  1 << 6 | 1 << 7 | 1 << 8); // 700
+	ASSERT_TRUE(g_file_test(datadir, (GFileTest)(G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR)));
+
+	for (int i = 0; i < 2500; i++) {
+		gchar * filename = g_strdup_printf("%s/app%d.url-dispatcher", datadir, i);
+		gchar * contents = g_strdup_printf("[ { \"protocol\": \"http\", \"domain-suffix\": \"app%d.com\" } ]", i);
+		g_file_set_contents(filename, contents, -1, nullptr);
+		g_free(contents);
+		g_free(filename);
+	}
+
+	/* Run the tool, with a few parsing threads however many cores
+	   we have */
+	g_setenv("URL_DISPATCHER_UPDATE_THREADS", "4", TRUE);
+	cmdline = g_strdup_printf("%s \"%s\"", UPDATE_DIRECTORY_TOOL, datadir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+	g_unsetenv("URL_DISPATCHER_UPDATE_THREADS");
+
+	EXPECT_EQ(2500, get_file_count(db));
+	EXPECT_EQ(2500, get_url_count(db));
+	EXPECT_TRUE(has_url(db, "http", "app0.com"));
+	EXPECT_TRUE(has_url(db, "http", "app2499.com"));
+
+	/* Cleanup */
+	cmdline = g_strdup_printf("rm -rf \"%s\"", datadir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+	g_free(datadir);
+
+	url_db_close(db);
+}
+
+TEST_F(DirectoryUpdateTest, Rebuild)
+{
+	gchar * cmdline;
+	gint exitstatus = -1;
+	UrlDb * db = url_db_create_database();
+
+	/* One directory the database knows about, one it doesn't */
+	gchar * knowndir = g_build_filename(CMAKE_BINARY_DIR, "rebuild-known-data", nullptr);
+	gchar * newdir = g_build_filename(CMAKE_BINARY_DIR, "rebuild-new-data", nullptr);
+	g_mkdir_with_parents(knowndir,  1 << 6 | 1 << 7 | 1 << 8); // 700
+	g_mkdir_with_parents(newdir,  1 << 6 | 1 << 7 | 1 << 8); // 700
+
+	gchar * keptfile = g_build_filename(knowndir, "kept.url-dispatcher", nullptr);
+	gchar * gonefile = g_build_filename(knowndir, "gone.url-dispatcher", nullptr);
+	gchar * newfile = g_build_filename(newdir, "new.url-dispatcher", nullptr);
+	g_file_set_contents(keptfile, "[ { \"protocol\": \"http\", \"domain-suffix\": \"kept.com\" }, { \"protocol\": \"http\", \"domain-suffix\": \"kept.com\" } ]", -1, nullptr);
+	g_file_set_contents(gonefile, "[ { \"protocol\": \"http\", \"domain-suffix\": \"gone.com\" } ]", -1, nullptr);
+	g_file_set_contents(newfile, "[ { \"protocol\": \"new\" } ]", -1, nullptr);
+
+	cmdline = g_strdup_printf("%s \"%s\"", UPDATE_DIRECTORY_TOOL, knowndir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+
+	EXPECT_EQ(2, get_file_count(db));
+
+	gint64 oldgeneration = 0;
+	EXPECT_TRUE(url_db_get_generation(db, &oldgeneration));
+
+	/* Missed by the update jobs */
+	g_unlink(gonefile);
+
+	/* With the database open the whole time, like the service */
+	cmdline = g_strdup_printf("%s --rebuild \"%s\"", UPDATE_DIRECTORY_TOOL, newdir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, &exitstatus, nullptr);
+	g_free(cmdline);
+	EXPECT_EQ(0, exitstatus);
+
+	EXPECT_EQ(2, get_file_count(db));
+	EXPECT_EQ(2, get_url_count(db));
+	EXPECT_TRUE(has_file(db, keptfile));
+	EXPECT_TRUE(has_file(db, newfile));
+	EXPECT_FALSE(has_file(db, gonefile));
+	EXPECT_TRUE(has_url(db, "http", "kept.com"));
+	EXPECT_FALSE(has_url(db, "http", "gone.com"));
+	gchar * found = url_db_find_url(db, "new", nullptr);
+	EXPECT_STREQ("new", found);
+	g_free(found);
+
+	/* Nothing left behind, and the index is for the new one */
+	gchar * shadowfile = g_build_filename(cachedir, "url-dispatcher", "urls-3.db.new", nullptr);
+	EXPECT_FALSE(g_file_test(shadowfile, G_FILE_TEST_EXISTS));
+	g_free(shadowfile);
+
+	gint64 generation = 0;
+	EXPECT_TRUE(url_db_get_generation(db, &generation));
+	EXPECT_LT(oldgeneration, generation);
+
+	gchar * indexfile = url_db_index_filename();
+	UrlIndex * index = url_index_open(indexfile);
+	ASSERT_TRUE(index != nullptr);
+	EXPECT_EQ(generation, url_index_get_generation(index));
+	url_index_unref(index);
+	g_free(indexfile);
+
+	/* Still gets updated like always */
+	g_unlink(newfile);
+	cmdline = g_strdup_printf("%s \"%s\"", UPDATE_DIRECTORY_TOOL, newdir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+
+	EXPECT_EQ(1, get_file_count(db));
+	EXPECT_EQ(1, get_url_count(db));
+
+	/* Cleanup */
+	cmdline = g_strdup_printf("rm -rf \"%s\" \"%s\"", knowndir, newdir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+	g_free(keptfile);
+	g_free(gonefile);
+	g_free(newfile);
+	g_free(knowndir);
+	g_free(newdir);
+
+	url_db_close(db);
 }
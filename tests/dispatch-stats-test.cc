@@ -0,0 +1,128 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstring>
+
+#include <gtest/gtest.h>
+#include "dispatch-stats.h"
+
+/* A timing with made up durations, in nanoseconds */
+static DispatchTiming
+make_timing (gint64 parse, gint64 lookup)
+{
+	DispatchTiming timing;
+	memset(&timing, 0, sizeof(timing));
+
+	timing.stages[DISPATCH_STAGE_PARSE] = parse;
+	timing.stages[DISPATCH_STAGE_LOOKUP] = lookup;
+	timing.reached = (1 << DISPATCH_STAGE_PARSE) | (1 << DISPATCH_STAGE_LOOKUP);
+	timing.start = 0;
+	timing.mark = parse + lookup;
+
+	return timing;
+}
+
+TEST(DispatchStatsTest, InitTest) {
+	DispatchStats * stats = dispatch_stats_new();
+	ASSERT_NE(nullptr, stats);
+
+	guint64 p50 = 1, p90 = 1, p99 = 1;
+	EXPECT_EQ(0u, dispatch_stats_get(stats, DISPATCH_OUTCOME_LAUNCHED, DISPATCH_STAGE_TOTAL, &p50, &p90, &p99));
+	EXPECT_EQ(0u, p50);
+	EXPECT_EQ(0u, p90);
+	EXPECT_EQ(0u, p99);
+
+	dispatch_stats_free(stats);
+}
+
+TEST(DispatchStatsTest, PercentileTest) {
+	DispatchStats * stats = dispatch_stats_new();
+
+	/* 1µs to 100µs parses */
+	for (int i = 1; i <= 100; i++) {
+		DispatchTiming timing = make_timing(i * 1000, 10);
+		dispatch_stats_record(stats, DISPATCH_OUTCOME_LAUNCHED, &timing);
+	}
+
+	guint64 p50 = 0, p90 = 0, p99 = 0;
+	EXPECT_EQ(100u, dispatch_stats_get(stats, DISPATCH_OUTCOME_LAUNCHED, DISPATCH_STAGE_PARSE, &p50, &p90, &p99));
+
+	/* Within a bucket, which is a quarter of a power of two */
+	EXPECT_GE(p50, 50000u);
+	EXPECT_LE(p50, 50000u * 5 / 4);
+	EXPECT_GE(p90, 90000u);
+	EXPECT_LE(p90, 90000u * 5 / 4);
+	EXPECT_GE(p99, 99000u);
+	EXPECT_LE(p99, 99000u * 5 / 4);
+	EXPECT_LE(p50, p90);
+	EXPECT_LE(p90, p99);
+
+	/* Small values are exact */
+	EXPECT_EQ(100u, dispatch_stats_get(stats, DISPATCH_OUTCOME_LAUNCHED, DISPATCH_STAGE_LOOKUP, &p50, nullptr, nullptr));
+	EXPECT_GE(p50, 10u);
+	EXPECT_LE(p50, 12u);
+
+	/* The total is from the start to the last mark */
+	EXPECT_EQ(100u, dispatch_stats_get(stats, DISPATCH_OUTCOME_LAUNCHED, DISPATCH_STAGE_TOTAL, &p50, nullptr, nullptr));
+	EXPECT_GE(p50, 50010u);
+
+	dispatch_stats_free(stats);
+}
+
+TEST(DispatchStatsTest, OutcomeTest) {
+	DispatchStats * stats = dispatch_stats_new();
+
+	DispatchTiming timing = make_timing(100, 100);
+	dispatch_stats_record(stats, DISPATCH_OUTCOME_BAD_URL, &timing);
+	dispatch_stats_record(stats, DISPATCH_OUTCOME_BAD_URL, &timing);
+	dispatch_stats_record(stats, DISPATCH_OUTCOME_RESTRICTED, &timing);
+
+	EXPECT_EQ(0u, dispatch_stats_get(stats, DISPATCH_OUTCOME_LAUNCHED, DISPATCH_STAGE_TOTAL, nullptr, nullptr, nullptr));
+	EXPECT_EQ(2u, dispatch_stats_get(stats, DISPATCH_OUTCOME_BAD_URL, DISPATCH_STAGE_TOTAL, nullptr, nullptr, nullptr));
+	EXPECT_EQ(1u, dispatch_stats_get(stats, DISPATCH_OUTCOME_RESTRICTED, DISPATCH_STAGE_TOTAL, nullptr, nullptr, nullptr));
+
+	/* Stages that weren't reached aren't counted */
+	EXPECT_EQ(0u, dispatch_stats_get(stats, DISPATCH_OUTCOME_BAD_URL, DISPATCH_STAGE_RESTRICT, nullptr, nullptr, nullptr));
+
+	dispatch_stats_free(stats);
+}
+
+TEST(DispatchStatsTest, TimingTest) {
+	DispatchTiming timing;
+	dispatch_timing_start(&timing);
+
+	g_usleep(1000);
+	dispatch_timing_mark(&timing, DISPATCH_STAGE_PARSE);
+	dispatch_timing_mark(&timing, DISPATCH_STAGE_REPLY);
+
+	EXPECT_GE(timing.stages[DISPATCH_STAGE_PARSE], 1000000);
+	EXPECT_LT(timing.stages[DISPATCH_STAGE_REPLY], timing.stages[DISPATCH_STAGE_PARSE]);
+	EXPECT_EQ(0, timing.stages[DISPATCH_STAGE_LOOKUP]);
+	EXPECT_EQ((1u << DISPATCH_STAGE_PARSE) | (1u << DISPATCH_STAGE_REPLY), timing.reached);
+
+	/* Marks add up */
+	gint64 parse = timing.stages[DISPATCH_STAGE_PARSE];
+	dispatch_timing_mark(&timing, DISPATCH_STAGE_PARSE);
+	EXPECT_GE(timing.stages[DISPATCH_STAGE_PARSE], parse);
+}
+
+TEST(DispatchStatsTest, NamesTest) {
+	EXPECT_STREQ("parse", dispatch_stage_name(DISPATCH_STAGE_PARSE));
+	EXPECT_STREQ("total", dispatch_stage_name(DISPATCH_STAGE_TOTAL));
+	EXPECT_STREQ("launched", dispatch_outcome_name(DISPATCH_OUTCOME_LAUNCHED));
+	EXPECT_STREQ("restricted", dispatch_outcome_name(DISPATCH_OUTCOME_RESTRICTED));
+}
@@ -17,12 +17,17 @@
 
 #include "test-config.h"
 
+#include <cstring>
+#include <string>
+#include <vector>
+
 #include <gio/gio.h>
 #include <gtest/gtest.h>
 #include "dispatcher.h"
 #include "ubuntu-app-launch-mock.h"
 #include "overlay-tracker-mock.h"
 #include "url-db.h"
+#include "url-index.h"
 
 class DispatcherTest : public ::testing::Test
 {
@@ -43,7 +48,7 @@ class DispatcherTest : public ::testing::Test
 			cachedir = g_build_filename(CMAKE_BINARY_DIR, "dispatcher-test-cache", nullptr);
 			g_setenv("URL_DISPATCHER_CACHE_DIR", cachedir, TRUE);
 
-			sqlite3 * db = url_db_create_database();
+			UrlDb * db = url_db_create_database();
 			GTimeVal timestamp;
 			timestamp.tv_sec = 12345;
 			timestamp.tv_usec = 0;
@@ -66,7 +71,7 @@ class DispatcherTest : public ::testing::Test
 			url_db_set_file_motification_time(db, "/testdir/intenter.url-dispatcher", &timestamp);
 			url_db_insert_url(db, "/testdir/intenter.url-dispatcher", "intent", "my.android.package");
 
-			sqlite3_close(db);
+			url_db_close(db);
 
 			testbus = g_test_dbus_new(G_TEST_DBUS_NONE);
 			g_test_dbus_up(testbus);
@@ -115,30 +120,35 @@ TEST_F(DispatcherTest, ApplicationTest)
 	/* Good sanity check */
 	dispatcher_url_to_appid("application:///foo.desktop", &out_appid, &out_url);
 	dispatcher_send_to_app(out_appid, out_url);
+	dispatcher_flush_launches();
 	ASSERT_STREQ("foo", ubuntu_app_launch_mock_get_last_app_id());
 	ubuntu_app_launch_mock_clear_last_app_id();
 
 	/* No .desktop */
 	dispatcher_url_to_appid("application:///foo", &out_appid, &out_url);
 	dispatcher_send_to_app(out_appid, out_url);
+	dispatcher_flush_launches();
 	ASSERT_TRUE(nullptr == ubuntu_app_launch_mock_get_last_app_id());
 	ubuntu_app_launch_mock_clear_last_app_id();
 
 	/* Missing a / */
 	dispatcher_url_to_appid("application://foo.desktop", &out_appid, &out_url);
 	dispatcher_send_to_app(out_appid, out_url);
+	dispatcher_flush_launches();
 	ASSERT_TRUE(nullptr == ubuntu_app_launch_mock_get_last_app_id());
 	ubuntu_app_launch_mock_clear_last_app_id();
 
 	/* Good with hyphens */
 	dispatcher_url_to_appid("application:///my-really-cool-app.desktop", &out_appid, &out_url);
 	dispatcher_send_to_app(out_appid, out_url);
+	dispatcher_flush_launches();
 	ASSERT_STREQ("my-really-cool-app", ubuntu_app_launch_mock_get_last_app_id());
 	ubuntu_app_launch_mock_clear_last_app_id();
 
 	/* Good Click Style */
 	dispatcher_url_to_appid("application:///com.test.foo_bar-app_0.3.4.desktop", &out_appid, &out_url);
 	dispatcher_send_to_app(out_appid, out_url);
+	dispatcher_flush_launches();
 	ASSERT_STREQ("com.test.foo_bar-app_0.3.4", ubuntu_app_launch_mock_get_last_app_id());
 	ubuntu_app_launch_mock_clear_last_app_id();
 
@@ -168,12 +178,14 @@ TEST_F(DispatcherTest, CalendarTest)
 	/* Base Calendar */
 	dispatcher_url_to_appid("calendar:///?starttime=196311221830Z", &out_appid, &out_url);
 	dispatcher_send_to_app(out_appid, out_url);
+	dispatcher_flush_launches();
 	ASSERT_STREQ("com.ubuntu.calendar_calendar_9.8.2343", ubuntu_app_launch_mock_get_last_app_id());
 	ubuntu_app_launch_mock_clear_last_app_id();
 
 	/* Two Slash, nothing else */
 	dispatcher_url_to_appid("calendar://", &out_appid, &out_url);
 	dispatcher_send_to_app(out_appid, out_url);
+	dispatcher_flush_launches();
 	ASSERT_STREQ("com.ubuntu.calendar_calendar_9.8.2343", ubuntu_app_launch_mock_get_last_app_id());
 	ubuntu_app_launch_mock_clear_last_app_id();
 
@@ -234,6 +246,105 @@ TEST_F(DispatcherTest, WebappTest)
 	EXPECT_STREQ("webapp", out_appid);
 	g_free(out_appid);
 
+	/* Only whole labels match */
+	EXPECT_TRUE(dispatcher_url_to_appid("http://badfoo.com", &out_appid, &out_url));
+	EXPECT_STREQ("browser", out_appid);
+	g_free(out_appid);
+
+	return;
+}
+
+TEST_F(DispatcherTest, DatabaseUpdateTest)
+{
+	gchar * out_appid = nullptr;
+	const gchar * out_url = nullptr;
+
+	EXPECT_FALSE(dispatcher_url_to_appid("mailto:someone@example.com", &out_appid, &out_url));
+
+	/* Another connection changes the database, like update-directory */
+	UrlDb * db = url_db_create_database();
+	GTimeVal timestamp = {12345, 0};
+	url_db_set_file_motification_time(db, "/testdir/mailer.url-dispatcher", &timestamp);
+	url_db_insert_url(db, "/testdir/mailer.url-dispatcher", "mailto", nullptr);
+	url_db_close(db);
+
+	EXPECT_TRUE(dispatcher_url_to_appid("mailto:someone@example.com", &out_appid, &out_url));
+	EXPECT_STREQ("mailer", out_appid);
+	g_free(out_appid);
+
+	return;
+}
+
+TEST_F(DispatcherTest, IndexUpdateTest)
+{
+	gchar * out_appid = nullptr;
+	gchar * indexfile = url_db_index_filename();
+
+	/* Changed by update-directory, which writes the index after */
+	UrlDb * db = url_db_create_database();
+	GTimeVal timestamp = {12345, 0};
+	url_db_set_file_motification_time(db, "/testdir/mailer.url-dispatcher", &timestamp);
+	url_db_insert_url(db, "/testdir/mailer.url-dispatcher", "mailto", nullptr);
+	ASSERT_TRUE(url_index_update(db, indexfile));
+
+	EXPECT_TRUE(dispatcher_url_to_appid("mailto:someone@example.com", &out_appid, nullptr));
+	EXPECT_STREQ("mailer", out_appid);
+	g_free(out_appid);
+	out_appid = nullptr;
+
+	/* Now it's mapped, a new index has to be noticed */
+	url_db_remove_file(db, "/testdir/mailer.url-dispatcher");
+	ASSERT_TRUE(url_index_update(db, indexfile));
+
+	EXPECT_FALSE(dispatcher_url_to_appid("mailto:someone@example.com", &out_appid, nullptr));
+	g_free(out_appid);
+	out_appid = nullptr;
+
+	/* An update-directory that stopped before writing the index still
+	   gets noticed, once the database is checked again */
+	url_db_set_file_motification_time(db, "/testdir/mailer.url-dispatcher", &timestamp);
+	url_db_insert_url(db, "/testdir/mailer.url-dispatcher", "mailto", nullptr);
+	url_db_close(db);
+
+	g_usleep(1100000);
+
+	EXPECT_TRUE(dispatcher_url_to_appid("mailto:someone@example.com", &out_appid, nullptr));
+	EXPECT_STREQ("mailer", out_appid);
+	g_free(out_appid);
+
+	g_free(indexfile);
+}
+
+TEST_F(DispatcherTest, CacheTest)
+{
+	gchar * out_appid = nullptr;
+	guint64 hits = 0, misses = 0;
+
+	dispatcher_get_cache_stats(&hits, &misses);
+	EXPECT_EQ(0u, hits);
+	EXPECT_EQ(0u, misses);
+
+	for (int i = 0; i < 3; i++) {
+		EXPECT_TRUE(dispatcher_url_to_appid("http://m.foo.com/path", &out_appid, nullptr));
+		EXPECT_STREQ("webapp", out_appid);
+		g_free(out_appid);
+		out_appid = nullptr;
+	}
+
+	/* Domains are matched ignoring case */
+	EXPECT_TRUE(dispatcher_url_to_appid("http://M.FOO.COM/other", &out_appid, nullptr));
+	EXPECT_STREQ("webapp", out_appid);
+	g_free(out_appid);
+	out_appid = nullptr;
+
+	/* Nobody handling it gets cached too */
+	EXPECT_FALSE(dispatcher_url_to_appid("nothandled://foo.com", &out_appid, nullptr));
+	EXPECT_FALSE(dispatcher_url_to_appid("nothandled://foo.com", &out_appid, nullptr));
+
+	dispatcher_get_cache_stats(&hits, &misses);
+	EXPECT_EQ(4u, hits);
+	EXPECT_EQ(2u, misses);
+
 	return;
 }
 
@@ -260,17 +371,618 @@ TEST_F(DispatcherTest, IntentTest)
 	return;
 }
 
+static void
+focus_signal_cb (GDBusConnection * /*connection*/, const gchar * /*sender_name*/, const gchar * /*object_path*/, const gchar * /*interface_name*/, const gchar * /*signal_name*/, GVariant * /*parameters*/, gpointer user_data)
+{
+	guint * focus_count = static_cast<guint *>(user_data);
+	*focus_count = *focus_count + 1;
+}
+
+TEST_F(DispatcherTest, DashQueueTest)
+{
+	guint focus_count = 0;
+	guint focus_signal = g_dbus_connection_signal_subscribe(session,
+		nullptr, /* sender */
+		"com.canonical.UbuntuAppLaunch",
+		"UnityFocusRequest",
+		"/",
+		nullptr, /* arg0 */
+		G_DBUS_SIGNAL_FLAGS_NONE,
+		focus_signal_cb,
+		&focus_count,
+		nullptr); /* user data free */
+
+	/* The dispatcher hasn't gotten its bus yet, these have to wait */
+	EXPECT_TRUE(dispatcher_send_to_app("unity8-dash", "scope://first"));
+	EXPECT_TRUE(dispatcher_send_to_app("unity8-dash", "scope://second"));
+	EXPECT_EQ(0u, focus_count);
+
+	gint64 end = g_get_monotonic_time() + 5 * G_USEC_PER_SEC;
+	while (focus_count < 2 && g_get_monotonic_time() < end) {
+		if (!g_main_context_iteration(nullptr, FALSE)) {
+			g_usleep(1000);
+		}
+	}
+	EXPECT_EQ(2u, focus_count);
+
+	/* Now it goes straight out */
+	EXPECT_TRUE(dispatcher_send_to_app("unity8-dash", "scope://third"));
+
+	end = g_get_monotonic_time() + 5 * G_USEC_PER_SEC;
+	while (focus_count < 3 && g_get_monotonic_time() < end) {
+		if (!g_main_context_iteration(nullptr, FALSE)) {
+			g_usleep(1000);
+		}
+	}
+	EXPECT_EQ(3u, focus_count);
+
+	g_dbus_connection_signal_unsubscribe(session, focus_signal);
+
+	return;
+}
+
+static void
+overlay_sent_cb (gboolean sent, gpointer user_data)
+{
+	auto results = static_cast<std::vector<bool> *>(user_data);
+	results->push_back(sent);
+}
+
 TEST_F(DispatcherTest, OverlayTest)
 {
 	EXPECT_TRUE(dispatcher_is_overlay("com.test.good_application_1.2.3"));
 	EXPECT_FALSE(dispatcher_is_overlay("com.test.bad_application_1.2.3"));
 
-	EXPECT_TRUE(dispatcher_send_to_overlay ("com.test.good_application_1.2.3", "overlay://ubuntu.com", session, g_dbus_connection_get_unique_name(session)));
+	std::vector<bool> results;
+	const gchar * sender = g_dbus_connection_get_unique_name(session);
+
+	/* Both wait on the same PID lookup */
+	dispatcher_send_to_overlay("com.test.good_application_1.2.3", "overlay://ubuntu.com", sender, overlay_sent_cb, &results);
+	dispatcher_send_to_overlay("com.test.good_application_1.2.3", "overlay://ubuntu.com/two", sender, overlay_sent_cb, &results);
+	EXPECT_EQ(0u, results.size());
+
+	gint64 end = g_get_monotonic_time() + 5 * G_USEC_PER_SEC;
+	while (results.size() < 2 && g_get_monotonic_time() < end) {
+		if (!g_main_context_iteration(nullptr, FALSE)) {
+			g_usleep(1000);
+		}
+	}
+
+	ASSERT_EQ(2u, results.size());
+	EXPECT_TRUE(results[0]);
+	EXPECT_TRUE(results[1]);
 
-	ASSERT_EQ(1, tracker.addedOverlays.size());
+	ASSERT_EQ(2, tracker.addedOverlays.size());
 	EXPECT_EQ("com.test.good_application_1.2.3", std::get<0>(tracker.addedOverlays[0]));
 	EXPECT_EQ(getpid(), std::get<1>(tracker.addedOverlays[0]));
 	EXPECT_EQ("overlay://ubuntu.com", std::get<2>(tracker.addedOverlays[0]));
+	EXPECT_EQ("overlay://ubuntu.com/two", std::get<2>(tracker.addedOverlays[1]));
+
+	/* Known now, so no waiting */
+	dispatcher_send_to_overlay("com.test.good_application_1.2.3", "overlay://ubuntu.com/three", sender, overlay_sent_cb, &results);
+	ASSERT_EQ(3u, results.size());
+	EXPECT_TRUE(results[2]);
+	EXPECT_EQ(getpid(), std::get<1>(tracker.addedOverlays[2]));
+
+	return;
+}
+
+TEST_F(DispatcherTest, OverlayBadSenderTest)
+{
+	std::vector<bool> results;
+
+	dispatcher_send_to_overlay("com.test.good_application_1.2.3", "overlay://ubuntu.com", ":1.99999", overlay_sent_cb, &results);
+
+	gint64 end = g_get_monotonic_time() + 5 * G_USEC_PER_SEC;
+	while (results.size() < 1 && g_get_monotonic_time() < end) {
+		if (!g_main_context_iteration(nullptr, FALSE)) {
+			g_usleep(1000);
+		}
+	}
+
+	ASSERT_EQ(1u, results.size());
+	EXPECT_FALSE(results[0]);
+	EXPECT_EQ(0, tracker.addedOverlays.size());
+
+	return;
+}
+
+struct LookupThreadData {
+	gint stop = 0;
+	gint failures = 0;
+};
+
+static gpointer
+lookup_thread (gpointer user_data)
+{
+	auto data = static_cast<LookupThreadData *>(user_data);
+
+	while (!g_atomic_int_get(&data->stop)) {
+		gchar * out_appid = nullptr;
+
+		if (!dispatcher_url_to_appid("http://m.foo.com/path", &out_appid, nullptr) || g_strcmp0(out_appid, "webapp") != 0) {
+			g_atomic_int_inc(&data->failures);
+		}
+		g_free(out_appid);
+		out_appid = nullptr;
+
+		if (!dispatcher_url_to_appid("tel:+442031485000", &out_appid, nullptr) || g_strcmp0(out_appid, "com.ubuntu.dialer_dialer_1234") != 0) {
+			g_atomic_int_inc(&data->failures);
+		}
+		g_free(out_appid);
+	}
+
+	return nullptr;
+}
+
+TEST_F(DispatcherTest, ThreadedLookupTest)
+{
+	LookupThreadData data;
+	std::vector<GThread *> threads;
+
+	for (int i = 0; i < 4; i++) {
+		threads.push_back(g_thread_new("lookup", lookup_thread, &data));
+	}
+
+	/* Rebuild the trie underneath them */
+	for (int i = 0; i < 10; i++) {
+		UrlDb * db = url_db_create_database();
+		GTimeVal timestamp = {12345, 0};
+		gchar * filename = g_strdup_printf("/testdir/mailer-%d.url-dispatcher", i);
+		url_db_set_file_motification_time(db, filename, &timestamp);
+		url_db_insert_url(db, filename, "mailto", nullptr);
+		url_db_close(db);
+		g_free(filename);
+
+		g_usleep(10000);
+	}
+
+	g_atomic_int_set(&data.stop, 1);
+	for (auto thread : threads) {
+		g_thread_join(thread);
+	}
+
+	EXPECT_EQ(0, data.failures);
+
+	gchar * out_appid = nullptr;
+	EXPECT_TRUE(dispatcher_url_to_appid("mailto:someone@example.com", &out_appid, nullptr));
+	EXPECT_STREQ("mailer-0", out_appid);
+	g_free(out_appid);
+
+	return;
+}
+
+class DispatcherLimitTest : public DispatcherTest
+{
+	protected:
+		virtual void SetUp() {
+			g_setenv("URL_DISPATCHER_MAX_URL_LENGTH", "4096", TRUE);
+			DispatcherTest::SetUp();
+		}
+
+		virtual void TearDown() {
+			DispatcherTest::TearDown();
+			g_unsetenv("URL_DISPATCHER_MAX_URL_LENGTH");
+		}
+};
+
+TEST_F(DispatcherLimitTest, HugeURLTest)
+{
+	std::string prefix = "http://m.foo.com/";
+	std::string atlimit = prefix + std::string(4096 - prefix.size(), 'a');
+	std::string overlimit = atlimit + "a";
+	std::string huge = prefix + std::string(10 * 1024 * 1024, 'a');
+
+	gchar * out_appid = nullptr;
+	EXPECT_TRUE(dispatcher_url_to_appid(atlimit.c_str(), &out_appid, nullptr));
+	EXPECT_STREQ("webapp", out_appid);
+	g_free(out_appid);
+
+	out_appid = nullptr;
+	EXPECT_FALSE(dispatcher_url_to_appid(overlimit.c_str(), &out_appid, nullptr));
+	EXPECT_FALSE(dispatcher_url_to_appid(huge.c_str(), &out_appid, nullptr));
+	EXPECT_EQ(nullptr, out_appid);
+
+	/* Turning them away doesn't get in the way of the URLs after them,
+	   url-resolve-bench's hit-with-huge mix has how long those take */
+	EXPECT_TRUE(dispatcher_url_to_appid("http://m.foo.com/path", &out_appid, nullptr));
+	EXPECT_STREQ("webapp", out_appid);
+	g_free(out_appid);
+	out_appid = nullptr;
+
+	EXPECT_TRUE(dispatcher_url_to_appid(atlimit.c_str(), &out_appid, nullptr));
+	EXPECT_STREQ("webapp", out_appid);
+	g_free(out_appid);
+
+	return;
+}
+
+class DispatcherWorkerTest : public DispatcherTest
+{
+	protected:
+		virtual void SetUp() {
+			g_setenv("URL_DISPATCHER_WORKERS", "2", TRUE);
+			DispatcherTest::SetUp();
+		}
+
+		virtual void TearDown() {
+			DispatcherTest::TearDown();
+			g_unsetenv("URL_DISPATCHER_WORKERS");
+		}
+
+		static void call_cb (GObject * /*object*/, GAsyncResult * res, gpointer user_data) {
+			*static_cast<GAsyncResult **>(user_data) = G_ASYNC_RESULT(g_object_ref(res));
+		}
+
+		/* Calls the dispatcher over the bus, retrying until it has exported
+		   its interface */
+		GVariant * call (const gchar * method, GVariant * params, GError ** error) {
+			GVariant * result = nullptr;
+			gint64 end = g_get_monotonic_time() + 5 * G_USEC_PER_SEC;
+
+			g_variant_ref_sink(params);
+
+			do {
+				GAsyncResult * res = nullptr;
+
+				g_clear_error(error);
+				g_dbus_connection_call(session,
+					g_dbus_connection_get_unique_name(session),
+					"/com/canonical/URLDispatcher",
+					"com.canonical.URLDispatcher",
+					method,
+					params,
+					nullptr, /* reply type */
+					G_DBUS_CALL_FLAGS_NONE,
+					-1, /* timeout */
+					nullptr, /* cancellable */
+					call_cb,
+					&res);
+
+				while (res == nullptr) {
+					if (!g_main_context_iteration(nullptr, FALSE)) {
+						g_usleep(1000);
+					}
+				}
+
+				result = g_dbus_connection_call_finish(session, res, error);
+				g_object_unref(res);
+			} while (result == nullptr &&
+				(g_error_matches(*error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD) ||
+				 g_error_matches(*error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_OBJECT) ||
+				 g_error_matches(*error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_INTERFACE)) &&
+				g_get_monotonic_time() < end);
+
+			g_variant_unref(params);
+
+			return result;
+		}
+};
+
+TEST_F(DispatcherWorkerTest, TestURLTest)
+{
+	GError * error = nullptr;
+	const gchar * urls[] = {
+		"http://m.foo.com/path",
+		"tel:+442031485000",
+		"application:///foo.desktop",
+		nullptr
+	};
+
+	GVariant * result = call("TestURL", g_variant_new("(^as)", urls), &error);
+	ASSERT_NE(nullptr, result);
+	EXPECT_TRUE(g_variant_equal(result, g_variant_new_parsed("(['webapp', 'com.ubuntu.dialer_dialer_1234', 'foo'],)")));
+	g_variant_unref(result);
+
+	/* One bad one fails the lot */
+	const gchar * badurls[] = {
+		"tel:+442031485000",
+		"nothandled://foo.com",
+		nullptr
+	};
+
+	result = call("TestURL", g_variant_new("(^as)", badurls), &error);
+	EXPECT_EQ(nullptr, result);
+	ASSERT_NE(nullptr, error);
+	gchar * errorname = g_dbus_error_get_remote_error(error);
+	EXPECT_STREQ("com.canonical.URLDispatcher.BadURL", errorname);
+	g_free(errorname);
+	g_clear_error(&error);
+
+	/* Workers notice the database changing too */
+	UrlDb * db = url_db_create_database();
+	GTimeVal timestamp = {12345, 0};
+	url_db_set_file_motification_time(db, "/testdir/mailer.url-dispatcher", &timestamp);
+	url_db_insert_url(db, "/testdir/mailer.url-dispatcher", "mailto", nullptr);
+	url_db_close(db);
+
+	const gchar * mailurls[] = {
+		"mailto:someone@example.com",
+		nullptr
+	};
+
+	result = call("TestURL", g_variant_new("(^as)", mailurls), &error);
+	ASSERT_NE(nullptr, result);
+	EXPECT_TRUE(g_variant_equal(result, g_variant_new_parsed("(['mailer'],)")));
+	g_variant_unref(result);
+
+	return;
+}
+
+TEST_F(DispatcherWorkerTest, TestURLsTest)
+{
+	GError * error = nullptr;
+
+	/* Enough for a few chunks, with a bad one here and there */
+	std::vector<std::string> urls;
+	for (int i = 0; i < 600; i++) {
+		if (i % 100 == 50) {
+			urls.push_back("nothandled://foo.com");
+		} else if (i % 2 == 0) {
+			urls.push_back("http://m.foo.com/" + std::to_string(i));
+		} else {
+			urls.push_back("tel:+44203148" + std::to_string(i));
+		}
+	}
+
+	GVariantBuilder builder;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("as"));
+	for (const auto & url : urls) {
+		g_variant_builder_add(&builder, "s", url.c_str());
+	}
+
+	GVariant * result = call("TestURLs", g_variant_new("(as)", &builder), &error);
+	ASSERT_NE(nullptr, result);
+
+	GVariant * results = g_variant_get_child_value(result, 0);
+	ASSERT_EQ(urls.size(), g_variant_n_children(results));
+
+	for (guint i = 0; i < urls.size(); i++) {
+		const gchar * appid = nullptr;
+		const gchar * errorname = nullptr;
+		g_variant_get_child(results, i, "(&s&s)", &appid, &errorname);
+
+		if (i % 100 == 50) {
+			EXPECT_STREQ("", appid);
+			EXPECT_STREQ("com.canonical.URLDispatcher.BadURL", errorname);
+		} else if (i % 2 == 0) {
+			EXPECT_STREQ("webapp", appid);
+			EXPECT_STREQ("", errorname);
+		} else {
+			EXPECT_STREQ("com.ubuntu.dialer_dialer_1234", appid);
+			EXPECT_STREQ("", errorname);
+		}
+	}
+
+	g_variant_unref(results);
+	g_variant_unref(result);
+
+	/* Nothing to test is fine too */
+	const gchar * nourls[] = {
+		nullptr
+	};
+
+	result = call("TestURLs", g_variant_new("(^as)", nourls), &error);
+	ASSERT_NE(nullptr, result);
+	EXPECT_TRUE(g_variant_equal(result, g_variant_new_parsed("(@a(ss) [],)")));
+	g_variant_unref(result);
+
+	return;
+}
+
+TEST_F(DispatcherWorkerTest, DispatchURLTest)
+{
+	GError * error = nullptr;
+
+	GVariant * result = call("DispatchURL", g_variant_new("(ss)", "tel:+442031485000", ""), &error);
+	ASSERT_NE(nullptr, result);
+	g_variant_unref(result);
+	dispatcher_flush_launches();
+	EXPECT_STREQ("com.ubuntu.dialer_dialer_1234", ubuntu_app_launch_mock_get_last_app_id());
+	ubuntu_app_launch_mock_clear_last_app_id();
+
+	/* Restrictions are still checked */
+	result = call("DispatchURL", g_variant_new("(ss)", "tel:+442031485000", "com.ubuntu.notdialer"), &error);
+	EXPECT_EQ(nullptr, result);
+	ASSERT_NE(nullptr, error);
+	gchar * errorname = g_dbus_error_get_remote_error(error);
+	EXPECT_STREQ("com.canonical.URLDispatcher.RestrictedURL", errorname);
+	g_free(errorname);
+	g_clear_error(&error);
+	dispatcher_flush_launches();
+	EXPECT_EQ(nullptr, ubuntu_app_launch_mock_get_last_app_id());
+
+	return;
+}
+
+TEST_F(DispatcherWorkerTest, DispatchURLsTest)
+{
+	GError * error = nullptr;
+
+	GVariant * result = call("DispatchURLs", g_variant_new_parsed("([('http://m.foo.com/one', ''), ('nothandled://foo.com', ''), ('tel:+442031485000', 'com.ubuntu.notdialer'), ('http://m.foo.com/two', ''), ('', '')],)"), &error);
+	ASSERT_NE(nullptr, result);
+	EXPECT_TRUE(g_variant_equal(result, g_variant_new_parsed("(['', 'com.canonical.URLDispatcher.BadURL', 'com.canonical.URLDispatcher.RestrictedURL', '', 'com.canonical.URLDispatcher.BadURL'],)")));
+	g_variant_unref(result);
+
+	/* Both URLs went to the webapp in one start */
+	dispatcher_flush_launches();
+	EXPECT_STREQ("webapp", ubuntu_app_launch_mock_get_last_app_id());
+
+	LaunchQueueStats stats;
+	dispatcher_get_launch_stats(&stats);
+	EXPECT_EQ(1u, stats.launched);
+	EXPECT_EQ(0u, stats.coalesced);
+
+	/* Nothing to do is fine too */
+	result = call("DispatchURLs", g_variant_new_parsed("(@a(ss) [],)"), &error);
+	ASSERT_NE(nullptr, result);
+	EXPECT_TRUE(g_variant_equal(result, g_variant_new_parsed("(@as [],)")));
+	g_variant_unref(result);
+
+	return;
+}
+
+TEST_F(DispatcherWorkerTest, HugeURLTest)
+{
+	GError * error = nullptr;
+
+	/* Over the default limit, it doesn't come back in the error */
+	std::string huge = "http://m.foo.com/" + std::string(10 * 1024 * 1024, 'a');
+
+	GVariant * result = call("DispatchURL", g_variant_new("(ss)", huge.c_str(), ""), &error);
+	EXPECT_EQ(nullptr, result);
+	ASSERT_NE(nullptr, error);
+	gchar * errorname = g_dbus_error_get_remote_error(error);
+	EXPECT_STREQ("com.canonical.URLDispatcher.BadURL", errorname);
+	g_free(errorname);
+	EXPECT_GT(1024u, strlen(error->message));
+	g_clear_error(&error);
+	dispatcher_flush_launches();
+	EXPECT_EQ(nullptr, ubuntu_app_launch_mock_get_last_app_id());
+
+	const gchar * urls[] = {
+		"tel:+442031485000",
+		huge.c_str(),
+		nullptr
+	};
+
+	result = call("TestURLs", g_variant_new("(^as)", urls), &error);
+	ASSERT_NE(nullptr, result);
+	EXPECT_TRUE(g_variant_equal(result, g_variant_new_parsed("([('com.ubuntu.dialer_dialer_1234', ''), ('', 'com.canonical.URLDispatcher.BadURL')],)")));
+	g_variant_unref(result);
+
+	return;
+}
+
+TEST_F(DispatcherWorkerTest, GetStatisticsTest)
+{
+	GError * error = nullptr;
+
+	GVariant * result = call("DispatchURL", g_variant_new("(ss)", "tel:+442031485000", ""), &error);
+	ASSERT_NE(nullptr, result);
+	g_variant_unref(result);
+
+	result = call("DispatchURL", g_variant_new("(ss)", "tel:+442031485000", "com.ubuntu.notdialer"), &error);
+	EXPECT_EQ(nullptr, result);
+	g_clear_error(&error);
+
+	dispatcher_flush_launches();
+
+	result = call("GetStatistics", g_variant_new("()"), &error);
+	ASSERT_NE(nullptr, result);
+
+	GVariantIter * stages = nullptr;
+	GVariantIter * counters = nullptr;
+	g_variant_get(result, "(a(sstttt)a{st})", &stages, &counters);
+
+	const gchar * outcome = nullptr;
+	const gchar * stage = nullptr;
+	guint64 count = 0, p50 = 0, p90 = 0, p99 = 0;
+	guint rows = 0;
+
+	while (g_variant_iter_next(stages, "(&s&stttt)", &outcome, &stage, &count, &p50, &p90, &p99)) {
+		rows++;
+
+		if (g_strcmp0(outcome, "launched") == 0 && g_strcmp0(stage, "total") == 0) {
+			EXPECT_EQ(1u, count);
+			EXPECT_LT(0u, p50);
+			EXPECT_LE(p50, p90);
+			EXPECT_LE(p90, p99);
+		} else if (g_strcmp0(outcome, "restricted") == 0 && (g_strcmp0(stage, "total") == 0 || g_strcmp0(stage, "restrict") == 0)) {
+			EXPECT_EQ(1u, count);
+		} else if (g_strcmp0(outcome, "restricted") == 0 && g_strcmp0(stage, "handoff") == 0) {
+			/* Never got that far */
+			EXPECT_EQ(0u, count);
+		} else if (g_strcmp0(outcome, "bad-url") == 0) {
+			EXPECT_EQ(0u, count);
+		}
+	}
+
+	/* Every stage of every outcome */
+	EXPECT_EQ(32u, rows);
+
+	const gchar * name = nullptr;
+	bool foundlaunches = false;
+	while (g_variant_iter_next(counters, "{&st}", &name, &count)) {
+		if (g_strcmp0(name, "launches") == 0) {
+			EXPECT_EQ(1u, count);
+			foundlaunches = true;
+		}
+	}
+	EXPECT_TRUE(foundlaunches);
+
+	g_variant_iter_free(stages);
+	g_variant_iter_free(counters);
+	g_variant_unref(result);
+
+	return;
+}
+
+/* Everything on the main thread, as it is by default */
+class DispatcherMainThreadTest : public DispatcherWorkerTest
+{
+	protected:
+		virtual void SetUp() {
+			g_setenv("URL_DISPATCHER_WORKERS", "0", TRUE);
+			DispatcherTest::SetUp();
+		}
+};
+
+TEST_F(DispatcherMainThreadTest, EarlyRequestTest)
+{
+	GError * error = nullptr;
+	const gchar * urls[] = {
+		"http://m.foo.com/path",
+		"tel:+442031485000",
+		nullptr
+	};
+
+	/* Sent as soon as we're started, before the database is likely
+	   to be open, and answered once it is */
+	GVariant * result = call("TestURL", g_variant_new("(^as)", urls), &error);
+	ASSERT_NE(nullptr, result);
+	EXPECT_TRUE(g_variant_equal(result, g_variant_new_parsed("(['webapp', 'com.ubuntu.dialer_dialer_1234'],)")));
+	g_variant_unref(result);
+
+	result = call("DispatchURL", g_variant_new("(ss)", "tel:+442031485000", ""), &error);
+	ASSERT_NE(nullptr, result);
+	g_variant_unref(result);
+	dispatcher_flush_launches();
+	EXPECT_STREQ("com.ubuntu.dialer_dialer_1234", ubuntu_app_launch_mock_get_last_app_id());
+
+	return;
+}
+
+TEST_F(DispatcherTest, LaunchQueueTest)
+{
+	/* Quick taps on the same app, the second is merged if it comes
+	   in while the first is starting */
+	EXPECT_TRUE(dispatcher_send_to_app("com.test.foo_bar-app_0.3.4", "foo://one"));
+	EXPECT_TRUE(dispatcher_send_to_app("com.test.foo_bar-app_0.3.4", "foo://two"));
+
+	dispatcher_flush_launches();
+	EXPECT_STREQ("com.test.foo_bar-app_0.3.4", ubuntu_app_launch_mock_get_last_app_id());
+
+	LaunchQueueStats stats;
+	dispatcher_get_launch_stats(&stats);
+	EXPECT_EQ(0u, stats.depth);
+	EXPECT_LE(1u, stats.max_depth);
+	EXPECT_LE(1u, stats.launched);
+	EXPECT_EQ(2u, stats.launched + stats.coalesced);
+
+	/* A lone one goes out without waiting on anything */
+	ubuntu_app_launch_mock_clear_last_app_id();
+	guint64 launched = stats.launched;
+	EXPECT_TRUE(dispatcher_send_to_app("foo", "foo://three"));
+
+	gint64 end = g_get_monotonic_time() + 5 * G_USEC_PER_SEC;
+	do {
+		g_usleep(1000);
+		dispatcher_get_launch_stats(&stats);
+	} while (stats.launched == launched && g_get_monotonic_time() < end);
+
+	EXPECT_EQ(launched + 1, stats.launched);
+	EXPECT_STREQ("foo", ubuntu_app_launch_mock_get_last_app_id());
 
 	return;
 }
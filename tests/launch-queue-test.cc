@@ -0,0 +1,263 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "launch-queue.h"
+
+class LaunchQueueTest : public ::testing::Test
+{
+	protected:
+		GMutex lock;
+		GCond cond;
+		std::vector<std::pair<std::string, std::string>> launches;
+		GThread * launchthread = nullptr;
+		gboolean result = TRUE;
+		bool hold = false; /* Starts don't return until it's cleared */
+		size_t entered = 0;
+
+		virtual void SetUp() {
+			g_mutex_init(&lock);
+			g_cond_init(&cond);
+		}
+
+		virtual void TearDown() {
+			g_cond_clear(&cond);
+			g_mutex_clear(&lock);
+		}
+
+		static gboolean launch (const gchar * appid, const gchar * const * urls, gpointer user_data) {
+			auto self = static_cast<LaunchQueueTest *>(user_data);
+			gchar * joined = g_strjoinv(" ", (gchar **)urls);
+
+			g_mutex_lock(&self->lock);
+			self->launches.push_back(std::make_pair(std::string(appid), std::string(joined)));
+			self->launchthread = g_thread_self();
+			self->entered++;
+			g_cond_broadcast(&self->cond);
+			while (self->hold) {
+				g_cond_wait(&self->cond, &self->lock);
+			}
+			g_mutex_unlock(&self->lock);
+
+			g_free(joined);
+
+			return self->result;
+		}
+
+		void push (LaunchQueue * queue, const gchar * appid, const gchar * url) {
+			const gchar * urls[2] = {
+				url,
+				nullptr
+			};
+			launch_queue_push(queue, appid, urls);
+		}
+
+		size_t launched () {
+			g_mutex_lock(&lock);
+			size_t count = launches.size();
+			g_mutex_unlock(&lock);
+			return count;
+		}
+
+		/* Holds the next starts in the launch function */
+		void hold_starts () {
+			g_mutex_lock(&lock);
+			hold = true;
+			g_mutex_unlock(&lock);
+		}
+
+		void wait_for_start (size_t count) {
+			g_mutex_lock(&lock);
+			while (entered < count) {
+				g_cond_wait(&cond, &lock);
+			}
+			g_mutex_unlock(&lock);
+		}
+
+		void release_starts () {
+			g_mutex_lock(&lock);
+			hold = false;
+			g_cond_broadcast(&cond);
+			g_mutex_unlock(&lock);
+		}
+};
+
+TEST_F(LaunchQueueTest, Coalesce)
+{
+	LaunchQueue * queue = launch_queue_new(launch, this);
+	hold_starts();
+
+	/* The first one doesn't wait on anything */
+	push(queue, "app", "app://one");
+	wait_for_start(1);
+
+	/* These come in while it's starting */
+	push(queue, "other", "other://one");
+	push(queue, "app", "app://two");
+	push(queue, "app", "app://three");
+	push(queue, "app", "app://two");
+
+	LaunchQueueStats stats;
+	launch_queue_get_stats(queue, &stats);
+	EXPECT_EQ(3u, stats.depth);
+	EXPECT_EQ(3u, stats.max_depth);
+	EXPECT_EQ(2u, stats.coalesced);
+
+	release_starts();
+	launch_queue_flush(queue);
+
+	/* Every URL gets to the app, once */
+	ASSERT_EQ(3u, launches.size());
+	EXPECT_EQ("app", launches[0].first);
+	EXPECT_EQ("app://one", launches[0].second);
+	EXPECT_EQ("other", launches[1].first);
+	EXPECT_EQ("other://one", launches[1].second);
+	EXPECT_EQ("app", launches[2].first);
+	EXPECT_EQ("app://two app://three", launches[2].second);
+	EXPECT_NE(g_thread_self(), launchthread);
+
+	launch_queue_get_stats(queue, &stats);
+	EXPECT_EQ(0u, stats.depth);
+	EXPECT_EQ(3u, stats.launched);
+	EXPECT_EQ(0u, stats.failed);
+	EXPECT_LE(stats.latency_max, stats.latency_total);
+
+	/* Once it's started a new request is a new start */
+	push(queue, "app", "app://four");
+	launch_queue_flush(queue);
+	ASSERT_EQ(4u, launches.size());
+	EXPECT_EQ("app://four", launches[3].second);
+
+	launch_queue_free(queue);
+}
+
+TEST_F(LaunchQueueTest, GroupThenSingle)
+{
+	LaunchQueue * queue = launch_queue_new(launch, this);
+	hold_starts();
+
+	push(queue, "app", "app://first");
+	wait_for_start(1);
+
+	/* A group and then one more, none of them are lost */
+	const gchar * urls[] = {
+		"app://one",
+		"app://two",
+		nullptr
+	};
+	launch_queue_push(queue, "app", urls);
+	push(queue, "app", "app://three");
+
+	release_starts();
+	launch_queue_flush(queue);
+
+	ASSERT_EQ(2u, launches.size());
+	EXPECT_EQ("app://first", launches[0].second);
+	EXPECT_EQ("app://one app://two app://three", launches[1].second);
+
+	launch_queue_free(queue);
+}
+
+TEST_F(LaunchQueueTest, Immediate)
+{
+	LaunchQueue * queue = launch_queue_new(launch, this);
+
+	/* Nothing to flush it, a lone start doesn't wait */
+	push(queue, "app", "app://one");
+	wait_for_start(1);
+
+	EXPECT_EQ(1u, launched());
+
+	launch_queue_free(queue);
+}
+
+TEST_F(LaunchQueueTest, OneAfterAnother)
+{
+	LaunchQueue * queue = launch_queue_new(launch, this);
+
+	/* The first is done before the second so nothing gets merged */
+	push(queue, "app", "app://one");
+	launch_queue_flush(queue);
+	push(queue, "app", "app://two");
+	launch_queue_flush(queue);
+
+	ASSERT_EQ(2u, launches.size());
+	EXPECT_EQ("app://one", launches[0].second);
+	EXPECT_EQ("app://two", launches[1].second);
+
+	LaunchQueueStats stats;
+	launch_queue_get_stats(queue, &stats);
+	EXPECT_EQ(0u, stats.coalesced);
+
+	launch_queue_free(queue);
+}
+
+TEST_F(LaunchQueueTest, FreeStartsWaiting)
+{
+	LaunchQueue * queue = launch_queue_new(launch, this);
+	hold_starts();
+
+	push(queue, "app", "app://one");
+	wait_for_start(1);
+	push(queue, "app", "app://two");
+	release_starts();
+
+	/* Still started when the queue goes away */
+	launch_queue_free(queue);
+
+	ASSERT_EQ(2u, launches.size());
+	EXPECT_EQ("app://two", launches[1].second);
+}
+
+TEST_F(LaunchQueueTest, Failures)
+{
+	LaunchQueue * queue = launch_queue_new(launch, this);
+
+	result = FALSE;
+	push(queue, "app", "app://one");
+	launch_queue_flush(queue);
+
+	LaunchQueueStats stats;
+	launch_queue_get_stats(queue, &stats);
+	EXPECT_EQ(0u, stats.launched);
+	EXPECT_EQ(1u, stats.failed);
+
+	launch_queue_free(queue);
+}
+
+TEST_F(LaunchQueueTest, ManyUrls)
+{
+	LaunchQueue * queue = launch_queue_new(launch, this);
+
+	const gchar * urls[] = {
+		"app://one",
+		"app://two",
+		nullptr
+	};
+	launch_queue_push(queue, "app", urls);
+	launch_queue_flush(queue);
+
+	/* One start with both */
+	ASSERT_EQ(1u, launches.size());
+	EXPECT_EQ("app://one app://two", launches[0].second);
+
+	launch_queue_free(queue);
+}
@@ -17,6 +17,10 @@
 
 #include "test-config.h"
 
+#include <string>
+#include <utility>
+#include <vector>
+
 #include <gio/gio.h>
 #include <gtest/gtest.h>
 #include <liburl-dispatcher/url-dispatcher.h>
@@ -43,6 +47,13 @@ class LibTest : public ::testing::Test
 				"", /* python */
 				nullptr); /* error */
 
+			dbus_test_dbus_mock_object_add_method(mock, obj,
+				"DispatchURLs",
+				G_VARIANT_TYPE("a(ss)"),
+				G_VARIANT_TYPE("as"),
+				"ret = [''] * (len(args[0]) - 1) + ['com.canonical.URLDispatcher.BadURL']", /* python */
+				nullptr); /* error */
+
 			dbus_test_dbus_mock_object_add_method(mock, obj,
 				"TestURL",
 				G_VARIANT_TYPE("as"),
@@ -137,6 +148,89 @@ TEST_F(LibTest, RestrictedTest) {
 	g_variant_unref(check);
 }
 
+struct ManyResults {
+	GMainLoop * loop;
+	std::vector<std::pair<std::string, bool>> results;
+};
+
+static void
+many_cb (const gchar * url, gboolean success, gpointer user_data)
+{
+	auto many = static_cast<ManyResults *>(user_data);
+	many->results.push_back(std::make_pair(std::string(url), success == TRUE));
+
+	if (many->results.size() == 3) {
+		g_main_loop_quit(many->loop);
+	}
+}
+
+TEST_F(LibTest, SendManyTest) {
+	const gchar * urls[4] = {
+		"foo://bar/one",
+		"foo://bar/two",
+		"foo://bar/three",
+		nullptr
+	};
+
+	ManyResults many;
+	many.loop = g_main_loop_new(nullptr, FALSE);
+
+	url_dispatch_send_many(urls, "bar-package", many_cb, &many);
+
+	/* Give it some time to send and reply */
+	g_main_loop_run(many.loop);
+	g_main_loop_unref(many.loop);
+
+	/* One callback per URL, in order, with the last one failing */
+	ASSERT_EQ(3u, many.results.size());
+	EXPECT_EQ("foo://bar/one", many.results[0].first);
+	EXPECT_TRUE(many.results[0].second);
+	EXPECT_EQ("foo://bar/two", many.results[1].first);
+	EXPECT_TRUE(many.results[1].second);
+	EXPECT_EQ("foo://bar/three", many.results[2].first);
+	EXPECT_FALSE(many.results[2].second);
+
+	guint callslen = 0;
+	const DbusTestDbusMockCall * calls = dbus_test_dbus_mock_object_get_method_calls(mock, obj, "DispatchURLs", &callslen, nullptr);
+
+	ASSERT_EQ(callslen, 1);
+	GVariant * check = g_variant_new_parsed("([('foo://bar/one', 'bar-package'), ('foo://bar/two', 'bar-package'), ('foo://bar/three', 'bar-package')],)");
+	g_variant_ref_sink(check);
+	ASSERT_TRUE(g_variant_equal(calls->params, check));
+	g_variant_unref(check);
+}
+
+static gboolean
+quit_loop (gpointer ploop)
+{
+	g_main_loop_quit((GMainLoop *)ploop);
+	return FALSE;
+}
+
+static void
+empty_cb (const gchar * url, gboolean success, gpointer user_data)
+{
+	ADD_FAILURE() << "Callback for '" << url << "' with no URLs sent";
+}
+
+TEST_F(LibTest, SendManyEmptyTest) {
+	const gchar * urls[1] = {
+		nullptr
+	};
+
+	url_dispatch_send_many(urls, "bar-package", empty_cb, nullptr);
+
+	/* Give anything that was sent time to be replied to */
+	GMainLoop * loop = g_main_loop_new(nullptr, FALSE);
+	g_timeout_add(100, quit_loop, loop);
+	g_main_loop_run(loop);
+	g_main_loop_unref(loop);
+
+	guint callslen = 0;
+	dbus_test_dbus_mock_object_get_method_calls(mock, obj, "DispatchURLs", &callslen, nullptr);
+	EXPECT_EQ(0u, callslen);
+}
+
 TEST_F(LibTest, TestTest) {
 	const gchar * urls[2] = {
 		"foo://bar/barish",
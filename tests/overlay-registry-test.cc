@@ -0,0 +1,213 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "test-config.h"
+
+#include <functional>
+
+#include <glib/gstdio.h>
+#include <gtest/gtest.h>
+#include "overlay-registry.h"
+
+#define GOOD_APPID "com.test.good_application_1.2.3"
+#define GOOD_DESKTOP GOOD_APPID ".desktop"
+
+class OverlayRegistryTest : public ::testing::Test
+{
+	protected:
+		gchar * basedir = nullptr;
+		gchar * systemdir = nullptr;
+		gchar * userdir = nullptr;
+
+		virtual void SetUp() {
+			basedir = g_build_filename(CMAKE_BINARY_DIR, "overlay-registry-test", nullptr);
+			systemdir = g_build_filename(basedir, "system", nullptr);
+			userdir = g_build_filename(basedir, "user", nullptr);
+
+			g_mkdir_with_parents(systemdir, 0700);
+		}
+
+		virtual void TearDown() {
+			gchar * cmdline = g_strdup_printf("rm -rf \"%s\"", basedir);
+			g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+			g_free(cmdline);
+
+			g_free(userdir);
+			g_free(systemdir);
+			g_free(basedir);
+		}
+
+		OverlayRegistry * registry_new () {
+			const gchar * dirs[3] = {
+				systemdir,
+				userdir,
+				nullptr
+			};
+
+			return overlay_registry_new(dirs);
+		}
+
+		/* Copy the fixture desktop file to @path */
+		void install (const gchar * path) {
+			gchar * contents = nullptr;
+			gsize length = 0;
+
+			ASSERT_TRUE(g_file_get_contents(OVERLAY_TEST_DIR "/" GOOD_DESKTOP, &contents, &length, nullptr));
+			ASSERT_TRUE(g_file_set_contents(path, contents, length, nullptr));
+
+			g_free(contents);
+		}
+
+		/* Run the main loop until @check is true or we give up */
+		bool wait_for (std::function<bool()> check, guint timeout_ms = 2000) {
+			gint64 end = g_get_monotonic_time() + timeout_ms * 1000;
+
+			while (!check()) {
+				if (g_get_monotonic_time() > end) {
+					return false;
+				}
+
+				while (g_main_context_iteration(nullptr, FALSE));
+				g_usleep(10000);
+			}
+
+			return true;
+		}
+
+		/* Let all the events from the file system come in */
+		void settle () {
+			gint64 end = g_get_monotonic_time() + 250000;
+
+			while (g_get_monotonic_time() < end) {
+				while (g_main_context_iteration(nullptr, FALSE));
+				g_usleep(10000);
+			}
+		}
+};
+
+TEST_F(OverlayRegistryTest, Fixtures)
+{
+	const gchar * dirs[2] = {
+		OVERLAY_TEST_DIR,
+		nullptr
+	};
+	OverlayRegistry * registry = overlay_registry_new(dirs);
+
+	EXPECT_TRUE(overlay_registry_contains(registry, GOOD_APPID));
+	EXPECT_FALSE(overlay_registry_contains(registry, "com.test.bad_application_1.2.3"));
+	EXPECT_EQ(1u, overlay_registry_size(registry));
+
+	overlay_registry_free(registry);
+}
+
+TEST_F(OverlayRegistryTest, InstallRemove)
+{
+	OverlayRegistry * registry = registry_new();
+	EXPECT_FALSE(overlay_registry_contains(registry, GOOD_APPID));
+
+	gchar * path = g_build_filename(systemdir, GOOD_DESKTOP, nullptr);
+
+	install(path);
+	EXPECT_TRUE(wait_for([&]{ return overlay_registry_contains(registry, GOOD_APPID); }));
+
+	g_unlink(path);
+	EXPECT_TRUE(wait_for([&]{ return !overlay_registry_contains(registry, GOOD_APPID); }));
+
+	/* Files that aren't desktop files don't count */
+	gchar * other = g_build_filename(systemdir, GOOD_APPID ".txt", nullptr);
+	install(other);
+	settle();
+	EXPECT_EQ(0u, overlay_registry_size(registry));
+
+	g_free(other);
+	g_free(path);
+	overlay_registry_free(registry);
+}
+
+TEST_F(OverlayRegistryTest, Races)
+{
+	OverlayRegistry * registry = registry_new();
+	gchar * path = g_build_filename(systemdir, GOOD_DESKTOP, nullptr);
+
+	/* Gone again before we look at the events */
+	install(path);
+	g_unlink(path);
+	settle();
+	EXPECT_FALSE(overlay_registry_contains(registry, GOOD_APPID));
+
+	/* Replaced before we look at the events */
+	install(path);
+	settle();
+	EXPECT_TRUE(overlay_registry_contains(registry, GOOD_APPID));
+
+	g_unlink(path);
+	install(path);
+	settle();
+	EXPECT_TRUE(overlay_registry_contains(registry, GOOD_APPID));
+
+	/* Flapping */
+	for (int i = 0; i < 20; i++) {
+		g_unlink(path);
+		install(path);
+	}
+	g_unlink(path);
+	settle();
+	EXPECT_FALSE(overlay_registry_contains(registry, GOOD_APPID));
+
+	g_free(path);
+	overlay_registry_free(registry);
+}
+
+TEST_F(OverlayRegistryTest, Moves)
+{
+	OverlayRegistry * registry = registry_new();
+	gchar * outside = g_build_filename(basedir, GOOD_DESKTOP, nullptr);
+	gchar * path = g_build_filename(systemdir, GOOD_DESKTOP, nullptr);
+	gchar * renamed = g_build_filename(systemdir, GOOD_APPID ".desktop.old", nullptr);
+
+	/* How package managers put files in place */
+	install(outside);
+	ASSERT_EQ(0, g_rename(outside, path));
+	EXPECT_TRUE(wait_for([&]{ return overlay_registry_contains(registry, GOOD_APPID); }));
+
+	ASSERT_EQ(0, g_rename(path, renamed));
+	EXPECT_TRUE(wait_for([&]{ return !overlay_registry_contains(registry, GOOD_APPID); }));
+
+	g_free(renamed);
+	g_free(path);
+	g_free(outside);
+	overlay_registry_free(registry);
+}
+
+TEST_F(OverlayRegistryTest, DirectoryAppears)
+{
+	/* The user directory only exists once a click package has an overlay */
+	OverlayRegistry * registry = registry_new();
+
+	g_mkdir_with_parents(userdir, 0700);
+	gchar * path = g_build_filename(userdir, GOOD_DESKTOP, nullptr);
+	install(path);
+
+	/* Missing directories are polled for, which can take a few seconds */
+	EXPECT_TRUE(wait_for([&]{ return overlay_registry_contains(registry, GOOD_APPID); }, 10000));
+
+	g_unlink(path);
+	EXPECT_TRUE(wait_for([&]{ return !overlay_registry_contains(registry, GOOD_APPID); }));
+
+	g_free(path);
+	overlay_registry_free(registry);
+}
@@ -27,4 +27,8 @@ class OverlayTrackerMock : public OverlayTrackerIface
 			addedOverlays.push_back(std::make_tuple(std::string(appid), pid, std::string(url)));
 			return true;
 		}
+
+		unsigned int overlayCount () {
+			return addedOverlays.size();
+		}
 };
@@ -60,12 +60,13 @@ TEST_F(OverlayTrackerTest, BasicCreation) {
 TEST_F(OverlayTrackerTest, AddOverlay) {
 	auto tracker = new OverlayTrackerMir();
 
+	/* Connecting happens on the tracker's thread before the overlay */
+	EXPECT_TRUE(tracker->addOverlay("app-id", 5, "http://no-name-yet.com"));
+
 	auto mirconn = mir_mock_connect_last_connect();
 	EXPECT_EQ("mir_socket_trusted", mirconn.first.substr(mirconn.first.size() - 18));
 	EXPECT_EQ("url-dispatcher", mirconn.second);
 
-	EXPECT_TRUE(tracker->addOverlay("app-id", 5, "http://no-name-yet.com"));
-
 	EXPECT_EQ(5, mir_mock_last_trust_pid);
 
 	EXPECT_STREQ("url-overlay", ubuntu_app_launch_mock_last_start_session_helper);
@@ -79,6 +80,16 @@ TEST_F(OverlayTrackerTest, AddOverlay) {
 	EXPECT_STREQ("instance", ubuntu_app_launch_mock_last_stop_instance);
 }
 
+TEST_F(OverlayTrackerTest, NoMir) {
+	mir_mock_connect_return_valid(false);
+	auto tracker = new OverlayTrackerMir();
+
+	EXPECT_FALSE(tracker->addOverlay("app-id", 5, "http://no-name-yet.com"));
+
+	delete tracker;
+	mir_mock_connect_return_valid(true);
+}
+
 TEST_F(OverlayTrackerTest, OverlayABunch) {
 	OverlayTrackerMir tracker;
 	std::uniform_int_distribution<> randpid(1, 32000);
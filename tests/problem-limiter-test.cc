@@ -0,0 +1,119 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include "problem-limiter.h"
+
+#define INTERVAL (60 * G_USEC_PER_SEC)
+
+TEST(ProblemLimiterTest, InitTest) {
+	ProblemLimiter * limiter = problem_limiter_new(INTERVAL);
+	ASSERT_NE(nullptr, limiter);
+
+	ProblemLimiterStats stats;
+	problem_limiter_get_stats(limiter, &stats);
+	EXPECT_EQ(0u, stats.reported);
+	EXPECT_EQ(0u, stats.suppressed);
+	EXPECT_EQ(0u, stats.keys);
+
+	problem_limiter_free(limiter);
+}
+
+TEST(ProblemLimiterTest, IntervalTest) {
+	ProblemLimiter * limiter = problem_limiter_new(INTERVAL);
+	gint64 now = 1000;
+	guint suppressed = 42;
+
+	EXPECT_TRUE(problem_limiter_check(limiter, ":1.5", "bad-url", now, &suppressed));
+	EXPECT_EQ(0u, suppressed);
+
+	/* The rest of the flood is only counted */
+	for (int i = 0; i < 10; i++) {
+		EXPECT_FALSE(problem_limiter_check(limiter, ":1.5", "bad-url", now + i, &suppressed));
+	}
+	EXPECT_FALSE(problem_limiter_check(limiter, ":1.5", "bad-url", now + INTERVAL - 1, &suppressed));
+
+	/* Next one out says how many were held back */
+	EXPECT_TRUE(problem_limiter_check(limiter, ":1.5", "bad-url", now + INTERVAL, &suppressed));
+	EXPECT_EQ(11u, suppressed);
+
+	EXPECT_TRUE(problem_limiter_check(limiter, ":1.5", "bad-url", now + 3 * INTERVAL, &suppressed));
+	EXPECT_EQ(0u, suppressed);
+
+	ProblemLimiterStats stats;
+	problem_limiter_get_stats(limiter, &stats);
+	EXPECT_EQ(3u, stats.reported);
+	EXPECT_EQ(11u, stats.suppressed);
+
+	problem_limiter_free(limiter);
+}
+
+TEST(ProblemLimiterTest, KeyTest) {
+	ProblemLimiter * limiter = problem_limiter_new(INTERVAL);
+	gint64 now = 1000;
+
+	/* Senders and signatures are limited separately */
+	EXPECT_TRUE(problem_limiter_check(limiter, ":1.5", "bad-url", now, nullptr));
+	EXPECT_TRUE(problem_limiter_check(limiter, ":1.6", "bad-url", now, nullptr));
+	EXPECT_TRUE(problem_limiter_check(limiter, ":1.5", "other", now, nullptr));
+	EXPECT_TRUE(problem_limiter_check(limiter, nullptr, "bad-url", now, nullptr));
+
+	EXPECT_FALSE(problem_limiter_check(limiter, ":1.5", "bad-url", now, nullptr));
+	EXPECT_FALSE(problem_limiter_check(limiter, ":1.6", "bad-url", now, nullptr));
+	EXPECT_FALSE(problem_limiter_check(limiter, ":1.5", "other", now, nullptr));
+	EXPECT_FALSE(problem_limiter_check(limiter, nullptr, "bad-url", now, nullptr));
+
+	ProblemLimiterStats stats;
+	problem_limiter_get_stats(limiter, &stats);
+	EXPECT_EQ(4u, stats.keys);
+
+	problem_limiter_free(limiter);
+}
+
+TEST(ProblemLimiterTest, PruneTest) {
+	ProblemLimiter * limiter = problem_limiter_new(INTERVAL);
+	gint64 now = INTERVAL;
+
+	for (int i = 0; i < 100; i++) {
+		gchar * sender = g_strdup_printf(":1.%d", i);
+		EXPECT_TRUE(problem_limiter_check(limiter, sender, "bad-url", now, nullptr));
+		g_free(sender);
+	}
+
+	ProblemLimiterStats stats;
+	problem_limiter_get_stats(limiter, &stats);
+	EXPECT_EQ(100u, stats.keys);
+
+	/* Quiet senders get forgotten */
+	EXPECT_TRUE(problem_limiter_check(limiter, ":1.1000", "bad-url", now + INTERVAL, nullptr));
+
+	problem_limiter_get_stats(limiter, &stats);
+	EXPECT_EQ(1u, stats.keys);
+	EXPECT_EQ(101u, stats.reported);
+
+	problem_limiter_free(limiter);
+}
+
+TEST(ProblemLimiterTest, ZeroIntervalTest) {
+	ProblemLimiter * limiter = problem_limiter_new(0);
+
+	/* Everything goes through */
+	EXPECT_TRUE(problem_limiter_check(limiter, ":1.5", "bad-url", 1000, nullptr));
+	EXPECT_TRUE(problem_limiter_check(limiter, ":1.5", "bad-url", 1000, nullptr));
+
+	problem_limiter_free(limiter);
+}
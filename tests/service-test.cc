@@ -17,6 +17,8 @@
 
 #include "test-config.h"
 
+#include <signal.h>
+#include <sys/wait.h>
 #include <gio/gio.h>
 #include <gtest/gtest.h>
 #include <liburl-dispatcher/url-dispatcher.h>
@@ -118,13 +120,13 @@ class ServiceTest : public ::testing::Test
 
 			g_setenv("XDG_CACHE_HOME", cachedir, TRUE);
 
-			sqlite3 * db = url_db_create_database();
+			UrlDb * db = url_db_create_database();
 
 			GTimeVal time = {0, 0};
 			time.tv_sec = 5;
 			url_db_set_file_motification_time(db, "/unity8-dash.url-dispatcher", &time);
 			url_db_insert_url(db, "/unity8-dash.url-dispatcher", "scope", nullptr);
-			sqlite3_close(db);
+			url_db_close(db);
 		}
 
 		void TearDownDb () {
@@ -176,8 +178,13 @@ TEST_F(ServiceTest, ApplicationTest) {
 	g_main_loop_run(main);
 	g_main_loop_unref(main);
 
+	/* The reply comes once it's queued, the start happens after */
 	guint callslen = 0;
-	const DbusTestDbusMockCall * calls = dbus_test_dbus_mock_object_get_method_calls(mock, jobobj, "Start", &callslen, nullptr);
+	const DbusTestDbusMockCall * calls = nullptr;
+	for (int tries = 0; callslen == 0 && tries < 50; tries++) {
+		pause(100);
+		calls = dbus_test_dbus_mock_object_get_method_calls(mock, jobobj, "Start", &callslen, nullptr);
+	}
 
 	ASSERT_EQ(callslen, 1);
 
@@ -295,3 +302,99 @@ TEST_F(ServiceTest, Unity8DashTest) {
 	g_dbus_connection_signal_unsubscribe(bus, focus_signal);
 	g_clear_object(&bus);
 }
+
+class ServiceIdleTest : public ServiceTest
+{
+	protected:
+		virtual void SetUp() {
+			g_setenv("URL_DISPATCHER_IDLE_TIMEOUT", "2", TRUE);
+			ServiceTest::SetUp();
+		}
+
+		virtual void TearDown() {
+			ServiceTest::TearDown();
+			g_unsetenv("URL_DISPATCHER_IDLE_TIMEOUT");
+		}
+
+		bool has_owner () {
+			GVariant * result = g_dbus_connection_call_sync(bus,
+				"org.freedesktop.DBus",
+				"/org/freedesktop/DBus",
+				"org.freedesktop.DBus",
+				"NameHasOwner",
+				g_variant_new("(s)", "com.canonical.URLDispatcher"),
+				G_VARIANT_TYPE("(b)"),
+				G_DBUS_CALL_FLAGS_NONE,
+				-1, nullptr, nullptr);
+
+			gboolean owned = FALSE;
+			if (result != nullptr) {
+				g_variant_get(result, "(b)", &owned);
+				g_variant_unref(result);
+			}
+			return owned;
+		}
+};
+
+TEST_F(ServiceIdleTest, ExitsWhenIdle) {
+	/* Still answers right after starting */
+	const char * testurls[] = {
+		"application:///foo-bar.desktop",
+		nullptr
+	};
+
+	gchar ** appids = url_dispatch_url_appid(testurls);
+	ASSERT_EQ(1, g_strv_length(appids));
+	EXPECT_STREQ("foo-bar", appids[0]);
+	g_strfreev(appids);
+
+	EXPECT_TRUE(has_owner());
+
+	/* Then gives up the name once it's had nothing to do */
+	for (int tries = 0; has_owner() && tries < 80; tries++) {
+		pause(100);
+	}
+
+	EXPECT_FALSE(has_owner());
+}
+
+TEST_F(ServiceIdleTest, ActivatedAfterRelease) {
+	for (int tries = 0; has_owner() && tries < 80; tries++) {
+		pause(100);
+	}
+	ASSERT_FALSE(has_owner());
+
+	/* It doesn't stay around without the name, so the job can be
+	   started again */
+	for (int tries = 0; dbus_test_task_get_state(DBUS_TEST_TASK(dispatcher)) != DBUS_TEST_TASK_STATE_FINISHED && tries < 30; tries++) {
+		pause(100);
+	}
+	EXPECT_EQ(DBUS_TEST_TASK_STATE_FINISHED, dbus_test_task_get_state(DBUS_TEST_TASK(dispatcher)));
+
+	/* Like activation starting it for the next caller */
+	const gchar * argv[] = {
+		URL_DISPATCHER_SERVICE,
+		nullptr
+	};
+	GPid pid = 0;
+	ASSERT_TRUE(g_spawn_async(nullptr, (gchar **)argv, nullptr, G_SPAWN_DEFAULT, nullptr, nullptr, &pid, nullptr));
+
+	for (int tries = 0; !has_owner() && tries < 50; tries++) {
+		pause(100);
+	}
+	EXPECT_TRUE(has_owner());
+
+	const char * testurls[] = {
+		"application:///foo-bar.desktop",
+		nullptr
+	};
+
+	gchar ** appids = url_dispatch_url_appid(testurls);
+	ASSERT_EQ(1, g_strv_length(appids));
+	EXPECT_STREQ("foo-bar", appids[0]);
+	g_strfreev(appids);
+
+	kill(pid, SIGTERM);
+	waitpid(pid, nullptr, 0);
+	g_spawn_close_pid(pid);
+}
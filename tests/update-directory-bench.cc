@@ -0,0 +1,191 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Indexes generated directories of URL files with every change
+   committed on its own, which is what update-directory used to do,
+   and in batched transactions like it does now. Then runs the tool
+   itself on the same files, parsing them on one thread and on one per
+   core, and rebuilds the database they made with --rebuild. Not run
+   as part of the test suite, run it by hand:
+
+     tests/update-directory-bench [files...]
+*/
+
+#include "test-config.h"
+
+#include <stdlib.h>
+#include <glib.h>
+#include "url-db.h"
+
+#define BATCH_SIZE 1000 /* Same as update-directory */
+
+/* Start each run from an empty database */
+static void
+clear_cache (const gchar * cachedir)
+{
+	gchar * cmdline = g_strdup_printf("rm -rf \"%s\"", cachedir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+}
+
+/* A click package's worth of URL files, each with a webapp domain
+   and a protocol of its own */
+static void
+write_corpus (const gchar * dir, int files)
+{
+	g_mkdir_with_parents(dir, 0700);
+
+	for (int i = 0; i < files; i++) {
+		gchar * filename = g_strdup_printf("%s/com.example.app%d_app%d_1.0.url-dispatcher", dir, i, i);
+		gchar * contents = g_strdup_printf("[ { \"protocol\": \"http\", \"domain-suffix\": \"app%d.example.com\" }, { \"protocol\": \"app%d\" } ]", i, i);
+
+		g_file_set_contents(filename, contents, -1, nullptr);
+
+		g_free(contents);
+		g_free(filename);
+	}
+}
+
+/* The database side of update-directory for @files new files,
+   committing every @batch of them or every statement if it's zero */
+static gint64
+index_files (const gchar * dir, int files, int batch)
+{
+	UrlDb * db = url_db_create_database();
+	g_return_val_if_fail(db != nullptr, 0);
+
+	gint64 start = g_get_monotonic_time();
+
+	if (batch > 0) {
+		url_db_begin(db);
+	}
+
+	for (int i = 0; i < files; i++) {
+		gchar * filename = g_strdup_printf("%s/com.example.app%d_app%d_1.0.url-dispatcher", dir, i, i);
+		gchar * domain = g_strdup_printf("app%d.example.com", i);
+		gchar * protocol = g_strdup_printf("app%d", i);
+		GTimeVal timeval = {12345, 0};
+		GTimeVal dbtime = {0, 0};
+
+		url_db_get_file_motification_time(db, filename, &dbtime);
+		url_db_set_file_motification_time(db, filename, &timeval);
+		url_db_insert_url(db, filename, "http", domain);
+		url_db_insert_url(db, filename, protocol, nullptr);
+
+		g_free(protocol);
+		g_free(domain);
+		g_free(filename);
+
+		if (batch > 0 && (i + 1) % batch == 0) {
+			url_db_commit(db);
+			url_db_begin(db);
+		}
+	}
+
+	if (batch > 0) {
+		url_db_commit(db);
+	}
+
+	gint64 time = g_get_monotonic_time() - start;
+	url_db_close(db);
+
+	return time;
+}
+
+/* The whole tool, parsing the files on @threads threads, with
+   --rebuild if @option says so */
+static gint64
+run_tool (const gchar * option, const gchar * dir, guint threads)
+{
+	gchar * threadcount = g_strdup_printf("%u", threads);
+	g_setenv("URL_DISPATCHER_UPDATE_THREADS", threadcount, TRUE);
+	g_free(threadcount);
+
+	gchar * cmdline = g_strdup_printf("%s %s \"%s\"", UPDATE_DIRECTORY_TOOL, option, dir);
+
+	gint64 start = g_get_monotonic_time();
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	gint64 time = g_get_monotonic_time() - start;
+
+	g_free(cmdline);
+
+	return time;
+}
+
+int
+main (int argc, char * argv[])
+{
+	GArray * sizes = g_array_new(FALSE, FALSE, sizeof(int));
+
+	for (int i = 1; i < argc; i++) {
+		int files = atoi(argv[i]);
+		if (files <= 0) {
+			g_printerr("Usage: %s [files...]\n", argv[0]);
+			return 1;
+		}
+		g_array_append_val(sizes, files);
+	}
+
+	if (sizes->len == 0) {
+		int defaults[] = { 10, 1000, 50000 };
+		g_array_append_vals(sizes, defaults, G_N_ELEMENTS(defaults));
+	}
+
+	gchar * cachedir = g_build_filename(CMAKE_BINARY_DIR, "update-directory-bench-cache", nullptr);
+	gchar * corpusdir = g_build_filename(CMAKE_BINARY_DIR, "update-directory-bench-corpus", nullptr);
+	g_setenv("URL_DISPATCHER_CACHE_DIR", cachedir, TRUE);
+
+	for (guint i = 0; i < sizes->len; i++) {
+		int files = g_array_index(sizes, int, i);
+
+		clear_cache(corpusdir);
+		write_corpus(corpusdir, files);
+
+		clear_cache(cachedir);
+		gint64 autocommit = index_files(corpusdir, files, 0);
+
+		clear_cache(cachedir);
+		gint64 batched = index_files(corpusdir, files, BATCH_SIZE);
+
+		clear_cache(cachedir);
+		gint64 onethread = run_tool("", corpusdir, 1);
+
+		clear_cache(cachedir);
+		gint64 allthreads = run_tool("", corpusdir, g_get_num_processors());
+
+		/* Over the database that was just built */
+		gint64 rebuild = run_tool("--rebuild", corpusdir, g_get_num_processors());
+
+		g_print("%6d files %10.1f ms autocommit %10.1f ms batched %7.2fx %10.1f ms update-directory %10.1f ms with %u threads %10.1f ms rebuild\n",
+			files,
+			autocommit / 1000.0,
+			batched / 1000.0,
+			(gdouble)autocommit / MAX(batched, 1),
+			onethread / 1000.0,
+			allthreads / 1000.0,
+			g_get_num_processors(),
+			rebuild / 1000.0);
+	}
+
+	clear_cache(cachedir);
+	clear_cache(corpusdir);
+	g_free(cachedir);
+	g_free(corpusdir);
+	g_array_free(sizes, TRUE);
+
+	return 0;
+}
@@ -0,0 +1,134 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <string>
+
+#include <gtest/gtest.h>
+#include "url-cache.h"
+
+class UrlCacheTest : public ::testing::Test
+{
+	protected:
+		bool lookup (UrlCache * cache, const gchar * protocol, const gchar * domain, const gchar ** appid) {
+			return url_cache_lookup(cache, protocol, strlen(protocol), domain, strlen(domain), appid);
+		}
+
+		void insert (UrlCache * cache, const gchar * protocol, const gchar * domain, const gchar * appid) {
+			url_cache_insert(cache, protocol, strlen(protocol), domain, strlen(domain), appid);
+		}
+};
+
+TEST_F(UrlCacheTest, Basic)
+{
+	UrlCache * cache = url_cache_new(4);
+	const gchar * appid = nullptr;
+
+	EXPECT_FALSE(lookup(cache, "http", "foo.com", &appid));
+
+	insert(cache, "http", "foo.com", "foo");
+	insert(cache, "mailto", "", nullptr);
+
+	EXPECT_TRUE(lookup(cache, "http", "foo.com", &appid));
+	EXPECT_STREQ("foo", appid);
+	EXPECT_TRUE(lookup(cache, "http", "FOO.com", &appid));
+	EXPECT_STREQ("foo", appid);
+
+	/* Negative entries */
+	EXPECT_TRUE(lookup(cache, "mailto", "", &appid));
+	EXPECT_EQ(nullptr, appid);
+
+	/* Protocol and domain don't run together */
+	EXPECT_FALSE(lookup(cache, "http", "foo.co", &appid));
+	EXPECT_FALSE(lookup(cache, "httpf", "oo.com", &appid));
+
+	guint64 hits = 0, misses = 0;
+	url_cache_get_stats(cache, &hits, &misses);
+	EXPECT_EQ(3u, hits);
+	EXPECT_EQ(3u, misses);
+
+	url_cache_clear(cache);
+	EXPECT_EQ(0u, url_cache_size(cache));
+	EXPECT_FALSE(lookup(cache, "http", "foo.com", &appid));
+
+	url_cache_free(cache);
+}
+
+TEST_F(UrlCacheTest, Eviction)
+{
+	UrlCache * cache = url_cache_new(2);
+	const gchar * appid = nullptr;
+
+	insert(cache, "http", "one.com", "one");
+	insert(cache, "http", "two.com", "two");
+
+	/* Makes 'two' the oldest */
+	EXPECT_TRUE(lookup(cache, "http", "one.com", &appid));
+
+	insert(cache, "http", "three.com", "three");
+	EXPECT_EQ(2u, url_cache_size(cache));
+
+	EXPECT_FALSE(lookup(cache, "http", "two.com", &appid));
+	EXPECT_TRUE(lookup(cache, "http", "one.com", &appid));
+	EXPECT_STREQ("one", appid);
+	EXPECT_TRUE(lookup(cache, "http", "three.com", &appid));
+	EXPECT_STREQ("three", appid);
+
+	/* Replacing doesn't grow it */
+	insert(cache, "http", "three.com", "tres");
+	EXPECT_EQ(2u, url_cache_size(cache));
+	EXPECT_TRUE(lookup(cache, "http", "three.com", &appid));
+	EXPECT_STREQ("tres", appid);
+
+	url_cache_free(cache);
+}
+
+TEST_F(UrlCacheTest, LongDomain)
+{
+	UrlCache * cache = url_cache_new(4);
+	const gchar * appid = nullptr;
+
+	std::string longest(253, 'a');
+	std::string toolong(254, 'a');
+
+	insert(cache, "http", longest.c_str(), "longest");
+	insert(cache, "http", toolong.c_str(), "toolong");
+	EXPECT_EQ(1u, url_cache_size(cache));
+
+	EXPECT_TRUE(lookup(cache, "http", longest.c_str(), &appid));
+	EXPECT_STREQ("longest", appid);
+	EXPECT_FALSE(lookup(cache, "http", toolong.c_str(), &appid));
+
+	guint64 hits = 0, misses = 0;
+	url_cache_get_stats(cache, &hits, &misses);
+	EXPECT_EQ(1u, hits);
+	EXPECT_EQ(1u, misses);
+
+	url_cache_free(cache);
+}
+
+TEST_F(UrlCacheTest, Disabled)
+{
+	UrlCache * cache = url_cache_new(0);
+	const gchar * appid = nullptr;
+
+	insert(cache, "http", "foo.com", "foo");
+	EXPECT_EQ(0u, url_cache_size(cache));
+	EXPECT_FALSE(lookup(cache, "http", "foo.com", &appid));
+
+	url_cache_free(cache);
+}
@@ -0,0 +1,174 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Compares the cached statements in url-db against preparing the same
+   SQL for every call, which is what url-db used to do. Not run as part
+   of the test suite, run it by hand:
+
+     tests/url-db-bench [iterations]
+*/
+
+#include "test-config.h"
+
+#include <stdlib.h>
+#include <glib.h>
+#include "url-db.h"
+
+#define INSERT_SQL "insert or replace into urls select rowid, ?2, ?3 from configfiles where name = ?1"
+#define FILETIME_SQL "select mtime, size, inode, hash from configfiles where name = ?1"
+#define FIND_SQL "select configfiles.name from configfiles, urls where urls.sourcefile = configfiles.rowid and urls.protocol = ?1 and (ltrim(urls.domainsuffix, '.') = '' or ?2 like ltrim(urls.domainsuffix, '.') or ?2 like '%.' || ltrim(urls.domainsuffix, '.')) order by length(ltrim(urls.domainsuffix, '.')) desc, urls.rowid limit 1"
+
+/* The way every url_db_* call worked before the statement cache */
+static void
+uncached_exec (sqlite3 * db, const gchar * sql, const gchar * one, const gchar * two, const gchar * three)
+{
+	sqlite3_stmt * stmt = nullptr;
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+		g_error("Unable to parse SQL: %s", sqlite3_errmsg(db));
+	}
+
+	sqlite3_bind_text(stmt, 1, one, -1, SQLITE_TRANSIENT);
+	if (two != nullptr) {
+		sqlite3_bind_text(stmt, 2, two, -1, SQLITE_TRANSIENT);
+	}
+	if (three != nullptr) {
+		sqlite3_bind_text(stmt, 3, three, -1, SQLITE_TRANSIENT);
+	}
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+	}
+
+	sqlite3_finalize(stmt);
+}
+
+static void
+report (const gchar * name, gint64 uncached, gint64 cached, int iterations)
+{
+	gdouble before = (gdouble)uncached * 1000.0 / iterations;
+	gdouble after = (gdouble)cached * 1000.0 / iterations;
+
+	g_print("%-8s %10.0f ns/op uncached %10.0f ns/op cached %6.2fx\n", name, before, after, before / after);
+}
+
+int
+main (int argc, char * argv[])
+{
+	int iterations = 20000;
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+	}
+	if (iterations <= 0) {
+		g_printerr("Usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	gchar * cachedir = g_build_filename(CMAKE_BINARY_DIR, "url-db-bench-cache", nullptr);
+	g_setenv("URL_DISPATCHER_CACHE_DIR", cachedir, TRUE);
+
+	UrlDb * db = url_db_create_database();
+	g_return_val_if_fail(db != nullptr, -1);
+	sqlite3 * conn = url_db_get_connection(db);
+
+	/* A database about the size of a full phone image */
+	GTimeVal timeval = {12345, 0};
+	sqlite3_exec(conn, "begin", nullptr, nullptr, nullptr);
+	for (int i = 0; i < 500; i++) {
+		gchar * filename = g_strdup_printf("/usr/share/url-dispatcher/urls/app%d.url-dispatcher", i);
+		gchar * domain = g_strdup_printf("app%d.example.com", i);
+
+		url_db_set_file_motification_time(db, filename, &timeval);
+		url_db_insert_url(db, filename, "http", domain);
+
+		g_free(domain);
+		g_free(filename);
+	}
+	sqlite3_exec(conn, "commit", nullptr, nullptr, nullptr);
+
+	gchar ** domains = g_new0(gchar *, iterations);
+	gchar ** filenames = g_new0(gchar *, iterations);
+	for (int i = 0; i < iterations; i++) {
+		domains[i] = g_strdup_printf("www.app%d.example.com", i % 500);
+		filenames[i] = g_strdup_printf("/usr/share/url-dispatcher/urls/app%d.url-dispatcher", i % 500);
+	}
+
+	/* File time checks, what update-directory does for every file */
+	gint64 start = g_get_monotonic_time();
+	for (int i = 0; i < iterations; i++) {
+		uncached_exec(conn, FILETIME_SQL, filenames[i], nullptr, nullptr);
+	}
+	gint64 uncached = g_get_monotonic_time() - start;
+
+	start = g_get_monotonic_time();
+	for (int i = 0; i < iterations; i++) {
+		url_db_get_file_motification_time(db, filenames[i], &timeval);
+	}
+	gint64 cached = g_get_monotonic_time() - start;
+
+	report("filetime", uncached, cached, iterations);
+
+	/* Lookups */
+	start = g_get_monotonic_time();
+	for (int i = 0; i < iterations; i++) {
+		uncached_exec(conn, FIND_SQL, "http", domains[i], nullptr);
+	}
+	uncached = g_get_monotonic_time() - start;
+
+	start = g_get_monotonic_time();
+	for (int i = 0; i < iterations; i++) {
+		g_free(url_db_find_url(db, "http", domains[i]));
+	}
+	cached = g_get_monotonic_time() - start;
+
+	report("lookup", uncached, cached, iterations);
+
+	/* Inserts, in a transaction like a bulk update */
+	const gchar * filename = "/usr/share/url-dispatcher/urls/app0.url-dispatcher";
+
+	sqlite3_exec(conn, "begin", nullptr, nullptr, nullptr);
+	start = g_get_monotonic_time();
+	for (int i = 0; i < iterations; i++) {
+		uncached_exec(conn, INSERT_SQL, filename, "uncached", domains[i]);
+	}
+	uncached = g_get_monotonic_time() - start;
+	sqlite3_exec(conn, "rollback", nullptr, nullptr, nullptr);
+
+	sqlite3_exec(conn, "begin", nullptr, nullptr, nullptr);
+	start = g_get_monotonic_time();
+	for (int i = 0; i < iterations; i++) {
+		url_db_insert_url(db, filename, "cached", domains[i]);
+	}
+	cached = g_get_monotonic_time() - start;
+	sqlite3_exec(conn, "rollback", nullptr, nullptr, nullptr);
+
+	report("insert", uncached, cached, iterations);
+
+	for (int i = 0; i < iterations; i++) {
+		g_free(domains[i]);
+		g_free(filenames[i]);
+	}
+	g_free(domains);
+	g_free(filenames);
+
+	url_db_close(db);
+
+	gchar * cmdline = g_strdup_printf("rm -rf \"%s\"", cachedir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+	g_free(cachedir);
+
+	return 0;
+}
@@ -17,6 +17,9 @@
 
 #include "test-config.h"
 
+#include <string>
+#include <vector>
+
 #include <gtest/gtest.h>
 #include "url-db.h"
 
@@ -56,29 +59,70 @@ class UrlDBTest : public ::testing::Test
 };
 
 static void verify_tables(const gchar *cachedir) {
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	ASSERT_TRUE(db != nullptr);
 
-	gchar * dbfile = g_build_filename(cachedir, "url-dispatcher", "urls-1.db", nullptr);
+	gchar * dbfile = g_build_filename(cachedir, "url-dispatcher", "urls-3.db", nullptr);
 	EXPECT_TRUE(g_file_test(dbfile, G_FILE_TEST_EXISTS));
 	g_free(dbfile);
 
 	const char * type = nullptr;
 
-	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(db, nullptr, "configfiles", "name", &type, nullptr, nullptr, nullptr, nullptr));
+	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(url_db_get_connection(db), nullptr, "configfiles", "name", &type, nullptr, nullptr, nullptr, nullptr));
 	EXPECT_STREQ("text", type);
-	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(db, nullptr, "configfiles", "timestamp", &type, nullptr, nullptr, nullptr, nullptr));
+	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(url_db_get_connection(db), nullptr, "configfiles", "mtime", &type, nullptr, nullptr, nullptr, nullptr));
+	EXPECT_STREQ("bigint", type);
+	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(url_db_get_connection(db), nullptr, "configfiles", "size", &type, nullptr, nullptr, nullptr, nullptr));
+	EXPECT_STREQ("bigint", type);
+	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(url_db_get_connection(db), nullptr, "configfiles", "inode", &type, nullptr, nullptr, nullptr, nullptr));
+	EXPECT_STREQ("bigint", type);
+	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(url_db_get_connection(db), nullptr, "configfiles", "hash", &type, nullptr, nullptr, nullptr, nullptr));
 	EXPECT_STREQ("bigint", type);
 
-	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(db, nullptr, "urls", "sourcefile", &type, nullptr, nullptr, nullptr, nullptr));
+	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(url_db_get_connection(db), nullptr, "urls", "sourcefile", &type, nullptr, nullptr, nullptr, nullptr));
 	EXPECT_STREQ("integer", type);
-	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(db, nullptr, "urls", "protocol", &type, nullptr, nullptr, nullptr, nullptr));
+	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(url_db_get_connection(db), nullptr, "urls", "protocol", &type, nullptr, nullptr, nullptr, nullptr));
 	EXPECT_STREQ("text", type);
-	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(db, nullptr, "urls", "domainsuffix", &type, nullptr, nullptr, nullptr, nullptr));
+	EXPECT_EQ(SQLITE_OK, sqlite3_table_column_metadata(url_db_get_connection(db), nullptr, "urls", "domainsuffix", &type, nullptr, nullptr, nullptr, nullptr));
 	EXPECT_STREQ("text", type);
 
-	sqlite3_close(db);
+	url_db_close(db);
+}
+
+TEST_F(UrlDBTest, OldSchemaRemoved)
+{
+	gchar * dbdir = g_build_filename(cachedir, "url-dispatcher", nullptr);
+	g_mkdir_with_parents(dbdir,  1 << 6 | 1 << 7 | 1 << 8); // 700
+
+	std::vector<std::string> oldfiles = {
+		"urls-1.db", "urls-1.db-wal", "urls-1.db-shm", "urls-1.index",
+		"urls-2.db", "urls-2.db-wal", "urls-2.db-shm", "urls-2.index",
+	};
+
+	for (auto oldfile : oldfiles) {
+		gchar * filename = g_build_filename(dbdir, oldfile.c_str(), nullptr);
+		ASSERT_TRUE(g_file_set_contents(filename, "old", -1, nullptr));
+		g_free(filename);
+	}
+
+	/* Someone else's file isn't touched */
+	gchar * otherfile = g_build_filename(dbdir, "other.db", nullptr);
+	ASSERT_TRUE(g_file_set_contents(otherfile, "other", -1, nullptr));
+
+	UrlDb * db = url_db_create_database();
+	ASSERT_TRUE(db != nullptr);
+
+	for (auto oldfile : oldfiles) {
+		gchar * filename = g_build_filename(dbdir, oldfile.c_str(), nullptr);
+		EXPECT_FALSE(g_file_test(filename, G_FILE_TEST_EXISTS)) << oldfile;
+		g_free(filename);
+	}
+	EXPECT_TRUE(g_file_test(otherfile, G_FILE_TEST_EXISTS));
+
+	url_db_close(db);
+	g_free(otherfile);
+	g_free(dbdir);
 }
 
 TEST_F(UrlDBTest, CreateTest) {
@@ -89,7 +133,7 @@ TEST_F(UrlDBTest, CreateTest) {
 }
 
 TEST_F(UrlDBTest, TimestampTest) {
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	ASSERT_TRUE(db != nullptr);
 
@@ -103,11 +147,11 @@ TEST_F(UrlDBTest, TimestampTest) {
 	EXPECT_TRUE(url_db_get_file_motification_time(db, "/foo", &timeval));
 	EXPECT_EQ(12345, timeval.tv_sec);
 
-	sqlite3_close(db);
+	url_db_close(db);
 }
 
 TEST_F(UrlDBTest, UrlTest) {
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	ASSERT_TRUE(db != nullptr);
 
@@ -128,11 +172,57 @@ TEST_F(UrlDBTest, UrlTest) {
 	EXPECT_STREQ("bar", url_db_find_url(db, "bar", "more.foo.com"));
 	EXPECT_STREQ("bar", url_db_find_url(db, "bar", "www.more.foo.com"));
 
-	sqlite3_close(db);
+	/* Only on label boundaries */
+	EXPECT_STREQ(nullptr, url_db_find_url(db, "bar", "badfoo.com"));
+	EXPECT_STREQ(nullptr, url_db_find_url(db, "bar", "foo.com.au"));
+	EXPECT_STREQ("foo", url_db_find_url(db, "bar", "WWW.FOO.COM"));
+
+	url_db_close(db);
+}
+
+static void
+count_url (const gchar * protocol, const gchar * domainsuffix, const gchar * appid, gpointer user_data)
+{
+	auto urls = static_cast<std::vector<std::string> *>(user_data);
+	urls->push_back(std::string(protocol) + " " + domainsuffix + " " + appid);
+}
+
+TEST_F(UrlDBTest, ForeachTest) {
+	UrlDb * db = url_db_create_database();
+
+	ASSERT_TRUE(db != nullptr);
+
+	gint64 startversion = 0;
+	EXPECT_TRUE(url_db_get_data_version(db, &startversion));
+
+	GTimeVal timeval = {12345, 0};
+	EXPECT_TRUE(url_db_set_file_motification_time(db, "/foo.url-dispatcher", &timeval));
+	EXPECT_TRUE(url_db_insert_url(db, "/foo.url-dispatcher", "bar", "foo.com"));
+	EXPECT_TRUE(url_db_insert_url(db, "/foo.url-dispatcher", "baz", nullptr));
+
+	std::vector<std::string> urls;
+	EXPECT_TRUE(url_db_foreach_url(db, count_url, &urls));
+	ASSERT_EQ(2u, urls.size());
+	EXPECT_EQ("bar foo.com foo", urls[0]);
+	EXPECT_EQ("baz  foo", urls[1]);
+
+	/* Our own changes don't count, only other connections */
+	gint64 version = 0;
+	EXPECT_TRUE(url_db_get_data_version(db, &version));
+	EXPECT_EQ(startversion, version);
+
+	UrlDb * other = url_db_create_database();
+	EXPECT_TRUE(url_db_insert_url(other, "/foo.url-dispatcher", "other", nullptr));
+	url_db_close(other);
+
+	EXPECT_TRUE(url_db_get_data_version(db, &version));
+	EXPECT_NE(startversion, version);
+
+	url_db_close(db);
 }
 
 TEST_F(UrlDBTest, FileListTest) {
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	ASSERT_TRUE(db != nullptr);
 
@@ -168,11 +258,11 @@ TEST_F(UrlDBTest, FileListTest) {
 	files = url_db_files_for_dir(db, "/dir/not/there");
 	EXPECT_EQ(0, g_list_length(files));
 
-	sqlite3_close(db);
+	url_db_close(db);
 }
 
 TEST_F(UrlDBTest, RemoveFile) {
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	ASSERT_TRUE(db != nullptr);
 
@@ -189,11 +279,47 @@ TEST_F(UrlDBTest, RemoveFile) {
 	EXPECT_FALSE(url_db_get_file_motification_time(db, "/foo.url-dispatcher", &timeval));
 	EXPECT_STREQ(nullptr, url_db_find_url(db, "bar", "foo.com"));
 
-	sqlite3_close(db);
+	url_db_close(db);
+}
+
+TEST_F(UrlDBTest, TransactionTest) {
+	UrlDb * db = url_db_create_database();
+
+	ASSERT_TRUE(db != nullptr);
+
+	GTimeVal timeval = {12345, 0};
+
+	/* Nothing is left after a rollback */
+	EXPECT_TRUE(url_db_begin(db));
+	EXPECT_TRUE(url_db_set_file_motification_time(db, "/foo.url-dispatcher", &timeval));
+	EXPECT_TRUE(url_db_insert_url(db, "/foo.url-dispatcher", "bar", "foo.com"));
+	EXPECT_STREQ("foo", url_db_find_url(db, "bar", "foo.com"));
+	url_db_rollback(db);
+
+	EXPECT_FALSE(url_db_get_file_motification_time(db, "/foo.url-dispatcher", &timeval));
+	EXPECT_STREQ(nullptr, url_db_find_url(db, "bar", "foo.com"));
+
+	/* Removing files works inside of one */
+	EXPECT_TRUE(url_db_begin(db));
+	EXPECT_TRUE(url_db_set_file_motification_time(db, "/foo.url-dispatcher", &timeval));
+	EXPECT_TRUE(url_db_insert_url(db, "/foo.url-dispatcher", "bar", "foo.com"));
+	EXPECT_TRUE(url_db_set_file_motification_time(db, "/baz.url-dispatcher", &timeval));
+	EXPECT_TRUE(url_db_insert_url(db, "/baz.url-dispatcher", "baz", nullptr));
+	EXPECT_TRUE(url_db_remove_file(db, "/baz.url-dispatcher"));
+	EXPECT_TRUE(url_db_commit(db));
+
+	EXPECT_STREQ("foo", url_db_find_url(db, "bar", "foo.com"));
+	EXPECT_STREQ(nullptr, url_db_find_url(db, "baz", nullptr));
+
+	/* Rolling back twice is fine, nothing to commit isn't */
+	url_db_rollback(db);
+	EXPECT_FALSE(url_db_commit(db));
+
+	url_db_close(db);
 }
 
 TEST_F(UrlDBTest, ReplaceTest) {
-	sqlite3 * db = url_db_create_database();
+	UrlDb * db = url_db_create_database();
 
 	ASSERT_TRUE(db != nullptr);
 
@@ -219,6 +345,96 @@ TEST_F(UrlDBTest, ReplaceTest) {
 	url_db_get_file_motification_time(db, "/foo.url-dispatcher", &timevaltest);
 	EXPECT_EQ(67890, timevaltest.tv_sec);
 
-	sqlite3_close(db);
+	url_db_close(db);
 }
 
+TEST_F(UrlDBTest, StampTest) {
+	UrlDb * db = url_db_create_database();
+
+	ASSERT_TRUE(db != nullptr);
+
+	UrlDbFileStamp stamp = {0, 0, 0};
+	EXPECT_FALSE(url_db_get_file_stamp(db, "/foo.url-dispatcher", &stamp));
+
+	/* Nanoseconds, size, inode and hash all survive, even a hash
+	   that doesn't fit in a signed column */
+	UrlDbFileStamp first = {1234567890123456789LL, 42, 1000, G_GUINT64_CONSTANT(0xfedcba9876543210)};
+	EXPECT_TRUE(url_db_set_file_stamp(db, "/foo.url-dispatcher", &first));
+	EXPECT_TRUE(url_db_insert_url(db, "/foo.url-dispatcher", "bar", "foo.com"));
+
+	EXPECT_TRUE(url_db_get_file_stamp(db, "/foo.url-dispatcher", &stamp));
+	EXPECT_EQ(first.mtime, stamp.mtime);
+	EXPECT_EQ(first.size, stamp.size);
+	EXPECT_EQ(first.inode, stamp.inode);
+	EXPECT_EQ(first.hash, stamp.hash);
+
+	/* Restamping in the same second keeps the file's URLs */
+	UrlDbFileStamp second = {1234567890000000001LL, 43, 1001, 5};
+	EXPECT_TRUE(url_db_set_file_stamp(db, "/foo.url-dispatcher", &second));
+	EXPECT_STREQ("foo", url_db_find_url(db, "bar", "foo.com"));
+
+	EXPECT_TRUE(url_db_get_file_stamp(db, "/foo.url-dispatcher", &stamp));
+	EXPECT_EQ(second.mtime, stamp.mtime);
+	EXPECT_EQ(second.size, stamp.size);
+	EXPECT_EQ(second.inode, stamp.inode);
+	EXPECT_EQ(second.hash, stamp.hash);
+
+	/* Dropping the URLs keeps the file */
+	EXPECT_TRUE(url_db_remove_file_urls(db, "/foo.url-dispatcher"));
+	EXPECT_STREQ(nullptr, url_db_find_url(db, "bar", "foo.com"));
+	EXPECT_TRUE(url_db_get_file_stamp(db, "/foo.url-dispatcher", &stamp));
+
+	/* The old seconds interface is still seconds */
+	GTimeVal timeval = {0, 0};
+	EXPECT_TRUE(url_db_get_file_motification_time(db, "/foo.url-dispatcher", &timeval));
+	EXPECT_EQ(1234567890, timeval.tv_sec);
+
+	url_db_close(db);
+}
+
+
+TEST_F(UrlDBTest, StatementReuseTest) {
+	UrlDb * db = url_db_create_database();
+
+	ASSERT_TRUE(db != nullptr);
+
+	/* Strings are freed right after each call, so nothing can be
+	   left pointing at them when the statement is used again */
+	for (int i = 0; i < 100; i++) {
+		gchar * filename = g_strdup_printf("/app%d.url-dispatcher", i);
+		gchar * domain = g_strdup_printf("app%d.com", i);
+		GTimeVal timeval = {i + 1, 0};
+
+		EXPECT_TRUE(url_db_set_file_motification_time(db, filename, &timeval));
+		EXPECT_TRUE(url_db_insert_url(db, filename, "http", domain));
+
+		g_free(filename);
+		g_free(domain);
+	}
+
+	for (int i = 0; i < 100; i++) {
+		gchar * domain = g_strdup_printf("www.app%d.com", i);
+		gchar * expected = g_strdup_printf("app%d", i);
+		gchar * found = url_db_find_url(db, "http", domain);
+
+		EXPECT_STREQ(expected, found);
+
+		g_free(found);
+		g_free(expected);
+		g_free(domain);
+	}
+
+	/* Cached statements can't keep a read transaction open that
+	   would hide what other connections write */
+	UrlDb * other = url_db_create_database();
+	GTimeVal timeval = {12345, 0};
+	EXPECT_TRUE(url_db_set_file_motification_time(other, "/other.url-dispatcher", &timeval));
+	EXPECT_TRUE(url_db_insert_url(other, "/other.url-dispatcher", "other", nullptr));
+	EXPECT_EQ(0, url_db_close(other));
+
+	gchar * found = url_db_find_url(db, "other", nullptr);
+	EXPECT_STREQ("other", found);
+	g_free(found);
+
+	EXPECT_EQ(SQLITE_OK, url_db_close(db));
+}
@@ -0,0 +1,258 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "test-config.h"
+
+#include <string.h>
+#include <string>
+
+#include <gtest/gtest.h>
+#include "url-db.h"
+#include "url-index.h"
+#include "url-trie.h"
+
+class UrlIndexTest : public ::testing::Test
+{
+	protected:
+		gchar * cachedir = nullptr;
+		gchar * indexfile = nullptr;
+		UrlDb * db = nullptr;
+
+		virtual void SetUp() {
+			cachedir = g_build_filename(CMAKE_BINARY_DIR, "url-index-test-cache", nullptr);
+			g_setenv("URL_DISPATCHER_CACHE_DIR", cachedir, TRUE);
+
+			db = url_db_create_database();
+			ASSERT_TRUE(db != nullptr);
+
+			indexfile = url_db_index_filename();
+		}
+
+		virtual void TearDown() {
+			url_db_close(db);
+
+			gchar * cmdline = g_strdup_printf("rm -rf \"%s\"", cachedir);
+			g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+			g_free(cmdline);
+			g_free(indexfile);
+			g_free(cachedir);
+		}
+
+		void insert (const gchar * filename, const gchar * protocol, const gchar * domain) {
+			GTimeVal timeval = {0, 0};
+			timeval.tv_sec = 12345;
+			url_db_set_file_motification_time(db, filename, &timeval);
+			EXPECT_TRUE(url_db_insert_url(db, filename, protocol, domain));
+		}
+
+		static void trie_add (const gchar * protocol, const gchar * domainsuffix, const gchar * appid, gpointer user_data) {
+			url_trie_insert((UrlTrie *)user_data, protocol, domainsuffix, appid);
+		}
+
+		static const gchar * lookup (UrlIndex * index, const gchar * protocol, const gchar * domain) {
+			return url_index_lookup(index, protocol, strlen(protocol), domain, domain != nullptr ? strlen(domain) : 0);
+		}
+};
+
+TEST_F(UrlIndexTest, Filename)
+{
+	gchar * expected = g_build_filename(cachedir, "url-dispatcher", "urls-3.index", nullptr);
+	EXPECT_STREQ(expected, indexfile);
+	g_free(expected);
+
+	EXPECT_EQ(nullptr, url_index_open(indexfile));
+}
+
+TEST_F(UrlIndexTest, SameAsTrie)
+{
+	insert("/browser.url-dispatcher", "http", nullptr);
+	insert("/foo.url-dispatcher", "http", "foo.com");
+	insert("/mobile.url-dispatcher", "http", "M.Foo.com");
+	insert("/dotted.url-dispatcher", "http", ".bar.org");
+	insert("/empty.url-dispatcher", "http", "a..b");
+	insert("/dialer.url-dispatcher", "tel", "");
+	insert("/second.url-dispatcher", "http", "foo.com");
+	insert("/caps.url-dispatcher", "HTTP", "foo.com");
+
+	ASSERT_TRUE(url_index_write(db, indexfile));
+
+	UrlIndex * index = url_index_open(indexfile);
+	ASSERT_TRUE(index != nullptr);
+
+	UrlTrie * trie = url_trie_new();
+	ASSERT_TRUE(url_db_foreach_url(db, trie_add, trie));
+
+	EXPECT_EQ(url_trie_size(trie), url_index_size(index));
+
+	const gchar * queries[][2] = {
+		{"http", nullptr},
+		{"http", ""},
+		{"http", "ubuntu.com"},
+		{"http", "foo.com"},
+		{"http", "www.FOO.com"},
+		{"http", "m.foo.com"},
+		{"http", "a.b.m.foo.com"},
+		{"http", "xm.foo.com"},
+		{"http", "badfoo.com"},
+		{"http", "bar.org"},
+		{"http", "www.bar.org"},
+		{"http", "a..b"},
+		{"http", "c.a..b"},
+		{"http", ".b"},
+		{"http", "foo.com."},
+		{"http", "."},
+		{"HTTP", "www.foo.com"},
+		{"HTTP", "ubuntu.com"},
+		{"tel", "5551234"},
+		{"https", "foo.com"},
+		{"htt", nullptr},
+		{"httpx", nullptr},
+	};
+
+	for (auto query : queries) {
+		SCOPED_TRACE(std::string(query[0]) + "://" + (query[1] != nullptr ? query[1] : "(null)"));
+
+		const gchar * fromtrie = url_trie_lookup(trie, query[0], strlen(query[0]), query[1], query[1] != nullptr ? strlen(query[1]) : 0);
+		EXPECT_STREQ(fromtrie, lookup(index, query[0], query[1]));
+	}
+
+	EXPECT_STREQ("foo", lookup(index, "http", "www.foo.com"));
+	EXPECT_STREQ("mobile", lookup(index, "http", "m.foo.com"));
+	EXPECT_STREQ("browser", lookup(index, "http", "badfoo.com"));
+	EXPECT_STREQ("dialer", lookup(index, "tel", "5551234"));
+	EXPECT_EQ(nullptr, lookup(index, "https", "foo.com"));
+
+	/* The same through a trie */
+	UrlTrie * mapped = url_trie_new_for_index(index);
+	EXPECT_EQ(url_trie_size(trie), url_trie_size(mapped));
+	EXPECT_STREQ("mobile", url_trie_lookup(mapped, "http", 4, "m.foo.com", 9));
+	EXPECT_FALSE(url_trie_insert(mapped, "http", "baz.com", "baz"));
+
+	url_trie_unref(mapped);
+	url_trie_unref(trie);
+	url_index_unref(index);
+}
+
+TEST_F(UrlIndexTest, LongDomain)
+{
+	insert("/foo.url-dispatcher", "http", "foo.com");
+	ASSERT_TRUE(url_index_write(db, indexfile));
+
+	UrlIndex * index = url_index_open(indexfile);
+	ASSERT_TRUE(index != nullptr);
+
+	GString * domain = g_string_new(nullptr);
+	while (domain->len < 1000) {
+		g_string_append(domain, "label.");
+	}
+	g_string_append(domain, "foo.com");
+
+	EXPECT_STREQ("foo", lookup(index, "http", domain->str));
+
+	g_string_free(domain, TRUE);
+	url_index_unref(index);
+}
+
+TEST_F(UrlIndexTest, Generation)
+{
+	insert("/foo.url-dispatcher", "http", "foo.com");
+	ASSERT_TRUE(url_index_update(db, indexfile));
+
+	gint64 generation = 0;
+	ASSERT_TRUE(url_db_get_generation(db, &generation));
+
+	UrlIndex * index = url_index_open(indexfile);
+	ASSERT_TRUE(index != nullptr);
+	EXPECT_EQ(generation, url_index_get_generation(index));
+	EXPECT_EQ(nullptr, lookup(index, "http", "bar.com"));
+	url_index_unref(index);
+
+	/* Any change to the URLs makes it stale */
+	insert("/bar.url-dispatcher", "http", "bar.com");
+
+	gint64 newgeneration = 0;
+	ASSERT_TRUE(url_db_get_generation(db, &newgeneration));
+	EXPECT_NE(generation, newgeneration);
+
+	ASSERT_TRUE(url_index_update(db, indexfile));
+
+	index = url_index_open(indexfile);
+	ASSERT_TRUE(index != nullptr);
+	EXPECT_EQ(newgeneration, url_index_get_generation(index));
+	EXPECT_STREQ("bar", lookup(index, "http", "bar.com"));
+	url_index_unref(index);
+
+	EXPECT_TRUE(url_db_remove_file(db, "/bar.url-dispatcher"));
+
+	generation = newgeneration;
+	ASSERT_TRUE(url_db_get_generation(db, &newgeneration));
+	EXPECT_NE(generation, newgeneration);
+}
+
+TEST_F(UrlIndexTest, RecreatedDatabase)
+{
+	insert("/foo.url-dispatcher", "http", "foo.com");
+	ASSERT_TRUE(url_index_update(db, indexfile));
+
+	gint64 generation = 0;
+	ASSERT_TRUE(url_db_get_generation(db, &generation));
+
+	/* Throw the database away but leave the index behind, the new one
+	   must not count up to the same generation */
+	url_db_close(db);
+	gchar * cmdline = g_strdup_printf("sh -c 'rm -f \"%s\"/url-dispatcher/urls-3.db*'", cachedir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+
+	db = url_db_create_database();
+	ASSERT_TRUE(db != nullptr);
+	insert("/bar.url-dispatcher", "http", "bar.com");
+
+	gint64 newgeneration = 0;
+	ASSERT_TRUE(url_db_get_generation(db, &newgeneration));
+	EXPECT_LT(generation, newgeneration);
+
+	UrlIndex * index = url_index_open(indexfile);
+	ASSERT_TRUE(index != nullptr);
+	EXPECT_NE(newgeneration, url_index_get_generation(index));
+	url_index_unref(index);
+}
+
+TEST_F(UrlIndexTest, Corrupt)
+{
+	insert("/foo.url-dispatcher", "http", "foo.com");
+	ASSERT_TRUE(url_index_write(db, indexfile));
+
+	gchar * contents = nullptr;
+	gsize length = 0;
+	ASSERT_TRUE(g_file_get_contents(indexfile, &contents, &length, nullptr));
+
+	/* Cut short */
+	ASSERT_TRUE(g_file_set_contents(indexfile, contents, length - 1, nullptr));
+	EXPECT_EQ(nullptr, url_index_open(indexfile));
+
+	/* Empty */
+	ASSERT_TRUE(g_file_set_contents(indexfile, "", 0, nullptr));
+	EXPECT_EQ(nullptr, url_index_open(indexfile));
+
+	/* Not an index */
+	contents[0] = 'X';
+	ASSERT_TRUE(g_file_set_contents(indexfile, contents, length, nullptr));
+	EXPECT_EQ(nullptr, url_index_open(indexfile));
+
+	g_free(contents);
+}
@@ -0,0 +1,442 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Times dispatcher_url_to_appid() and url_db_find_url() against
+   synthetic databases from 100 rows up to a million, with a few
+   different mixes of URLs. Not run as part of the test suite, run it
+   by hand and keep the JSON it prints to compare builds:
+
+     tests/url-resolve-bench [iterations] [max rows] [seconds per run]
+
+   Each run stops after the iterations or the time, whichever comes
+   first, url_db_find_url() is a table scan so it gets slow on the big
+   databases. The URLs are picked at random over the whole database so
+   the bigger ones mostly miss the lookup cache, set
+   URL_DISPATCHER_LOOKUP_CACHE_SIZE=0 to take it out entirely.
+
+   The hit-with-huge mix is the hit one with a 10 MB URL turned away
+   before each lookup. Only the hits are timed, they should come out
+   the same as in the hit mix.
+*/
+
+#include "test-config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <gio/gio.h>
+#include "dispatcher.h"
+#include "overlay-tracker-mock.h"
+#include "url-db.h"
+#include "url-parse.h"
+
+#define ROWS_PER_FILE 100
+
+/* What each synthetic row handles, by its index mod 10 */
+enum {
+	ROW_INTENT = 0,   /* intent for com.example.pkgN */
+	ROW_SCHEME = 1,   /* protoN: with no domain */
+	ROW_HTTP = 2      /* and up, http for siteN.example.com */
+};
+
+typedef enum {
+	MIX_HIT,
+	MIX_MISS,
+	MIX_DEEP_SUFFIX,
+	MIX_INTENT,
+	MIX_APPID,
+	MIX_HIT_WITH_HUGE,
+	MIX_COUNT
+} Mix;
+
+static const gchar * mix_names[MIX_COUNT] = {
+	"hit",
+	"miss",
+	"deep-suffix",
+	"intent",
+	"appid",
+	"hit-with-huge"
+};
+
+/* A URL and what url_db_find_url() would be asked for it */
+struct BenchUrl {
+	gchar * url;
+	gchar * protocol;
+	gchar * domain;
+};
+
+struct Result {
+	guint64 ops = 0;
+	guint64 found = 0;
+	gint64 elapsed = 0;
+	std::vector<gint64> times;
+};
+
+static gint64
+now_ns (void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (gint64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Picks a row of the given kind */
+static guint
+random_row (GRand * rand, guint rows, guint kind)
+{
+	guint row = (guint)g_rand_int_range(rand, 0, rows / 10) * 10;
+
+	if (kind == ROW_HTTP) {
+		return row + (guint)g_rand_int_range(rand, ROW_HTTP, 10);
+	}
+
+	return row + kind;
+}
+
+/* Fills the database, a file per ROWS_PER_FILE rows so the number of
+   config files grows with it too */
+static void
+build_database (guint rows)
+{
+	UrlDb * db = url_db_create_database();
+	g_return_if_fail(db != nullptr);
+	sqlite3 * conn = url_db_get_connection(db);
+
+	GTimeVal timeval = {12345, 0};
+	gchar * filename = nullptr;
+
+	sqlite3_exec(conn, "begin", nullptr, nullptr, nullptr);
+	for (guint i = 0; i < rows; i++) {
+		if (i % ROWS_PER_FILE == 0) {
+			g_free(filename);
+			filename = g_strdup_printf("/usr/share/url-dispatcher/urls/com.example.app%u_app_1.0.url-dispatcher", i / ROWS_PER_FILE);
+			url_db_set_file_motification_time(db, filename, &timeval);
+		}
+
+		gchar * protocol = nullptr;
+		gchar * domain = nullptr;
+
+		switch (i % 10) {
+		case ROW_INTENT:
+			protocol = g_strdup("intent");
+			domain = g_strdup_printf("com.example.pkg%u", i);
+			break;
+		case ROW_SCHEME:
+			protocol = g_strdup_printf("proto%u", i);
+			break;
+		default:
+			protocol = g_strdup("http");
+			domain = g_strdup_printf("site%u.example.com", i);
+			break;
+		}
+
+		url_db_insert_url(db, filename, protocol, domain);
+
+		g_free(protocol);
+		g_free(domain);
+	}
+	sqlite3_exec(conn, "commit", nullptr, nullptr, nullptr);
+
+	g_free(filename);
+	url_db_close(db);
+}
+
+static gchar *
+mix_url (Mix mix, GRand * rand, guint rows)
+{
+	switch (mix) {
+	case MIX_HIT:
+		if (g_rand_boolean(rand)) {
+			return g_strdup_printf("proto%u:some/path", random_row(rand, rows, ROW_SCHEME));
+		}
+		return g_strdup_printf("http://site%u.example.com/index.html", random_row(rand, rows, ROW_HTTP));
+	case MIX_MISS:
+		return g_strdup_printf("http://site%u.example.org/index.html", random_row(rand, rows, ROW_HTTP));
+	case MIX_DEEP_SUFFIX:
+		return g_strdup_printf("http://a.b.c.d.e.f.g.site%u.example.com/index.html", random_row(rand, rows, ROW_HTTP));
+	case MIX_INTENT:
+		return g_strdup_printf("intent://maps.example.com/place#Intent;scheme=http;package=com.example.pkg%u;end", random_row(rand, rows, ROW_INTENT));
+	case MIX_APPID:
+		return g_strdup_printf("appid://com.example.app%u/app/1.0", (guint)g_rand_int_range(rand, 0, rows / ROWS_PER_FILE + 1));
+	case MIX_HIT_WITH_HUGE:
+		return mix_url(MIX_HIT, rand, rows);
+	case MIX_COUNT:
+		break;
+	}
+
+	return nullptr;
+}
+
+/* Same URLs for every build, so the results can be compared */
+static std::vector<BenchUrl>
+mix_urls (Mix mix, guint rows, guint count)
+{
+	GRand * rand = g_rand_new_with_seed(rows * MIX_COUNT + mix);
+	std::vector<BenchUrl> urls(count);
+
+	for (auto &url : urls) {
+		url.url = mix_url(mix, rand, rows);
+
+		UrlParts parts;
+		if (url_parse(url.url, &parts) == URL_KIND_GENERIC) {
+			url.protocol = g_strndup(parts.protocol.start, parts.protocol.len);
+			url.domain = g_strndup(parts.domain.start, parts.domain.len);
+		} else {
+			url.protocol = nullptr;
+			url.domain = nullptr;
+		}
+	}
+
+	g_rand_free(rand);
+	return urls;
+}
+
+static void
+free_urls (std::vector<BenchUrl> &urls)
+{
+	for (auto &url : urls) {
+		g_free(url.url);
+		g_free(url.protocol);
+		g_free(url.domain);
+	}
+	urls.clear();
+}
+
+/* Times each of @urls, after an untimed lookup of @between if there
+   is one */
+static Result
+run_dispatcher (const std::vector<BenchUrl> &urls, const gchar * between, gint64 budget)
+{
+	Result result;
+	result.times.reserve(urls.size());
+	gint64 start = now_ns();
+
+	for (const auto &url : urls) {
+		gchar * appid = nullptr;
+		const gchar * outurl = nullptr;
+
+		if (between != nullptr) {
+			dispatcher_url_to_appid(between, &appid, nullptr);
+			g_clear_pointer(&appid, g_free);
+		}
+
+		gint64 before = now_ns();
+		gboolean found = dispatcher_url_to_appid(url.url, &appid, &outurl);
+		gint64 after = now_ns();
+
+		result.times.push_back(after - before);
+		result.ops++;
+		if (found) {
+			result.found++;
+		}
+		g_free(appid);
+
+		if (after - start > budget) {
+			break;
+		}
+	}
+
+	result.elapsed = now_ns() - start;
+	return result;
+}
+
+static Result
+run_find_url (UrlDb * db, const std::vector<BenchUrl> &urls, gint64 budget)
+{
+	Result result;
+	result.times.reserve(urls.size());
+	gint64 start = now_ns();
+
+	for (const auto &url : urls) {
+		gint64 before = now_ns();
+		gchar * appid = url_db_find_url(db, url.protocol, url.domain);
+		gint64 after = now_ns();
+
+		result.times.push_back(after - before);
+		result.ops++;
+		if (appid != nullptr) {
+			result.found++;
+		}
+		g_free(appid);
+
+		if (after - start > budget) {
+			break;
+		}
+	}
+
+	result.elapsed = now_ns() - start;
+	return result;
+}
+
+static gint64
+percentile (const std::vector<gint64> &sorted, double fraction)
+{
+	if (sorted.empty()) {
+		return 0;
+	}
+
+	size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+static void
+report (bool &first, guint rows, const gchar * function, Mix mix, Result &result, guint64 cachehits, guint64 cachemisses)
+{
+	std::sort(result.times.begin(), result.times.end());
+
+	gint64 total = 0;
+	for (auto time : result.times) {
+		total += time;
+	}
+
+	g_print("%s\n    {\"rows\": %u, \"function\": \"%s\", \"mix\": \"%s\", "
+		"\"ops\": %" G_GUINT64_FORMAT ", \"found\": %" G_GUINT64_FORMAT ", "
+		"\"ops_per_sec\": %.1f, \"mean_ns\": %" G_GINT64_FORMAT ", "
+		"\"p50_ns\": %" G_GINT64_FORMAT ", \"p90_ns\": %" G_GINT64_FORMAT ", "
+		"\"p99_ns\": %" G_GINT64_FORMAT ", \"p999_ns\": %" G_GINT64_FORMAT ", "
+		"\"max_ns\": %" G_GINT64_FORMAT ", "
+		"\"cache_hits\": %" G_GUINT64_FORMAT ", \"cache_misses\": %" G_GUINT64_FORMAT "}",
+		first ? "" : ",",
+		rows, function, mix_names[mix],
+		result.ops, result.found,
+		result.elapsed > 0 ? (double)result.ops * 1000000000.0 / result.elapsed : 0.0,
+		result.ops > 0 ? total / (gint64)result.ops : 0,
+		percentile(result.times, 0.50), percentile(result.times, 0.90),
+		percentile(result.times, 0.99), percentile(result.times, 0.999),
+		result.times.empty() ? 0 : result.times.back(),
+		cachehits, cachemisses);
+
+	first = false;
+}
+
+static void
+remove_dir (const gchar * dir)
+{
+	gchar * cmdline = g_strdup_printf("rm -rf \"%s\"", dir);
+	g_spawn_command_line_sync(cmdline, nullptr, nullptr, nullptr, nullptr);
+	g_free(cmdline);
+}
+
+int
+main (int argc, char * argv[])
+{
+	int iterations = 20000;
+	long maxrows = 1000000;
+	double seconds = 2.0;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		maxrows = atol(argv[2]);
+	}
+	if (argc > 3) {
+		seconds = g_ascii_strtod(argv[3], nullptr);
+	}
+	if (iterations <= 0 || maxrows < 100 || seconds <= 0.0) {
+		g_printerr("Usage: %s [iterations] [max rows] [seconds per run]\n", argv[0]);
+		return 1;
+	}
+
+	gint64 budget = (gint64)(seconds * 1000000000.0);
+
+	gchar * cachedir = g_build_filename(CMAKE_BINARY_DIR, "url-resolve-bench-cache", nullptr);
+	g_setenv("URL_DISPATCHER_CACHE_DIR", cachedir, TRUE);
+	g_setenv("URL_DISPATCHER_OVERLAY_DIR", OVERLAY_TEST_DIR, TRUE);
+
+	GTestDBus * testbus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_up(testbus);
+
+	GMainLoop * mainloop = g_main_loop_new(nullptr, FALSE);
+	OverlayTrackerMock tracker;
+	bool first = true;
+
+	/* Over the default limit, so it's turned away */
+	std::string huge = "http://site2.example.com/" + std::string(10 * 1024 * 1024, 'a');
+
+	g_print("{\"benchmark\": \"url-resolve\", \"iterations\": %d, \"seconds\": %.2f, \"results\": [", iterations, seconds);
+
+	for (long rows = 100; rows <= maxrows; rows *= 10) {
+		remove_dir(cachedir);
+
+		g_printerr("Building %ld rows\n", rows);
+		gint64 start = now_ns();
+		build_database((guint)rows);
+		gint64 buildtime = now_ns() - start;
+
+		/* Builds the routing trie */
+		start = now_ns();
+		dispatcher_init(mainloop, reinterpret_cast<OverlayTracker *>(&tracker));
+		gint64 inittime = now_ns() - start;
+
+		g_print("%s\n    {\"rows\": %ld, \"build_ms\": %.1f, \"init_ms\": %.1f}",
+			first ? "" : ",", rows, buildtime / 1000000.0, inittime / 1000000.0);
+		first = false;
+
+		UrlDb * db = url_db_open_readonly();
+
+		for (int mix = 0; mix < MIX_COUNT; mix++) {
+			std::vector<BenchUrl> urls = mix_urls((Mix)mix, (guint)rows, (guint)iterations);
+
+			guint64 hits = 0, misses = 0;
+			guint64 afterhits = 0, aftermisses = 0;
+			dispatcher_get_cache_stats(&hits, &misses);
+			Result result = run_dispatcher(urls, mix == MIX_HIT_WITH_HUGE ? huge.c_str() : nullptr, budget);
+			dispatcher_get_cache_stats(&afterhits, &aftermisses);
+
+			report(first, (guint)rows, "dispatcher_url_to_appid", (Mix)mix, result, afterhits - hits, aftermisses - misses);
+
+			/* AppIDs are worked out without the database, and the
+			   database never sees the huge URLs */
+			if (mix != MIX_APPID && mix != MIX_HIT_WITH_HUGE && db != nullptr) {
+				g_printerr("Finding %s URLs in %ld rows\n", mix_names[mix], rows);
+				Result dbresult = run_find_url(db, urls, budget);
+				report(first, (guint)rows, "url_db_find_url", (Mix)mix, dbresult, 0, 0);
+			}
+
+			free_urls(urls);
+		}
+
+		if (db != nullptr) {
+			url_db_close(db);
+		}
+
+		dispatcher_shutdown();
+
+		/* Clean up queued events */
+		while (g_main_pending()) {
+			g_main_iteration(TRUE);
+		}
+	}
+
+	g_print("\n]}\n");
+
+	g_main_loop_unref(mainloop);
+
+	g_test_dbus_down(testbus);
+	g_object_unref(testbus);
+
+	remove_dir(cachedir);
+	g_free(cachedir);
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+#include "url-trie.h"
+
+class UrlTrieTest : public ::testing::Test
+{
+	protected:
+		UrlTrie * trie = nullptr;
+
+		virtual void SetUp() {
+			trie = url_trie_new();
+		}
+
+		virtual void TearDown() {
+			url_trie_unref(trie);
+		}
+
+		const gchar * lookup (const gchar * protocol, const gchar * domain) {
+			return url_trie_lookup(trie, protocol, strlen(protocol), domain, domain != nullptr ? strlen(domain) : 0);
+		}
+};
+
+TEST_F(UrlTrieTest, Basic)
+{
+	EXPECT_TRUE(url_trie_insert(trie, "http", nullptr, "browser"));
+	EXPECT_TRUE(url_trie_insert(trie, "http", "foo.com", "foo"));
+	EXPECT_TRUE(url_trie_insert(trie, "http", "m.foo.com", "mobile"));
+	EXPECT_TRUE(url_trie_insert(trie, "tel", "", "dialer"));
+	EXPECT_EQ(4u, url_trie_size(trie));
+
+	EXPECT_STREQ("browser", lookup("http", nullptr));
+	EXPECT_STREQ("browser", lookup("http", "ubuntu.com"));
+	EXPECT_STREQ("foo", lookup("http", "foo.com"));
+	EXPECT_STREQ("foo", lookup("http", "www.foo.com"));
+	EXPECT_STREQ("mobile", lookup("http", "m.foo.com"));
+	EXPECT_STREQ("mobile", lookup("http", "a.b.m.foo.com"));
+	EXPECT_STREQ("dialer", lookup("tel", ""));
+
+	EXPECT_EQ(nullptr, lookup("https", "foo.com"));
+	EXPECT_EQ(nullptr, lookup("htt", nullptr));
+}
+
+TEST_F(UrlTrieTest, LabelBoundary)
+{
+	EXPECT_TRUE(url_trie_insert(trie, "http", "example.com", "example"));
+
+	EXPECT_STREQ("example", lookup("http", "example.com"));
+	EXPECT_STREQ("example", lookup("http", "www.example.com"));
+	EXPECT_EQ(nullptr, lookup("http", "badexample.com"));
+	EXPECT_EQ(nullptr, lookup("http", "example.com.au"));
+	EXPECT_EQ(nullptr, lookup("http", "com"));
+
+	/* A leading dot doesn't make a different suffix */
+	EXPECT_FALSE(url_trie_insert(trie, "http", ".example.com", "dotted"));
+	EXPECT_STREQ("example", lookup("http", "www.example.com"));
+}
+
+TEST_F(UrlTrieTest, Case)
+{
+	EXPECT_TRUE(url_trie_insert(trie, "http", "Foo.COM", "foo"));
+
+	EXPECT_STREQ("foo", lookup("http", "foo.com"));
+	EXPECT_STREQ("foo", lookup("http", "WWW.FOO.COM"));
+
+	/* Protocols are case sensitive */
+	EXPECT_EQ(nullptr, lookup("HTTP", "foo.com"));
+}
+
+TEST_F(UrlTrieTest, FirstWins)
+{
+	EXPECT_TRUE(url_trie_insert(trie, "http", "foo.com", "first"));
+	EXPECT_FALSE(url_trie_insert(trie, "http", "FOO.com", "second"));
+	EXPECT_EQ(1u, url_trie_size(trie));
+
+	EXPECT_STREQ("first", lookup("http", "foo.com"));
+}
+
+TEST_F(UrlTrieTest, Spans)
+{
+	EXPECT_TRUE(url_trie_insert(trie, "http", "foo.com", "foo"));
+
+	/* Lookups take lengths so they can point into a larger URL */
+	const gchar * url = "http://www.foo.com/path";
+	EXPECT_STREQ("foo", url_trie_lookup(trie, url, 4, url + 7, 11));
+	EXPECT_EQ(nullptr, url_trie_lookup(trie, url, 4, url + 7, 10));
+}
+
+TEST_F(UrlTrieTest, References)
+{
+	EXPECT_TRUE(url_trie_insert(trie, "http", "foo.com", "foo"));
+
+	/* Whoever still has a reference can keep looking things up */
+	UrlTrie * ref = url_trie_ref(trie);
+	EXPECT_EQ(trie, ref);
+	url_trie_unref(ref);
+
+	EXPECT_STREQ("foo", lookup("http", "foo.com"));
+}
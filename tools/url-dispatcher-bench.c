@@ -0,0 +1,541 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Load generator for the service. Starts a dispatcher on a private bus
+   with the same Upstart and Dash mocks the service test uses, then
+   drives DispatchURL and TestURL at it:
+
+     url-dispatcher-bench --concurrency 16 --rate 2000 --duration 30 \
+         --calls dispatch=3,test=1 --mix handled=4,web=2,bad=1
+
+   With --rate the calls are sent on a schedule and their latency counts
+   from when they were due, so replies backing up show in the tail.
+   Without it each slot sends a new call as soon as its reply comes in. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <libdbustest/dbus-test.h>
+#include "url-db.h"
+
+#define DISPATCHER_NAME "com.canonical.URLDispatcher"
+#define DISPATCHER_PATH "/com/canonical/URLDispatcher"
+
+typedef enum {
+	CALL_DISPATCH,
+	CALL_TEST,
+	CALL_COUNT
+} CallType;
+
+static const gchar * call_names[CALL_COUNT] = {
+	"dispatch",
+	"test"
+};
+
+static const gchar * call_methods[CALL_COUNT] = {
+	"DispatchURL",
+	"TestURL"
+};
+
+/* The kinds of URL to send, %u gets a counter */
+typedef enum {
+	URL_HANDLED,
+	URL_WEB,
+	URL_APPLICATION,
+	URL_SCOPE,
+	URL_BAD,
+	URL_COUNT
+} UrlType;
+
+static const gchar * url_names[URL_COUNT] = {
+	"handled",
+	"web",
+	"application",
+	"scope",
+	"bad"
+};
+
+static const gchar * url_formats[URL_COUNT] = {
+	"bench://item/%u",
+	"http://m%u.example.com/index.html",
+	"application:///bench-app.desktop",
+	"scope://bench-scope",
+	"nohandler://item/%u"
+};
+
+typedef struct {
+	guint64 calls;
+	guint64 errors;
+	GArray * latencies; /* gint64, us */
+} CallStats;
+
+typedef struct {
+	CallType type;
+	gint64 start;
+} Call;
+
+/* Options */
+static gint concurrency = 8;
+static gdouble rate = 0.0;
+static gdouble duration = 10.0;
+static gint seed = 1;
+static gchar * callmix = NULL;
+static gchar * urlmix = NULL;
+static gchar * dispatcherpath = NULL;
+static gchar * mirmockpath = NULL;
+
+static GOptionEntry entries[] = {
+	{ "concurrency", 'c', 0, G_OPTION_ARG_INT, &concurrency, "Calls waiting on a reply at once (8)", "N" },
+	{ "rate", 'r', 0, G_OPTION_ARG_DOUBLE, &rate, "Calls per second, unlimited if not set", "RATE" },
+	{ "duration", 'd', 0, G_OPTION_ARG_DOUBLE, &duration, "Seconds to send calls for (10)", "SECONDS" },
+	{ "calls", 0, 0, G_OPTION_ARG_STRING, &callmix, "Weights of the methods to call (dispatch=1,test=1)", "MIX" },
+	{ "mix", 'm', 0, G_OPTION_ARG_STRING, &urlmix, "Weights of handled, web, application, scope and bad URLs (handled=1)", "MIX" },
+	{ "seed", 0, 0, G_OPTION_ARG_INT, &seed, "Seed for picking calls and URLs (1)", "SEED" },
+	{ "dispatcher", 0, 0, G_OPTION_ARG_FILENAME, &dispatcherpath, "Service to run", "PATH" },
+	{ "mir-mock", 0, 0, G_OPTION_ARG_FILENAME, &mirmockpath, "Mir mock library to preload", "PATH" },
+	{ NULL }
+};
+
+/* Run state */
+static GDBusConnection * bus = NULL;
+static GMainLoop * mainloop = NULL;
+static GRand * picker = NULL;
+static guint callweights[CALL_COUNT] = { 0 };
+static guint urlweights[URL_COUNT] = { 0 };
+static CallStats stats[CALL_COUNT];
+static gint64 begin = 0;
+static gint64 end = 0;
+static guint64 issued = 0;
+static guint64 backlog = 0;
+static guint64 backlogmax = 0;
+static guint outstanding = 0;
+static gboolean stopping = FALSE;
+
+/* Parses "name=weight,name=weight" into @weights */
+static gboolean
+parse_weights (const gchar * mix, const gchar ** names, guint count, guint * weights)
+{
+	gchar ** items = g_strsplit(mix, ",", -1);
+	gboolean valid = TRUE;
+	guint total = 0;
+	guint i;
+
+	for (i = 0; items[i] != NULL && valid; i++) {
+		gchar ** pair = g_strsplit(items[i], "=", 2);
+		guint64 weight = 1;
+		guint j;
+
+		if (pair[1] != NULL) {
+			gchar * endptr = NULL;
+			weight = g_ascii_strtoull(pair[1], &endptr, 10);
+			if (endptr == pair[1] || *endptr != '\0' || weight > G_MAXUINT16) {
+				valid = FALSE;
+			}
+		}
+
+		for (j = 0; j < count; j++) {
+			if (g_strcmp0(g_strstrip(pair[0]), names[j]) == 0) {
+				weights[j] = (guint)weight;
+				total += (guint)weight;
+				break;
+			}
+		}
+
+		if (j == count) {
+			g_printerr("Unknown name '%s' in '%s'\n", pair[0], mix);
+			valid = FALSE;
+		}
+
+		g_strfreev(pair);
+	}
+
+	g_strfreev(items);
+
+	if (valid && total == 0) {
+		g_printerr("Nothing to pick from in '%s'\n", mix);
+		valid = FALSE;
+	}
+
+	return valid;
+}
+
+static guint
+pick (const guint * weights, guint count)
+{
+	guint total = 0;
+	guint i;
+
+	for (i = 0; i < count; i++) {
+		total += weights[i];
+	}
+
+	guint choice = (guint)g_rand_int_range(picker, 0, (gint32)total);
+	for (i = 0; i < count; i++) {
+		if (choice < weights[i]) {
+			return i;
+		}
+		choice -= weights[i];
+	}
+
+	return count - 1;
+}
+
+static void fill (void);
+
+static void
+call_done (GObject * obj, GAsyncResult * res, gpointer user_data)
+{
+	Call * call = (Call *)user_data;
+	GError * error = NULL;
+
+	GVariant * reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, &error);
+	gint64 latency = g_get_monotonic_time() - call->start;
+
+	CallStats * callstats = &stats[call->type];
+	callstats->calls++;
+	g_array_append_val(callstats->latencies, latency);
+
+	if (error != NULL) {
+		/* Bad URLs come back as errors, which is expected */
+		callstats->errors++;
+		g_error_free(error);
+	}
+	if (reply != NULL) {
+		g_variant_unref(reply);
+	}
+
+	g_free(call);
+	outstanding--;
+
+	if (stopping) {
+		if (outstanding == 0) {
+			g_main_loop_quit(mainloop);
+		}
+		return;
+	}
+
+	fill();
+}
+
+/* Sends a call, counting its latency from @due */
+static void
+send_call (gint64 due)
+{
+	Call * call = g_new0(Call, 1);
+	call->type = (CallType)pick(callweights, CALL_COUNT);
+	call->start = due;
+
+	UrlType urltype = (UrlType)pick(urlweights, URL_COUNT);
+	gchar * url = g_strdup_printf(url_formats[urltype], (guint)issued);
+
+	GVariant * params = NULL;
+	if (call->type == CALL_DISPATCH) {
+		params = g_variant_new("(ss)", url, "");
+	} else {
+		const gchar * urls[2] = { url, NULL };
+		params = g_variant_new("(^as)", urls);
+	}
+
+	g_dbus_connection_call(bus,
+		DISPATCHER_NAME,
+		DISPATCHER_PATH,
+		DISPATCHER_NAME,
+		call_methods[call->type],
+		params,
+		NULL, /* reply type */
+		G_DBUS_CALL_FLAGS_NONE,
+		-1, /* timeout */
+		NULL, /* cancellable */
+		call_done,
+		call);
+
+	g_free(url);
+
+	issued++;
+	outstanding++;
+}
+
+/* Sends whatever is due and there are slots for */
+static void
+fill (void)
+{
+	gint64 now = g_get_monotonic_time();
+
+	if (rate <= 0.0) {
+		while (outstanding < (guint)concurrency) {
+			send_call(now);
+		}
+		return;
+	}
+
+	guint64 due = (guint64)((now - begin) * rate / G_USEC_PER_SEC);
+	while (issued < due && outstanding < (guint)concurrency) {
+		send_call(begin + (gint64)(issued * G_USEC_PER_SEC / rate));
+	}
+
+	/* Calls that should have gone out but have no slot */
+	backlog = due > issued ? due - issued : 0;
+	backlogmax = MAX(backlogmax, backlog);
+}
+
+static gboolean
+tick (gpointer user_data)
+{
+	if (g_get_monotonic_time() >= end) {
+		stopping = TRUE;
+		if (outstanding == 0) {
+			g_main_loop_quit(mainloop);
+		}
+		return G_SOURCE_REMOVE;
+	}
+
+	fill();
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+name_appeared (GDBusConnection * connection, const gchar * name, const gchar * owner, gpointer user_data)
+{
+	*(gboolean *)user_data = TRUE;
+	g_main_loop_quit(mainloop);
+}
+
+static gboolean
+wait_timeout (gpointer user_data)
+{
+	g_main_loop_quit(mainloop);
+	return G_SOURCE_REMOVE;
+}
+
+/* Gives the dispatcher something to route to */
+static gboolean
+setup_database (void)
+{
+	UrlDb * db = url_db_create_database();
+	if (db == NULL) {
+		return FALSE;
+	}
+
+	GTimeVal timeval = {5, 0};
+
+	url_db_set_file_motification_time(db, "/usr/share/url-dispatcher/urls/unity8-dash.url-dispatcher", &timeval);
+	url_db_insert_url(db, "/usr/share/url-dispatcher/urls/unity8-dash.url-dispatcher", "scope", NULL);
+
+	url_db_set_file_motification_time(db, "/usr/share/url-dispatcher/urls/com.example.bench_bench_1.0.url-dispatcher", &timeval);
+	url_db_insert_url(db, "/usr/share/url-dispatcher/urls/com.example.bench_bench_1.0.url-dispatcher", "bench", NULL);
+	url_db_insert_url(db, "/usr/share/url-dispatcher/urls/com.example.bench_bench_1.0.url-dispatcher", "http", "example.com");
+
+	url_db_close(db);
+	return TRUE;
+}
+
+static int
+compare_latency (gconstpointer a, gconstpointer b)
+{
+	gint64 one = *(const gint64 *)a;
+	gint64 two = *(const gint64 *)b;
+
+	return one < two ? -1 : (one > two ? 1 : 0);
+}
+
+static gint64
+percentile (GArray * sorted, gdouble fraction)
+{
+	if (sorted->len == 0) {
+		return 0;
+	}
+
+	return g_array_index(sorted, gint64, (guint)(fraction * (sorted->len - 1) + 0.5));
+}
+
+static void
+report (gdouble elapsed)
+{
+	if (rate > 0.0) {
+		g_print("%.1f s, concurrency %d, %.0f calls/s asked for\n", elapsed, concurrency, rate);
+	} else {
+		g_print("%.1f s, concurrency %d, unlimited rate\n", elapsed, concurrency);
+	}
+
+	g_print("%-12s %10s %8s %10s %9s %9s %9s %9s\n", "method", "calls", "errors", "calls/s", "p50 us", "p99 us", "p999 us", "max us");
+
+	CallType type;
+	for (type = 0; type < CALL_COUNT; type++) {
+		GArray * latencies = stats[type].latencies;
+		if (latencies->len == 0) {
+			continue;
+		}
+
+		g_array_sort(latencies, compare_latency);
+
+		g_print("%-12s %10" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT " %10.1f %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT "\n",
+			call_methods[type],
+			stats[type].calls,
+			stats[type].errors,
+			stats[type].calls / elapsed,
+			percentile(latencies, 0.50),
+			percentile(latencies, 0.99),
+			percentile(latencies, 0.999),
+			g_array_index(latencies, gint64, latencies->len - 1));
+	}
+
+	if (rate > 0.0) {
+		g_print("Most calls waiting on a slot: %" G_GUINT64_FORMAT "\n", backlogmax);
+	}
+}
+
+int
+main (int argc, char * argv[])
+{
+	GError * error = NULL;
+	GOptionContext * context = g_option_context_new("- load the URL dispatcher over D-Bus");
+	g_option_context_add_main_entries(context, entries, NULL);
+
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (concurrency <= 0 || rate < 0.0 || duration <= 0.0) {
+		g_printerr("Concurrency and duration need to be above zero\n");
+		return 1;
+	}
+
+	if (!parse_weights(callmix != NULL ? callmix : "dispatch=1,test=1", call_names, CALL_COUNT, callweights) ||
+			!parse_weights(urlmix != NULL ? urlmix : "handled=1", url_names, URL_COUNT, urlweights)) {
+		return 1;
+	}
+
+	gchar * cachedir = g_dir_make_tmp("url-dispatcher-bench-XXXXXX", &error);
+	if (cachedir == NULL) {
+		g_printerr("Unable to make a cache directory: %s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	/* Same environment as the service test */
+	g_setenv("URL_DISPATCHER_CACHE_DIR", cachedir, TRUE);
+	g_setenv("UBUNTU_APP_LAUNCH_USE_SESSION", "1", TRUE);
+	g_setenv("URL_DISPATCHER_DISABLE_RECOVERABLE_ERROR", "1", TRUE);
+	g_setenv("XDG_DATA_DIRS", XDG_DATA_DIRS, TRUE);
+	g_setenv("LD_PRELOAD", mirmockpath != NULL ? mirmockpath : MIR_MOCK_PATH, TRUE);
+
+	if (!setup_database()) {
+		g_printerr("Unable to create the URL database in '%s'\n", cachedir);
+		return 1;
+	}
+
+	DbusTestService * service = dbus_test_service_new(NULL);
+
+	DbusTestProcess * dispatcher = dbus_test_process_new(dispatcherpath != NULL ? dispatcherpath : URL_DISPATCHER_SERVICE);
+	dbus_test_task_set_name(DBUS_TEST_TASK(dispatcher), "Dispatcher");
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(dispatcher));
+
+	/* Upstart Mock */
+	DbusTestDbusMock * mock = dbus_test_dbus_mock_new("com.ubuntu.Upstart");
+	DbusTestDbusMockObject * obj = dbus_test_dbus_mock_get_object(mock, "/com/ubuntu/Upstart", "com.ubuntu.Upstart0_6", NULL);
+	dbus_test_dbus_mock_object_add_method(mock, obj,
+		"GetJobByName",
+		G_VARIANT_TYPE_STRING,
+		G_VARIANT_TYPE_OBJECT_PATH, /* out */
+		"ret = dbus.ObjectPath('/job')", /* python */
+		NULL); /* error */
+
+	DbusTestDbusMockObject * jobobj = dbus_test_dbus_mock_get_object(mock, "/job", "com.ubuntu.Upstart0_6.Job", NULL);
+	dbus_test_dbus_mock_object_add_method(mock, jobobj,
+		"Start",
+		G_VARIANT_TYPE("(asb)"),
+		G_VARIANT_TYPE_OBJECT_PATH, /* out */
+		"ret = dbus.ObjectPath('/instance')", /* python */
+		NULL); /* error */
+
+	dbus_test_task_set_name(DBUS_TEST_TASK(mock), "Upstart");
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(mock));
+
+	/* Dash Mock */
+	DbusTestDbusMock * dashmock = dbus_test_dbus_mock_new("com.canonical.UnityDash");
+	DbusTestDbusMockObject * fdoobj = dbus_test_dbus_mock_get_object(dashmock, "/unity8_2ddash", "org.freedesktop.Application", NULL);
+	dbus_test_dbus_mock_object_add_method(dashmock, fdoobj,
+		"Open",
+		G_VARIANT_TYPE("(asa{sv})"),
+		NULL, /* return */
+		"", /* python */
+		NULL); /* error */
+	dbus_test_task_set_name(DBUS_TEST_TASK(dashmock), "UnityDash");
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(dashmock));
+
+	dbus_test_service_start_tasks(service);
+
+	bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+	g_dbus_connection_set_exit_on_close(bus, FALSE);
+	mainloop = g_main_loop_new(NULL, FALSE);
+
+	/* Wait for the dispatcher to get its name */
+	gboolean ready = FALSE;
+	guint watch = g_bus_watch_name_on_connection(bus, DISPATCHER_NAME, G_BUS_NAME_WATCHER_FLAGS_NONE, name_appeared, NULL, &ready, NULL);
+	guint timeout = g_timeout_add_seconds(10, wait_timeout, NULL);
+	g_main_loop_run(mainloop);
+	g_bus_unwatch_name(watch);
+	if (ready) {
+		g_source_remove(timeout);
+	}
+
+	int retval = 0;
+
+	if (ready) {
+		CallType type;
+		for (type = 0; type < CALL_COUNT; type++) {
+			stats[type].latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+		}
+
+		picker = g_rand_new_with_seed((guint32)seed);
+		begin = g_get_monotonic_time();
+		end = begin + (gint64)(duration * G_USEC_PER_SEC);
+
+		fill();
+		g_timeout_add(1, tick, NULL);
+		g_main_loop_run(mainloop);
+
+		report((g_get_monotonic_time() - begin) / (gdouble)G_USEC_PER_SEC);
+
+		for (type = 0; type < CALL_COUNT; type++) {
+			g_array_free(stats[type].latencies, TRUE);
+		}
+		g_rand_free(picker);
+	} else {
+		g_printerr("Dispatcher didn't show up on the bus\n");
+		retval = 1;
+	}
+
+	g_main_loop_unref(mainloop);
+	g_object_unref(bus);
+
+	g_object_unref(dispatcher);
+	g_object_unref(mock);
+	g_object_unref(dashmock);
+	g_object_unref(service);
+
+	gchar * cmdline = g_strdup_printf("rm -rf \"%s\"", cachedir);
+	g_spawn_command_line_sync(cmdline, NULL, NULL, NULL, NULL);
+	g_free(cmdline);
+	g_free(cachedir);
+
+	return retval;
+}
@@ -0,0 +1,322 @@
+/**
+ * Copyright © 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranties of MERCHANTABILITY,
+ * SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Startup benchmark for the service. Runs it over and over on a private
+   bus and times how long it takes from exec until it owns its name, and
+   until it has answered a TestURL that's sent as soon as the name shows
+   up. The database can be padded out to see what loading it costs:
+
+     url-dispatcher-startup-bench --runs 20 --urls 10000 */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <gio/gio.h>
+#include "url-db.h"
+
+#define DISPATCHER_NAME "com.canonical.URLDispatcher"
+#define DISPATCHER_PATH "/com/canonical/URLDispatcher"
+
+/* Options */
+static gint runs = 20;
+static gint urlcount = 0;
+static gchar * dispatcherpath = NULL;
+static gchar * mirmockpath = NULL;
+
+static GOptionEntry entries[] = {
+	{ "runs", 'n', 0, G_OPTION_ARG_INT, &runs, "Times to start the service (20)", "N" },
+	{ "urls", 'u', 0, G_OPTION_ARG_INT, &urlcount, "Extra URLs to put in the database (0)", "N" },
+	{ "dispatcher", 0, 0, G_OPTION_ARG_FILENAME, &dispatcherpath, "Service to run", "PATH" },
+	{ "mir-mock", 0, 0, G_OPTION_ARG_FILENAME, &mirmockpath, "Mir mock library to preload", "PATH" },
+	{ NULL }
+};
+
+/* One start of the service */
+typedef struct {
+	GMainLoop * loop;
+	GPid pid;
+	gint64 start;
+	gint64 named; /* us after exec, or zero */
+	gint64 served; /* us after exec, or zero */
+	guint timeout;
+} Run;
+
+static GDBusConnection * bus = NULL;
+
+/* Gives the dispatcher something to route to, with @count rows that
+   it has to read on the way up */
+static gboolean
+setup_database (gint count)
+{
+	UrlDb * db = url_db_create_database();
+	if (db == NULL) {
+		return FALSE;
+	}
+
+	GTimeVal timeval = {5, 0};
+
+	sqlite3_exec(url_db_get_connection(db), "begin", NULL, NULL, NULL);
+
+	url_db_set_file_motification_time(db, "/usr/share/url-dispatcher/urls/com.example.bench_bench_1.0.url-dispatcher", &timeval);
+	url_db_insert_url(db, "/usr/share/url-dispatcher/urls/com.example.bench_bench_1.0.url-dispatcher", "bench", NULL);
+
+	gint i;
+	for (i = 0; i < count; i++) {
+		gchar * filename = g_strdup_printf("/usr/share/url-dispatcher/urls/com.example.site%d_site_1.0.url-dispatcher", i);
+		gchar * domain = g_strdup_printf("site%d.example.com", i);
+
+		url_db_set_file_motification_time(db, filename, &timeval);
+		url_db_insert_url(db, filename, "http", domain);
+
+		g_free(domain);
+		g_free(filename);
+	}
+
+	sqlite3_exec(url_db_get_connection(db), "commit", NULL, NULL, NULL);
+
+	url_db_close(db);
+	return TRUE;
+}
+
+static void
+test_done (GObject * obj, GAsyncResult * res, gpointer user_data)
+{
+	Run * run = (Run *)user_data;
+	GError * error = NULL;
+	GVariant * result = g_dbus_connection_call_finish(bus, res, &error);
+
+	if (result != NULL) {
+		run->served = g_get_monotonic_time() - run->start;
+		g_variant_unref(result);
+	} else {
+		g_printerr("TestURL failed: %s\n", error->message);
+		g_error_free(error);
+	}
+
+	kill(run->pid, SIGTERM);
+}
+
+static void
+name_appeared (GDBusConnection * connection, const gchar * name, const gchar * owner, gpointer user_data)
+{
+	Run * run = (Run *)user_data;
+
+	if (run->named != 0) {
+		return;
+	}
+	run->named = g_get_monotonic_time() - run->start;
+
+	const gchar * urls[] = { "bench://item/1", NULL };
+	g_dbus_connection_call(bus,
+		owner,
+		DISPATCHER_PATH,
+		DISPATCHER_NAME,
+		"TestURL",
+		g_variant_new("(^as)", urls),
+		G_VARIANT_TYPE("(as)"),
+		G_DBUS_CALL_FLAGS_NONE,
+		-1, /* timeout */
+		NULL, /* cancellable */
+		test_done,
+		run);
+}
+
+static void
+child_exited (GPid pid, gint status, gpointer user_data)
+{
+	Run * run = (Run *)user_data;
+
+	g_spawn_close_pid(pid);
+	g_main_loop_quit(run->loop);
+}
+
+static gboolean
+run_timeout (gpointer user_data)
+{
+	Run * run = (Run *)user_data;
+
+	g_printerr("Dispatcher didn't start and answer in time\n");
+	kill(run->pid, SIGKILL);
+	run->timeout = 0;
+	return G_SOURCE_REMOVE;
+}
+
+/* Starts the service once, FALSE if it couldn't be run at all */
+static gboolean
+run_once (Run * run)
+{
+	GError * error = NULL;
+	gchar * argv[] = { dispatcherpath != NULL ? dispatcherpath : URL_DISPATCHER_SERVICE, NULL };
+
+	guint watch = g_bus_watch_name_on_connection(bus, DISPATCHER_NAME, G_BUS_NAME_WATCHER_FLAGS_NONE, name_appeared, NULL, run, NULL);
+
+	run->start = g_get_monotonic_time();
+	if (!g_spawn_async(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &run->pid, &error)) {
+		g_printerr("Unable to start '%s': %s\n", argv[0], error->message);
+		g_error_free(error);
+		g_bus_unwatch_name(watch);
+		return FALSE;
+	}
+
+	/* Runs until it's been told to stop and has gone */
+	g_child_watch_add(run->pid, child_exited, run);
+	run->timeout = g_timeout_add_seconds(10, run_timeout, run);
+
+	g_main_loop_run(run->loop);
+
+	if (run->timeout != 0) {
+		g_source_remove(run->timeout);
+	}
+	g_bus_unwatch_name(watch);
+
+	return TRUE;
+}
+
+static int
+compare_time (gconstpointer a, gconstpointer b)
+{
+	gint64 one = *(const gint64 *)a;
+	gint64 two = *(const gint64 *)b;
+
+	return one < two ? -1 : (one > two ? 1 : 0);
+}
+
+static gint64
+percentile (GArray * sorted, gdouble fraction)
+{
+	if (sorted->len == 0) {
+		return 0;
+	}
+
+	return g_array_index(sorted, gint64, (guint)(fraction * (sorted->len - 1) + 0.5));
+}
+
+static void
+report_line (const gchar * name, GArray * times)
+{
+	if (times->len == 0) {
+		g_print("%-14s %6s\n", name, "0");
+		return;
+	}
+
+	g_array_sort(times, compare_time);
+
+	g_print("%-14s %6u %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT "\n",
+		name,
+		times->len,
+		g_array_index(times, gint64, 0),
+		percentile(times, 0.50),
+		percentile(times, 0.90),
+		g_array_index(times, gint64, times->len - 1));
+}
+
+int
+main (int argc, char * argv[])
+{
+	GError * error = NULL;
+	GOptionContext * context = g_option_context_new("- time starting the URL dispatcher");
+	g_option_context_add_main_entries(context, entries, NULL);
+
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (runs <= 0 || urlcount < 0) {
+		g_printerr("Runs need to be above zero\n");
+		return 1;
+	}
+
+	gchar * cachedir = g_dir_make_tmp("url-dispatcher-startup-bench-XXXXXX", &error);
+	if (cachedir == NULL) {
+		g_printerr("Unable to make a cache directory: %s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	/* Same environment as the service test */
+	g_setenv("URL_DISPATCHER_CACHE_DIR", cachedir, TRUE);
+	g_setenv("UBUNTU_APP_LAUNCH_USE_SESSION", "1", TRUE);
+	g_setenv("URL_DISPATCHER_DISABLE_RECOVERABLE_ERROR", "1", TRUE);
+	g_setenv("XDG_DATA_DIRS", XDG_DATA_DIRS, TRUE);
+
+	if (!setup_database(urlcount)) {
+		g_printerr("Unable to create the URL database in '%s'\n", cachedir);
+		return 1;
+	}
+
+	GTestDBus * testbus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_up(testbus);
+
+	bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+	g_dbus_connection_set_exit_on_close(bus, FALSE);
+
+	/* Only for the service, not us */
+	g_setenv("LD_PRELOAD", mirmockpath != NULL ? mirmockpath : MIR_MOCK_PATH, TRUE);
+
+	GArray * named = g_array_new(FALSE, FALSE, sizeof(gint64));
+	GArray * served = g_array_new(FALSE, FALSE, sizeof(gint64));
+	int retval = 0;
+
+	gint i;
+	for (i = 0; i < runs; i++) {
+		Run run = { 0 };
+		run.loop = g_main_loop_new(NULL, FALSE);
+
+		gboolean ran = run_once(&run);
+		g_main_loop_unref(run.loop);
+
+		if (!ran) {
+			retval = 1;
+			break;
+		}
+
+		if (run.named != 0) {
+			g_array_append_val(named, run.named);
+		}
+		if (run.served != 0) {
+			g_array_append_val(served, run.served);
+		}
+	}
+
+	g_unsetenv("LD_PRELOAD");
+
+	g_print("%d runs, %d extra URLs\n", runs, urlcount);
+	g_print("%-14s %6s %9s %9s %9s %9s\n", "from exec", "runs", "min us", "p50 us", "p90 us", "max us");
+	report_line("name owned", named);
+	report_line("first reply", served);
+
+	if (served->len < (guint)runs) {
+		retval = 1;
+	}
+
+	g_array_free(named, TRUE);
+	g_array_free(served, TRUE);
+
+	g_object_unref(bus);
+	g_test_dbus_down(testbus);
+	g_object_unref(testbus);
+
+	gchar * cmdline = g_strdup_printf("rm -rf \"%s\"", cachedir);
+	g_spawn_command_line_sync(cmdline, NULL, NULL, NULL, NULL);
+	g_free(cmdline);
+	g_free(cachedir);
+
+	return retval;
+}